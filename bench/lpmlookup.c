@@ -0,0 +1,251 @@
+/*
+ * Compare owampd's "assign net" lookup strategies over a synthetic limits
+ * file: the old per-mask-length hash probing (up to 32/128 probes per
+ * connection) against the prefix trie in owampd/lpm.c.
+ *
+ * cc -O2 -Iowampd -o lpmlookup bench/lpmlookup.c owampd/lpm.c
+ * ./lpmlookup [nprefixes [nlookups]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "lpm.h"
+
+typedef struct{
+        uint8_t         mask_len;
+        size_t          addrsize;
+        uint8_t         addrval[16];
+} Net;
+
+/*
+ * Open addressed hash of Net - stands in for the idents I2Table.
+ */
+static Net      *htab;
+static void     **hval;
+static size_t   hsize;
+
+static uint32_t
+hash(
+        const Net       *n
+        )
+{
+        const uint8_t   *p = (const uint8_t *)n;
+        uint32_t        h = 2166136261u;
+        size_t          i;
+
+        for(i=0;i<sizeof(*n);i++){
+                h = (h ^ p[i]) * 16777619u;
+        }
+        return h;
+}
+
+static void
+hstore(
+        const Net       *n,
+        void            *val
+        )
+{
+        size_t  i = hash(n) & (hsize-1);
+
+        while(hval[i] && memcmp(&htab[i],n,sizeof(*n))){
+                i = (i+1) & (hsize-1);
+        }
+        htab[i] = *n;
+        hval[i] = val;
+}
+
+static void *
+hfetch(
+        const Net       *n
+        )
+{
+        size_t  i = hash(n) & (hsize-1);
+
+        while(hval[i]){
+                if(!memcmp(&htab[i],n,sizeof(*n))){
+                        return hval[i];
+                }
+                i = (i+1) & (hsize-1);
+        }
+        return NULL;
+}
+
+/*
+ * Same loop GetNodeFromAddr used to run.
+ */
+static void *
+probe(
+        const uint8_t   *addr,
+        size_t          addrsize
+        )
+{
+        Net     n;
+        uint8_t nbytes,nbits;
+        void    *val;
+
+        memset(&n,0,sizeof(n));
+        memcpy(n.addrval,addr,addrsize);
+        n.addrsize = addrsize;
+
+        for(n.mask_len=addrsize*8;n.mask_len > 0;n.mask_len--){
+                nbytes = n.mask_len/8;
+                nbits = n.mask_len%8;
+                if(nbytes < addrsize){
+                        n.addrval[nbytes] &= (0xFF << (8-nbits));
+                }
+                if((val = hfetch(&n))){
+                        return val;
+                }
+        }
+        return NULL;
+}
+
+static void
+randaddr(
+        uint8_t *addr,
+        size_t  addrsize
+        )
+{
+        size_t  i;
+
+        for(i=0;i<addrsize;i++){
+                addr[i] = random() & 0xFF;
+        }
+}
+
+static void
+masknet(
+        Net     *n
+        )
+{
+        size_t  i;
+
+        for(i=0;i<n->addrsize;i++){
+                if(n->mask_len <= i*8){
+                        n->addrval[i] = 0;
+                }
+                else if(n->mask_len < (i+1)*8){
+                        n->addrval[i] &= (0xFF << ((i+1)*8 - n->mask_len));
+                }
+        }
+}
+
+static double
+now(
+        void
+        )
+{
+        struct timeval  tv;
+
+        gettimeofday(&tv,NULL);
+        return tv.tv_sec + tv.tv_usec/1e6;
+}
+
+int
+main(
+        int     argc,
+        char    **argv
+        )
+{
+        size_t  nprefix = (argc > 1)? strtoul(argv[1],NULL,10): 5000;
+        size_t  nlookup = (argc > 2)? strtoul(argv[2],NULL,10): 1000000;
+        size_t  i,hits=0,mismatch=0;
+        Net     *nets,*addrs;
+        OWPDLpm lpm;
+        void    *a,*b;
+        double  t0,t1,t2;
+
+        srandom(1);
+        for(hsize=1;hsize < nprefix*2;hsize <<= 1);
+        nets = calloc(nprefix,sizeof(Net));
+        addrs = calloc(nlookup,sizeof(Net));
+        htab = calloc(hsize,sizeof(Net));
+        hval = calloc(hsize,sizeof(void *));
+        if(!nets || !addrs || !htab || !hval || !(lpm = OWPDLpmCreate())){
+                perror("alloc");
+                exit(1);
+        }
+
+        /*
+         * Mostly v4 /8-/32 with some v6 /16-/64, like a real limits file.
+         */
+        for(i=0;i<nprefix;i++){
+                if(random() % 4){
+                        nets[i].addrsize = 4;
+                        nets[i].mask_len = 8 + random() % 25;
+                }
+                else{
+                        nets[i].addrsize = 16;
+                        nets[i].mask_len = 16 + random() % 49;
+                }
+                randaddr(nets[i].addrval,nets[i].addrsize);
+                masknet(&nets[i]);
+                hstore(&nets[i],&nets[i]);
+                if(OWPDLpmInsert(lpm,nets[i].addrval,nets[i].addrsize,
+                                        nets[i].mask_len,&nets[i])){
+                        perror("OWPDLpmInsert");
+                        exit(1);
+                }
+        }
+
+        /*
+         * Half of the lookups fall inside a configured net, the rest
+         * are random (and mostly end up at the default class).
+         */
+        for(i=0;i<nlookup;i++){
+                if(i & 1){
+                        addrs[i].addrsize = (random() % 4)? 4: 16;
+                        randaddr(addrs[i].addrval,addrs[i].addrsize);
+                }
+                else{
+                        Net     *n = &nets[random() % nprefix];
+                        size_t  j;
+
+                        addrs[i] = *n;
+                        randaddr(addrs[i].addrval,n->addrsize);
+                        for(j=0;j<n->mask_len/8u;j++){
+                                addrs[i].addrval[j] = n->addrval[j];
+                        }
+                        if(n->mask_len%8){
+                                uint8_t m = 0xFF << (8 - n->mask_len%8);
+                                addrs[i].addrval[j] = (n->addrval[j] & m) |
+                                        (addrs[i].addrval[j] & ~m);
+                        }
+                }
+        }
+
+        t0 = now();
+        for(i=0;i<nlookup;i++){
+                if(probe(addrs[i].addrval,addrs[i].addrsize)){
+                        hits++;
+                }
+        }
+        t1 = now();
+        for(i=0;i<nlookup;i++){
+                if(OWPDLpmLookup(lpm,addrs[i].addrval,addrs[i].addrsize)){
+                        hits--;
+                }
+        }
+        t2 = now();
+
+        for(i=0;i<nlookup;i++){
+                a = probe(addrs[i].addrval,addrs[i].addrsize);
+                b = OWPDLpmLookup(lpm,addrs[i].addrval,addrs[i].addrsize);
+                if(a != b){
+                        mismatch++;
+                }
+        }
+
+        printf("%lu prefixes, %lu lookups\n",
+                        (unsigned long)nprefix,(unsigned long)nlookup);
+        printf("hash probe: %8.1f ns/lookup\n",(t1-t0)*1e9/nlookup);
+        printf("lpm trie:   %8.1f ns/lookup\n",(t2-t1)*1e9/nlookup);
+        printf("mismatches: %lu\n",(unsigned long)mismatch);
+
+        OWPDLpmFree(lpm);
+
+        return (mismatch || hits)? 1: 0;
+}
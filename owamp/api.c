@@ -99,6 +99,64 @@ OWPControlFD(
     return cntrl->sockfd;
 }
 
+/*
+ * Function:        OWPControlGetState
+ *
+ * Description:        
+ *         Copies the per-message state of cntrl (protocol state and IVs)
+ *         to state, so a copy of cntrl in another process can hand it
+ *         back with OWPControlSetState.
+ *
+ * In Args:        
+ *
+ * Out Args:        
+ *
+ * Scope:        
+ * Returns:        
+ * Side Effect:        
+ */
+void
+OWPControlGetState(
+        OWPControl          cntrl,
+        OWPControlStateRec  *state
+        )
+{
+    memset(state,0,sizeof(*state));
+    state->state = cntrl->state;
+    memcpy(state->readIV,cntrl->readIV,sizeof(state->readIV));
+    memcpy(state->writeIV,cntrl->writeIV,sizeof(state->writeIV));
+
+    return;
+}
+
+/*
+ * Function:        OWPControlSetState
+ *
+ * Description:        
+ *         Resumes cntrl from the per-message state that another copy of
+ *         it reached (see OWPControlGetState).
+ *
+ * In Args:        
+ *
+ * Out Args:        
+ *
+ * Scope:        
+ * Returns:        
+ * Side Effect:        
+ */
+void
+OWPControlSetState(
+        OWPControl          cntrl,
+        OWPControlStateRec  *state
+        )
+{
+    cntrl->state = state->state;
+    memcpy(cntrl->readIV,state->readIV,sizeof(cntrl->readIV));
+    memcpy(cntrl->writeIV,state->writeIV,sizeof(cntrl->writeIV));
+
+    return;
+}
+
 /*
  * Function:        OWPGetRTTBound
  *
@@ -2118,6 +2176,17 @@ GetSessionFinishedType(
  * which is first. The Num Skip Records and Num Data Records fields are
  * used to determine how long these ranges will be.
  *
+ * Version 4 files use the same header. The data records are block
+ * encoded (documented in filev4.c) and are always followed by the skip
+ * records. Version 4 files are written with the OWPDataWriter functions
+ * and are not updated in place the way the Endpoint Receiver and
+ * FetchClient (below) update version 3 files.
+ *
+ * Finished version 3 and 4 files can have a block index after the data
+ * and skip records (documented in dataindex.c). No header field points
+ * at it, so readers must use num_datarecs/num_skiprecs rather than the
+ * file size to find the end of the records in a finished file.
+ *
  * The format for individual packet records is documented in the
  * header for the _OWPDecodeDataRecord function which should be used
  * to fetch them.
@@ -2263,7 +2332,7 @@ GetSessionFinishedType(
     phdr->version = ntohl(phdr->version);
 
     /*
-     * Currently it supports 0 and 2 and 3.
+     * Currently it supports 0 and 2 and 3 and 4.
      */
     phdr->header = True;
     switch(phdr->version){
@@ -2290,6 +2359,13 @@ GetSessionFinishedType(
         case 3:
             phdr->rec_size = _OWP_DATARECV3_SIZE;
             break;
+        case 4:
+            /*
+             * Records are not fixed size in version 4 files. rec_size
+             * is the size of a decoded (version 3) record.
+             */
+            phdr->rec_size = _OWP_DATAREC_SIZE;
+            break;
         default:
             OWPError(ctx,OWPErrFATAL,EINVAL,
                     "_OWPReadDataHeaderInitial: Invalid file version (%ul)",
@@ -2508,9 +2584,10 @@ OWPWriteDataHeaderNumSkipRecs(
     }
 
     /*
-     * Files before version 3 don't have skips.
+     * Files before version 3 don't have skips. Version 4 files are
+     * only written by OWPDataWriter.
      */
-    if(phrec.version < 3){
+    if(phrec.version != 3){
         OWPError(ctx,OWPErrFATAL,EINVAL,
                 "_OWPWriteDataHeaderNumSkipRecs: Invalid file version (%ul)",
                 phrec.version);
@@ -2620,9 +2697,10 @@ OWPWriteDataHeaderNumDataRecs(
     }
 
     /*
-     * Files before version 3 not supported for writing.
+     * Files before version 3 not supported for writing. Version 4 files
+     * are only written by OWPDataWriter.
      */
-    if(phrec.version < 3){
+    if(phrec.version != 3){
         OWPError(ctx,OWPErrFATAL,EINVAL,
                 "_OWPWriteDataHeaderNumDataRecs: Invalid file version (%ul)",
                 phrec.version);
@@ -2704,6 +2782,33 @@ OWPWriteDataHeader(
         FILE               *fp,
         OWPSessionHeader   hdr
         )
+{
+    return _OWPWriteDataHeaderVersion(ctx,fp,hdr,3);
+}
+
+/*
+ * Function:    _OWPWriteDataHeaderVersion
+ *
+ * Description:    
+ *    Implementation of OWPWriteDataHeader. Versions 3 and 4 share the
+ *    same header layout, only the version field differs. (Version 4
+ *    files are written using OWPDataWriterCreate.)
+ *
+ * In Args:    
+ *
+ * Out Args:    
+ *
+ * Scope:    
+ * Returns:    
+ * Side Effect:
+ */
+OWPBoolean
+_OWPWriteDataHeaderVersion(
+        OWPContext         ctx,
+        FILE               *fp,
+        OWPSessionHeader   hdr,
+        uint32_t           version
+        )
 {
     uint32_t   ver;
     uint32_t   finished = OWP_SESSION_FINISHED_INCOMPLETE;
@@ -2735,7 +2840,7 @@ OWPWriteDataHeader(
                     hdr->sid,&hdr->test_spec) != 0) || !len){
         return False;
     }
-    ver = htonl(3);
+    ver = htonl(version);
 
     /*
      * Compute the offset to the end of the "header" information. Either
@@ -2946,6 +3051,12 @@ OWPWriteDataRecord(
  *      Same as 2, but api modifed to not return hdr_len as a field.
  *      hdr_ret is now REQUIRED to be filled in, and the oset to data
  *      and/or skip records can be retrieved from fields in that record.
+ * Version 4:
+ *      Same header as 3. Data records are stored in compressed blocks
+ *      (see filev4.c) so num_datarecs can not be derived from the
+ *      file size. If the file was never closed by the writer, the
+ *      complete blocks are counted instead. rec_size is the size of
+ *      a decoded record, not of the records in the file.
  *
  *
  * In Args:        
@@ -3029,6 +3140,24 @@ OWPReadDataHeader(
         return 0;
     }
 
+    hdr_ret->next_seqno = phrec.next_seqno;
+    hdr_ret->num_skiprecs = phrec.num_skiprecs;
+    hdr_ret->oset_skiprecs = phrec.oset_skiprecs;
+    hdr_ret->oset_datarecs = phrec.oset_datarecs;
+
+    if(phrec.version == 4){
+        hdr_ret->num_datarecs = phrec.num_datarecs;
+        if(!phrec.oset_skiprecs){
+            if( !_OWPCountRecordsV4(ctx,fp,phrec.oset_datarecs,
+                        phrec.sbuf.st_size,&hdr_ret->num_datarecs) ||
+                    fseeko(fp,phrec.hdr_len,SEEK_SET)){
+                return 0;
+            }
+        }
+
+        return hdr_ret->num_datarecs;
+    }
+
     /*
      * Make sure num_datarecs is not larger than the file allows.
      */
@@ -3039,10 +3168,6 @@ OWPReadDataHeader(
         return 0;
     }
 
-    hdr_ret->next_seqno = phrec.next_seqno;
-    hdr_ret->num_skiprecs = phrec.num_skiprecs;
-    hdr_ret->oset_skiprecs = phrec.oset_skiprecs;
-    hdr_ret->oset_datarecs = phrec.oset_datarecs;
     if(phrec.finished != OWP_SESSION_FINISHED_NORMAL){
         hdr_ret->num_datarecs = (phrec.sbuf.st_size - phrec.hdr_len)/
             hdr_ret->rec_size;
@@ -3231,6 +3356,9 @@ OWPReadDataHeaderSlots(
  *         Fetch num_rec records from disk calling the record proc function
  *         on each record.
  *
+ *         For version 4 files fp must be at the beginning of a block
+ *         of records (oset_datarecs), see _OWPParseRecordsV4.
+ *
  * In Args:        
  *
  * Out Args:        
@@ -3260,7 +3388,7 @@ OWPParseRecords(
      * of different versions of the owd data files.
      * Currently it supports 0 and 2, (both of which
      * require the same 24 octet data records) and 3 which requires
-     * 25 octets.
+     * 25 octets. Version 4 files are block encoded.
      */
     switch(file_version){
         case 0: case 2:
@@ -3269,6 +3397,8 @@ OWPParseRecords(
         case 3:
             len_rec = _OWP_DATAREC_SIZE;
             break;
+        case 4:
+            return _OWPParseRecordsV4(ctx,fp,num_rec,proc_rec,app_data);
         default:
             OWPError(ctx,OWPErrFATAL,EINVAL,
                     "OWPParseRecords: Invalid file version (%d)",
@@ -3399,6 +3529,237 @@ OWPReadDataSkips(
     return True;
 }
 
+typedef struct SegmentWriteRec{
+    OWPContext  ctx;
+    FILE        *fp;
+    uint32_t    first;
+    uint32_t    last;
+    uint32_t    nrecs;
+} SegmentWriteRec;
+
+static int
+SegmentWriteRecord(
+        OWPDataRec  *rec,
+        void        *udata
+        )
+{
+    SegmentWriteRec *sw = udata;
+
+    if((rec->seq_no < sw->first) || (rec->seq_no >= sw->last)){
+        return 0;
+    }
+    if( !OWPWriteDataRecord(sw->ctx,sw->fp,rec)){
+        return -1;
+    }
+    sw->nrecs++;
+
+    return 0;
+}
+
+/*
+ * Function:        OWPWriteDataSegment
+ *
+ * Description:        
+ *         Write the records of fromfp with seq_no in [first,last) to tofp
+ *         as a finished version 3 session file. fromfp may still be
+ *         written to by a receiver - only the complete records are used.
+ *         The session header of fromfp is kept so the segment can be
+ *         merged with its neighbors again. Every packet outside of
+ *         [first,last) is described by a skip record, as are the
+ *         session skips that fall within it.
+ *
+ *         tofp should be an empty file opened for reading and writing.
+ *
+ *         begin_oset is a hint: the offset of the first record of fromfp
+ *         that can be in [first,last), e.g. the next_oset of the
+ *         OWPStats record that parsed the previous segment. Records
+ *         before it are not read. It is only used for version 3 files
+ *         and 0 means the start of the records.
+ *
+ * In Args:        
+ *
+ * Out Args:        
+ *        nrecs_ret:    number of records written to tofp (may be NULL)
+ *
+ * Scope:        
+ * Returns:        
+ * Side Effect:        
+ */
+OWPBoolean
+OWPWriteDataSegment(
+        OWPContext  ctx,
+        FILE        *fromfp,
+        FILE        *tofp,
+        off_t       begin_oset,
+        uint32_t    first,
+        uint32_t    last,
+        uint32_t    *nrecs_ret
+        )
+{
+    OWPSessionHeaderRec hdr;
+    OWPSessionHeaderRec shdr;
+    uint32_t            num_datarecs;
+    OWPSkip             skips = NULL;
+    OWPSkip             sskips = NULL;
+    uint32_t            nsskips = 0;
+    SegmentWriteRec     sw;
+    uint8_t             sbuf[_OWP_SKIPREC_SIZE];
+    uint32_t            i;
+    OWPBoolean          rc = False;
+
+    if(nrecs_ret){
+        *nrecs_ret = 0;
+    }
+
+    memset(&hdr,0,sizeof(hdr));
+    num_datarecs = OWPReadDataHeader(ctx,fromfp,&hdr);
+    if(!hdr.header){
+        OWPError(ctx,OWPErrFATAL,EINVAL,
+                "OWPWriteDataSegment: Invalid session file");
+        return False;
+    }
+
+    last = MIN(last,hdr.test_spec.npackets);
+    if(first >= last){
+        OWPError(ctx,OWPErrFATAL,EINVAL,
+                "OWPWriteDataSegment: Invalid range [%" PRIu32 ",%" PRIu32 ")",
+                first,last);
+        return False;
+    }
+
+    if( !(hdr.test_spec.slots = calloc(hdr.test_spec.nslots,sizeof(OWPSlot)))){
+        OWPError(ctx,OWPErrFATAL,errno,"calloc(%" PRIu32 ",OWPSlot): %M",
+                hdr.test_spec.nslots);
+        return False;
+    }
+    if( !OWPReadDataHeaderSlots(ctx,fromfp,hdr.test_spec.nslots,
+                hdr.test_spec.slots)){
+        goto done;
+    }
+
+    /*
+     * Room for the session skips, plus one on either side of the segment.
+     */
+    if( !(sskips = calloc(hdr.num_skiprecs + 2,sizeof(OWPSkipRec)))){
+        OWPError(ctx,OWPErrFATAL,errno,"calloc(%" PRIu32 ",OWPSkipRec): %M",
+                hdr.num_skiprecs + 2);
+        goto done;
+    }
+    if(hdr.num_skiprecs){
+        if( !(skips = calloc(hdr.num_skiprecs,sizeof(OWPSkipRec)))){
+            OWPError(ctx,OWPErrFATAL,errno,
+                    "calloc(%" PRIu32 ",OWPSkipRec): %M",hdr.num_skiprecs);
+            goto done;
+        }
+        if( !OWPReadDataSkips(ctx,fromfp,hdr.num_skiprecs,skips)){
+            goto done;
+        }
+    }
+
+    if(first){
+        sskips[nsskips].begin = 0;
+        sskips[nsskips].end = first - 1;
+        nsskips++;
+    }
+    for(i=0;i<hdr.num_skiprecs;i++){
+        if((skips[i].end < first) || (skips[i].begin >= last)){
+            continue;
+        }
+        sskips[nsskips].begin = MAX(skips[i].begin,first);
+        sskips[nsskips].end = MIN(skips[i].end,last - 1);
+        nsskips++;
+    }
+    if(last < hdr.test_spec.npackets){
+        sskips[nsskips].begin = last;
+        sskips[nsskips].end = hdr.test_spec.npackets - 1;
+        nsskips++;
+    }
+
+    /*
+     * The counts are not known until the records have been filtered,
+     * so the skips go after the data.
+     */
+    shdr = hdr;
+    shdr.rec_size = _OWP_DATAREC_SIZE;
+    shdr.finished = OWP_SESSION_FINISHED_INCOMPLETE;
+    shdr.next_seqno = 0;
+    shdr.num_skiprecs = 0;
+    shdr.num_datarecs = 0;
+    if( !OWPWriteDataHeader(ctx,tofp,&shdr)){
+        OWPError(ctx,OWPErrFATAL,errno,
+                "OWPWriteDataSegment: Unable to write header: %M");
+        goto done;
+    }
+
+    /*
+     * Only use the hint if it is a record boundary within the file.
+     * (Version 4 records are not at fixed offsets.)
+     */
+    if((hdr.version != 3) || (begin_oset < hdr.oset_datarecs) ||
+            ((begin_oset - hdr.oset_datarecs) % hdr.rec_size) ||
+            ((begin_oset - hdr.oset_datarecs) / hdr.rec_size >
+             num_datarecs)){
+        begin_oset = hdr.oset_datarecs;
+    }
+    num_datarecs -= (begin_oset - hdr.oset_datarecs) / hdr.rec_size;
+
+    if(fseeko(fromfp,begin_oset,SEEK_SET)){
+        OWPError(ctx,OWPErrFATAL,errno,"fseeko(): %M");
+        goto done;
+    }
+    sw.ctx = ctx;
+    sw.fp = tofp;
+    sw.first = first;
+    sw.last = last;
+    sw.nrecs = 0;
+    if(OWPParseRecords(ctx,fromfp,num_datarecs,hdr.version,
+                SegmentWriteRecord,&sw) != OWPErrOK){
+        goto done;
+    }
+
+    if( !OWPWriteDataHeaderNumDataRecs(ctx,tofp,sw.nrecs) ||
+            !OWPWriteDataHeaderNumSkipRecs(ctx,tofp,nsskips)){
+        goto done;
+    }
+    if(fseeko(tofp,0,SEEK_END)){
+        OWPError(ctx,OWPErrFATAL,errno,"fseeko(): %M");
+        goto done;
+    }
+    for(i=0;i<nsskips;i++){
+        _OWPEncodeSkipRecord(sbuf,&sskips[i]);
+        if(fwrite(sbuf,1,_OWP_SKIPREC_SIZE,tofp) != _OWP_SKIPREC_SIZE){
+            OWPError(ctx,OWPErrFATAL,errno,
+                    "OWPWriteDataSegment: fwrite(): %M");
+            goto done;
+        }
+    }
+    if( !_OWPWriteDataHeaderFinished(ctx,tofp,OWP_SESSION_FINISHED_NORMAL,
+                last)){
+        goto done;
+    }
+    if(fflush(tofp) != 0){
+        OWPError(ctx,OWPErrFATAL,errno,"OWPWriteDataSegment: fflush(): %M");
+        goto done;
+    }
+    (void)OWPWriteDataIndex(ctx,tofp);
+
+    if(nrecs_ret){
+        *nrecs_ret = sw.nrecs;
+    }
+    rc = True;
+
+done:
+    if(sskips){
+        free(sskips);
+    }
+    if(skips){
+        free(skips);
+    }
+    free(hdr.test_spec.slots);
+
+    return rc;
+}
+
 /*
  * Function:        OWPTestDiskspace
  *
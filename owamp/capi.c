@@ -1221,25 +1221,66 @@ OWPDelay(
 }
 
 /*
- * Function:        OWPFetchSession
+ * State for OWPFetchSessionAppend. Skip records are held until the data
+ * records have been appended, since they go after the data in an
+ * appended file.
+ */
+typedef struct FetchAppendRec{
+    OWPBoolean      writehdr;       /* in: new file, write the header   */
+    OWPBoolean      accepted;       /* out: server accepted the request */
+    uint32_t        maxseq;         /* out: 1 + largest non-lost seq_no */
+    uint8_t         *skips;         /* out: skip records (malloc)       */
+} FetchAppendRec, *FetchAppend;
+
+/*
+ * State for OWPFetchSessionStream.
+ */
+typedef struct FetchStreamRec{
+    OWPFetchHeaderFunc  hdr_func;
+    OWPFetchRecordsFunc rec_func;
+    void                *udata;
+    OWPDataRec          *recs;          /* decoded batch (malloc)       */
+} FetchStreamRec, *FetchStream;
+
+/*
+ * Decode nrecs data records from buf and pass them to strm->rec_func.
+ */
+static OWPBoolean
+FetchStreamRecords(
+        OWPControl  cntrl,
+        FetchStream strm,
+        char        *buf,
+        uint32_t    nrecs
+        )
+{
+    uint32_t    i;
+
+    for(i=0;i<nrecs;i++){
+        if( !_OWPDecodeDataRecord(3,&strm->recs[i],
+                    &buf[i*_OWP_DATAREC_SIZE])){
+            OWPError(cntrl->ctx,OWPErrFATAL,OWPErrUNKNOWN,
+                    "OWPFetchSessionStream: Invalid data record");
+            return False;
+        }
+    }
+
+    return strm->rec_func(strm->recs,nrecs,strm->udata);
+}
+
+/*
+ * Function:        FetchSessionData
  *
  * Description:        
- *        This function is used to request that the data for the TestSession
- *        identified by sid be fetched from the server and copied to the
- *        file pointed at by fp. This function assumes fp is currently pointing
- *        at an open file, and that fp is ready to write at the begining of the
- *        file.
+ *        Does the work for OWPFetchSession and OWPFetchSessionAppend.
+ *        hdr is filled in from the FetchAck and the TestReq.
  *
- *        To request an entire session set begin = 0, and end = 0xFFFFFFFF.
- *        (This is only valid if the session is complete - otherwise the server
- *        should deny this request.)
- *        Otherwise, "begin" and "end" refer to sequence numbers in the test
- *        session.
- *        The number of records returned will not necessarily be end-begin due
- *        to possible loss and/or duplication.
+ *        If app is NULL, the complete file is written to fp. Otherwise
+ *        only the data records are written (at the current position of
+ *        fp), and the file header only if app->writehdr is set.
  *
- *      There is a full description of the owp file format in the comments
- *      in api.c.
+ *        If strm is set, nothing is written and fp is not used. The
+ *        header and skips, then the decoded data records, are passed
+ *        to the strm callbacks instead.
  *
  * In Args:        
  *
@@ -1247,30 +1288,33 @@ OWPDelay(
  *
  * Scope:        
  * Returns:        
- *        The number of data records in the file. If < 1, check err_ret to
- *        find out if it was an error condition: ErrOK just means the request
- *        was denied by the server. ErrWARNING means there was a local
- *        problem (fp not writeable etc...) and the control connection is
- *        still valid.
+ *        The number of data records received. See OWPFetchSession.
  * Side Effect:        
  */
-uint32_t
-OWPFetchSession(
-        OWPControl      cntrl,
-        FILE            *fp,
-        uint32_t       begin,
-        uint32_t       end,
-        OWPSID          sid,
-        OWPErrSeverity  *err_ret
+static uint32_t
+FetchSessionData(
+        OWPControl          cntrl,
+        FILE                *fp,
+        uint32_t            begin,
+        uint32_t            end,
+        OWPSID              sid,
+        OWPSessionHeader    hdr,
+        FetchAppend         app,
+        FetchStream         strm,
+        OWPErrSeverity      *err_ret
         )
 {
     OWPAcceptType       acceptval;
     uint8_t             finished;
-    uint32_t            n;
+    uint32_t            n,nrecs,i;
+    int                 blks;
     OWPTestSession      tsession = NULL;
-    OWPSessionHeaderRec hdr;
+    OWPDataRec          rec;
     off_t               toff;
     char                buf[_OWP_FETCH_BUFFSIZE];
+    char                *dbuf = NULL;
+    uint8_t             *sbuf = NULL;
+    OWPSkip             skips = NULL;
     OWPBoolean          dowrite = True;
     struct sockaddr     *saddr;
     socklen_t           saddrlen;
@@ -1279,7 +1323,7 @@ OWPFetchSession(
 
     *err_ret = OWPErrOK;
 
-    if(!fp){
+    if(!fp && !strm){
         OWPError(cntrl->ctx,OWPErrFATAL,OWPErrINVALID,
                 "OWPFetchSession: Invalid fp");
         *err_ret = OWPErrFATAL;
@@ -1297,7 +1341,7 @@ OWPFetchSession(
     /*
      * Initialize file header record.
      */
-    memset(&hdr,0,sizeof(hdr));
+    memset(hdr,0,sizeof(*hdr));
 
     /*
      * Make the request of the server.
@@ -1311,12 +1355,12 @@ OWPFetchSession(
      * Read the response
      */
     if((*err_ret = _OWPReadFetchAck(cntrl,retn_on_intr,
-                    &acceptval,&finished,&hdr.next_seqno,
-                    &hdr.num_skiprecs,&hdr.num_datarecs)) < OWPErrWARNING){
+                    &acceptval,&finished,&hdr->next_seqno,
+                    &hdr->num_skiprecs,&hdr->num_datarecs)) < OWPErrWARNING){
         goto failure;
     }
-    /* store 8 bit finished in 32 bit hdr.finished field. */
-    hdr.finished = finished;
+    /* store 8 bit finished in 32 bit hdr->finished field. */
+    hdr->finished = finished;
 
     /*
      * If the server didn't accept, the fetch response is complete.
@@ -1324,6 +1368,9 @@ OWPFetchSession(
     if(acceptval != OWP_CNTRL_ACCEPT){
         return 0;
     }
+    if(app){
+        app->accepted = True;
+    }
 
     /*
      * Representation of original TestReq is first.
@@ -1340,62 +1387,95 @@ OWPFetchSession(
     if( !(saddr = I2AddrSAddr(tsession->sender,&saddrlen))){
         goto failure;
     }
-    assert(sizeof(hdr.addr_sender) >= saddrlen);
-    memcpy(&hdr.addr_sender,saddr,saddrlen);
+    assert(sizeof(hdr->addr_sender) >= saddrlen);
+    memcpy(&hdr->addr_sender,saddr,saddrlen);
 
     if( !(saddr = I2AddrSAddr(tsession->receiver,&saddrlen))){
         goto failure;
     }
-    assert(sizeof(hdr.addr_receiver) >= saddrlen);
-    memcpy(&hdr.addr_receiver,saddr,saddrlen);
+    assert(sizeof(hdr->addr_receiver) >= saddrlen);
+    memcpy(&hdr->addr_receiver,saddr,saddrlen);
 
-    hdr.conf_sender = tsession->conf_sender;
-    hdr.conf_receiver = tsession->conf_receiver;
+    hdr->conf_sender = tsession->conf_sender;
+    hdr->conf_receiver = tsession->conf_receiver;
 
-    memcpy(hdr.sid,tsession->sid,sizeof(hdr.sid));
-    /* hdr.test_spec will now point at same slots memory. */
-    hdr.test_spec = tsession->test_spec;
+    memcpy(hdr->sid,tsession->sid,sizeof(hdr->sid));
+    /* hdr->test_spec will now point at same slots memory. */
+    hdr->test_spec = tsession->test_spec;
 
     /*
-     * Now, actually write the header
+     * Now, actually write the header. (An appended file starts out
+     * with no skips or data records, they are added as they arrive.)
      */
-    if( !OWPWriteDataHeader(cntrl->ctx,fp,&hdr)){
-        OWPError(cntrl->ctx,OWPErrFATAL,OWPErrUNKNOWN,
-                "OWPFetchSession: OWPWriteDataHeader(): %M");
-        *err_ret = OWPErrWARNING;
-        dowrite = False;
+    if(strm){
+        /* nothing to write */
     }
+    else if(!app){
+        if( !OWPWriteDataHeader(cntrl->ctx,fp,hdr)){
+            OWPError(cntrl->ctx,OWPErrFATAL,OWPErrUNKNOWN,
+                    "OWPFetchSession: OWPWriteDataHeader(): %M");
+            *err_ret = OWPErrWARNING;
+            dowrite = False;
+        }
+    }
+    else if(app->writehdr){
+        OWPSessionHeaderRec ahdr = *hdr;
 
-    /*
-     * Done with tsession
-     * (Make sure hdr.test_spec->slots is not accessed - mem is freed!)
-     */
-    (void)_OWPTestSessionFree(tsession,OWP_CNTRL_INVALID);
-    hdr.test_spec.slots = NULL;
+        ahdr.finished = OWP_SESSION_FINISHED_INCOMPLETE;
+        ahdr.next_seqno = 0;
+        ahdr.num_skiprecs = 0;
+        ahdr.num_datarecs = 0;
+        if( !OWPWriteDataHeader(cntrl->ctx,fp,&ahdr)){
+            OWPError(cntrl->ctx,OWPErrFATAL,OWPErrUNKNOWN,
+                    "OWPFetchSessionAppend: OWPWriteDataHeader(): %M");
+            *err_ret = OWPErrWARNING;
+            dowrite = False;
+        }
+    }
 
     /*
      * Skip records:
      *
      * How many octets of skip records?
      */
-    toff = hdr.num_skiprecs * _OWP_SKIPREC_SIZE;
+    toff = hdr->num_skiprecs * _OWP_SKIPREC_SIZE;
+
+    /*
+     * Appended files and streams need the skips after the data records
+     * have been read, so keep them in memory.
+     */
+    if((app || strm) && toff){
+        if( !(sbuf = malloc(toff))){
+            OWPError(cntrl->ctx,OWPErrFATAL,errno,"malloc(): %M");
+            *err_ret = OWPErrFATAL;
+            goto failure;
+        }
+        if(app){
+            app->skips = sbuf;
+        }
+    }
 
     /*
      * Read even AES blocks of skips first
      */
+    i = 0;
     while(toff > _OWP_RIJNDAEL_BLOCK_SIZE){
         if(_OWPReceiveBlocksIntr(cntrl,(uint8_t *)buf,1,retn_on_intr) != 1){
             *err_ret = OWPErrFATAL;
             goto failure;
         }
         _OWPRecvHMACAdd(cntrl,buf,1);
-        if(dowrite && ( fwrite(buf,1,_OWP_RIJNDAEL_BLOCK_SIZE,fp) !=
+        if(sbuf){
+            memcpy(&sbuf[i],buf,_OWP_RIJNDAEL_BLOCK_SIZE);
+        }
+        else if(dowrite && ( fwrite(buf,1,_OWP_RIJNDAEL_BLOCK_SIZE,fp) !=
                     _OWP_RIJNDAEL_BLOCK_SIZE)){
             OWPError(cntrl->ctx,OWPErrFATAL,errno,
                     "OWPFetchSession: fwrite(): %M");
             dowrite = False;
         }
         toff -= _OWP_RIJNDAEL_BLOCK_SIZE;
+        i += _OWP_RIJNDAEL_BLOCK_SIZE;
     }
     /*
      * Finish incomplete block
@@ -1406,7 +1486,10 @@ OWPFetchSession(
             goto failure;
         }
         _OWPRecvHMACAdd(cntrl,buf,1);
-        if(dowrite && ( fwrite(buf,1,toff,fp) != (size_t)toff)){
+        if(sbuf){
+            memcpy(&sbuf[i],buf,toff);
+        }
+        else if(dowrite && ( fwrite(buf,1,toff,fp) != (size_t)toff)){
             OWPError(cntrl->ctx,OWPErrFATAL,errno,
                     "OWPFetchSession: fwrite(): %M");
             dowrite = False;
@@ -1428,62 +1511,138 @@ OWPFetchSession(
     }
 
     /*
-     * Data records are next (fp is already positioned correctly).
+     * A stream gets the header (with the slots still valid) and the
+     * skips before any data records.
      */
-
-    for(n=hdr.num_datarecs;
-            n >= _OWP_FETCH_DATAREC_BLOCKS;
-            n -= _OWP_FETCH_DATAREC_BLOCKS){
-        if(_OWPReceiveBlocksIntr(cntrl,(uint8_t *)buf,_OWP_FETCH_AES_BLOCKS,
-                    retn_on_intr) != _OWP_FETCH_AES_BLOCKS){
+    if(strm){
+        if(hdr->num_skiprecs &&
+                !(skips = calloc(hdr->num_skiprecs,sizeof(OWPSkipRec)))){
+            OWPError(cntrl->ctx,OWPErrFATAL,errno,"calloc(): %M");
             *err_ret = OWPErrFATAL;
             goto failure;
         }
-        _OWPRecvHMACAdd(cntrl,buf,_OWP_FETCH_AES_BLOCKS);
-        if(dowrite && (fwrite(buf,_OWP_DATAREC_SIZE,
-                        _OWP_FETCH_DATAREC_BLOCKS,fp) !=
-                    _OWP_FETCH_DATAREC_BLOCKS)){
-            OWPError(cntrl->ctx,OWPErrFATAL,OWPErrUNKNOWN,
-                    "OWPFetchSession: fwrite(): %M");
-            dowrite = False;
+        for(i=0;i<hdr->num_skiprecs;i++){
+            _OWPDecodeSkipRecord(&skips[i],
+                    (char *)&sbuf[i*_OWP_SKIPREC_SIZE]);
+        }
+        if( !(strm->recs = calloc(MAX(1,MIN(hdr->num_datarecs,
+                                _OWP_FETCH_BATCH_DATARECS)),
+                        sizeof(OWPDataRec)))){
+            OWPError(cntrl->ctx,OWPErrFATAL,errno,"calloc(): %M");
+            *err_ret = OWPErrFATAL;
+            goto failure;
         }
+        /* describe the records as they would be in a fetched file */
+        hdr->header = True;
+        hdr->version = 3;
+        hdr->rec_size = _OWP_DATAREC_SIZE;
+        dowrite = strm->hdr_func(hdr,skips,strm->udata);
     }
 
-    if(n){
-        /*
-         * Read enough AES blocks to get remaining records.
-         */
-        int        blks = n*_OWP_DATAREC_SIZE/_OWP_RIJNDAEL_BLOCK_SIZE + 1;
+    /*
+     * Done with tsession
+     * (Make sure hdr->test_spec->slots is not accessed - mem is freed!)
+     */
+    (void)_OWPTestSessionFree(tsession,OWP_CNTRL_INVALID);
+    tsession = NULL;
+    hdr->test_spec.slots = NULL;
 
-        if(_OWPReceiveBlocksIntr(cntrl,(uint8_t *)buf,
-                    blks,retn_on_intr) != blks){
+    /*
+     * Data records are next (fp is already positioned correctly).
+     *
+     * Complete fetch buffers are read in batches of up to
+     * _OWP_FETCH_BATCH_DATARECS records.
+     */
+    if((hdr->num_datarecs >= _OWP_FETCH_DATAREC_BLOCKS) &&
+            !(dbuf = malloc(_OWP_FETCH_BATCH_SIZE))){
+        OWPError(cntrl->ctx,OWPErrFATAL,errno,"malloc(): %M");
+        *err_ret = OWPErrFATAL;
+        goto failure;
+    }
+
+    for(n=hdr->num_datarecs;
+            n >= _OWP_FETCH_DATAREC_BLOCKS;
+            n -= nrecs){
+        nrecs = MIN(n - (n % _OWP_FETCH_DATAREC_BLOCKS),
+                _OWP_FETCH_BATCH_DATARECS);
+        blks = nrecs / _OWP_FETCH_DATAREC_BLOCKS * _OWP_FETCH_AES_BLOCKS;
+
+        if(_OWPReceiveBlocksIntr(cntrl,(uint8_t *)dbuf,blks,
+                    retn_on_intr) != blks){
             *err_ret = OWPErrFATAL;
             goto failure;
         }
-        _OWPRecvHMACAdd(cntrl,buf,blks);
-        if(dowrite && (fwrite(buf,_OWP_DATAREC_SIZE,n,fp) != n)){
+        _OWPRecvHMACAdd(cntrl,dbuf,blks);
+        if(strm){
+            if(dowrite){
+                dowrite = FetchStreamRecords(cntrl,strm,dbuf,nrecs);
+            }
+        }
+        else if(dowrite &&
+                (fwrite(dbuf,_OWP_DATAREC_SIZE,nrecs,fp) != nrecs)){
             OWPError(cntrl->ctx,OWPErrFATAL,OWPErrUNKNOWN,
                     "OWPFetchSession: fwrite(): %M");
             dowrite = False;
         }
+        for(i=0;app && (i<nrecs);i++){
+            if(_OWPDecodeDataRecord(3,&rec,&dbuf[i*_OWP_DATAREC_SIZE]) &&
+                    !OWPIsLostRecord(&rec)){
+                app->maxseq = MAX(app->maxseq,rec.seq_no+1);
+            }
+        }
     }
 
-    fflush(fp);
-
     /*
-     * Read final block of HMAC
+     * Read enough AES blocks to get remaining records, and the final
+     * block of HMAC, in one read.
      */
-    if(_OWPReceiveBlocksIntr(cntrl,(uint8_t *)buf,1,retn_on_intr) != 1){
+    blks = (n)? n*_OWP_DATAREC_SIZE/_OWP_RIJNDAEL_BLOCK_SIZE + 1: 0;
+
+    if(_OWPReceiveBlocksIntr(cntrl,(uint8_t *)buf,
+                blks+1,retn_on_intr) != blks+1){
         *err_ret = OWPErrFATAL;
         goto failure;
     }
-    if(!_OWPRecvHMACCheckClear(cntrl,buf)){
+    _OWPRecvHMACAdd(cntrl,buf,blks);
+    if(strm){
+        if(n && dowrite){
+            dowrite = FetchStreamRecords(cntrl,strm,buf,n);
+        }
+    }
+    else if(n && dowrite && (fwrite(buf,_OWP_DATAREC_SIZE,n,fp) != n)){
+        OWPError(cntrl->ctx,OWPErrFATAL,OWPErrUNKNOWN,
+                "OWPFetchSession: fwrite(): %M");
+        dowrite = False;
+    }
+    for(i=0;app && (i<n);i++){
+        if(_OWPDecodeDataRecord(3,&rec,&buf[i*_OWP_DATAREC_SIZE]) &&
+                !OWPIsLostRecord(&rec)){
+            app->maxseq = MAX(app->maxseq,rec.seq_no+1);
+        }
+    }
+
+    if(fp){
+        fflush(fp);
+    }
+
+    if(!_OWPRecvHMACCheckClear(cntrl,&buf[blks*_OWP_RIJNDAEL_BLOCK_SIZE])){
         OWPError(cntrl->ctx,OWPErrFATAL,OWPErrUNKNOWN,
                 "OWPFetchSession: Invalid HMAC");
         *err_ret = OWPErrFATAL;
         goto failure;
     }
 
+    if(dbuf){
+        free(dbuf);
+        dbuf = NULL;
+    }
+    if(strm){
+        free(strm->recs);
+        strm->recs = NULL;
+        free(skips);
+        free(sbuf);
+    }
+
     /*
      * reset state to request.
      */
@@ -1492,16 +1651,309 @@ OWPFetchSession(
 
     if(!dowrite){
         *err_ret = OWPErrWARNING;
-        hdr.num_datarecs = 0;
+        hdr->num_datarecs = 0;
+    }
+    else if(!app && !strm &&
+            (hdr->finished == OWP_SESSION_FINISHED_NORMAL)){
+        /*
+         * The index is optional - the file is usable without it.
+         */
+        (void)OWPWriteDataIndex(cntrl->ctx,fp);
     }
 
-    return hdr.num_datarecs;
+    return hdr->num_datarecs;
 
 failure:
+    if(dbuf){
+        free(dbuf);
+    }
+    if(tsession){
+        (void)_OWPTestSessionFree(tsession,OWP_CNTRL_INVALID);
+        hdr->test_spec.slots = NULL;
+    }
+    if(strm){
+        free(strm->recs);
+        strm->recs = NULL;
+        free(skips);
+        free(sbuf);
+    }
     (void)_OWPFailControlSession(cntrl,*err_ret);
     return 0;
 }
 
+/*
+ * Function:        OWPFetchSession
+ *
+ * Description:        
+ *        This function is used to request that the data for the TestSession
+ *        identified by sid be fetched from the server and copied to the
+ *        file pointed at by fp. This function assumes fp is currently pointing
+ *        at an open file, and that fp is ready to write at the begining of the
+ *        file.
+ *
+ *        To request an entire session set begin = 0, and end = 0xFFFFFFFF.
+ *        (This is only valid if the session is complete - otherwise the server
+ *        should deny this request.)
+ *        Otherwise, "begin" and "end" refer to sequence numbers in the test
+ *        session.
+ *        The number of records returned will not necessarily be end-begin due
+ *        to possible loss and/or duplication.
+ *
+ *      There is a full description of the owp file format in the comments
+ *      in api.c. If the session finished normally, a block index is
+ *      appended to the file (OWPWriteDataIndex).
+ *
+ * In Args:        
+ *
+ * Out Args:        
+ *
+ * Scope:        
+ * Returns:        
+ *        The number of data records in the file. If < 1, check err_ret to
+ *        find out if it was an error condition: ErrOK just means the request
+ *        was denied by the server. ErrWARNING means there was a local
+ *        problem (fp not writeable etc...) and the control connection is
+ *        still valid.
+ * Side Effect:        
+ */
+uint32_t
+OWPFetchSession(
+        OWPControl      cntrl,
+        FILE            *fp,
+        uint32_t       begin,
+        uint32_t       end,
+        OWPSID          sid,
+        OWPErrSeverity  *err_ret
+        )
+{
+    OWPSessionHeaderRec hdr;
+
+    return FetchSessionData(cntrl,fp,begin,end,sid,&hdr,NULL,NULL,err_ret);
+}
+
+/*
+ * Function:        OWPFetchSessionStream
+ *
+ * Description:        
+ *        Version of OWPFetchSession that does not use a file. Once the
+ *        session header and skip records have been received, hdr_func is
+ *        called with them (hdr->test_spec.slots is only valid during the
+ *        call). rec_func is then called with each batch of decoded data
+ *        records, in the order they would be in the file.
+ *
+ *        If a callback returns False, no more callbacks are made, the
+ *        rest of the session data is read and discarded, and err_ret is
+ *        set to OWPErrWARNING.
+ *
+ * In Args:        
+ *
+ * Out Args:        
+ *
+ * Scope:        
+ * Returns:        
+ *        The number of data records received. See OWPFetchSession.
+ * Side Effect:        
+ */
+uint32_t
+OWPFetchSessionStream(
+        OWPControl          cntrl,
+        uint32_t            begin,
+        uint32_t            end,
+        OWPSID              sid,
+        OWPFetchHeaderFunc  hdr_func,
+        OWPFetchRecordsFunc rec_func,
+        void                *udata,
+        OWPErrSeverity      *err_ret
+        )
+{
+    OWPSessionHeaderRec hdr;
+    FetchStreamRec      strm;
+
+    memset(&strm,0,sizeof(strm));
+    strm.hdr_func = hdr_func;
+    strm.rec_func = rec_func;
+    strm.udata = udata;
+
+    return FetchSessionData(cntrl,NULL,begin,end,sid,&hdr,NULL,&strm,
+            err_ret);
+}
+
+/*
+ * Function:        OWPFetchSessionAppend
+ *
+ * Description:        
+ *        Incremental version of OWPFetchSession. fp must be open for
+ *        reading and writing, and either be empty or hold data from
+ *        previous calls for the same sid.
+ *
+ *        Only the records that are not already in fp are requested.
+ *        They are appended to the data records in fp. The session does
+ *        not need to be complete: the server only sends records up to
+ *        the point where the session data can be trusted. The position
+ *        to continue from is saved in the next_seqno field of the file
+ *        header while the session is not finished.
+ *
+ *        Once the server reports the session finished normally, the skip
+ *        records are added after the data, the header is marked
+ *        finished, the block index is written, and fp holds the
+ *        complete session. (Records the server dropped from the tail
+ *        of the session when it was finalized can remain in fp.)
+ *
+ * In Args:        
+ *
+ * Out Args:        
+ *        nrecs_ret:    number of records appended by this call
+ *        finished_ret: finished state of the session
+ *
+ * Scope:        
+ * Returns:        
+ *        False if the request was denied or failed - err_ret is set as
+ *        for OWPFetchSession. True otherwise, even if no records were
+ *        appended.
+ * Side Effect:        
+ */
+OWPBoolean
+OWPFetchSessionAppend(
+        OWPControl              cntrl,
+        FILE                    *fp,
+        OWPSID                  sid,
+        uint32_t                *nrecs_ret,
+        OWPSessionFinishedType  *finished_ret,
+        OWPErrSeverity          *err_ret
+        )
+{
+    _OWPSessionHeaderInitialRec phrec;
+    OWPSessionHeaderRec         hdr;
+    FetchAppendRec              app;
+    struct stat                 sbuf;
+    uint32_t                    begin = 0;
+    uint32_t                    num_datarecs = 0;
+    uint32_t                    next_seqno;
+    off_t                       dend;
+    OWPBoolean                  rc = False;
+
+    *nrecs_ret = 0;
+    *finished_ret = OWP_SESSION_FINISHED_ERROR;
+    *err_ret = OWPErrOK;
+
+    memset(&app,0,sizeof(app));
+
+    if(!fp || (fstat(fileno(fp),&sbuf) != 0)){
+        OWPError(cntrl->ctx,OWPErrFATAL,OWPErrINVALID,
+                "OWPFetchSessionAppend: Invalid fp");
+        *err_ret = OWPErrWARNING;
+        return False;
+    }
+
+    /*
+     * Find where the local data ends and what to ask for next.
+     */
+    if(!sbuf.st_size){
+        app.writehdr = True;
+    }
+    else{
+        if( !_OWPReadDataHeaderInitial(cntrl->ctx,fp,&phrec)){
+            *err_ret = OWPErrWARNING;
+            return False;
+        }
+        if((phrec.version != 3) || (phrec.rec_size != _OWP_DATAREC_SIZE) ||
+                phrec.num_skiprecs || phrec.oset_skiprecs){
+            OWPError(cntrl->ctx,OWPErrFATAL,OWPErrINVALID,
+                    "OWPFetchSessionAppend: File was not created by OWPFetchSessionAppend");
+            *err_ret = OWPErrWARNING;
+            return False;
+        }
+        if(phrec.finished == OWP_SESSION_FINISHED_NORMAL){
+            *finished_ret = OWP_SESSION_FINISHED_NORMAL;
+            return True;
+        }
+
+        begin = phrec.next_seqno;
+        num_datarecs = phrec.num_datarecs;
+        dend = phrec.oset_datarecs + (off_t)num_datarecs * _OWP_DATAREC_SIZE;
+
+        /*
+         * Drop anything past the last complete append.
+         */
+        if((fflush(fp) != 0) || (ftruncate(fileno(fp),dend) != 0) ||
+                fseeko(fp,dend,SEEK_SET)){
+            OWPError(cntrl->ctx,OWPErrFATAL,errno,
+                    "OWPFetchSessionAppend: Unable to position file: %M");
+            *err_ret = OWPErrWARNING;
+            return False;
+        }
+    }
+
+    /*
+     * [0,0xFFFFFFFF] asks for the complete session, which the server
+     * denies until the session is finished.
+     */
+    app.maxseq = begin;
+    *nrecs_ret = FetchSessionData(cntrl,fp,begin,
+            (begin)? 0xFFFFFFFF: 0xFFFFFFFE,sid,&hdr,&app,NULL,err_ret);
+    if(!app.accepted || (*err_ret != OWPErrOK)){
+        goto done;
+    }
+    *finished_ret = hdr.finished;
+    num_datarecs += *nrecs_ret;
+
+    /*
+     * Where to continue from. Servers that don't report it for an
+     * incomplete session send everything up to the last record that
+     * was not lost.
+     */
+    next_seqno = hdr.next_seqno;
+    if(hdr.finished != OWP_SESSION_FINISHED_NORMAL){
+        if(!next_seqno){
+            next_seqno = app.maxseq;
+        }
+        next_seqno = MAX(next_seqno,begin);
+    }
+
+    if( !OWPWriteDataHeaderNumDataRecs(cntrl->ctx,fp,num_datarecs)){
+        *err_ret = OWPErrWARNING;
+        goto done;
+    }
+
+    if(hdr.finished == OWP_SESSION_FINISHED_NORMAL){
+        /*
+         * Skip records go after the data.
+         */
+        if( !OWPWriteDataHeaderNumSkipRecs(cntrl->ctx,fp,hdr.num_skiprecs)){
+            *err_ret = OWPErrWARNING;
+            goto done;
+        }
+        if(hdr.num_skiprecs){
+            if(fseeko(fp,0,SEEK_END) ||
+                    (fwrite(app.skips,_OWP_SKIPREC_SIZE,hdr.num_skiprecs,fp)
+                     != hdr.num_skiprecs)){
+                OWPError(cntrl->ctx,OWPErrFATAL,errno,
+                        "OWPFetchSessionAppend: fwrite(): %M");
+                *err_ret = OWPErrWARNING;
+                goto done;
+            }
+        }
+    }
+
+    if( !_OWPWriteDataHeaderFinished(cntrl->ctx,fp,hdr.finished,next_seqno)){
+        *err_ret = OWPErrWARNING;
+        goto done;
+    }
+
+    if(hdr.finished == OWP_SESSION_FINISHED_NORMAL){
+        (void)OWPWriteDataIndex(cntrl->ctx,fp);
+    }
+
+    rc = True;
+
+done:
+    if(app.skips){
+        free(app.skips);
+    }
+
+    return rc;
+}
+
 /*
  * Function:        OWPParsePortRange
  *
@@ -0,0 +1,1287 @@
+/*
+ *      $Id$
+ */
+/************************************************************************
+ *                                                                      *
+ *                             Copyright (C)  2026                      *
+ *                                Internet2                             *
+ *                             All Rights Reserved                      *
+ *                                                                      *
+ ************************************************************************/
+/*
+ *        File:         dataindex.c
+ *
+ *        Description:
+ *              Block index for finished (version 3 and 4) session files.
+ *
+ *              The index is appended after everything else in the file
+ *              (data records and skip records) once the session is
+ *              finished. It has one entry for every _OWP_DATAINDEX_RECS
+ *              data records (one entry per block for version 4 files),
+ *              the delay histograms of the entries, and a fixed size
+ *              trailer. All fields are in network byte order:
+ *
+ *              entry (_OWP_DATAINDEX_ENTRY_SIZE octets):
+ *                  00  oset        offset of the first record (8)
+ *                  08  recidx      index of the first record
+ *                  12  nrecs       records in the group
+ *                  16  seq_min     smallest seq_no in the group
+ *                  20  seq_max     largest seq_no in the group
+ *                  24  send_min    earliest send time in the group (8)
+ *                  32  send_max    latest send time in the group (8)
+ *                  40  lost        lost records
+ *                  44  dups        duplicate records (by seq_no, within
+ *                                  the group)
+ *                  48  delay_min   smallest delay, signed OWPNum64 (8)
+ *                  56  delay_max   largest delay, signed OWPNum64 (8)
+ *                  64  nbuckets    non-empty histogram buckets
+ *
+ *              histograms, nbuckets pairs for each entry in order:
+ *                  00  bucket      (2) see DelayBucket()
+ *                  02  count       (2) received records in the bucket
+ *
+ *              trailer (_OWP_DATAINDEX_TRAILER_SIZE octets):
+ *                  00  oset        offset of the first entry (8)
+ *                  08  nentries
+ *                  12  num_datarecs
+ *                  16  version     _OWP_DATAINDEX_VERSION
+ *                  20  magic       "OwI\0"
+ *
+ *              Records are not sorted by seq_no or send time in the
+ *              file (the receiver writes them in arrival order), so the
+ *              range for a query is every group from the first to the
+ *              last one whose [min,max] intersects it. Callers still
+ *              have to filter the records they parse.
+ *
+ *              The per-entry summaries (zone maps) let OWPReadDataSummary
+ *              answer send time range queries from the index for every
+ *              group that is completely inside the range. Only the
+ *              groups at the edges of the range are parsed.
+ *
+ *              Version 1 indexes (no summaries, 40 octet entries) are
+ *              still accepted by OWPReadDataIndex.
+ *
+ *              The index is not referenced by any header field. It is
+ *              only used if the trailer ends the file exactly and agrees
+ *              with num_datarecs, otherwise readers fall back to parsing
+ *              all of the records.
+ */
+#include "owampP.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+
+#define _OWP_DATAINDEX_VERSION  (2)
+#define _OWP_DATAINDEX_V1_SIZE  (40)    /* version 1 entries */
+#define _OWP_DATAINDEX_NREAD    (64)    /* entries per fread */
+
+/*
+ * Delay histogram: _OWP_DATASUM_SUB log spaced buckets for every power of
+ * two from 2^_OWP_DATASUM_MINEXP to 2^_OWP_DATASUM_MAXEXP seconds, plus
+ * one bucket below (and including negative delays) and one above.
+ */
+#define _OWP_DATASUM_SUB        (16)
+#define _OWP_DATASUM_MINEXP     (-24)
+#define _OWP_DATASUM_MAXEXP     (12)
+
+static uint8_t owp_index_magic[] = "OwI";
+
+struct _OWPDataIndexRec{
+    OWPContext              ctx;
+    _OWPDataIndexEntry      entries;
+    uint32_t                nentries;
+    uint32_t                size;
+    uint16_t                *hist;      /* (bucket,count) pairs */
+    uint32_t                nhist;
+    uint32_t                hist_size;
+
+    /* current group */
+    _OWPDataIndexEntryRec   cur;
+    uint32_t                nseqs;
+    uint32_t                seqs[_OWP_DATAINDEX_RECS];
+    uint16_t                counts[OWP_DATASUM_NBUCKETS];
+};
+
+/*
+ * Function:    DelayBucket
+ *
+ * Description:
+ *      Histogram bucket for a delay in seconds.
+ */
+static uint32_t
+DelayBucket(
+        double  d
+        )
+{
+    double  m;
+    int     e;
+
+    if(d < ldexp(1.0,_OWP_DATASUM_MINEXP)){
+        return 0;
+    }
+    if(d >= ldexp(1.0,_OWP_DATASUM_MAXEXP)){
+        return OWP_DATASUM_NBUCKETS - 1;
+    }
+
+    /* d = m * 2^e, m in [0.5,1) */
+    m = frexp(d,&e);
+
+    return 1 + (e - 1 - _OWP_DATASUM_MINEXP) * _OWP_DATASUM_SUB +
+        (uint32_t)((2.0 * m - 1.0) * _OWP_DATASUM_SUB);
+}
+
+/*
+ * Function:    DelayToDouble
+ *
+ * Description:
+ *      Convert a signed OWPNum64 delay to seconds.
+ */
+static double
+DelayToDouble(
+        int64_t delay
+        )
+{
+    if(delay < 0){
+        return -OWPNum64ToDouble((OWPNum64)-delay);
+    }
+
+    return OWPNum64ToDouble((OWPNum64)delay);
+}
+
+/*
+ * Function:    _OWPDataIndexCreate
+ *
+ * Description:
+ *      Allocate an index builder. Records are added to the current
+ *      group with _OWPDataIndexAdd, and the group is ended (and its
+ *      entry added to the index) with _OWPDataIndexEnd.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+_OWPDataIndex
+_OWPDataIndexCreate(
+        OWPContext  ctx
+        )
+{
+    _OWPDataIndex   idx;
+
+    if( !(idx = calloc(1,sizeof(*idx)))){
+        OWPError(ctx,OWPErrFATAL,errno,"calloc(1,_OWPDataIndexRec): %M");
+        return NULL;
+    }
+    idx->ctx = ctx;
+
+    return idx;
+}
+
+void
+_OWPDataIndexFree(
+        _OWPDataIndex   idx
+        )
+{
+    if(!idx){
+        return;
+    }
+    if(idx->entries){
+        free(idx->entries);
+    }
+    if(idx->hist){
+        free(idx->hist);
+    }
+    free(idx);
+
+    return;
+}
+
+/*
+ * Function:    _OWPDataIndexAdd
+ *
+ * Description:
+ *      Add rec to the current group.
+ */
+void
+_OWPDataIndexAdd(
+        _OWPDataIndex   idx,
+        OWPDataRec      *rec
+        )
+{
+    _OWPDataIndexEntry  cur = &idx->cur;
+    int64_t             delay;
+    uint32_t            b;
+
+    if(!cur->nrecs){
+        cur->seq_min = cur->seq_max = rec->seq_no;
+        cur->send_min = cur->send_max = rec->send.owptime;
+    }
+    else{
+        cur->seq_min = MIN(cur->seq_min,rec->seq_no);
+        cur->seq_max = MAX(cur->seq_max,rec->seq_no);
+        cur->send_min = MIN(cur->send_min,rec->send.owptime);
+        cur->send_max = MAX(cur->send_max,rec->send.owptime);
+    }
+    cur->nrecs++;
+
+    if(idx->nseqs < _OWP_DATAINDEX_RECS){
+        idx->seqs[idx->nseqs++] = rec->seq_no;
+    }
+
+    if(OWPIsLostRecord(rec)){
+        cur->lost++;
+        return;
+    }
+
+    delay = (int64_t)(rec->recv.owptime - rec->send.owptime);
+    if(cur->nrecs - cur->lost == 1){
+        cur->delay_min = cur->delay_max = delay;
+    }
+    else{
+        cur->delay_min = MIN(cur->delay_min,delay);
+        cur->delay_max = MAX(cur->delay_max,delay);
+    }
+
+    b = DelayBucket(DelayToDouble(delay));
+    idx->counts[b]++;
+
+    return;
+}
+
+static int
+CmpSeq(
+        const void  *a,
+        const void  *b
+        )
+{
+    uint32_t    x = *(const uint32_t *)a;
+    uint32_t    y = *(const uint32_t *)b;
+
+    return (x < y)? -1: (x > y)? 1: 0;
+}
+
+/*
+ * Function:    _OWPDataIndexEnd
+ *
+ * Description:
+ *      End the current group: count the duplicates, add the entry
+ *      (records starting at oset/recidx) and its histogram to the index
+ *      and reset the group. Does nothing if the group is empty.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+OWPBoolean
+_OWPDataIndexEnd(
+        _OWPDataIndex   idx,
+        off_t           oset,
+        uint32_t        recidx
+        )
+{
+    _OWPDataIndexEntry  tentries;
+    uint16_t            *thist;
+    uint32_t            i;
+
+    if(!idx->cur.nrecs){
+        return True;
+    }
+
+    if(idx->nentries >= idx->size){
+        if( !(tentries = realloc(idx->entries,
+                        sizeof(_OWPDataIndexEntryRec)*(idx->size+256)))){
+            OWPError(idx->ctx,OWPErrFATAL,errno,"realloc(): %M");
+            return False;
+        }
+        idx->entries = tentries;
+        idx->size += 256;
+    }
+    if(idx->nhist + OWP_DATASUM_NBUCKETS > idx->hist_size){
+        if( !(thist = realloc(idx->hist,sizeof(uint16_t)*2*
+                        (idx->hist_size + 4*OWP_DATASUM_NBUCKETS)))){
+            OWPError(idx->ctx,OWPErrFATAL,errno,"realloc(): %M");
+            return False;
+        }
+        idx->hist = thist;
+        idx->hist_size += 4*OWP_DATASUM_NBUCKETS;
+    }
+
+    /*
+     * Duplicates: extra copies of a seq_no within the group.
+     */
+    qsort(idx->seqs,idx->nseqs,sizeof(uint32_t),CmpSeq);
+    for(i=1;i<idx->nseqs;i++){
+        if(idx->seqs[i] == idx->seqs[i-1]){
+            idx->cur.dups++;
+        }
+    }
+
+    for(i=0;i<OWP_DATASUM_NBUCKETS;i++){
+        if(!idx->counts[i]){
+            continue;
+        }
+        idx->hist[2*idx->nhist] = i;
+        idx->hist[2*idx->nhist+1] = idx->counts[i];
+        idx->nhist++;
+        idx->cur.nbuckets++;
+        idx->counts[i] = 0;
+    }
+
+    idx->cur.oset = oset;
+    idx->cur.recidx = recidx;
+    idx->entries[idx->nentries++] = idx->cur;
+
+    memset(&idx->cur,0,sizeof(idx->cur));
+    idx->nseqs = 0;
+
+    return True;
+}
+
+/*
+ * Function:    _OWPWriteDataIndexEntries
+ *
+ * Description:
+ *      Write the index at the current fp offset, which must be the end
+ *      of the session data. If the index can not be completely written,
+ *      the file is truncated back to where it started so it is still a
+ *      valid session file.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+OWPBoolean
+_OWPWriteDataIndexEntries(
+        OWPContext      ctx,
+        FILE            *fp,
+        _OWPDataIndex   idx,
+        uint32_t        num_datarecs
+        )
+{
+    uint8_t             buf[_OWP_DATAINDEX_ENTRY_SIZE];
+    _OWPDataIndexEntry  e;
+    uint16_t            n16;
+    uint32_t            n32;
+    uint64_t            n64;
+    off_t               oset;
+    uint32_t            i;
+
+    if((oset = ftello(fp)) < 0){
+        OWPError(ctx,OWPErrFATAL,errno,"ftello(): %M");
+        return False;
+    }
+
+    for(i=0;i<idx->nentries;i++){
+        e = &idx->entries[i];
+        n64 = htonll((uint64_t)e->oset);
+        memcpy(&buf[0],&n64,8);
+        n32 = htonl(e->recidx);
+        memcpy(&buf[8],&n32,4);
+        n32 = htonl(e->nrecs);
+        memcpy(&buf[12],&n32,4);
+        n32 = htonl(e->seq_min);
+        memcpy(&buf[16],&n32,4);
+        n32 = htonl(e->seq_max);
+        memcpy(&buf[20],&n32,4);
+        n64 = htonll(e->send_min);
+        memcpy(&buf[24],&n64,8);
+        n64 = htonll(e->send_max);
+        memcpy(&buf[32],&n64,8);
+        n32 = htonl(e->lost);
+        memcpy(&buf[40],&n32,4);
+        n32 = htonl(e->dups);
+        memcpy(&buf[44],&n32,4);
+        n64 = htonll((uint64_t)e->delay_min);
+        memcpy(&buf[48],&n64,8);
+        n64 = htonll((uint64_t)e->delay_max);
+        memcpy(&buf[56],&n64,8);
+        n32 = htonl(e->nbuckets);
+        memcpy(&buf[64],&n32,4);
+
+        if(fwrite(buf,1,_OWP_DATAINDEX_ENTRY_SIZE,fp) !=
+                _OWP_DATAINDEX_ENTRY_SIZE){
+            goto error;
+        }
+    }
+
+    for(i=0;i<2*idx->nhist;i++){
+        n16 = htons(idx->hist[i]);
+        if(fwrite(&n16,1,2,fp) != 2){
+            goto error;
+        }
+    }
+
+    n64 = htonll((uint64_t)oset);
+    memcpy(&buf[0],&n64,8);
+    n32 = htonl(idx->nentries);
+    memcpy(&buf[8],&n32,4);
+    n32 = htonl(num_datarecs);
+    memcpy(&buf[12],&n32,4);
+    n32 = htonl(_OWP_DATAINDEX_VERSION);
+    memcpy(&buf[16],&n32,4);
+    memcpy(&buf[20],owp_index_magic,4);
+
+    if((fwrite(buf,1,_OWP_DATAINDEX_TRAILER_SIZE,fp) !=
+                _OWP_DATAINDEX_TRAILER_SIZE) || (fflush(fp) != 0)){
+        goto error;
+    }
+
+    return True;
+
+error:
+    OWPError(ctx,OWPErrFATAL,errno,"_OWPWriteDataIndexEntries: fwrite(): %M");
+    (void)fflush(fp);
+    if(ftruncate(fileno(fp),oset) != 0){
+        OWPError(ctx,OWPErrFATAL,errno,"ftruncate(): %M");
+    }
+
+    return False;
+}
+
+/*
+ * Record groups of a session file, and the state used to build its
+ * index with OWPParseRecords.
+ */
+typedef struct _OWPDataIndexGroupRec{
+    off_t       oset;
+    uint32_t    recidx;
+} _OWPDataIndexGroupRec, *_OWPDataIndexGroup;
+
+typedef struct _OWPDataIndexBuildRec{
+    _OWPDataIndex       idx;
+    _OWPDataIndexGroup  groups;
+    uint32_t            ngroups;
+    uint32_t            cur;
+    uint32_t            i;
+} _OWPDataIndexBuildRec;
+
+/*
+ * Function:    IndexRecord
+ *
+ * Description:
+ *      OWPDoDataRecord function used by OWPWriteDataIndex to add each
+ *      record to the entry for its group.
+ */
+static int
+IndexRecord(
+        OWPDataRec  *rec,
+        void        *udata
+        )
+{
+    _OWPDataIndexBuildRec   *build = (_OWPDataIndexBuildRec *)udata;
+    _OWPDataIndexGroup      g;
+
+    while((build->cur + 1 < build->ngroups) &&
+            (build->i >= build->groups[build->cur + 1].recidx)){
+        g = &build->groups[build->cur++];
+        if( !_OWPDataIndexEnd(build->idx,g->oset,g->recidx)){
+            return -1;
+        }
+    }
+    _OWPDataIndexAdd(build->idx,rec);
+    build->i++;
+
+    return 0;
+}
+
+/*
+ * Function:    _OWPBuildDataIndex
+ *
+ * Description:
+ *      Parse the records of the finished session file fp and return its
+ *      index. The file is only read, so this does not need to hold the
+ *      lock that writers of the file take (see _OWPReadStopSessions).
+ *      *fend_ret is the end of the session data, where the index is
+ *      written by _OWPAppendDataIndex.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ *      The index, or NULL on error.
+ * Side Effect:
+ *      fp is left at an undefined offset.
+ */
+_OWPDataIndex
+_OWPBuildDataIndex(
+        OWPContext  ctx,
+        FILE        *fp,
+        off_t       *fend_ret,
+        uint32_t    *num_datarecs_ret
+        )
+{
+    _OWPSessionHeaderInitialRec phrec;
+    _OWPDataIndexBuildRec       build;
+    _OWPDataIndexGroup          tgroups;
+    uint32_t                    size = 0;
+    uint32_t                    i;
+    uint32_t                    nrecs,bnrecs;
+    off_t                       dend,fend,oset,blen;
+    _OWPDataIndex               idx = NULL;
+    int                         brc;
+
+    memset(&build,0,sizeof(build));
+
+    if(!_OWPReadDataHeaderInitial(ctx,fp,&phrec)){
+        return NULL;
+    }
+
+    if((phrec.version != 3) && (phrec.version != 4)){
+        OWPError(ctx,OWPErrFATAL,EINVAL,
+                "OWPWriteDataIndex: Invalid file version (%ul)",
+                phrec.version);
+        errno = EINVAL;
+        return NULL;
+    }
+    if(phrec.finished != OWP_SESSION_FINISHED_NORMAL){
+        OWPError(ctx,OWPErrFATAL,EINVAL,
+                "OWPWriteDataIndex: Session not finished");
+        errno = EINVAL;
+        return NULL;
+    }
+
+    /*
+     * Find the end of the session data. (Skip records can be before
+     * or after the data records in version 3 files.)
+     */
+    if(phrec.version == 4){
+        dend = phrec.oset_skiprecs;
+    }
+    else{
+        dend = phrec.oset_datarecs +
+            (off_t)phrec.num_datarecs * phrec.rec_size;
+    }
+    fend = dend;
+    if(phrec.oset_skiprecs){
+        fend = MAX(fend,phrec.oset_skiprecs +
+                (off_t)phrec.num_skiprecs * _OWP_SKIPREC_SIZE);
+    }
+    if((dend < phrec.oset_datarecs) || (fend > phrec.sbuf.st_size)){
+        OWPError(ctx,OWPErrFATAL,EFTYPE,
+                "OWPWriteDataIndex: Invalid session file");
+        errno = EFTYPE;
+        return NULL;
+    }
+
+    if( !(build.idx = _OWPDataIndexCreate(ctx))){
+        return NULL;
+    }
+
+    /*
+     * Group the records. Version 3 records are fixed size so the groups
+     * are computed, version 4 groups are the blocks.
+     */
+    if(phrec.version == 3){
+        build.ngroups = (phrec.num_datarecs + _OWP_DATAINDEX_RECS - 1) /
+            _OWP_DATAINDEX_RECS;
+        if(build.ngroups && !(build.groups =
+                    calloc(build.ngroups,sizeof(_OWPDataIndexGroupRec)))){
+            OWPError(ctx,OWPErrFATAL,errno,"calloc(): %M");
+            goto done;
+        }
+        for(i=0;i<build.ngroups;i++){
+            build.groups[i].recidx = i * _OWP_DATAINDEX_RECS;
+            build.groups[i].oset = phrec.oset_datarecs +
+                (off_t)build.groups[i].recidx * phrec.rec_size;
+        }
+    }
+    else{
+        nrecs = 0;
+        oset = phrec.oset_datarecs;
+        while(oset < dend){
+            if(build.ngroups >= size){
+                size += 256;
+                if( !(tgroups = realloc(build.groups,
+                                sizeof(_OWPDataIndexGroupRec)*size))){
+                    OWPError(ctx,OWPErrFATAL,errno,"realloc(): %M");
+                    goto done;
+                }
+                build.groups = tgroups;
+            }
+            if((brc = _OWPReadBlockSizeV4(ctx,fp,oset,dend,&bnrecs,
+                            &blen)) <= 0){
+                if(!brc){
+                    goto invalid;
+                }
+                goto done;
+            }
+            build.groups[build.ngroups].oset = oset;
+            build.groups[build.ngroups].recidx = nrecs;
+            build.ngroups++;
+            nrecs += bnrecs;
+            oset += blen;
+        }
+        if(nrecs != phrec.num_datarecs){
+            goto invalid;
+        }
+    }
+
+    if(fseeko(fp,phrec.oset_datarecs,SEEK_SET)){
+        OWPError(ctx,OWPErrFATAL,errno,"fseeko(): %M");
+        goto done;
+    }
+    if(OWPParseRecords(ctx,fp,phrec.num_datarecs,phrec.version,
+                IndexRecord,&build) != OWPErrOK){
+        goto done;
+    }
+    if(build.ngroups && !_OWPDataIndexEnd(build.idx,
+                build.groups[build.cur].oset,build.groups[build.cur].recidx)){
+        goto done;
+    }
+
+    idx = build.idx;
+    build.idx = NULL;
+    *fend_ret = fend;
+    *num_datarecs_ret = phrec.num_datarecs;
+    goto done;
+
+invalid:
+    OWPError(ctx,OWPErrFATAL,EFTYPE,
+            "OWPWriteDataIndex: Invalid session file");
+    errno = EFTYPE;
+done:
+    if(build.groups){
+        free(build.groups);
+    }
+    if(build.idx){
+        _OWPDataIndexFree(build.idx);
+    }
+
+    return idx;
+}
+
+/*
+ * Function:    _OWPAppendDataIndex
+ *
+ * Description:
+ *      Write idx (from _OWPBuildDataIndex) to fp at fend, replacing
+ *      anything that follows the session data (an old index).
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+OWPBoolean
+_OWPAppendDataIndex(
+        OWPContext      ctx,
+        FILE            *fp,
+        _OWPDataIndex   idx,
+        off_t           fend,
+        uint32_t        num_datarecs
+        )
+{
+    if((fflush(fp) != 0) || (ftruncate(fileno(fp),fend) != 0)){
+        OWPError(ctx,OWPErrFATAL,errno,"OWPWriteDataIndex: ftruncate(): %M");
+        return False;
+    }
+    if(fseeko(fp,fend,SEEK_SET)){
+        OWPError(ctx,OWPErrFATAL,errno,"fseeko(): %M");
+        return False;
+    }
+
+    return _OWPWriteDataIndexEntries(ctx,fp,idx,num_datarecs);
+}
+
+/*
+ * Function:    OWPWriteDataIndex
+ *
+ * Description:
+ *      Append a block index to the finished session file fp. Any index
+ *      already in the file is replaced.
+ *
+ *      The records have to be parsed once to build the index, so this
+ *      should be done once when the session is finished. (Writers that
+ *      see the records anyway, such as OWPDataWriter, build the index
+ *      as they go.)
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ *      fp is left at an undefined offset.
+ */
+OWPBoolean
+OWPWriteDataIndex(
+        OWPContext  ctx,
+        FILE        *fp
+        )
+{
+    _OWPDataIndex   idx;
+    off_t           fend;
+    uint32_t        num_datarecs;
+    OWPBoolean      rc;
+
+    if( !(idx = _OWPBuildDataIndex(ctx,fp,&fend,&num_datarecs))){
+        return False;
+    }
+    rc = _OWPAppendDataIndex(ctx,fp,idx,fend,num_datarecs);
+    _OWPDataIndexFree(idx);
+
+    return rc;
+}
+
+/*
+ * Function:    ReadIndexEntries
+ *
+ * Description:
+ *      Validate the trailer of the index in fp and read the entries.
+ *      *entries_ret is allocated and must be freed by the caller.
+ *      oset_hist_ret is the offset of the histograms (0 for version 1
+ *      indexes, which don't have them).
+ *
+ * Returns:
+ *      False if there is no valid index (or it could not be read).
+ */
+static OWPBoolean
+ReadIndexEntries(
+        OWPContext          ctx,
+        FILE                *fp,
+        uint32_t            num_datarecs,
+        _OWPDataIndexEntry  *entries_ret,
+        uint32_t            *nentries_ret,
+        off_t               *oset_hist_ret
+        )
+{
+    struct stat             sbuf;
+    uint8_t                 buf[_OWP_DATAINDEX_NREAD *
+                                _OWP_DATAINDEX_ENTRY_SIZE];
+    uint8_t                 *p;
+    uint32_t                n32;
+    uint64_t                n64;
+    off_t                   oset_index,oset_hist;
+    uint32_t                version,esize;
+    uint32_t                nentries,n,i,j;
+    uint64_t                nbuckets = 0;
+    _OWPDataIndexEntry      entries = NULL;
+    _OWPDataIndexEntry      e;
+
+    *entries_ret = NULL;
+    *nentries_ret = 0;
+    *oset_hist_ret = 0;
+
+    if(fstat(fileno(fp),&sbuf) != 0){
+        OWPError(ctx,OWPErrFATAL,errno,"fstat(): %M");
+        return False;
+    }
+    if(sbuf.st_size < (off_t)_OWP_DATAINDEX_TRAILER_SIZE){
+        return False;
+    }
+
+    /*
+     * Read and validate the trailer.
+     */
+    if(fseeko(fp,sbuf.st_size - _OWP_DATAINDEX_TRAILER_SIZE,SEEK_SET)){
+        OWPError(ctx,OWPErrFATAL,errno,"fseeko(): %M");
+        return False;
+    }
+    if(fread(buf,1,_OWP_DATAINDEX_TRAILER_SIZE,fp) !=
+            _OWP_DATAINDEX_TRAILER_SIZE){
+        OWPError(ctx,OWPErrFATAL,errno,"fread(): %M");
+        return False;
+    }
+    if(memcmp(&buf[20],owp_index_magic,4) != 0){
+        return False;
+    }
+    memcpy(&n64,&buf[0],8);
+    oset_index = (off_t)ntohll(n64);
+    memcpy(&n32,&buf[8],4);
+    nentries = ntohl(n32);
+    memcpy(&n32,&buf[12],4);
+    if(ntohl(n32) != num_datarecs){
+        return False;
+    }
+    memcpy(&n32,&buf[16],4);
+    switch((version = ntohl(n32))){
+        case 1:
+            esize = _OWP_DATAINDEX_V1_SIZE;
+            break;
+        case 2:
+            esize = _OWP_DATAINDEX_ENTRY_SIZE;
+            break;
+        default:
+            return False;
+    }
+    oset_hist = oset_index + (off_t)nentries * esize;
+    if((oset_index < 0) || (nentries > num_datarecs) ||
+            (oset_hist + _OWP_DATAINDEX_TRAILER_SIZE > sbuf.st_size)){
+        return False;
+    }
+
+    if(nentries && !(entries = calloc(nentries,sizeof(*entries)))){
+        OWPError(ctx,OWPErrFATAL,errno,"calloc(): %M");
+        return False;
+    }
+
+    if(fseeko(fp,oset_index,SEEK_SET)){
+        OWPError(ctx,OWPErrFATAL,errno,"fseeko(): %M");
+        goto error;
+    }
+    for(i=0;i<nentries;i+=n){
+        n = MIN(_OWP_DATAINDEX_NREAD,nentries - i);
+        if(fread(buf,esize,n,fp) != n){
+            OWPError(ctx,OWPErrFATAL,errno,"fread(): %M");
+            goto error;
+        }
+        for(j=0,p=buf;j<n;j++,p+=esize){
+            e = &entries[i+j];
+            memcpy(&n64,&p[0],8);
+            e->oset = (off_t)ntohll(n64);
+            memcpy(&n32,&p[8],4);
+            e->recidx = ntohl(n32);
+            memcpy(&n32,&p[12],4);
+            e->nrecs = ntohl(n32);
+            memcpy(&n32,&p[16],4);
+            e->seq_min = ntohl(n32);
+            memcpy(&n32,&p[20],4);
+            e->seq_max = ntohl(n32);
+            memcpy(&n64,&p[24],8);
+            e->send_min = ntohll(n64);
+            memcpy(&n64,&p[32],8);
+            e->send_max = ntohll(n64);
+            if((e->recidx > num_datarecs) ||
+                    (e->nrecs > num_datarecs - e->recidx)){
+                goto invalid;
+            }
+            if(version < 2){
+                continue;
+            }
+            memcpy(&n32,&p[40],4);
+            e->lost = ntohl(n32);
+            memcpy(&n32,&p[44],4);
+            e->dups = ntohl(n32);
+            memcpy(&n64,&p[48],8);
+            e->delay_min = (int64_t)ntohll(n64);
+            memcpy(&n64,&p[56],8);
+            e->delay_max = (int64_t)ntohll(n64);
+            memcpy(&n32,&p[64],4);
+            e->nbuckets = ntohl(n32);
+            nbuckets += e->nbuckets;
+        }
+    }
+
+    /*
+     * The histograms must fill the space up to the trailer.
+     */
+    if(oset_hist + (off_t)nbuckets * 4 + _OWP_DATAINDEX_TRAILER_SIZE !=
+            sbuf.st_size){
+        goto invalid;
+    }
+
+    *entries_ret = entries;
+    *nentries_ret = nentries;
+    *oset_hist_ret = (version < 2)? 0: oset_hist;
+
+    return True;
+
+invalid:
+    OWPError(ctx,OWPErrWARNING,EFTYPE,"Ignoring invalid session index");
+error:
+    if(entries){
+        free(entries);
+    }
+
+    return False;
+}
+
+/*
+ * Function:    OWPReadDataIndex
+ *
+ * Description:
+ *      Use the block index of fp to find the records that can have a
+ *      seq_no (OWP_DATAINDEX_SEQ) or send time (OWP_DATAINDEX_SENDTIME)
+ *      within [lo,hi]. Parsing nrecs_ret records from oset_ret reports
+ *      every such record, along with others that have to be filtered
+ *      out by the caller. nrecs_ret is 0 if there are none.
+ *
+ *      num_datarecs is the number of records in the session (from the
+ *      header), the index is only used if it agrees.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ *      False if the file does not have a valid index (or it could not
+ *      be read). The caller should parse all the records in that case.
+ * Side Effect:
+ *      fp is left at an undefined offset.
+ */
+OWPBoolean
+OWPReadDataIndex(
+        OWPContext      ctx,
+        FILE            *fp,
+        uint32_t        num_datarecs,
+        OWPDataIndexKey key,
+        OWPNum64        lo,
+        OWPNum64        hi,
+        off_t           *oset_ret,
+        uint32_t        *nrecs_ret
+        )
+{
+    _OWPDataIndexEntry  entries;
+    _OWPDataIndexEntry  e;
+    uint32_t            nentries,i;
+    off_t               oset_hist;
+    OWPBoolean          found = False;
+    uint32_t            first = 0;
+    uint32_t            end = 0;
+
+    *oset_ret = 0;
+    *nrecs_ret = 0;
+
+    if( !ReadIndexEntries(ctx,fp,num_datarecs,&entries,&nentries,
+                &oset_hist)){
+        return False;
+    }
+
+    /*
+     * Find the first and last groups that intersect [lo,hi].
+     */
+    for(i=0;i<nentries;i++){
+        e = &entries[i];
+        if(!e->nrecs){
+            continue;
+        }
+        if(key == OWP_DATAINDEX_SEQ){
+            if((e->seq_max < lo) || (e->seq_min > hi)){
+                continue;
+            }
+        }
+        else if((e->send_max < lo) || (e->send_min > hi)){
+            continue;
+        }
+
+        if(!found){
+            *oset_ret = e->oset;
+            first = e->recidx;
+            found = True;
+        }
+        end = e->recidx + e->nrecs;
+    }
+
+    if(entries){
+        free(entries);
+    }
+
+    if(found){
+        if(end < first){
+            *oset_ret = 0;
+            return False;
+        }
+        *nrecs_ret = end - first;
+    }
+
+    return True;
+}
+
+/*
+ * Function:    SummaryMerge
+ *
+ * Description:
+ *      Add the summary of one group (entry and its histogram pairs in
+ *      network (file) or host byte order) to sum.
+ */
+static void
+SummaryMerge(
+        OWPDataSummary      sum,
+        _OWPDataIndexEntry  e,
+        uint16_t            *pairs,
+        OWPBoolean          net
+        )
+{
+    uint16_t    b,c;
+    uint32_t    i;
+
+    if(!e->nrecs){
+        return;
+    }
+
+    if(e->nrecs > e->lost){
+        if(sum->nrecs == sum->lost){
+            sum->min_delay = DelayToDouble(e->delay_min);
+            sum->max_delay = DelayToDouble(e->delay_max);
+        }
+        else{
+            sum->min_delay = MIN(sum->min_delay,DelayToDouble(e->delay_min));
+            sum->max_delay = MAX(sum->max_delay,DelayToDouble(e->delay_max));
+        }
+    }
+    sum->nrecs += e->nrecs;
+    sum->lost += e->lost;
+    sum->dups += e->dups;
+
+    for(i=0;i<e->nbuckets;i++){
+        b = pairs[2*i];
+        c = pairs[2*i+1];
+        if(net){
+            b = ntohs(b);
+            c = ntohs(c);
+        }
+        if(b < OWP_DATASUM_NBUCKETS){
+            sum->hist[b] += c;
+        }
+    }
+
+    return;
+}
+
+/*
+ * State for parsing the records of one group (or, without an index,
+ * the whole file) into a summary.
+ */
+typedef struct _OWPDataSummaryParseRec{
+    _OWPDataIndex   idx;
+    OWPDataSummary  sum;
+    OWPNum64        begin;
+    OWPNum64        end;
+    uint32_t        n;
+} _OWPDataSummaryParseRec;
+
+static OWPBoolean
+SummaryFlush(
+        _OWPDataSummaryParseRec *sp
+        )
+{
+    if( !_OWPDataIndexEnd(sp->idx,0,0)){
+        return False;
+    }
+    if(sp->idx->nentries){
+        SummaryMerge(sp->sum,&sp->idx->entries[0],sp->idx->hist,False);
+    }
+    sp->idx->nentries = 0;
+    sp->idx->nhist = 0;
+
+    return True;
+}
+
+static int
+SummaryRecord(
+        OWPDataRec  *rec,
+        void        *udata
+        )
+{
+    _OWPDataSummaryParseRec *sp = (_OWPDataSummaryParseRec *)udata;
+
+    if((rec->send.owptime >= sp->begin) && (rec->send.owptime < sp->end)){
+        _OWPDataIndexAdd(sp->idx,rec);
+    }
+
+    /*
+     * Without an index, group the records the same way the index
+     * would so duplicates are counted the same way.
+     */
+    if(++sp->n >= _OWP_DATAINDEX_RECS){
+        sp->n = 0;
+        if( !SummaryFlush(sp)){
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Function:    OWPReadDataSummary
+ *
+ * Description:
+ *      Summarize the records of the session in fp (hdr from
+ *      OWPReadDataHeader) with a send time in [begin,end).
+ *
+ *      If the file has a summary index, the summaries of the groups
+ *      that are entirely inside the range are merged and only the
+ *      groups that straddle begin or end are parsed. Otherwise every
+ *      record is parsed.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ *      fp is left at an undefined offset.
+ */
+OWPBoolean
+OWPReadDataSummary(
+        OWPContext          ctx,
+        FILE                *fp,
+        OWPSessionHeader    hdr,
+        OWPNum64            begin,
+        OWPNum64            end,
+        OWPDataSummary      sum
+        )
+{
+    OWPBoolean              rc = False;
+    _OWPDataIndexEntry      entries = NULL;
+    _OWPDataIndexEntry      e;
+    uint32_t                nentries = 0;
+    off_t                   oset_hist = 0;
+    uint64_t                hoff = 0;
+    uint16_t                pairs[2*OWP_DATASUM_NBUCKETS];
+    _OWPDataSummaryParseRec sp;
+    uint32_t                i;
+
+    memset(sum,0,sizeof(*sum));
+    memset(&sp,0,sizeof(sp));
+    sp.sum = sum;
+    sp.begin = begin;
+    sp.end = end;
+
+    if(begin >= end){
+        return True;
+    }
+
+    if( !(sp.idx = _OWPDataIndexCreate(ctx))){
+        return False;
+    }
+
+    if((hdr->finished != OWP_SESSION_FINISHED_NORMAL) ||
+            !ReadIndexEntries(ctx,fp,hdr->num_datarecs,&entries,&nentries,
+                &oset_hist) || !oset_hist){
+        /*
+         * No summaries: parse everything.
+         */
+        if(fseeko(fp,hdr->oset_datarecs,SEEK_SET)){
+            OWPError(ctx,OWPErrFATAL,errno,"fseeko(): %M");
+            goto done;
+        }
+        if((OWPParseRecords(ctx,fp,hdr->num_datarecs,hdr->version,
+                        SummaryRecord,&sp) != OWPErrOK) ||
+                !SummaryFlush(&sp)){
+            goto done;
+        }
+        rc = True;
+        goto done;
+    }
+
+    for(i=0;i<nentries;i++,hoff += e->nbuckets){
+        e = &entries[i];
+
+        if(!e->nrecs || (e->send_max < begin) || (e->send_min >= end)){
+            continue;
+        }
+
+        /*
+         * Group entirely inside the range: use its summary.
+         */
+        if((e->send_min >= begin) && (e->send_max < end)){
+            if(e->nbuckets > OWP_DATASUM_NBUCKETS){
+                OWPError(ctx,OWPErrFATAL,EFTYPE,
+                        "OWPReadDataSummary: Invalid session index");
+                goto done;
+            }
+            if(e->nbuckets){
+                if(fseeko(fp,oset_hist + (off_t)hoff * 4,SEEK_SET)){
+                    OWPError(ctx,OWPErrFATAL,errno,"fseeko(): %M");
+                    goto done;
+                }
+                if(fread(pairs,4,e->nbuckets,fp) != e->nbuckets){
+                    OWPError(ctx,OWPErrFATAL,errno,"fread(): %M");
+                    goto done;
+                }
+            }
+            SummaryMerge(sum,e,pairs,True);
+            continue;
+        }
+
+        /*
+         * Edge of the range: parse the group.
+         */
+        if(fseeko(fp,e->oset,SEEK_SET)){
+            OWPError(ctx,OWPErrFATAL,errno,"fseeko(): %M");
+            goto done;
+        }
+        sp.n = 0;
+        if((OWPParseRecords(ctx,fp,e->nrecs,hdr->version,SummaryRecord,
+                        &sp) != OWPErrOK) || !SummaryFlush(&sp)){
+            goto done;
+        }
+    }
+
+    rc = True;
+
+done:
+    if(entries){
+        free(entries);
+    }
+    _OWPDataIndexFree(sp.idx);
+
+    return rc;
+}
+
+/*
+ * Function:    OWPDataSummaryQuantile
+ *
+ * Description:
+ *      Estimate the alpha quantile (0.0 - 1.0) of delay from the
+ *      histogram in sum. The upper bound of the bucket is returned,
+ *      limited to [min_delay,max_delay]. Returns NaN if no records
+ *      were received.
+ */
+double
+OWPDataSummaryQuantile(
+        OWPDataSummary  sum,
+        double          alpha
+        )
+{
+    uint64_t    total = 0;
+    uint64_t    cum = 0;
+    uint32_t    b;
+    double      d;
+
+    for(b=0;b<OWP_DATASUM_NBUCKETS;b++){
+        total += sum->hist[b];
+    }
+    if(!total){
+        return NAN;
+    }
+
+    for(b=0;b<OWP_DATASUM_NBUCKETS-1;b++){
+        cum += sum->hist[b];
+        if((double)cum >= alpha * total){
+            break;
+        }
+    }
+
+    if(b == 0){
+        d = ldexp(1.0,_OWP_DATASUM_MINEXP);
+    }
+    else if(b == OWP_DATASUM_NBUCKETS-1){
+        d = sum->max_delay;
+    }
+    else{
+        d = ldexp(1.0 + (double)((b-1) % _OWP_DATASUM_SUB + 1) /
+                _OWP_DATASUM_SUB,
+                _OWP_DATASUM_MINEXP + (int)((b-1) / _OWP_DATASUM_SUB));
+    }
+
+    d = MIN(d,sum->max_delay);
+    d = MAX(d,sum->min_delay);
+
+    return d;
+}
@@ -1993,6 +1993,51 @@ flush_lost(
     return 0;
 }
 
+/*
+ * Function:    write_safepoint
+ *
+ * Description:    
+ *          Flush the datafile and record the first seq number that
+ *          may still get records (ep->begin) in the next_seqno field
+ *          of the header. Every record before it is in the file, so
+ *          FetchSession can return them while the test is running.
+ *          Nothing is written if ep->begin has not moved since the
+ *          last safe point (*safeseq), so an idle or completely lost
+ *          stream does not rewrite the header every interval.
+ *
+ * In Args:    
+ *
+ * Out Args:    
+ *          safeseq is updated to the next_seqno written.
+ *
+ * Scope:    
+ * Returns:    
+ * Side Effect:    
+ *          datafile is positioned at the end of the file.
+ */
+static OWPBoolean
+write_safepoint(
+        OWPEndpoint ep,
+        uint32_t    *safeseq
+        )
+{
+    if(ep->begin->seq == *safeseq){
+        return True;
+    }
+
+    if((fflush(ep->datafile) != 0) ||
+            !_OWPWriteDataHeaderFinished(ep->cntrl->ctx,ep->datafile,
+                OWP_SESSION_FINISHED_INCOMPLETE,ep->begin->seq) ||
+            (fseeko(ep->datafile,0,SEEK_END) != 0)){
+        OWPError(ep->cntrl->ctx,OWPErrFATAL,OWPErrUNKNOWN,
+                "write_safepoint: Unable to update datafile: %M");
+        return False;
+    }
+    *safeseq = ep->begin->seq;
+
+    return True;
+}
+
 static void
 run_receiver(
         OWPEndpoint ep
@@ -2021,6 +2066,8 @@ run_receiver(
     struct sockaddr     *rsaddr;
     socklen_t           rsaddrlen;
     int                 rc;
+    time_t              safetime = 0;
+    uint32_t            safeseq = 0;
 
     /*
      * Prepare the file header - had to wait until now to
@@ -2266,6 +2313,18 @@ again:
             goto test_over;
         }
 
+        /*
+         * Every _OWP_SAFEPOINT_INTERVAL seconds, let fetch clients see
+         * the records the running test has completed since the last
+         * safe point.
+         */
+        if(currtime.tv_sec >= safetime){
+            if( !write_safepoint(ep,&safeseq)){
+                goto error;
+            }
+            safetime = currtime.tv_sec + _OWP_SAFEPOINT_INTERVAL;
+        }
+
         /*
          * Check signals...
          */
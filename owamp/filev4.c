@@ -0,0 +1,1242 @@
+/*
+ *      $Id$
+ */
+/************************************************************************
+ *                                                                      *
+ *                             Copyright (C)  2026                      *
+ *                                Internet2                             *
+ *                             All Rights Reserved                      *
+ *                                                                      *
+ ************************************************************************/
+/*
+ *        File:         filev4.c
+ *
+ *        Description:
+ *              Compact (version 4) session data files.
+ *
+ *              The header of a version 4 file is identical to the
+ *              version 3 header (see api.c). The data records are
+ *              stored in independently decodable blocks of columns
+ *              instead of fixed-size records:
+ *
+ *              block header (5 network ordered uint32_t):
+ *                  nrecs       logical records in the block
+ *                  flags       _OWP_V4_BLK_SCHED: send times predicted
+ *                              from the test schedule
+ *                  seq_len     octets in the seq column
+ *                  time_len    octets in the time column
+ *                  meta_len    octets in the meta column
+ *
+ *              seq column, one varint "tag" per entry:
+ *                  tag = (zigzag(seq - expect) << 2) | (lost << 1) | run
+ *                  expect is 0 at the start of the block and the last
+ *                  seq of the previous entry + 1 afterwards. If run is
+ *                  set, a varint (count - 1) follows and the entry
+ *                  stands for count consecutive lost records whose send
+ *                  times are exactly the scheduled send times.
+ *
+ *              time column, for each entry that is not a run:
+ *                  varint zigzag(send - predicted send)
+ *                  varint zigzag(delay - previous delay), received only
+ *                  The predicted send time is the scheduled send time
+ *                  for seq, or the previous send time in the block if
+ *                  the schedule can not be used.
+ *
+ *              meta column, run length encoded:
+ *                  varint count, send/recv error estimates (4 octets), ttl
+ *
+ *              Records are encoded from, and decoded into, the version 3
+ *              record format so conversion between the two versions is
+ *              lossless.
+ */
+#include "owampP.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define _OWP_V4_BLK_HDR_SIZE    (20)
+#define _OWP_V4_BLK_RECS        (1024)
+#define _OWP_V4_BLK_SCHED       (0x1)
+#define _OWP_V4_SEQ_MAX         (8)     /* per entry: tag + run count   */
+#define _OWP_V4_TIME_MAX        (20)    /* per record: 2 varint64       */
+#define _OWP_V4_META_MAX        (7)     /* per record: count + 5 octets */
+#define _OWP_V4_BLK_MAXPAYLOAD  (_OWP_V4_BLK_RECS * \
+        (_OWP_V4_SEQ_MAX + _OWP_V4_TIME_MAX + _OWP_V4_META_MAX))
+#define _OWP_V4_META_SIZE       (5)
+#define _OWP_V4_SCHED_RING      (4096)
+
+/*
+ * Scheduled send times for recent sequence numbers. Records are mostly
+ * in order so the schedule only needs to be regenerated from the
+ * beginning when a seq falls outside the ring.
+ */
+typedef struct _OWPSchedCacheRec{
+    OWPScheduleContext  sctx;
+    OWPSlot             *slots;
+    OWPNum64            start;
+    uint32_t            npackets;
+    uint64_t            n;      /* number of scheduled times generated */
+    OWPNum64            cur;    /* scheduled send time of seq n-1      */
+    OWPNum64            ring[_OWP_V4_SCHED_RING];
+} _OWPSchedCacheRec, *_OWPSchedCache;
+
+struct OWPDataWriterRec{
+    OWPContext          ctx;
+    FILE                *fp;
+    off_t               oset_datarecs;
+    uint32_t            num_datarecs;
+    OWPBoolean          err;
+
+    _OWPSchedCacheRec   sched;
+
+    /* block index */
+    off_t               oset_block;
+    _OWPDataIndex       index;
+
+    /* current block */
+    uint32_t            nrecs;
+    uint32_t            expect;
+    OWPNum64            prev_send;
+    OWPNum64            prev_delay;
+    uint32_t            run_seq;
+    uint32_t            run_len;
+    uint32_t            meta_run;
+    uint8_t             meta[_OWP_V4_META_SIZE];
+    size_t              seq_len;
+    size_t              time_len;
+    size_t              meta_len;
+    uint8_t             seqbuf[_OWP_V4_BLK_RECS * _OWP_V4_SEQ_MAX];
+    uint8_t             timebuf[_OWP_V4_BLK_RECS * _OWP_V4_TIME_MAX];
+    uint8_t             metabuf[_OWP_V4_BLK_RECS * _OWP_V4_META_MAX];
+};
+
+static size_t
+PutVarint(
+        uint8_t     *buf,
+        uint64_t    val
+        )
+{
+    size_t  n = 0;
+
+    while(val >= 0x80){
+        buf[n++] = (uint8_t)(val | 0x80);
+        val >>= 7;
+    }
+    buf[n++] = (uint8_t)val;
+
+    return n;
+}
+
+static OWPBoolean
+GetVarint(
+        const uint8_t   **pp,
+        const uint8_t   *end,
+        uint64_t        *val
+        )
+{
+    const uint8_t   *p = *pp;
+    uint64_t        v = 0;
+    unsigned int    shift;
+
+    for(shift=0;shift<64;shift+=7){
+        if(p >= end){
+            return False;
+        }
+        v |= (uint64_t)(*p & 0x7F) << shift;
+        if(!(*p++ & 0x80)){
+            *pp = p;
+            *val = v;
+            return True;
+        }
+    }
+
+    return False;
+}
+
+static uint64_t
+ZigZag(
+        int64_t v
+        )
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t
+UnZigZag(
+        uint64_t    v
+        )
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 0x1);
+}
+
+static uint64_t
+Get64(
+        const uint8_t   *buf
+        )
+{
+    uint64_t    v = 0;
+    int         i;
+
+    for(i=0;i<8;i++){
+        v = (v << 8) | buf[i];
+    }
+
+    return v;
+}
+
+static void
+Put64(
+        uint8_t     *buf,
+        uint64_t    v
+        )
+{
+    int i;
+
+    for(i=7;i>=0;i--){
+        buf[i] = v & 0xFF;
+        v >>= 8;
+    }
+
+    return;
+}
+
+/*
+ * Function:    SchedInit
+ *
+ * Description:
+ *      Initialize the schedule cache for the session described by hdr.
+ *      The slots are copied so hdr does not need to remain valid. If the
+ *      schedule can not be used (no slots) sched->sctx is left NULL
+ *      and predictions fall back to the previous send time.
+ *
+ * Returns:
+ *      False on memory allocation failure.
+ */
+static OWPBoolean
+SchedInit(
+        OWPContext          ctx,
+        _OWPSchedCache      sched,
+        OWPSessionHeader    hdr
+        )
+{
+    OWPTestSpec tspec;
+
+    memset(sched,0,sizeof(*sched));
+
+    if(!hdr->header || !hdr->test_spec.nslots || !hdr->test_spec.slots ||
+            !hdr->test_spec.npackets){
+        return True;
+    }
+
+    if( !(sched->slots = calloc(hdr->test_spec.nslots,sizeof(OWPSlot)))){
+        OWPError(ctx,OWPErrFATAL,errno,"calloc(%" PRIu32 ",OWPSlot): %M",
+                hdr->test_spec.nslots);
+        return False;
+    }
+    memcpy(sched->slots,hdr->test_spec.slots,
+            hdr->test_spec.nslots * sizeof(OWPSlot));
+
+    tspec = hdr->test_spec;
+    tspec.slots = sched->slots;
+
+    /*
+     * An invalid schedule just disables prediction. (The file was
+     * written with the same result.)
+     */
+    if( !(sched->sctx = OWPScheduleContextCreate(ctx,hdr->sid,&tspec))){
+        free(sched->slots);
+        sched->slots = NULL;
+        return True;
+    }
+
+    sched->start = hdr->test_spec.start_time;
+    sched->npackets = hdr->test_spec.npackets;
+    sched->n = 0;
+    sched->cur = sched->start;
+
+    return True;
+}
+
+static void
+SchedFree(
+        _OWPSchedCache  sched
+        )
+{
+    if(sched->sctx){
+        OWPScheduleContextFree(sched->sctx);
+        sched->sctx = NULL;
+    }
+    if(sched->slots){
+        free(sched->slots);
+        sched->slots = NULL;
+    }
+
+    return;
+}
+
+/*
+ * Function:    SchedTime
+ *
+ * Description:
+ *      Return the scheduled send time for seq in *tstamp. This is the
+ *      same value the receiver uses as the send time of a lost packet.
+ *
+ * Returns:
+ *      False if there is no scheduled send time for seq.
+ */
+static OWPBoolean
+SchedTime(
+        _OWPSchedCache  sched,
+        uint32_t        seq,
+        OWPNum64        *tstamp
+        )
+{
+    if(!sched->sctx || (seq >= sched->npackets)){
+        return False;
+    }
+
+    if((uint64_t)seq + _OWP_V4_SCHED_RING < sched->n){
+        OWPScheduleContextReset(sched->sctx,NULL,NULL);
+        sched->n = 0;
+        sched->cur = sched->start;
+    }
+
+    while(sched->n <= seq){
+        sched->cur = OWPNum64Add(sched->cur,
+                OWPScheduleContextGenerateNextDelta(sched->sctx));
+        sched->ring[sched->n % _OWP_V4_SCHED_RING] = sched->cur;
+        sched->n++;
+    }
+
+    *tstamp = sched->ring[seq % _OWP_V4_SCHED_RING];
+
+    return True;
+}
+
+static void
+WriterBlockReset(
+        OWPDataWriter   w
+        )
+{
+    w->nrecs = 0;
+    w->expect = 0;
+    w->prev_send = 0;
+    w->prev_delay = 0;
+    w->run_len = 0;
+    w->meta_run = 0;
+    w->seq_len = w->time_len = w->meta_len = 0;
+
+    return;
+}
+
+static void
+WriterRunFlush(
+        OWPDataWriter   w
+        )
+{
+    int64_t     dseq;
+
+    if(!w->run_len){
+        return;
+    }
+
+    dseq = (int64_t)w->run_seq - (int64_t)w->expect;
+    w->seq_len += PutVarint(&w->seqbuf[w->seq_len],(ZigZag(dseq) << 2) | 0x3);
+    w->seq_len += PutVarint(&w->seqbuf[w->seq_len],w->run_len - 1);
+    w->expect = w->run_seq + w->run_len;
+    w->run_len = 0;
+
+    return;
+}
+
+static void
+WriterMetaFlush(
+        OWPDataWriter   w
+        )
+{
+    if(!w->meta_run){
+        return;
+    }
+
+    w->meta_len += PutVarint(&w->metabuf[w->meta_len],w->meta_run);
+    memcpy(&w->metabuf[w->meta_len],w->meta,_OWP_V4_META_SIZE);
+    w->meta_len += _OWP_V4_META_SIZE;
+    w->meta_run = 0;
+
+    return;
+}
+
+/*
+ * Function:    WriterBlockFlush
+ *
+ * Description:
+ *      Write the current block (if any) to the file and reset the
+ *      block state.
+ */
+static OWPBoolean
+WriterBlockFlush(
+        OWPDataWriter   w
+        )
+{
+    uint32_t    bhdr[_OWP_V4_BLK_HDR_SIZE/sizeof(uint32_t)];
+
+    if(!w->nrecs){
+        return True;
+    }
+
+    WriterRunFlush(w);
+    WriterMetaFlush(w);
+
+    bhdr[0] = htonl(w->nrecs);
+    bhdr[1] = htonl((w->sched.sctx)? _OWP_V4_BLK_SCHED: 0);
+    bhdr[2] = htonl((uint32_t)w->seq_len);
+    bhdr[3] = htonl((uint32_t)w->time_len);
+    bhdr[4] = htonl((uint32_t)w->meta_len);
+
+    if((fwrite(bhdr,1,_OWP_V4_BLK_HDR_SIZE,w->fp) != _OWP_V4_BLK_HDR_SIZE) ||
+            (fwrite(w->seqbuf,1,w->seq_len,w->fp) != w->seq_len) ||
+            (fwrite(w->timebuf,1,w->time_len,w->fp) != w->time_len) ||
+            (fwrite(w->metabuf,1,w->meta_len,w->fp) != w->meta_len)){
+        OWPError(w->ctx,OWPErrFATAL,errno,"OWPDataWriter: fwrite(): %M");
+        w->err = True;
+        return False;
+    }
+
+    if( !_OWPDataIndexEnd(w->index,w->oset_block,w->num_datarecs)){
+        w->err = True;
+        return False;
+    }
+    w->oset_block += _OWP_V4_BLK_HDR_SIZE +
+        (off_t)w->seq_len + w->time_len + w->meta_len;
+
+    w->num_datarecs += w->nrecs;
+    WriterBlockReset(w);
+
+    return True;
+}
+
+/*
+ * Function:    OWPDataWriterCreate
+ *
+ * Description:
+ *      Write a version 4 file header for the session described by hdr
+ *      to fp, and return a writer for the data records. fp must be
+ *      positioned at the beginning of the file and be seekable.
+ *
+ *      The header is marked incomplete until OWPDataWriterClose is
+ *      called. The slots in hdr->test_spec are used to predict send
+ *      times and are copied.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ *      NULL on failure.
+ * Side Effect:
+ */
+OWPDataWriter
+OWPDataWriterCreate(
+        OWPContext          ctx,
+        FILE                *fp,
+        OWPSessionHeader    hdr
+        )
+{
+    OWPDataWriter       w;
+    OWPSessionHeaderRec hrec;
+
+    if(!hdr || !hdr->header){
+        OWPError(ctx,OWPErrFATAL,OWPErrINVALID,
+                "OWPDataWriterCreate: No hdr data specified");
+        return NULL;
+    }
+
+    if( !(w = calloc(1,sizeof(*w)))){
+        OWPError(ctx,OWPErrFATAL,errno,"calloc(1,OWPDataWriterRec): %M");
+        return NULL;
+    }
+    w->ctx = ctx;
+    w->fp = fp;
+
+    if( !(w->index = _OWPDataIndexCreate(ctx))){
+        free(w);
+        return NULL;
+    }
+
+    if( !SchedInit(ctx,&w->sched,hdr)){
+        _OWPDataIndexFree(w->index);
+        free(w);
+        return NULL;
+    }
+
+    /*
+     * Data records follow the header, skips are added by Close.
+     */
+    hrec = *hdr;
+    hrec.finished = OWP_SESSION_FINISHED_INCOMPLETE;
+    hrec.num_skiprecs = 0;
+    hrec.num_datarecs = 0;
+    if( !_OWPWriteDataHeaderVersion(ctx,fp,&hrec,4) ||
+            ((w->oset_datarecs = ftello(fp)) < 0)){
+        OWPError(ctx,OWPErrFATAL,errno,
+                "OWPDataWriterCreate: Unable to write header: %M");
+        SchedFree(&w->sched);
+        _OWPDataIndexFree(w->index);
+        free(w);
+        return NULL;
+    }
+    w->oset_block = w->oset_datarecs;
+
+    WriterBlockReset(w);
+
+    return w;
+}
+
+/*
+ * Function:    OWPDataWriterRecord
+ *
+ * Description:
+ *      Add rec to the current block, writing the block out when full.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+OWPBoolean
+OWPDataWriterRecord(
+        OWPDataWriter   w,
+        OWPDataRec      *rec
+        )
+{
+    char        buf[_OWP_DATAREC_SIZE];
+    OWPNum64    send,recv,pred,delay;
+    OWPBoolean  lost;
+    OWPBoolean  scheduled;
+
+    if(w->err){
+        return False;
+    }
+
+    if(!_OWPEncodeDataRecord(buf,rec)){
+        OWPError(w->ctx,OWPErrFATAL,OWPErrUNKNOWN,
+                "OWPDataWriterRecord: Unable to encode data record");
+        return False;
+    }
+
+    send = Get64((uint8_t *)&buf[8]);
+    recv = Get64((uint8_t *)&buf[16]);
+    lost = (recv == 0);
+
+    if( !(scheduled = SchedTime(&w->sched,rec->seq_no,&pred))){
+        pred = w->prev_send;
+    }
+
+    /*
+     * Lost packets sent exactly on schedule are collapsed into runs.
+     */
+    if(lost && scheduled && (send == pred)){
+        if(w->run_len && (rec->seq_no == w->run_seq + w->run_len) &&
+                (rec->seq_no != 0xFFFFFFFF)){
+            w->run_len++;
+        }
+        else{
+            WriterRunFlush(w);
+            w->run_seq = rec->seq_no;
+            w->run_len = 1;
+        }
+    }
+    else{
+        WriterRunFlush(w);
+
+        w->seq_len += PutVarint(&w->seqbuf[w->seq_len],
+                (ZigZag((int64_t)rec->seq_no - (int64_t)w->expect) << 2) |
+                ((lost)? 0x2: 0x0));
+        w->expect = rec->seq_no + 1;
+
+        w->time_len += PutVarint(&w->timebuf[w->time_len],
+                ZigZag((int64_t)(send - pred)));
+        if(!lost){
+            delay = recv - send;
+            w->time_len += PutVarint(&w->timebuf[w->time_len],
+                    ZigZag((int64_t)(delay - w->prev_delay)));
+            w->prev_delay = delay;
+        }
+    }
+    w->prev_send = send;
+
+    /*
+     * error estimates and ttl
+     */
+    if(w->meta_run && memcmp(w->meta,&buf[4],4) == 0 &&
+            (w->meta[4] == (uint8_t)buf[24])){
+        w->meta_run++;
+    }
+    else{
+        WriterMetaFlush(w);
+        memcpy(w->meta,&buf[4],4);
+        w->meta[4] = buf[24];
+        w->meta_run = 1;
+    }
+
+    _OWPDataIndexAdd(w->index,rec);
+
+    if(++w->nrecs >= _OWP_V4_BLK_RECS){
+        return WriterBlockFlush(w);
+    }
+
+    return True;
+}
+
+/*
+ * Function:    OWPDataWriterParse
+ *
+ * Description:
+ *      OWPDoDataRecord function that adds each record to the
+ *      OWPDataWriter passed as udata. This allows records to be copied
+ *      from any file version with OWPParseRecords.
+ */
+int
+OWPDataWriterParse(
+        OWPDataRec  *rec,
+        void        *udata
+        )
+{
+    return (OWPDataWriterRecord((OWPDataWriter)udata,rec))? 0: -1;
+}
+
+/*
+ * Function:    OWPDataWriterClose
+ *
+ * Description:
+ *      Write out the last block and the skip records (and the block
+ *      index if the session finished normally), then fill in the
+ *      finished, next_seqno, num_skiprecs, num_datarecs and
+ *      oset_skiprecs header fields. The writer is freed in all cases.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ *      fp is left at an undefined offset.
+ */
+OWPBoolean
+OWPDataWriterClose(
+        OWPDataWriter           w,
+        OWPSessionFinishedType  finished,
+        uint32_t                next_seqno,
+        uint32_t                num_skiprecs,
+        OWPSkip                 skips
+        )
+{
+    OWPBoolean  rc = False;
+    off_t       oset_skiprecs;
+    uint8_t     sbuf[_OWP_SKIPREC_SIZE];
+    uint32_t    n32[2];
+    uint64_t    n64;
+    uint32_t    i;
+
+    if(!w){
+        return False;
+    }
+
+    if(w->err || !WriterBlockFlush(w)){
+        goto done;
+    }
+
+    if((oset_skiprecs = ftello(w->fp)) < 0){
+        OWPError(w->ctx,OWPErrFATAL,errno,"OWPDataWriterClose: ftello(): %M");
+        goto done;
+    }
+
+    for(i=0;i<num_skiprecs;i++){
+        _OWPEncodeSkipRecord(sbuf,&skips[i]);
+        if(fwrite(sbuf,1,_OWP_SKIPREC_SIZE,w->fp) != _OWP_SKIPREC_SIZE){
+            OWPError(w->ctx,OWPErrFATAL,errno,
+                    "OWPDataWriterClose: fwrite(): %M");
+            goto done;
+        }
+    }
+
+    /*
+     * The block index goes last. It is optional, so a session is not
+     * failed for it.
+     */
+    if(finished == OWP_SESSION_FINISHED_NORMAL){
+        (void)_OWPWriteDataIndexEntries(w->ctx,w->fp,w->index,
+                w->num_datarecs);
+    }
+
+    if(finished > OWP_SESSION_FINISHED_INCOMPLETE){
+        finished = OWP_SESSION_FINISHED_INCOMPLETE;
+    }
+    if( !_OWPWriteDataHeaderFinished(w->ctx,w->fp,finished,next_seqno)){
+        goto done;
+    }
+
+    /*
+     * num_skiprecs, num_datarecs, oset_skiprecs are contiguous after
+     * next_seqno.
+     */
+    n32[0] = htonl(num_skiprecs);
+    n32[1] = htonl(w->num_datarecs);
+    n64 = htonll((uint64_t)oset_skiprecs);
+    if((fwrite(n32,1,sizeof(n32),w->fp) != sizeof(n32)) ||
+            (fwrite(&n64,1,sizeof(n64),w->fp) != sizeof(n64)) ||
+            (fflush(w->fp) != 0)){
+        OWPError(w->ctx,OWPErrFATAL,errno,"OWPDataWriterClose: fwrite(): %M");
+        goto done;
+    }
+
+    rc = True;
+
+done:
+    SchedFree(&w->sched);
+    _OWPDataIndexFree(w->index);
+    free(w);
+
+    return rc;
+}
+
+/*
+ * Function:    ReadBlockHeader
+ *
+ * Description:
+ *      Read and validate a block header at the current fp offset.
+ *
+ * Returns:
+ *      -1 on error, 0 on EOF (or a short read), 1 otherwise.
+ */
+static int
+ReadBlockHeader(
+        OWPContext  ctx,
+        FILE        *fp,
+        uint32_t    *nrecs,
+        uint32_t    *flags,
+        uint32_t    lens[3]
+        )
+{
+    uint32_t    bhdr[_OWP_V4_BLK_HDR_SIZE/sizeof(uint32_t)];
+    uint64_t    payload;
+
+    if(fread(bhdr,1,_OWP_V4_BLK_HDR_SIZE,fp) != _OWP_V4_BLK_HDR_SIZE){
+        if(ferror(fp)){
+            OWPError(ctx,OWPErrFATAL,errno,"fread(): %M");
+            return -1;
+        }
+        return 0;
+    }
+
+    *nrecs = ntohl(bhdr[0]);
+    *flags = ntohl(bhdr[1]);
+    lens[0] = ntohl(bhdr[2]);
+    lens[1] = ntohl(bhdr[3]);
+    lens[2] = ntohl(bhdr[4]);
+    payload = (uint64_t)lens[0] + lens[1] + lens[2];
+
+    if(!*nrecs || (*nrecs > _OWP_V4_BLK_RECS) ||
+            (payload > _OWP_V4_BLK_MAXPAYLOAD)){
+        OWPError(ctx,OWPErrFATAL,EFTYPE,
+                "OWPParseRecords: Invalid version 4 data block");
+        errno = EFTYPE;
+        return -1;
+    }
+
+    return 1;
+}
+
+/*
+ * Function:    _OWPReadBlockSizeV4
+ *
+ * Description:
+ *      Read the header of the block at oset and return the number of
+ *      records and octets (blen) in the block.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ *      -1 on error, 0 if there is not a complete block between oset and
+ *      fend, 1 otherwise.
+ * Side Effect:
+ *      fp is left at an undefined offset.
+ */
+int
+_OWPReadBlockSizeV4(
+        OWPContext  ctx,
+        FILE        *fp,
+        off_t       oset,
+        off_t       fend,
+        uint32_t    *nrecs,
+        off_t       *blen
+        )
+{
+    uint32_t    flags;
+    uint32_t    lens[3];
+    int         rc;
+
+    if(oset + _OWP_V4_BLK_HDR_SIZE > fend){
+        return 0;
+    }
+    if(fseeko(fp,oset,SEEK_SET)){
+        OWPError(ctx,OWPErrFATAL,errno,"fseeko(): %M");
+        return -1;
+    }
+    if((rc = ReadBlockHeader(ctx,fp,nrecs,&flags,lens)) <= 0){
+        return rc;
+    }
+    *blen = _OWP_V4_BLK_HDR_SIZE + (off_t)lens[0] + lens[1] + lens[2];
+    if(oset + *blen > fend){
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Function:    _OWPCountRecordsV4
+ *
+ * Description:
+ *      Count the data records in the complete blocks starting at oset.
+ *      This is used for files that were not closed by the writer.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ *      fp is left at an undefined offset.
+ */
+OWPBoolean
+_OWPCountRecordsV4(
+        OWPContext  ctx,
+        FILE        *fp,
+        off_t       oset,
+        off_t       fsize,
+        uint32_t    *num_datarecs
+        )
+{
+    uint32_t    nrecs;
+    off_t       blen;
+    int         rc;
+
+    *num_datarecs = 0;
+
+    while((rc = _OWPReadBlockSizeV4(ctx,fp,oset,fsize,&nrecs,&blen)) > 0){
+        *num_datarecs += nrecs;
+        oset += blen;
+    }
+
+    return (rc < 0)? False: True;
+}
+
+/*
+ * Function:    _OWPParseRecordsV4
+ *
+ * Description:
+ *      Version 4 implementation of OWPParseRecords. fp must be positioned
+ *      at the beginning of a block (oset_datarecs). If num_rec ends in
+ *      the middle of a block, the rest of that block is not reported and
+ *      fp is left at the beginning of the next block.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+OWPErrSeverity
+_OWPParseRecordsV4(
+        OWPContext      ctx,
+        FILE            *fp,
+        uint32_t        num_rec,
+        OWPDoDataRecord proc_rec,
+        void            *app_data
+        )
+{
+    OWPErrSeverity      err = OWPErrFATAL;
+    OWPSessionHeaderRec hdr;
+    _OWPSchedCacheRec   *sched = NULL;
+    off_t               oset;
+    uint8_t             *payload = NULL;
+    uint32_t            nrecs,flags,lens[3];
+    const uint8_t       *sp,*seqend,*tp,*tend,*mp,*mend;
+    uint32_t            i,j,k;
+    uint32_t            count;
+    uint32_t            meta_run;
+    const uint8_t       *meta = NULL;
+    uint32_t            expect;
+    OWPNum64            prev_send,prev_delay,pred,stime,delay;
+    uint64_t            v;
+    int64_t             seq;
+    uint32_t            n32;
+    OWPBoolean          run,lost,scheduled;
+    char                rbuf[_OWP_DATAREC_SIZE];
+    OWPDataRec          rec;
+    int                 rc;
+
+    if(!num_rec){
+        return OWPErrOK;
+    }
+
+    /*
+     * The schedule is needed to reconstruct send times. Read it from
+     * the header, then return to the current block.
+     */
+    if(((oset = ftello(fp)) < 0)){
+        OWPError(ctx,OWPErrFATAL,errno,"ftello(): %M");
+        return OWPErrFATAL;
+    }
+    memset(&hdr,0,sizeof(hdr));
+    if(!OWPReadDataHeader(ctx,fp,&hdr) && !hdr.header){
+        return OWPErrFATAL;
+    }
+    if(hdr.test_spec.nslots){
+        if( !(hdr.test_spec.slots =
+                    calloc(hdr.test_spec.nslots,sizeof(OWPSlot)))){
+            OWPError(ctx,OWPErrFATAL,errno,"calloc(%" PRIu32 ",OWPSlot): %M",
+                    hdr.test_spec.nslots);
+            return OWPErrFATAL;
+        }
+        if( !OWPReadDataHeaderSlots(ctx,fp,hdr.test_spec.nslots,
+                    hdr.test_spec.slots)){
+            goto done;
+        }
+    }
+    if( !(sched = malloc(sizeof(*sched))) ||
+            !(payload = malloc(_OWP_V4_BLK_MAXPAYLOAD))){
+        OWPError(ctx,OWPErrFATAL,errno,"malloc(): %M");
+        goto done;
+    }
+    if( !SchedInit(ctx,sched,&hdr)){
+        free(sched);
+        sched = NULL;
+        goto done;
+    }
+    if(fseeko(fp,oset,SEEK_SET)){
+        OWPError(ctx,OWPErrFATAL,errno,"fseeko(): %M");
+        goto done;
+    }
+
+    i = 0;
+    while(i < num_rec){
+        if((rc = ReadBlockHeader(ctx,fp,&nrecs,&flags,lens)) <= 0){
+            if(!rc){
+                OWPError(ctx,OWPErrFATAL,errno,
+                        "fread(): EOF: offset=%" PRIu64,ftello(fp));
+            }
+            goto done;
+        }
+        if((flags & _OWP_V4_BLK_SCHED) && !sched->sctx){
+            OWPError(ctx,OWPErrFATAL,EFTYPE,
+                    "OWPParseRecords: Session schedule unavailable");
+            goto done;
+        }
+        if(fread(payload,1,lens[0]+lens[1]+lens[2],fp) !=
+                lens[0]+lens[1]+lens[2]){
+            OWPError(ctx,OWPErrFATAL,errno,
+                    "fread(): offset=%" PRIu64 ": %M",ftello(fp));
+            goto done;
+        }
+        sp = payload;
+        seqend = tp = sp + lens[0];
+        tend = mp = tp + lens[1];
+        mend = mp + lens[2];
+
+        expect = 0;
+        prev_send = prev_delay = 0;
+        meta_run = 0;
+        j = 0;
+        while(j < nrecs){
+            if( !GetVarint(&sp,seqend,&v)){
+                goto invalid;
+            }
+            seq = (int64_t)expect + UnZigZag(v >> 2);
+            lost = (v & 0x2)? True: False;
+            count = 1;
+            if((run = (v & 0x1)? True: False)){
+                if(!lost || !GetVarint(&sp,seqend,&v) || (v >= nrecs)){
+                    goto invalid;
+                }
+                count += (uint32_t)v;
+            }
+            if((seq < 0) || (seq + count - 1 > 0xFFFFFFFF) ||
+                    (j + count > nrecs)){
+                goto invalid;
+            }
+            expect = (uint32_t)(seq + count);
+
+            for(k=0;k<count;k++,j++,seq++){
+                if((flags & _OWP_V4_BLK_SCHED) &&
+                        SchedTime(sched,(uint32_t)seq,&pred)){
+                    scheduled = True;
+                }
+                else{
+                    scheduled = False;
+                    pred = prev_send;
+                }
+
+                /*
+                 * send time
+                 */
+                if(run){
+                    if(!scheduled){
+                        goto invalid;
+                    }
+                    stime = pred;
+                }
+                else{
+                    if( !GetVarint(&tp,tend,&v)){
+                        goto invalid;
+                    }
+                    stime = pred + (OWPNum64)UnZigZag(v);
+                }
+                prev_send = stime;
+
+                memset(rbuf,0,sizeof(rbuf));
+                n32 = htonl((uint32_t)seq);
+                memcpy(&rbuf[0],&n32,4);
+                Put64((uint8_t *)&rbuf[8],stime);
+
+                /*
+                 * recv time
+                 */
+                if(!lost){
+                    if( !GetVarint(&tp,tend,&v)){
+                        goto invalid;
+                    }
+                    delay = prev_delay + (OWPNum64)UnZigZag(v);
+                    prev_delay = delay;
+                    Put64((uint8_t *)&rbuf[16],stime + delay);
+                }
+
+                /*
+                 * error estimates and ttl
+                 */
+                if(!meta_run){
+                    if( !GetVarint(&mp,mend,&v) || !v || (v > nrecs) ||
+                            (mend - mp < _OWP_V4_META_SIZE)){
+                        goto invalid;
+                    }
+                    meta_run = (uint32_t)v;
+                    meta = mp;
+                    mp += _OWP_V4_META_SIZE;
+                }
+                memcpy(&rbuf[4],meta,4);
+                rbuf[24] = meta[4];
+                meta_run--;
+
+                if(!_OWPDecodeDataRecord(3,&rec,rbuf)){
+                    errno = EFTYPE;
+                    OWPError(ctx,OWPErrFATAL,errno,
+                            "OWPParseRecords: Invalid Data Record: %M");
+                    goto done;
+                }
+                rc = proc_rec(&rec,app_data);
+                if(rc < 0){
+                    goto done;
+                }
+                if(rc || (++i >= num_rec)){
+                    err = OWPErrOK;
+                    goto done;
+                }
+            }
+        }
+
+        if((sp != seqend) || (tp != tend) || (mp != mend)){
+            goto invalid;
+        }
+    }
+
+    err = OWPErrOK;
+    goto done;
+
+invalid:
+    OWPError(ctx,OWPErrFATAL,EFTYPE,
+            "OWPParseRecords: Invalid version 4 data block");
+    errno = EFTYPE;
+done:
+    if(sched){
+        SchedFree(sched);
+        free(sched);
+    }
+    if(payload){
+        free(payload);
+    }
+    if(hdr.test_spec.slots){
+        free(hdr.test_spec.slots);
+    }
+
+    return err;
+}
+
+typedef struct _OWPConvertV3Rec{
+    OWPContext  ctx;
+    FILE        *fp;
+} _OWPConvertV3Rec;
+
+static int
+ConvertV3Record(
+        OWPDataRec  *rec,
+        void        *udata
+        )
+{
+    _OWPConvertV3Rec    *cv = udata;
+
+    return (OWPWriteDataRecord(cv->ctx,cv->fp,rec))? 0: -1;
+}
+
+/*
+ * Function:    OWPConvertDataFile
+ *
+ * Description:
+ *      Copy the session in infp to outfp as a version 3 or version 4
+ *      file. infp can be any file version that has a session header
+ *      (2 and above). outfp should be an empty file opened for reading
+ *      and writing. (The block index of a version 3 file is built from
+ *      the records written to outfp.)
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+OWPBoolean
+OWPConvertDataFile(
+        OWPContext  ctx,
+        FILE        *infp,
+        FILE        *outfp,
+        uint32_t    version
+        )
+{
+    OWPBoolean          rc = False;
+    OWPSessionHeaderRec hdr;
+    OWPSkip             skips = NULL;
+    OWPDataWriter       w;
+    _OWPConvertV3Rec    cv;
+    uint8_t             sbuf[_OWP_SKIPREC_SIZE];
+    uint32_t            i;
+
+    if((version != 3) && (version != 4)){
+        OWPError(ctx,OWPErrFATAL,EINVAL,
+                "OWPConvertDataFile: Invalid file version (%" PRIu32 ")",
+                version);
+        return False;
+    }
+
+    memset(&hdr,0,sizeof(hdr));
+    if(!OWPReadDataHeader(ctx,infp,&hdr) && !hdr.header){
+        return False;
+    }
+    if(!hdr.header){
+        OWPError(ctx,OWPErrFATAL,EINVAL,
+                "OWPConvertDataFile: Version %" PRIu32
+                " file has no session header",hdr.version);
+        return False;
+    }
+
+    if(hdr.test_spec.nslots){
+        if( !(hdr.test_spec.slots =
+                    calloc(hdr.test_spec.nslots,sizeof(OWPSlot)))){
+            OWPError(ctx,OWPErrFATAL,errno,"calloc(%" PRIu32 ",OWPSlot): %M",
+                    hdr.test_spec.nslots);
+            return False;
+        }
+        if( !OWPReadDataHeaderSlots(ctx,infp,hdr.test_spec.nslots,
+                    hdr.test_spec.slots)){
+            goto done;
+        }
+    }
+
+    if(hdr.num_skiprecs){
+        if( !(skips = calloc(hdr.num_skiprecs,sizeof(OWPSkipRec)))){
+            OWPError(ctx,OWPErrFATAL,errno,
+                    "calloc(%" PRIu32 ",OWPSkipRec): %M",hdr.num_skiprecs);
+            goto done;
+        }
+        if( !OWPReadDataSkips(ctx,infp,hdr.num_skiprecs,skips)){
+            goto done;
+        }
+    }
+
+    if(fseeko(infp,hdr.oset_datarecs,SEEK_SET)){
+        OWPError(ctx,OWPErrFATAL,errno,"fseeko(): %M");
+        goto done;
+    }
+
+    if(version == 4){
+        if( !(w = OWPDataWriterCreate(ctx,outfp,&hdr))){
+            goto done;
+        }
+        if(OWPParseRecords(ctx,infp,hdr.num_datarecs,hdr.version,
+                    OWPDataWriterParse,w) != OWPErrOK){
+            (void)OWPDataWriterClose(w,OWP_SESSION_FINISHED_ERROR,
+                    hdr.next_seqno,0,NULL);
+            goto done;
+        }
+        rc = OWPDataWriterClose(w,hdr.finished,hdr.next_seqno,
+                hdr.num_skiprecs,skips);
+        goto done;
+    }
+
+    /*
+     * Version 3: the counts are known, so skips go first.
+     */
+    hdr.rec_size = _OWP_DATAREC_SIZE;
+    if( !OWPWriteDataHeader(ctx,outfp,&hdr)){
+        OWPError(ctx,OWPErrFATAL,errno,
+                "OWPConvertDataFile: Unable to write header: %M");
+        goto done;
+    }
+    for(i=0;i<hdr.num_skiprecs;i++){
+        _OWPEncodeSkipRecord(sbuf,&skips[i]);
+        if(fwrite(sbuf,1,_OWP_SKIPREC_SIZE,outfp) != _OWP_SKIPREC_SIZE){
+            OWPError(ctx,OWPErrFATAL,errno,
+                    "OWPConvertDataFile: fwrite(): %M");
+            goto done;
+        }
+    }
+    cv.ctx = ctx;
+    cv.fp = outfp;
+    if(OWPParseRecords(ctx,infp,hdr.num_datarecs,hdr.version,
+                ConvertV3Record,&cv) != OWPErrOK){
+        goto done;
+    }
+    if(fflush(outfp) != 0){
+        OWPError(ctx,OWPErrFATAL,errno,"OWPConvertDataFile: fflush(): %M");
+        goto done;
+    }
+    if(hdr.finished == OWP_SESSION_FINISHED_NORMAL){
+        (void)OWPWriteDataIndex(ctx,outfp);
+    }
+
+    rc = True;
+
+done:
+    if(skips){
+        free(skips);
+    }
+    if(hdr.test_spec.slots){
+        free(hdr.test_spec.slots);
+    }
+
+    return rc;
+}
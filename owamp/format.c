@@ -0,0 +1,824 @@
+/*
+ *      $Id$
+ */
+/************************************************************************
+ *                                                                      *
+ *                             Copyright (C)  2026                      *
+ *                                Internet2                             *
+ *                             All Rights Reserved                      *
+ *                                                                      *
+ ************************************************************************/
+/*
+ *        File:         format.c
+ *
+ *        Description:
+ *              Buffered formatter for individual packet records. This
+ *              is used to print the per-packet (owping -v/-R) outputs.
+ *
+ *              Records are formatted into a large buffer that is written
+ *              to the output FILE in one piece instead of calling fprintf
+ *              for each record. The floating-point fields are formatted
+ *              directly from the OWPNum64 fixed-point values using integer
+ *              arithmetic. The double values printed by the original
+ *              fprintf formats are exact functions of those integers, so
+ *              the output is byte-identical. Whenever a value can not be
+ *              proven exact in 64 bits, snprintf is used for that field
+ *              instead.
+ */
+#include "owampP.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#define _OWP_RECFMT_BUFSIZE     (64*1024)
+#define _OWP_RECFMT_MAXLINE     (256)
+#define _OWP_RECFMT_EXP2POW32   0x100000000ULL
+#define _OWP_RECFMT_MAXEXACT    0x20000000000000ULL     /* 2^53 */
+
+struct OWPRecFormatterRec{
+    OWPContext  ctx;
+    FILE        *output;
+    OWPRecFmt   fmt;
+    float       scale_factor;
+    uint64_t    iscale;         /* scale_factor as an integer */
+    char        scale_abrv[3];
+    OWPBoolean  header;         /* CSV header printed */
+    size_t      len;
+    char        buf[_OWP_RECFMT_BUFSIZE];
+};
+
+static const uint64_t pow10tab[20] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL,
+    10000000000000000000ULL
+};
+
+/*
+ * Function:        OWPRecFormatterCreate
+ *
+ * Description:
+ *              Create a formatter that prints records to output using
+ *              the given format. scale is one of the units understood
+ *              by OWPStatsScaleFactor. (It is not used for the
+ *              OWPRecFmtRaw format.)
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+OWPRecFormatter
+OWPRecFormatterCreate(
+        OWPContext  ctx,
+        FILE        *output,
+        OWPRecFmt   fmt,
+        char        scale
+        )
+{
+    OWPRecFormatter formatter;
+    size_t          s;
+
+    if(!output){
+        OWPError(ctx,OWPErrFATAL,EINVAL,
+                "OWPRecFormatterCreate: Invalid output FILE");
+        return NULL;
+    }
+
+    if( !(formatter = calloc(1,sizeof(*formatter)))){
+        OWPError(ctx,OWPErrFATAL,ENOMEM,"calloc(1,%lu): %M",
+                (unsigned long)sizeof(*formatter));
+        return NULL;
+    }
+
+    formatter->ctx = ctx;
+    formatter->output = output;
+    formatter->fmt = fmt;
+
+    s = sizeof(formatter->scale_abrv);
+    formatter->scale_factor = OWPStatsScaleFactor(scale,
+            formatter->scale_abrv,&s);
+    if(formatter->scale_factor == 0.0){
+        OWPError(ctx,OWPErrFATAL,EINVAL,
+                "OWPRecFormatterCreate: Invalid scale \'%c\'",scale);
+        free(formatter);
+        return NULL;
+    }
+    formatter->iscale = (uint64_t)formatter->scale_factor;
+
+    return formatter;
+}
+
+/*
+ * Function:        OWPRecFormatterFlush
+ *
+ * Description:
+ *              Write any buffered records to the output FILE.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+OWPBoolean
+OWPRecFormatterFlush(
+        OWPRecFormatter formatter
+        )
+{
+    size_t  len;
+
+    if(!formatter || !formatter->len)
+        return True;
+
+    len = formatter->len;
+    formatter->len = 0;
+    if(fwrite(formatter->buf,1,len,formatter->output) != len){
+        OWPError(formatter->ctx,OWPErrFATAL,errno,
+                "OWPRecFormatterFlush: fwrite(): %M");
+        return False;
+    }
+
+    return True;
+}
+
+/*
+ * Function:        OWPRecFormatterFree
+ *
+ * Description:
+ *              Flush and free the formatter. The output FILE is not
+ *              closed.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+OWPBoolean
+OWPRecFormatterFree(
+        OWPRecFormatter formatter
+        )
+{
+    OWPBoolean  rc;
+
+    if(!formatter)
+        return True;
+
+    rc = OWPRecFormatterFlush(formatter);
+    free(formatter);
+
+    return rc;
+}
+
+static char *
+FmtString(
+        char        *p,
+        const char  *str
+        )
+{
+    while(*str)
+        *p++ = *str++;
+
+    return p;
+}
+
+static char *
+FmtUInt(
+        char        *p,
+        uint64_t    val
+        )
+{
+    char    tbuf[20];
+    int     i = 0;
+
+    do{
+        tbuf[i++] = '0' + (char)(val % 10);
+        val /= 10;
+    }while(val);
+
+    while(i > 0)
+        *p++ = tbuf[--i];
+
+    return p;
+}
+
+/*
+ * Left justify the field that begins at start (%-Nu).
+ */
+static char *
+FmtPad(
+        char    *p,
+        char    *start,
+        int     width
+        )
+{
+    while((p - start) < width)
+        *p++ = ' ';
+
+    return p;
+}
+
+static char *
+FmtTStamp(
+        char        *p,
+        OWPNum64    tstamp
+        )
+{
+    char    tbuf[20];
+    int     i;
+
+    /* OWP_TSTAMPFMT */
+    for(i=19;i>=0;i--){
+        tbuf[i] = '0' + (char)(tstamp % 10);
+        tstamp /= 10;
+    }
+    memcpy(p,tbuf,sizeof(tbuf));
+
+    return p + sizeof(tbuf);
+}
+
+/*
+ * Round a fixed-point value to the 53 significant bits it keeps when
+ * converted to a double (round-half-even). (double)val == *ret / 2^32.
+ */
+static OWPBoolean
+FmtRound53(
+        uint64_t    val,
+        uint64_t    *ret
+        )
+{
+    uint64_t    tmp,unit,low;
+    int         shift = 0;
+
+    for(tmp = val >> 53;tmp;tmp >>= 1){
+        shift++;
+    }
+
+    if(!shift){
+        *ret = val;
+        return True;
+    }
+
+    unit = 1ULL << shift;
+    low = val & (unit - 1);
+    val -= low;
+    if((low > (unit >> 1)) || ((low == (unit >> 1)) && (val & unit))){
+        if(val > (UINT64_MAX - unit))
+            return False;
+        val += unit;
+    }
+    *ret = val;
+
+    return True;
+}
+
+/*
+ * Format mag/2^32 (negated if neg) with prec significant digits. If
+ * gstyle, the output matches "%.*g", otherwise "%.*e" with prec-1
+ * digits after the decimal point.
+ */
+static OWPBoolean
+FmtSig(
+        char        **pp,
+        uint64_t    mag,
+        OWPBoolean  neg,
+        int         prec,
+        OWPBoolean  gstyle
+        )
+{
+    char        digits[20];
+    char        *p = *pp;
+    uint64_t    q=0,r=0,num,den;
+    int         x=0,k,i,n,tries;
+
+    if(mag){
+        x = (int)floor(log10((double)mag / _OWP_RECFMT_EXP2POW32));
+        for(tries=0;;tries++){
+            if(tries > 2)
+                return False;
+
+            k = prec - 1 - x;
+            if(k >= 0){
+                if((k > 19) || (mag > (UINT64_MAX / pow10tab[k])))
+                    return False;
+                num = mag * pow10tab[k];
+                den = _OWP_RECFMT_EXP2POW32;
+            }
+            else{
+                if((-k > 19) || (pow10tab[-k] > (UINT64_MAX >> 32)))
+                    return False;
+                num = mag;
+                den = pow10tab[-k] << 32;
+            }
+            q = num / den;
+            r = num % den;
+
+            if(q < pow10tab[prec-1]){
+                x--;
+            }
+            else if(q >= pow10tab[prec]){
+                x++;
+            }
+            else{
+                break;
+            }
+        }
+
+        /* round-half-even */
+        if((r > (den - r)) || ((r == (den - r)) && (q & 1))){
+            q++;
+        }
+        if(q == pow10tab[prec]){
+            q /= 10;
+            x++;
+        }
+    }
+
+    for(i=prec-1;i>=0;i--){
+        digits[i] = '0' + (char)(q % 10);
+        q /= 10;
+    }
+
+    if(neg){
+        *p++ = '-';
+    }
+
+    n = prec;
+    if(!gstyle || (x < -4) || (x >= prec)){
+        if(gstyle){
+            while((n > 1) && (digits[n-1] == '0'))
+                n--;
+        }
+        *p++ = digits[0];
+        if(n > 1){
+            *p++ = '.';
+            memcpy(p,&digits[1],n-1);
+            p += n-1;
+        }
+        *p++ = 'e';
+        if(x < 0){
+            *p++ = '-';
+            x = -x;
+        }
+        else{
+            *p++ = '+';
+        }
+        if(x < 10){
+            *p++ = '0';
+        }
+        p = FmtUInt(p,x);
+    }
+    else if(x >= 0){
+        while((n > x+1) && (digits[n-1] == '0'))
+            n--;
+        memcpy(p,digits,x+1);
+        p += x+1;
+        if(n > x+1){
+            *p++ = '.';
+            memcpy(p,&digits[x+1],n-x-1);
+            p += n-x-1;
+        }
+    }
+    else{
+        while((n > 1) && (digits[n-1] == '0'))
+            n--;
+        *p++ = '0';
+        *p++ = '.';
+        for(i=0;i < (-x-1);i++){
+            *p++ = '0';
+        }
+        memcpy(p,digits,n);
+        p += n;
+    }
+
+    *pp = p;
+    return True;
+}
+
+/*
+ * Format a double with snprintf - used when the integer path can not
+ * reproduce it exactly.
+ */
+static char *
+FmtDouble(
+        char        *p,
+        const char  *fmt,
+        int         prec,
+        double      val
+        )
+{
+    int rc;
+
+    rc = snprintf(p,64,fmt,prec,val);
+    if(rc < 0)
+        return p;
+
+    return p + MIN(rc,63);
+}
+
+/*
+ * Delay (scaled) as it is computed by OWPDelay()*scale_factor, as a
+ * fixed-point magnitude and sign.
+ */
+static OWPBoolean
+FmtDelayVal(
+        OWPRecFormatter formatter,
+        OWPDataRec      *rec,
+        uint64_t        *mag,
+        OWPBoolean      *neg
+        )
+{
+    uint64_t    s,r,d;
+
+    if(!FmtRound53(rec->send.owptime,&s) ||
+            !FmtRound53(rec->recv.owptime,&r)){
+        return False;
+    }
+
+    /*
+     * The double subtraction is exact if the difference of the rounded
+     * values is itself a double.
+     */
+    if(r >= s){
+        *neg = False;
+        d = r - s;
+    }
+    else{
+        *neg = True;
+        d = s - r;
+    }
+    if(!FmtRound53(d,&s) || (s != d)){
+        return False;
+    }
+
+    /*
+     * Multiplying by the scale is exact while the product fits in 53 bits.
+     */
+    if(d >= (_OWP_RECFMT_MAXEXACT / formatter->iscale)){
+        return False;
+    }
+    *mag = d * formatter->iscale;
+
+    return True;
+}
+
+static uint64_t
+FmtErrNum64(
+        OWPTimeStamp    *tstamp
+        )
+{
+    /* see OWPGetTimeStampError */
+    return (uint64_t)(tstamp->multiplier & 0xFF) << (tstamp->scale & 0x3F);
+}
+
+/*
+ * Total send+recv error estimate multiplied by scale (when iscale is
+ * non-zero), as a fixed-point value.
+ */
+static OWPBoolean
+FmtErrVal(
+        OWPTimeStamp    *send,
+        OWPTimeStamp    *recv,
+        uint64_t        iscale,
+        uint64_t        *mag
+        )
+{
+    uint64_t    s,r=0,e;
+
+    if(!FmtRound53(FmtErrNum64(send),&s) ||
+            (recv && !FmtRound53(FmtErrNum64(recv),&r))){
+        return False;
+    }
+
+    if(s > (UINT64_MAX - r))
+        return False;
+    e = s + r;
+    if(!FmtRound53(e,&s) || (s != e))
+        return False;
+
+    if(e >= (_OWP_RECFMT_MAXEXACT / iscale))
+        return False;
+    *mag = e * iscale;
+
+    return True;
+}
+
+/*
+ * Unix timestamp as printed by "%f" of
+ * OWPNum64ToDouble(tstamp) - (double)OWPJAN_1970.
+ */
+static char *
+FmtUnixTS(
+        char        *p,
+        OWPNum64    tstamp
+        )
+{
+    uint64_t    t,epoch,frac;
+    int         i;
+
+    epoch = (uint64_t)OWPJAN_1970 << 32;
+    if(FmtRound53(tstamp,&t) && (t >= epoch) && ((t - epoch) <= epoch)){
+        /* Sterbenz - the subtraction is exact */
+        t -= epoch;
+        frac = (t & 0xFFFFFFFFULL) * 1000000;
+        t >>= 32;
+        if(((frac & 0xFFFFFFFFULL) > 0x80000000ULL) ||
+                (((frac & 0xFFFFFFFFULL) == 0x80000000ULL) &&
+                 ((frac >> 32) & 1))){
+            frac += _OWP_RECFMT_EXP2POW32;
+        }
+        frac >>= 32;
+        if(frac >= 1000000){
+            frac -= 1000000;
+            t++;
+        }
+        p = FmtUInt(p,t);
+        *p++ = '.';
+        for(i=5;i>=0;i--){
+            p[i] = '0' + (char)(frac % 10);
+            frac /= 10;
+        }
+        return p + 6;
+    }
+
+    return FmtDouble(p,"%.*f",6,OWPNum64ToDouble(tstamp) -
+            (double)OWPJAN_1970);
+}
+
+static char *
+FmtDelay(
+        OWPRecFormatter formatter,
+        char            *p,
+        OWPDataRec      *rec,
+        int             prec,
+        OWPBoolean      gstyle
+        )
+{
+    uint64_t    mag;
+    OWPBoolean  neg;
+
+    if(FmtDelayVal(formatter,rec,&mag,&neg) &&
+            FmtSig(&p,mag,neg,prec,gstyle)){
+        return p;
+    }
+
+    return FmtDouble(p,(gstyle)?"%.*g":"%.*e",(gstyle)?prec:prec-1,
+            OWPDelay(&rec->send,&rec->recv) * formatter->scale_factor);
+}
+
+/*
+ * recv may be NULL to format the error estimate of a single timestamp.
+ */
+static char *
+FmtErr(
+        char            *p,
+        OWPTimeStamp    *send,
+        OWPTimeStamp    *recv,
+        uint64_t        iscale,
+        float           scale_factor,
+        int             prec
+        )
+{
+    uint64_t    mag;
+    double      derr;
+
+    if(FmtErrVal(send,recv,iscale,&mag) && FmtSig(&p,mag,False,prec,True)){
+        return p;
+    }
+
+    derr = OWPGetTimeStampError(send);
+    if(recv){
+        derr += OWPGetTimeStampError(recv);
+    }
+
+    return FmtDouble(p,"%.*g",prec,derr * scale_factor);
+}
+
+/*
+ * "seq_no=%-10u delay=%.3g %s\t(sync, err=%.3g %s)\n" and friends, as
+ * printed by OWPStatsParse for each record.
+ */
+static char *
+FmtRecText(
+        OWPRecFormatter formatter,
+        char            *p,
+        OWPDataRec      *rec
+        )
+{
+    char    *start;
+
+    p = FmtString(p,"seq_no=");
+
+    if(OWPIsLostRecord(rec)){
+        start = p;
+        p = FmtUInt(p,rec->seq_no);
+        p = FmtPad(p,start,10);
+        return FmtString(p," *LOST*\n");
+    }
+
+    if(rec->send.sync && rec->recv.sync &&
+            (formatter->fmt == OWPRecFmtUnixTS)){
+        /* seq_no is printed with %d */
+        if(rec->seq_no & 0x80000000UL){
+            *p++ = '-';
+            p = FmtUInt(p,0x100000000ULL - rec->seq_no);
+        }
+        else{
+            p = FmtUInt(p,rec->seq_no);
+        }
+        p = FmtString(p," delay=");
+        p = FmtDelay(formatter,p,rec,7,False);
+        *p++ = ' ';
+        p = FmtString(p,formatter->scale_abrv);
+        p = FmtString(p," (sync, err=");
+        p = FmtErr(p,&rec->send,&rec->recv,formatter->iscale,
+                formatter->scale_factor,3);
+        *p++ = ' ';
+        p = FmtString(p,formatter->scale_abrv);
+        p = FmtString(p,") sent=");
+        p = FmtUnixTS(p,rec->send.owptime);
+        p = FmtString(p," recv=");
+        p = FmtUnixTS(p,rec->recv.owptime);
+        *p++ = '\n';
+        return p;
+    }
+
+    start = p;
+    p = FmtUInt(p,rec->seq_no);
+    p = FmtPad(p,start,10);
+    p = FmtString(p," delay=");
+    p = FmtDelay(formatter,p,rec,3,True);
+    *p++ = ' ';
+    p = FmtString(p,formatter->scale_abrv);
+    if(rec->send.sync && rec->recv.sync){
+        p = FmtString(p,"\t(sync, err=");
+        p = FmtErr(p,&rec->send,&rec->recv,formatter->iscale,
+                formatter->scale_factor,3);
+        *p++ = ' ';
+        p = FmtString(p,formatter->scale_abrv);
+        p = FmtString(p,")\n");
+    }
+    else{
+        p = FmtString(p,"\t(unsync)\n");
+    }
+
+    return p;
+}
+
+/*
+ * RAW ascii format is:
+ * "SEQ STIME SS SERR RTIME RS RERR TTL\n"
+ * (see owping -R)
+ */
+static char *
+FmtRecRaw(
+        char            *p,
+        OWPDataRec      *rec
+        )
+{
+    p = FmtUInt(p,rec->seq_no);
+    *p++ = ' ';
+    p = FmtTStamp(p,rec->send.owptime);
+    *p++ = ' ';
+    p = FmtUInt(p,rec->send.sync);
+    *p++ = ' ';
+    p = FmtErr(p,&rec->send,NULL,1,1.0,6);
+    *p++ = ' ';
+    p = FmtTStamp(p,rec->recv.owptime);
+    *p++ = ' ';
+    p = FmtUInt(p,rec->recv.sync);
+    *p++ = ' ';
+    p = FmtErr(p,&rec->recv,NULL,1,1.0,6);
+    *p++ = ' ';
+    p = FmtUInt(p,rec->ttl);
+    *p++ = '\n';
+
+    return p;
+}
+
+/*
+ * CSV format is:
+ * "seq_no,sent,recv,delay,err,sync,ttl\n"
+ * sent/recv are unix timestamps, delay/err are in the formatter units.
+ * recv and delay are empty for lost packets.
+ */
+static char *
+FmtRecCSV(
+        OWPRecFormatter formatter,
+        char            *p,
+        OWPDataRec      *rec
+        )
+{
+    OWPBoolean  lost = OWPIsLostRecord(rec);
+
+    p = FmtUInt(p,rec->seq_no);
+    *p++ = ',';
+    p = FmtUnixTS(p,rec->send.owptime);
+    *p++ = ',';
+    if(!lost){
+        p = FmtUnixTS(p,rec->recv.owptime);
+    }
+    *p++ = ',';
+    if(!lost){
+        p = FmtDelay(formatter,p,rec,6,True);
+    }
+    *p++ = ',';
+    p = FmtErr(p,&rec->send,&rec->recv,formatter->iscale,
+            formatter->scale_factor,6);
+    *p++ = ',';
+    *p++ = (rec->send.sync && rec->recv.sync)? '1': '0';
+    *p++ = ',';
+    p = FmtUInt(p,rec->ttl);
+    *p++ = '\n';
+
+    return p;
+}
+
+/*
+ * Function:        OWPRecFormatterWrite
+ *
+ * Description:
+ *              Format a single record into the output buffer. The buffer
+ *              is written out when it fills, or by OWPRecFormatterFlush.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+OWPBoolean
+OWPRecFormatterWrite(
+        OWPRecFormatter formatter,
+        OWPDataRec      *rec
+        )
+{
+    char    *start,*p;
+
+    if((formatter->len > (_OWP_RECFMT_BUFSIZE - _OWP_RECFMT_MAXLINE)) &&
+            !OWPRecFormatterFlush(formatter)){
+        return False;
+    }
+
+    start = p = &formatter->buf[formatter->len];
+
+    switch(formatter->fmt){
+        case OWPRecFmtRaw:
+            p = FmtRecRaw(p,rec);
+            break;
+        case OWPRecFmtCSV:
+            if(!formatter->header){
+                p = FmtString(p,"seq_no,sent,recv,delay,err,sync,ttl\n");
+                formatter->header = True;
+            }
+            p = FmtRecCSV(formatter,p,rec);
+            break;
+        case OWPRecFmtUnixTS:
+        case OWPRecFmtDefault:
+        default:
+            p = FmtRecText(formatter,p,rec);
+            break;
+    }
+
+    formatter->len += (p - start);
+
+    return True;
+}
+
+/*
+ * Function:        OWPRecFormatterParse
+ *
+ * Description:
+ *              OWPDoDataRecord function that writes each record using
+ *              the OWPRecFormatter passed in as udata.
+ *              i.e. OWPParseRecords(ctx,fp,n,ver,OWPRecFormatterParse,fmtr)
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+int
+OWPRecFormatterParse(
+        OWPDataRec  *rec,
+        void        *udata
+        )
+{
+    return (OWPRecFormatterWrite((OWPRecFormatter)udata,rec))? 0: -1;
+}
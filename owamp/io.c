@@ -74,6 +74,72 @@ _OWPReceiveBlocksIntr(
     return num_blocks;
 }
 
+/*
+ * Function:    _OWPSendBlocksVIntr
+ *
+ * Description:
+ *      Gather version of _OWPSendBlocksIntr. Each iov_len must be a
+ *      multiple of _OWP_RIJNDAEL_BLOCK_SIZE. The buffers are encrypted
+ *      in place (in order, so the result on the wire is the same as
+ *      sending each buffer with _OWPSendBlocksIntr) and written with as
+ *      few writev calls as possible.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ *      number of blocks written, -1 on error
+ * Side Effect:
+ *      iov is modified.
+ */
+int
+_OWPSendBlocksVIntr(
+        OWPControl      cntrl,
+        struct iovec    *iov,
+        int             iovcnt,
+        int             *retn_on_intr
+        )
+{
+    ssize_t n;
+    size_t  len = 0;
+    int     i;
+
+    for(i=0;i<iovcnt;i++){
+        if(cntrl->mode & OWP_MODE_DOCIPHER){
+            _OWPEncryptBlocks(cntrl,iov[i].iov_base,
+                    iov[i].iov_len/_OWP_RIJNDAEL_BLOCK_SIZE,
+                    iov[i].iov_base);
+        }
+        len += iov[i].iov_len;
+    }
+
+    while(iovcnt > 0){
+        if((n = writev(cntrl->sockfd,iov,iovcnt)) < 0){
+            if((errno == EINTR) && !*retn_on_intr){
+                continue;
+            }
+            return -1;
+        }
+
+        /*
+         * Advance past whatever was written.
+         */
+        while((iovcnt > 0) && ((size_t)n >= iov->iov_len)){
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0){
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return len / _OWP_RIJNDAEL_BLOCK_SIZE;
+}
+
 int
 _OWPSendBlocks(
         OWPControl  cntrl,
@@ -699,6 +699,14 @@ typedef void (*OWPCloseFileFunc)(
  */
 #define OWPEndDelay "OWPEndDelay"
 
+/*
+ * Set the size of the window (in packets) used to compute reordering
+ * statistics. If unset, the window is sized to hold the number of
+ * packets that can be sent within the loss timeout.
+ * (uint32_t)
+ */
+#define OWPReorderWindow "OWPReorderWindow"
+
 /*
  * Use IPv4 addresses only.
  */
@@ -794,6 +802,13 @@ OWPControlConfigSetV(
         void        *value
         );
 
+extern OWPBoolean
+OWPControlConfigSetU32(
+        OWPControl  cntrl,
+        const char  *key,
+        uint32_t    u32
+        );
+
 extern OWPFunc
 OWPControlConfigGetF(
         OWPControl  cntrl,
@@ -806,6 +821,13 @@ OWPControlConfigGetV(
         const char  *key
         );
 
+extern OWPBoolean
+OWPControlConfigGetU32(
+        OWPControl  cntrl,
+        const char  *key,
+        uint32_t    *u32
+        );
+
 extern OWPBoolean
 OWPControlConfigDelete(
         OWPControl  cntrl,
@@ -1024,6 +1046,34 @@ OWPControlFD(
         OWPControl  control_handle
         );
 
+/*
+ * The part of a control connection that changes with every message: the
+ * protocol state, and the CBC chaining of an encrypted connection. A
+ * server that has a forked copy of itself complete one request on the
+ * connection takes the connection back with these once that copy is
+ * done. (Only valid between messages - the HMAC is restarted with each
+ * message, so it is not part of it.)
+ *
+ * Server.
+ */
+typedef struct OWPControlStateRec{
+    uint32_t    state;
+    uint8_t     readIV[16];
+    uint8_t     writeIV[16];
+} OWPControlStateRec;
+
+extern void
+OWPControlGetState(
+        OWPControl          control_handle,
+        OWPControlStateRec  *state
+        );
+
+extern void
+OWPControlSetState(
+        OWPControl          control_handle,
+        OWPControlStateRec  *state
+        );
+
 extern int
 OWPErrorFD(
         OWPContext  ctx
@@ -1187,6 +1237,22 @@ typedef enum{
     OWP_SESSION_FINISHED_INCOMPLETE=2   /* StopSessions did not happen  */
 } OWPSessionFinishedType;
 
+/*
+ * Incremental OWPFetchSession: appends the records fp does not have yet
+ * (fp must be empty or from earlier calls for the same sid). Can be
+ * called repeatedly while the session is running. Once finished_ret
+ * is OWP_SESSION_FINISHED_NORMAL fp holds the complete session.
+ */
+extern OWPBoolean
+OWPFetchSessionAppend(
+        OWPControl              cntrl,
+        FILE                    *fp,
+        OWPSID                  sid,
+        uint32_t                *nrecs_ret,
+        OWPSessionFinishedType  *finished_ret,
+        OWPErrSeverity          *err_ret
+        );
+
 /*
  * This data structure is used to read/write a session header. When
  * reading a header, if the "header" element returns false, the file
@@ -1381,6 +1447,184 @@ OWPReadDataSkips(
         OWPSkip             skips
         );
 
+/*
+ * OWPWriteDataSegment
+ *  Write the records of fromfp with seq_no in [first,last) to tofp as a
+ *  finished session. Packets outside the range are marked as skipped.
+ *  begin_oset is a hint where the records of the range start (0 if
+ *  unknown).
+ */
+extern OWPBoolean
+OWPWriteDataSegment(
+        OWPContext          ctx,
+        FILE                *fromfp,
+        FILE                *tofp,
+        off_t               begin_oset,
+        uint32_t            first,
+        uint32_t            last,
+        uint32_t            *nrecs_ret
+        );
+
+/*
+ * OWPFetchSessionStream
+ *  Fetch session data without writing it to a file. hdr_func gets the
+ *  session header (the slots are only valid during the call) and the
+ *  skip records, then rec_func gets the data records in batches. If
+ *  either returns False, the rest of the data is discarded.
+ */
+typedef OWPBoolean (*OWPFetchHeaderFunc)(
+        OWPSessionHeader    hdr,
+        OWPSkip             skips,
+        void                *udata
+        );
+
+typedef OWPBoolean (*OWPFetchRecordsFunc)(
+        OWPDataRec  *recs,
+        uint32_t    nrecs,
+        void        *udata
+        );
+
+extern uint32_t
+OWPFetchSessionStream(
+        OWPControl          cntrl,
+        uint32_t            begin,
+        uint32_t            end,
+        OWPSID              sid,
+        OWPFetchHeaderFunc  hdr_func,
+        OWPFetchRecordsFunc rec_func,
+        void                *udata,
+        OWPErrSeverity      *err_ret
+        );
+
+/*
+ * Compact (version 4) session files.
+ *
+ * Version 4 files store the data records in blocks of delta/varint
+ * encoded columns, with runs of lost packets collapsed into ranges.
+ * They are read with OWPReadDataHeader/OWPParseRecords like any other
+ * version, but can not be updated in place so they are written with an
+ * OWPDataWriter:
+ *
+ *  OWPDataWriterCreate writes the header (hdr must include the slots).
+ *  OWPDataWriterRecord adds records in file order. (OWPDataWriterParse
+ *      can be passed to OWPParseRecords with the writer as udata.)
+ *  OWPDataWriterClose writes the skip records, fills in the remaining
+ *      header fields and frees the writer.
+ *
+ * OWPConvertDataFile copies the session in infp to outfp as a version 3
+ * or 4 file. (Version 0 files have no session header and can not be
+ * converted.)
+ */
+typedef struct OWPDataWriterRec *OWPDataWriter;
+
+extern OWPDataWriter
+OWPDataWriterCreate(
+        OWPContext          ctx,
+        FILE                *fp,
+        OWPSessionHeader    hdr
+        );
+
+extern OWPBoolean
+OWPDataWriterRecord(
+        OWPDataWriter   writer,
+        OWPDataRec      *rec
+        );
+
+extern int
+OWPDataWriterParse(
+        OWPDataRec  *rec,
+        void        *udata
+        );
+
+extern OWPBoolean
+OWPDataWriterClose(
+        OWPDataWriter           writer,
+        OWPSessionFinishedType  finished,
+        uint32_t                next_seqno,
+        uint32_t                num_skiprecs,
+        OWPSkip                 skips
+        );
+
+extern OWPBoolean
+OWPConvertDataFile(
+        OWPContext  ctx,
+        FILE        *infp,
+        FILE        *outfp,
+        uint32_t    version
+        );
+
+/*
+ * Block index for finished (version 3 and 4) session files.
+ *
+ * OWPWriteDataIndex appends an index mapping groups of records to their
+ * seq_no and send time ranges. It is written when a session finishes
+ * normally (and by OWPDataWriterClose/OWPFetchSession).
+ *
+ * OWPReadDataIndex returns the span of records (oset_ret/nrecs_ret) that
+ * holds every record with a key within [lo,hi]. The records in the span
+ * still need to be filtered. It returns False if the file has no usable
+ * index, in which case all num_datarecs records should be parsed.
+ */
+typedef enum{
+    OWP_DATAINDEX_SEQ=0,            /* seq_no                           */
+    OWP_DATAINDEX_SENDTIME          /* send timestamp (OWPNum64)        */
+} OWPDataIndexKey;
+
+extern OWPBoolean
+OWPWriteDataIndex(
+        OWPContext  ctx,
+        FILE        *fp
+        );
+
+extern OWPBoolean
+OWPReadDataIndex(
+        OWPContext      ctx,
+        FILE            *fp,
+        uint32_t        num_datarecs,
+        OWPDataIndexKey key,
+        OWPNum64        lo,
+        OWPNum64        hi,
+        off_t           *oset_ret,
+        uint32_t        *nrecs_ret
+        );
+
+/*
+ * Summaries of the records in a send time range, merged from the
+ * per-group summaries in the index where possible (see
+ * OWPReadDataSummary). dups are only counted within groups of records.
+ *
+ * hist is a log-scale delay histogram with 16 buckets per power of two
+ * from 2^-24 to 2^12 seconds. The first bucket holds smaller (and
+ * negative) delays, the last holds larger ones.
+ * OWPDataSummaryQuantile estimates delay quantiles from it.
+ */
+#define OWP_DATASUM_NBUCKETS    (2 + (12 + 24) * 16)
+
+typedef struct OWPDataSummaryRec{
+    uint32_t    nrecs;
+    uint32_t    lost;
+    uint32_t    dups;
+    double      min_delay;
+    double      max_delay;
+    uint32_t    hist[OWP_DATASUM_NBUCKETS];
+} OWPDataSummaryRec, *OWPDataSummary;
+
+extern OWPBoolean
+OWPReadDataSummary(
+        OWPContext          ctx,
+        FILE                *fp,
+        OWPSessionHeader    hdr,
+        OWPNum64            begin,
+        OWPNum64            end,
+        OWPDataSummary      sum
+        );
+
+extern double
+OWPDataSummaryQuantile(
+        OWPDataSummary  sum,
+        double          alpha
+        );
+
 
 extern double
 OWPDelay(
@@ -1398,6 +1642,61 @@ OWPParsePortRange (
         char    *pspec,
         OWPPortRangeRec   *portspec
         );
+
+/*
+ * Buffered formatting of individual packet records.
+ *
+ * OWPRecFmtDefault:    "seq_no=%-10u delay=%.3g %s\t(sync, err=%.3g %s)\n"
+ * OWPRecFmtUnixTS:     as default, with unix send/recv timestamps for
+ *                      synchronized records (owping -U)
+ * OWPRecFmtRaw:        "SEQ STIME SS SERR RTIME RS RERR TTL\n" (owping -R)
+ * OWPRecFmtCSV:        "seq_no,sent,recv,delay,err,sync,ttl\n" with a
+ *                      header line
+ *
+ * Records are accumulated in a buffer that is written to output when it
+ * fills, or when OWPRecFormatterFlush/OWPRecFormatterFree is called.
+ * OWPRecFormatterParse can be passed to OWPParseRecords directly with
+ * the formatter as udata.
+ */
+typedef enum{
+    OWPRecFmtDefault=0,
+    OWPRecFmtUnixTS,
+    OWPRecFmtRaw,
+    OWPRecFmtCSV
+} OWPRecFmt;
+
+typedef struct OWPRecFormatterRec *OWPRecFormatter;
+
+extern OWPRecFormatter
+OWPRecFormatterCreate(
+        OWPContext  ctx,
+        FILE        *output,
+        OWPRecFmt   fmt,
+        char        scale   /* units - see OWPStatsScaleFactor */
+        );
+
+extern OWPBoolean
+OWPRecFormatterWrite(
+        OWPRecFormatter formatter,
+        OWPDataRec      *rec
+        );
+
+extern OWPBoolean
+OWPRecFormatterFlush(
+        OWPRecFormatter formatter
+        );
+
+extern OWPBoolean
+OWPRecFormatterFree(
+        OWPRecFormatter formatter
+        );
+
+extern int
+OWPRecFormatterParse(
+        OWPDataRec  *rec,
+        void        *udata
+        );
+
 /*
  * TODO: This needs lots of clean-up to be a good public interface.
  * Most of these fields do not really need to be exposed.
@@ -1412,6 +1711,7 @@ struct OWPPacketRec{
     OWPNum64    schedtime;  /* scheduled send time */
     uint32_t    seen;       /* how many times seen? */
     OWPBoolean  lost;
+    double      delay;      /* delay of first arrival (if seen) */
 };
 
 typedef struct OWPBucketRec OWPBucketRec, *OWPBucket;
@@ -1421,6 +1721,16 @@ struct OWPBucketRec{
     uint32_t    n;      /* samples in this bucket */
 };
 
+/*
+ * Arrival record used by the reordering computations. idx is the position
+ * of the packet in the arrival stream.
+ */
+typedef struct OWPReorderRec OWPReorderRec, *OWPReorder;
+struct OWPReorderRec{
+    uint32_t    seq;        /* packet seq no */
+    long int    idx;        /* arrival index */
+};
+
 typedef struct OWPStatsRec{
 
     /*
@@ -1432,6 +1742,7 @@ typedef struct OWPStatsRec{
      * Output values
      */
     FILE                *output;    /* If set, verbose description of rec's */
+    OWPRecFormatter     formatter;  /* formats rec's to output */
 
     char                fromhost[NI_MAXHOST];
     char                fromaddr[NI_MAXHOST];
@@ -1441,6 +1752,7 @@ typedef struct OWPStatsRec{
     char                toaddr[NI_MAXHOST];
     char                toserv[NI_MAXSERV];
     
+    char                scale;
     float               scale_factor;
     char                scale_abrv[3];
 
@@ -1504,6 +1816,21 @@ typedef struct OWPStatsRec{
     uint32_t        bsortsize;      /* number used in sort array */
     uint32_t        bsortlen;       /* number allocated */
 
+    /*
+     * IPDV (RFC 3393) - delay variation between packets with
+     * consecutive seqno's. The histogram uses bucketwidth and shares
+     * the bucket freelist with the delay histogram.
+     */
+    I2Table         itable;
+    OWPBucket       *isort;
+    uint32_t        isortsize;      /* number used in sort array */
+    uint32_t        isortlen;       /* number allocated */
+    uint32_t        ipdv_n;         /* number of ipdv samples */
+    double          ipdv_min;
+    double          ipdv_max;
+    double          ipdv_sum;
+    double          ipdv_abssum;
+
     /*
      * TTL info - histogram of received TTL values.
      */
@@ -1511,13 +1838,45 @@ typedef struct OWPStatsRec{
 
     /*
      * Reordering buffers
+     *
+     * rstack is a ring holding the arrivals (within the window) that
+     * can still be the most recent arrival with a smaller seqno for
+     * some future packet. rfen is a Fenwick tree over n that is used to
+     * count a packet as 1..k-reordered in O(log rlistlen). rn is filled
+     * in from rfen when parsing is complete.
+     *
+     * rhigh is a ring holding the arrivals that advanced NextExp (RFC 4737)
+     * and is used to find the reordering extent of a reordered packet.
      */
     long int        rlistlen;
-    long int        rindex;
-    long int        rnumseqno;
-    uint32_t       *rseqno;    /* buffer of seqno's seen */
+    long int        rnumseqno;  /* arrivals (including dups) */
+    long int        rnumrecv;   /* arrivals (excluding dups) */
+    OWPReorder      rstack;
+    long int        rstackb;    /* index of bottom of rstack */
+    long int        rstackn;    /* entries in rstack */
+    OWPReorder      rhigh;
+    long int        rhighb;     /* index of oldest entry in rhigh */
+    long int        rhighn;     /* entries in rhigh */
+    OWPBoolean      rhighexp;   /* entries have left the window */
+    uint32_t        rhighexpseq;/* seqno of last entry to leave the window */
+    uint32_t       *rfen;      /* Fenwick tree [1..rlistlen] */
     uint32_t       *rn;        /* number of j-reordered packets */
 
+    /*
+     * RFC 4737 reordering metrics
+     */
+    uint32_t        rnextexp;       /* NextExp */
+    uint32_t        rreordered;     /* packets with seqno < NextExp */
+    uint32_t        rextent_max;
+    uint64_t        rextent_sum;
+    uint32_t        rextent_unknown;/* extent larger than rlistlen */
+    uint32_t        rdisc_seq;      /* seqno of last discontinuity */
+    OWPBoolean      rdisc_valid;
+    OWPBoolean      rdisc_reordered;/* reordering since rdisc_seq */
+    uint32_t        rgap_num;
+    uint32_t        rgap_max;
+    uint64_t        rgap_sum;
+
     /*
      * Summary Stats
      */
@@ -1539,6 +1898,93 @@ typedef struct OWPStatsRec{
  * functions as well as providing those functions.
  */
 
+/*
+ * Stats results:
+ *
+ * A self contained copy of the statistics computed by OWPStatsParse.
+ * This does not reference the OWPStats object it came from, so it can be
+ * kept, serialized (OWPStatsResultWrite/OWPStatsResultRead) and printed
+ * (OWPStatsResultPrintMachine/OWPStatsResultPrintSummary) without
+ * re-parsing any text.
+ */
+typedef struct OWPStatsBucketRec{
+    int32_t     b;      /* bucket index (in units of bucketwidth) */
+    uint32_t    n;      /* samples in this bucket */
+} OWPStatsBucketRec;
+
+typedef struct OWPStatsResultRec{
+    /*
+     * Session information
+     */
+    OWPSID              sid;
+    char                fromhost[NI_MAXHOST];
+    char                fromaddr[NI_MAXHOST];
+    char                fromserv[NI_MAXSERV];
+    char                tohost[NI_MAXHOST];
+    char                toaddr[NI_MAXHOST];
+    char                toserv[NI_MAXSERV];
+    OWPNum64            start_time;
+    OWPNum64            end_time;
+    OWPBoolean          display_unix_ts;
+    uint32_t            typeP;
+    OWPNum64            loss_timeout;
+    uint32_t            packet_padding;
+    uint32_t            session_npackets;
+    uint32_t            sample_npackets;
+    double              bucketwidth;
+    OWPBoolean          finished;
+
+    /*
+     * Counts
+     */
+    uint32_t            sent;
+    uint32_t            lost;
+    uint32_t            dups;
+    OWPBoolean          sync;
+    double              maxerr;
+
+    /*
+     * Delay (min/max only valid if have_delay). buckets are sorted.
+     */
+    OWPBoolean          have_delay;
+    double              min_delay;
+    double              max_delay;
+    uint32_t            nbuckets;
+    OWPStatsBucketRec   *buckets;
+
+    /*
+     * IPDV. ipdvbuckets are sorted.
+     */
+    uint32_t            ipdv_n;
+    double              ipdv_min;
+    double              ipdv_max;
+    double              ipdv_sum;
+    double              ipdv_abssum;
+    uint32_t            nipdvbuckets;
+    OWPStatsBucketRec   *ipdvbuckets;
+
+    /*
+     * TTL histogram
+     */
+    uint32_t            ttl_count[256];
+
+    /*
+     * Reordering. reordering[j] is the number of (j+1)-reordered packets.
+     */
+    uint32_t            reorder_window;
+    uint32_t            narrived;
+    uint32_t            nreordering;
+    uint32_t            *reordering;
+    uint32_t            nrecv;
+    uint32_t            reordered;
+    uint32_t            extent_max;
+    uint32_t            extent_unknown;
+    uint64_t            extent_sum;
+    uint32_t            gap_num;
+    uint32_t            gap_max;
+    uint64_t            gap_sum;
+} OWPStatsResultRec, *OWPStatsResult;
+
 extern void
 OWPStatsFree(
         OWPStats    stats
@@ -1564,6 +2010,53 @@ OWPStatsParse(
         uint32_t   last             /* last seq num non-inclusive */
         );
 
+/*
+ * Stats for a session that is not in a file (see OWPFetchSessionStream).
+ * hdr->test_spec.slots and skips (hdr->num_skiprecs of them) are copied.
+ */
+extern OWPStats
+OWPStatsCreateFromHeader(
+        OWPContext          ctx,
+        OWPSessionHeader    hdr,
+        OWPSkip             skips,
+        char                *fromhost,  /* from hostname */
+        char                *tohost,    /* to hostname */
+        char                scale,
+        double              bucketWidth
+        );
+
+/*
+ * Incremental version of OWPStatsParse: Begin, then Records for each
+ * batch of data records (in file order), then End.
+ */
+extern OWPBoolean
+OWPStatsParseBegin(
+        OWPStats    stats,          /* Stats record */
+        FILE        *output,        /* Print packet records here */
+        uint32_t    first,          /* first seq num inclusive */
+        uint32_t    last            /* last seq num non-inclusive */
+        );
+
+extern OWPBoolean
+OWPStatsParseRecords(
+        OWPStats    stats,
+        OWPDataRec  *recs,
+        uint32_t    nrecs
+        );
+
+extern OWPBoolean
+OWPStatsParseEnd(
+        OWPStats    stats
+        );
+
+extern OWPBoolean
+OWPStatsSummarizeRange(
+        OWPStats        stats,
+        OWPNum64        begin,      /* send time inclusive */
+        OWPNum64        end,        /* send time non-inclusive */
+        OWPDataSummary  sum
+        );
+
 extern OWPBoolean
 OWPStatsPrintSummary(
         OWPStats    stats,
@@ -1578,6 +2071,64 @@ OWPStatsPrintMachine(
         FILE        *output
         );
 
+extern OWPStatsResult
+OWPStatsResultCreate(
+        OWPStats    stats
+        );
+
+extern void
+OWPStatsResultFree(
+        OWPStatsResult  result
+        );
+
+extern OWPBoolean
+OWPStatsResultPercentile(
+        OWPStatsResult  result,
+        double          alpha,
+        double          *delay_ret
+        );
+
+extern OWPBoolean
+OWPStatsResultIPDVPercentile(
+        OWPStatsResult  result,
+        double          alpha,
+        double          *ipdv_ret
+        );
+
+extern double
+OWPStatsResultLossRatio(
+        OWPStatsResult  result
+        );
+
+extern OWPBoolean
+OWPStatsResultPrintMachine(
+        OWPStatsResult  result,
+        FILE            *output
+        );
+
+extern OWPBoolean
+OWPStatsResultPrintSummary(
+        OWPContext      ctx,
+        OWPStatsResult  result,
+        FILE            *output,
+        char            scale,
+        float           *percentiles,
+        uint32_t        npercentiles
+        );
+
+extern OWPBoolean
+OWPStatsResultWrite(
+        OWPContext      ctx,
+        OWPStatsResult  result,
+        FILE            *fp
+        );
+
+extern OWPStatsResult
+OWPStatsResultRead(
+        OWPContext      ctx,
+        FILE            *fp
+        );
+
 extern float
 OWPStatsScaleFactor(
         char        scale,
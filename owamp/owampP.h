@@ -40,6 +40,7 @@
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/param.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 
 #ifndef MAXHOSTNAMELEN
@@ -62,6 +63,12 @@
  */
 #define _OWP_DEFAULT_PBKDF2_COUNT   (2048)
 
+/*
+ * Seconds between safe points in the datafile of a running test
+ * (the header is only rewritten if records completed in between).
+ */
+#define _OWP_SAFEPOINT_INTERVAL     (5)
+
 /*
  * Offset's and lengths for various file versions.
  */
@@ -105,6 +112,18 @@
 #if (_OWP_FETCH_BUFFSIZE != (_OWP_DATAREC_SIZE * _OWP_FETCH_DATAREC_BLOCKS))
 #error "Fetch Buffer is mis-sized for Test Record Size!"
 #endif
+
+/*
+ * Data records of a FetchSession response are encoded/encrypted in
+ * batches of _OWP_FETCH_BATCH_BUFFS fetch buffers so large sessions are
+ * moved with few large reads and writes. This only changes the local
+ * buffering - the records are sent exactly as if they were sent one
+ * fetch buffer at a time.
+ */
+#define _OWP_FETCH_BATCH_BUFFS      640
+#define _OWP_FETCH_BATCH_SIZE       (_OWP_FETCH_BATCH_BUFFS*_OWP_FETCH_BUFFSIZE)
+#define _OWP_FETCH_BATCH_AES_BLOCKS (_OWP_FETCH_BATCH_BUFFS*_OWP_FETCH_AES_BLOCKS)
+#define _OWP_FETCH_BATCH_DATARECS   (_OWP_FETCH_BATCH_BUFFS*_OWP_FETCH_DATAREC_BLOCKS)
 /* 
  ** Lengths (in 16-byte blocks) of various Control messages. 
  */
@@ -436,6 +455,117 @@ _OWPWriteDataHeaderFinished(
         uint32_t   next_seqno
         );
 
+extern OWPBoolean
+_OWPWriteDataHeaderVersion(
+        OWPContext          ctx,
+        FILE                *fp,
+        OWPSessionHeader    hdr,
+        uint32_t            version
+        );
+
+/*
+ * filev4.c
+ */
+extern OWPBoolean
+_OWPCountRecordsV4(
+        OWPContext  ctx,
+        FILE        *fp,
+        off_t       oset,
+        off_t       fsize,
+        uint32_t    *num_datarecs
+        );
+
+extern OWPErrSeverity
+_OWPParseRecordsV4(
+        OWPContext      ctx,
+        FILE            *fp,
+        uint32_t        num_rec,
+        OWPDoDataRecord proc_rec,
+        void            *app_data
+        );
+
+extern int
+_OWPReadBlockSizeV4(
+        OWPContext  ctx,
+        FILE        *fp,
+        off_t       oset,
+        off_t       fend,
+        uint32_t    *nrecs,
+        off_t       *blen
+        );
+
+/*
+ * dataindex.c
+ */
+#define _OWP_DATAINDEX_RECS         (1024)
+#define _OWP_DATAINDEX_ENTRY_SIZE   (68)
+#define _OWP_DATAINDEX_TRAILER_SIZE (24)
+
+typedef struct _OWPDataIndexEntryRec{
+    off_t       oset;       /* offset of first record in group  */
+    uint32_t    recidx;     /* index of first record in group   */
+    uint32_t    nrecs;
+    uint32_t    seq_min;
+    uint32_t    seq_max;
+    OWPNum64    send_min;
+    OWPNum64    send_max;
+    uint32_t    lost;
+    uint32_t    dups;
+    int64_t     delay_min;  /* signed OWPNum64 (recv - send)    */
+    int64_t     delay_max;
+    uint32_t    nbuckets;   /* non-empty histogram buckets      */
+} _OWPDataIndexEntryRec, *_OWPDataIndexEntry;
+
+typedef struct _OWPDataIndexRec *_OWPDataIndex;
+
+extern _OWPDataIndex
+_OWPDataIndexCreate(
+        OWPContext  ctx
+        );
+
+extern void
+_OWPDataIndexFree(
+        _OWPDataIndex   idx
+        );
+
+extern void
+_OWPDataIndexAdd(
+        _OWPDataIndex   idx,
+        OWPDataRec      *rec
+        );
+
+extern OWPBoolean
+_OWPDataIndexEnd(
+        _OWPDataIndex   idx,
+        off_t           oset,
+        uint32_t        recidx
+        );
+
+extern OWPBoolean
+_OWPWriteDataIndexEntries(
+        OWPContext      ctx,
+        FILE            *fp,
+        _OWPDataIndex   idx,
+        uint32_t        num_datarecs
+        );
+
+extern _OWPDataIndex
+_OWPBuildDataIndex(
+        OWPContext  ctx,
+        FILE        *fp,
+        off_t       *fend_ret,
+        uint32_t    *num_datarecs_ret
+        );
+
+extern OWPBoolean
+_OWPAppendDataIndex(
+        OWPContext      ctx,
+        FILE            *fp,
+        _OWPDataIndex   idx,
+        off_t           fend,
+        uint32_t        num_datarecs
+        );
+
 extern OWPBoolean
 _OWPCleanDataRecs(
         OWPContext      cntrl,
@@ -464,6 +594,14 @@ _OWPReceiveBlocksIntr(
         int         *retn_on_intr
         );
 
+extern int
+_OWPSendBlocksVIntr(
+        OWPControl      cntrl,
+        struct iovec    *iov,
+        int             iovcnt,
+        int             *retn_on_intr
+        );
+
 extern int
 _OWPSendBlocks(
         OWPControl  cntrl,
@@ -2083,6 +2083,81 @@ _OWPDecodeSkipRecord(
     return;
 }
 
+/*
+ * Function:    IndexStopSession
+ *
+ * Description:    
+ *              Append the block index to the finished recv session file
+ *              of tptr. The records are parsed without the file lock (the
+ *              file no longer changes, and a fetch in the meantime just
+ *              sees a file without an index). The lock is only held while
+ *              the index is appended, so a fetch sees the file either
+ *              with or without a complete index. Failures are only
+ *              reported: the session file is still valid without it.
+ *
+ * In Args:    
+ *
+ * Out Args:    
+ *
+ * Scope:    
+ * Returns:    
+ * Side Effect:    
+ */
+static void
+IndexStopSession(
+        OWPControl      cntrl,
+        OWPTestSession  tptr
+        )
+{
+    FILE            *rfp = tptr->endpoint->datafile;
+    char            sid_name[sizeof(OWPSID)*2+1];
+    struct flock    flk;
+    _OWPDataIndex   idx;
+    off_t           fend;
+    uint32_t        num_datarecs;
+    OWPBoolean      rc;
+
+    I2HexEncode(sid_name,tptr->sid,sizeof(OWPSID));
+
+    if( !(idx = _OWPBuildDataIndex(cntrl->ctx,rfp,&fend,&num_datarecs))){
+        OWPError(cntrl->ctx,OWPErrWARNING,OWPErrUNKNOWN,
+                "_OWPReadStopSessions: Unable to index session sid(%s)",
+                sid_name);
+        return;
+    }
+
+    memset(&flk,0,sizeof(flk));
+    flk.l_start = 0;
+    flk.l_len = 0;
+    flk.l_whence = SEEK_SET;
+    flk.l_type = F_WRLCK;
+
+    if( fcntl(fileno(rfp), F_SETLKW, &flk) < 0){
+        OWPError(cntrl->ctx,OWPErrWARNING,errno,
+                "_OWPReadStopSessions: Unable to lock file sid(%s): %M",
+                sid_name);
+        _OWPDataIndexFree(idx);
+        return;
+    }
+
+    rc = _OWPAppendDataIndex(cntrl->ctx,rfp,idx,fend,num_datarecs);
+    _OWPDataIndexFree(idx);
+    if(!rc){
+        OWPError(cntrl->ctx,OWPErrWARNING,OWPErrUNKNOWN,
+                "_OWPReadStopSessions: Unable to index session sid(%s)",
+                sid_name);
+    }
+
+    flk.l_type = F_UNLCK;
+    if( fcntl(fileno(rfp), F_SETLKW, &flk) < 0){
+        OWPError(cntrl->ctx,OWPErrWARNING,errno,
+                "_OWPReadStopSessions: Unable to unlock file sid(%s): %M",
+                sid_name);
+    }
+
+    return;
+}
+
 /*
  * Function:    _OWPReadStopSessions
  *
@@ -2110,6 +2185,8 @@ _OWPDecodeSkipRecord(
  *                      4. write skips
  *                      5. write num_skips
  *                      6. write next_seqno/finished
+ *                  The block index is appended (IndexStopSession) once
+ *                  the whole message has been read.
  *
  *
  *              TODO: Eventually should probably read this message into a temp
@@ -2426,6 +2503,17 @@ done_skips:
         goto err;
     }
 
+    /*
+     * Index the finished sessions so partial fetches can seek to the
+     * records they need. This is done once the complete message has
+     * been read and verified.
+     */
+    for(tptr = cntrl->tests;tptr;tptr = tptr->next){
+        if(!tptr->endpoint->send && tptr->endpoint->datafile){
+            IndexStopSession(cntrl,tptr);
+        }
+    }
+
     /*
      * The control connection is now ready to send the response.
      */
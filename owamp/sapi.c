@@ -29,6 +29,9 @@
 #include <assert.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#if defined(HAVE_SYS_SENDFILE_H) && defined(HAVE_SENDFILE)
+#include <sys/sendfile.h>
+#endif
 
 
 static int
@@ -723,6 +726,7 @@ struct DoDataState{
     OWPBoolean      send;
     uint32_t       begin;
     uint32_t       end;
+    char            *buf;
     uint32_t       inbuf;
     uint64_t       count;
     uint32_t       maxiseen;
@@ -737,7 +741,7 @@ DoDataRecords(
 {
     struct DoDataState  *dstate = (struct DoDataState *)udata;
     OWPControl          cntrl = dstate->cntrl;
-    char                *buf = (char *)cntrl->msg;
+    char                *buf = dstate->buf;
 
     /*
      * Save largest index seen that is not lost.
@@ -761,7 +765,7 @@ DoDataRecords(
 
     if(dstate->send){
         /*
-         * Encode this record into cntrl->msg buffer.
+         * Encode this record into the batch buffer.
          */
         if(!_OWPEncodeDataRecord(&buf[dstate->inbuf*dstate->rec_size],
                     rec)){
@@ -772,17 +776,18 @@ DoDataRecords(
         /*
          * If the buffer is full enough to send, do so.
          */
-        if(dstate->inbuf == _OWP_FETCH_DATAREC_BLOCKS){
-            _OWPSendHMACAdd(cntrl,buf,_OWP_FETCH_AES_BLOCKS);
-            if(_OWPSendBlocksIntr(cntrl,(uint8_t *)buf,_OWP_FETCH_AES_BLOCKS,
-                        dstate->intr) != _OWP_FETCH_AES_BLOCKS){
+        if(dstate->inbuf == _OWP_FETCH_BATCH_DATARECS){
+            _OWPSendHMACAdd(cntrl,buf,_OWP_FETCH_BATCH_AES_BLOCKS);
+            if(_OWPSendBlocksIntr(cntrl,(uint8_t *)buf,
+                        _OWP_FETCH_BATCH_AES_BLOCKS,dstate->intr) !=
+                    _OWP_FETCH_BATCH_AES_BLOCKS){
                 dstate->err = OWPErrFATAL;
                 _OWPFailControlSession(cntrl,OWPErrFATAL);
                 return -1;
             }
             dstate->inbuf = 0;
         }
-        else if(dstate->inbuf > _OWP_FETCH_DATAREC_BLOCKS){
+        else if(dstate->inbuf > _OWP_FETCH_BATCH_DATARECS){
             dstate->err = OWPErrFATAL;
             _OWPFailControlSession(cntrl,OWPErrFATAL);
             return -1;
@@ -792,6 +797,112 @@ DoDataRecords(
     return 0;
 }
 
+/*
+ * Function:    SendDataRecordsRaw
+ *
+ * Description:
+ *      Send the nrecs data records stored at oset in fp directly from
+ *      the file, followed by the zero padding to the next AES block.
+ *
+ *      This is only valid in open mode (the payload is not encrypted,
+ *      and the HMAC is not used) for version 3 files, where the records
+ *      are stored in exactly the form they are sent in. sendfile() is
+ *      used where available, otherwise the records are copied through
+ *      a batch sized buffer without being decoded.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ *      fp is left at an undefined offset.
+ */
+static OWPBoolean
+SendDataRecordsRaw(
+        OWPControl  cntrl,
+        FILE        *fp,
+        off_t       oset,
+        uint32_t    nrecs,
+        int         *intr
+        )
+{
+    off_t   len = (off_t)nrecs * _OWP_DATAREC_SIZE;
+    char    pad[_OWP_RIJNDAEL_BLOCK_SIZE];
+    size_t  padlen;
+    char    *buf;
+    size_t  n;
+#if defined(HAVE_SYS_SENDFILE_H) && defined(HAVE_SENDFILE)
+    ssize_t rc;
+#endif
+
+    padlen = (_OWP_RIJNDAEL_BLOCK_SIZE - (len % _OWP_RIJNDAEL_BLOCK_SIZE)) %
+        _OWP_RIJNDAEL_BLOCK_SIZE;
+
+#if defined(HAVE_SYS_SENDFILE_H) && defined(HAVE_SENDFILE)
+    while(len > 0){
+        rc = sendfile(cntrl->sockfd,fileno(fp),&oset,
+                (size_t)MIN(len,_OWP_FETCH_BATCH_SIZE*64));
+        if(rc < 0){
+            if((errno == EINTR) && !*intr){
+                continue;
+            }
+
+            /*
+             * sendfile() not supported for this fd pair - copy instead.
+             */
+            if(((errno == EINVAL) || (errno == ENOSYS)) &&
+                    (len == (off_t)nrecs * _OWP_DATAREC_SIZE)){
+                break;
+            }
+            OWPError(cntrl->ctx,OWPErrFATAL,errno,"sendfile(): %M");
+            return False;
+        }
+        if(rc == 0){
+            OWPError(cntrl->ctx,OWPErrFATAL,OWPErrUNKNOWN,
+                    "SendDataRecordsRaw: Session file truncated");
+            return False;
+        }
+        len -= rc;
+    }
+#endif
+
+    if(len > 0){
+        if(fseeko(fp,oset,SEEK_SET)){
+            OWPError(cntrl->ctx,OWPErrFATAL,errno,"fseeko(): %M");
+            return False;
+        }
+        if( !(buf = malloc(_OWP_FETCH_BATCH_SIZE))){
+            OWPError(cntrl->ctx,OWPErrFATAL,errno,"malloc(): %M");
+            return False;
+        }
+        while(len > 0){
+            n = MIN(len,_OWP_FETCH_BATCH_SIZE);
+            if(fread(buf,1,n,fp) != n){
+                OWPError(cntrl->ctx,OWPErrFATAL,errno,"fread(): %M");
+                free(buf);
+                return False;
+            }
+            if(I2Writeni(cntrl->sockfd,buf,n,intr) != (ssize_t)n){
+                free(buf);
+                return False;
+            }
+            len -= n;
+        }
+        free(buf);
+    }
+
+    if(padlen){
+        memset(pad,0,sizeof(pad));
+        if(I2Writeni(cntrl->sockfd,pad,padlen,intr) != (ssize_t)padlen){
+            return False;
+        }
+    }
+
+    return True;
+}
+
 OWPErrSeverity
 OWPProcessFetchSession(
         OWPControl  cntrl,
@@ -821,8 +932,13 @@ OWPProcessFetchSession(
     uint32_t                    next_seqno = 0;
     uint32_t                    num_skiprecs = 0;
     off_t                       tr_size;
+    off_t                       data_oset,ioset;
+    uint32_t                    data_nrecs,inrecs;
 
     struct DoDataState          dodata;
+    struct iovec                iov[2];
+    int                         iovcnt = 0;
+    int                         blks = 0;
 
     int                         ival=1;
     int                         *intr = &ival;
@@ -976,6 +1092,20 @@ read_file:
         }
     }
 
+    /*
+     * Range of records to parse. If the session is finished and indexed,
+     * only the part of the file that can hold [begin,end] is read.
+     */
+    data_oset = fhdr.oset_datarecs;
+    data_nrecs = fhdr.num_datarecs;
+    if((fhdr.finished == OWP_SESSION_FINISHED_NORMAL) &&
+            ((begin != 0) || (end != 0xFFFFFFFF)) &&
+            OWPReadDataIndex(cntrl->ctx,fp,fhdr.num_datarecs,
+                OWP_DATAINDEX_SEQ,begin,end,&ioset,&inrecs)){
+        data_oset = ioset;
+        data_nrecs = inrecs;
+    }
+
     /*
      * setup the state record for parsing the records.
      */
@@ -986,10 +1116,21 @@ read_file:
     dodata.send = False;
     dodata.begin = begin;
     dodata.end = end;
+    dodata.buf = NULL;
     dodata.inbuf = 0;
     dodata.count = 0;
     dodata.maxiseen = 0;
 
+    /*
+     * While the session is running, the receiver keeps the first seq_no
+     * that may still be missing records in next_seqno (0 if it has not
+     * said). Only send records before it so a client can continue from
+     * there later without missing or repeating any.
+     */
+    if((fhdr.finished != OWP_SESSION_FINISHED_NORMAL) && fhdr.next_seqno){
+        dodata.end = MIN(dodata.end,fhdr.next_seqno - 1);
+    }
+
     /*
      * Now - count the number of records that will be sent.
      * short-cut the count if full session is requested.
@@ -1000,14 +1141,14 @@ read_file:
     }
     else{
         /* forward pointer to data records for counting */
-        if(fseeko(fp,fhdr.oset_datarecs,SEEK_SET)){
+        if(fseeko(fp,data_oset,SEEK_SET)){
             OWPError(cntrl->ctx,OWPErrFATAL,errno,"fseeko(): %M");
             goto failed;
         }
         /*
          * Now, count the records in range.
          */
-        if(OWPParseRecords(cntrl->ctx,fp,fhdr.num_datarecs,fhdr.version,
+        if(OWPParseRecords(cntrl->ctx,fp,data_nrecs,fhdr.version,
                     DoDataRecords,&dodata) != OWPErrOK){
             goto failed;
         }
@@ -1020,16 +1161,16 @@ read_file:
          * last seen one.
          */
         if((fhdr.finished != OWP_SESSION_FINISHED_NORMAL) &&
-                (dodata.maxiseen < end)){
+                (dodata.maxiseen < dodata.end)){
             dodata.end = dodata.maxiseen;
 
             /* set pointer to beginning of data recs */
-            if(fseeko(fp,fhdr.oset_datarecs,SEEK_SET)){
+            if(fseeko(fp,data_oset,SEEK_SET)){
                 OWPError(cntrl->ctx,OWPErrFATAL,errno,"fseeko(): %M");
                 goto failed;
             }
 
-            if(OWPParseRecords(cntrl->ctx,fp,fhdr.num_datarecs,fhdr.version,
+            if(OWPParseRecords(cntrl->ctx,fp,data_nrecs,fhdr.version,
                         DoDataRecords,&dodata) != OWPErrOK){
                 goto failed;
             }
@@ -1044,6 +1185,13 @@ read_file:
         num_skiprecs = fhdr.num_skiprecs;
     }
 
+    /*
+     * For a running session, tell the client where to continue from.
+     */
+    if((fhdr.finished != OWP_SESSION_FINISHED_NORMAL) && fhdr.next_seqno){
+        next_seqno = (dodata.end >= begin)? dodata.end + 1: begin;
+    }
+
     /* set file pointer to beginning of TestReq */
     if(fseeko(fp,_OWP_TESTREC_OFFSET,SEEK_SET)){
         OWPError(cntrl->ctx,OWPErrFATAL,errno,"fseeko(): %M");
@@ -1189,19 +1337,41 @@ read_file:
     if(!sendrecs) goto final;
 
     /* set file pointer to beginning of data */
-    if(fseeko(fp,fhdr.oset_datarecs,SEEK_SET)){
+    if(fseeko(fp,data_oset,SEEK_SET)){
         OWPError(cntrl->ctx,OWPErrFATAL,errno,"fseeko(): %M");
         _OWPCallCloseFile(cntrl,closure,fp,OWP_CNTRL_FAILURE);
         return _OWPFailControlSession(cntrl,err);
     }
 
+    /*
+     * Open mode, complete session: the records are sent exactly as they
+     * are stored, so skip decoding/encoding them. (Only version 3 files
+     * hold them in the wire format - version 4 files are compressed.)
+     */
+    if( !(cntrl->mode & OWP_MODE_DOCIPHER) &&
+            (fhdr.finished == OWP_SESSION_FINISHED_NORMAL) &&
+            (begin == 0) && (end == 0xFFFFFFFF) &&
+            (fhdr.version == 3) && (fhdr.rec_size == _OWP_DATAREC_SIZE)){
+        if( !SendDataRecordsRaw(cntrl,fp,fhdr.oset_datarecs,sendrecs,intr)){
+            _OWPCallCloseFile(cntrl,closure,fp,OWP_CNTRL_FAILURE);
+            return _OWPFailControlSession(cntrl,OWPErrFATAL);
+        }
+        goto final;
+    }
+
     /*
      * Now, send the data!
      */
+    if( !(dodata.buf = malloc(_OWP_FETCH_BATCH_SIZE))){
+        OWPError(cntrl->ctx,OWPErrFATAL,errno,"malloc(): %M");
+        _OWPCallCloseFile(cntrl,closure,fp,OWP_CNTRL_FAILURE);
+        return _OWPFailControlSession(cntrl,OWPErrFATAL);
+    }
     dodata.send = True;
-    if( (OWPParseRecords(cntrl->ctx,fp,fhdr.num_datarecs,fhdr.version,
+    if( (OWPParseRecords(cntrl->ctx,fp,data_nrecs,fhdr.version,
                     DoDataRecords,&dodata) != OWPErrOK) ||
             (dodata.count != sendrecs)){
+        free(dodata.buf);
         _OWPCallCloseFile(cntrl,closure,fp,OWP_CNTRL_FAILURE);
         return _OWPFailControlSession(cntrl,err);
     }
@@ -1211,21 +1381,18 @@ read_file:
          * Set "blks" to number of AES blocks that need to be sent to
          * hold all "leftover" records.
          */
-        int blks = (dodata.inbuf*fhdr.rec_size/_OWP_RIJNDAEL_BLOCK_SIZE) + 1;
+        blks = (dodata.inbuf*fhdr.rec_size + _OWP_RIJNDAEL_BLOCK_SIZE - 1) /
+            _OWP_RIJNDAEL_BLOCK_SIZE;
 
         /* zero out any partial data blocks */
-        memset(&buf[dodata.inbuf*fhdr.rec_size],0,
+        memset(&dodata.buf[dodata.inbuf*fhdr.rec_size],0,
                 (blks*_OWP_RIJNDAEL_BLOCK_SIZE)-
                 (dodata.inbuf*fhdr.rec_size));
 
-        /*
-         * Write enough AES blocks to get remaining records.
-         */
-        _OWPSendHMACAdd(cntrl,buf,blks);
-        if( (_OWPSendBlocksIntr(cntrl,(uint8_t *)buf,blks,intr) != blks)){
-            _OWPCallCloseFile(cntrl,closure,fp,OWP_CNTRL_FAILURE);
-            return _OWPFailControlSession(cntrl,err);
-        }
+        _OWPSendHMACAdd(cntrl,dodata.buf,blks);
+        iov[iovcnt].iov_base = dodata.buf;
+        iov[iovcnt].iov_len = blks*_OWP_RIJNDAEL_BLOCK_SIZE;
+        iovcnt++;
     }
 
 final:
@@ -1234,11 +1401,22 @@ final:
      */
     _OWPCallCloseFile(cntrl,closure,fp,OWP_CNTRL_ACCEPT);
 
-    /* now send final HMAC Block */
+    /*
+     * Send any remaining records along with the final HMAC Block.
+     */
     _OWPSendHMACDigestClear(cntrl,buf);
-    if(_OWPSendBlocksIntr(cntrl,(uint8_t *)buf,1,intr) != 1){
+    iov[iovcnt].iov_base = buf;
+    iov[iovcnt].iov_len = _OWP_RIJNDAEL_BLOCK_SIZE;
+    iovcnt++;
+    if(_OWPSendBlocksVIntr(cntrl,iov,iovcnt,intr) != blks+1){
+        if(dodata.buf){
+            free(dodata.buf);
+        }
         return _OWPFailControlSession(cntrl,err);
     }
+    if(dodata.buf){
+        free(dodata.buf);
+    }
 
     /*
      * reset state to request.
@@ -37,6 +37,7 @@
 #include <assert.h>
 #include <math.h>
 #include <ctype.h>
+#include <netinet/in.h>
 
 /*
  * PacketBuffer utility functions:
@@ -185,6 +186,7 @@ PacketAlloc(
     node->seq = seq;
     node->seen = 0;
     node->lost = False;
+    node->delay = 0.0;
 
     k.dptr = &node->seq;
     k.dsize = sizeof(node->seq);
@@ -293,6 +295,50 @@ PacketGet(
     return (OWPPacket)v.dptr;
 }
 
+/*
+ * Function:    PacketFind
+ *
+ * Description:    
+ *              Returns the packet record for a given sequence number
+ *              if it is currently in the buffer. Unlike PacketGet,
+ *              this never allocates records, and it is not an error
+ *              for the record to be missing.
+ *
+ * In Args:    
+ *
+ * Out Args:    
+ *
+ * Scope:    
+ * Returns:    
+ * Side Effect:    
+ */
+static OWPPacket
+PacketFind(
+        OWPStats    stats,
+        uint32_t    seq
+        )
+{
+    I2Datum     k,v;
+
+    if(!stats->pbegin || (seq < stats->pbegin->seq) ||
+            (seq > stats->pend->seq)){
+        return NULL;
+    }
+
+    if(seq == stats->pend->seq){
+        return stats->pend;
+    }
+
+    k.dptr = &seq;
+    k.dsize = sizeof(seq);
+
+    if(!I2HashFetch(stats->ptable,k,&v)){
+        return NULL;
+    }
+
+    return (OWPPacket)v.dptr;
+}
+
 /*
  * BucketBuffer utility functions:
  *
@@ -317,17 +363,15 @@ PacketGet(
  * Returns:    
  * Side Effect:    
  */
-static I2Boolean
-BucketBufferClean(
-        I2Datum k,
-        I2Datum v,
-        void    *app_data
+static void
+BucketFree(
+        OWPStats    stats,
+        I2Table     table,
+        I2Datum     k,
+        OWPBucket   node
         )
 {
-    OWPStats    stats = app_data;
-    OWPBucket   node = v.dptr;
-
-    if(I2HashDelete(stats->btable,k) != 0){
+    if(I2HashDelete(table,k) != 0){
         OWPError(stats->ctx,OWPErrWARNING,OWPErrUNKNOWN,
                 "BucketBufferClean: Unable to remove bucket #%d",node->b);
     }
@@ -337,34 +381,33 @@ BucketBufferClean(
     node->next = stats->bfreelist;
     stats->bfreelist = node;
 
+    return;
+}
+
+static I2Boolean
+BucketBufferClean(
+        I2Datum k,
+        I2Datum v,
+        void    *app_data
+        )
+{
+    OWPStats    stats = app_data;
+
+    BucketFree(stats,stats->btable,k,v.dptr);
+
     return True;
 }
 
-/*
- * Function:    BucketBufferPrint
- *
- * Description:    
- *              Used to print out the current hash of all existing values.
- *
- * In Args:    
- *
- * Out Args:    
- *
- * Scope:    
- * Returns:    
- * Side Effect:    
- */
 static I2Boolean
-BucketBufferPrint(
-        I2Datum k __attribute__((unused)),
+IPDVBufferClean(
+        I2Datum k,
         I2Datum v,
         void    *app_data
         )
 {
-    OWPBucket   node = v.dptr;
-    FILE        *fp = app_data;
+    OWPStats    stats = app_data;
 
-    fprintf(fp,"\t%d\t%u\n",node->b,node->n);
+    BucketFree(stats,stats->itable,k,v.dptr);
 
     return True;
 }
@@ -383,6 +426,11 @@ BucketBufferPrint(
  * Returns:    
  * Side Effect:    
  */
+struct BucketSortFillRec{
+    OWPBucket   *sort;
+    uint32_t    i;
+};
+
 static I2Boolean
 BucketBufferSortFill(
         I2Datum k   __attribute__((unused)),
@@ -390,21 +438,22 @@ BucketBufferSortFill(
         void    *app_data
         )
 {
-    OWPStats    stats = app_data;
-    OWPBucket   node = v.dptr;
+    struct BucketSortFillRec    *fill = app_data;
+    OWPBucket                   node = v.dptr;
 
-    stats->bsort[stats->bsorti++] = node;
+    fill->sort[fill->i++] = node;
 
     return True;
 }
 
 /*
- * Function:    BucketIncrementDelay
+ * Function:    BucketIncrement
  *
  * Description:    
  *              Used to record that fact that a given packet was recieved
  *              in a given delay time. Adds a new record into the hash
- *              if necessary.
+ *              if necessary. (table is either the delay histogram or
+ *              the ipdv histogram.)
  *
  * In Args:    
  *
@@ -415,8 +464,9 @@ BucketBufferSortFill(
  * Side Effect:    
  */
 static OWPBoolean
-BucketIncrementDelay(
+BucketIncrement(
     OWPStats    stats,
+    I2Table     table,
     double      d       /* delay */
     )
 {
@@ -435,7 +485,7 @@ BucketIncrementDelay(
     k.dsize = sizeof(b);
     k.dptr = &b;
 
-    if(I2HashFetch(stats->btable,k,&v)){
+    if(I2HashFetch(table,k,&v)){
         node = (OWPBucket)v.dptr;
     }
     else{
@@ -475,7 +525,7 @@ BucketIncrementDelay(
         v.dptr = node;
         v.dsize = sizeof(*node);
 
-        if(I2HashStore(stats->btable,k,v) != 0){
+        if(I2HashStore(table,k,v) != 0){
             return False;
         }
     }
@@ -488,6 +538,72 @@ BucketIncrementDelay(
     return True;
 }
 
+#define BucketIncrementDelay(stats,d)   BucketIncrement(stats,stats->btable,d)
+#define BucketIncrementIPDV(stats,d)    BucketIncrement(stats,stats->itable,d)
+
+/*
+ * Function:    IPDVUpdate
+ *
+ * Description:    
+ *              Computes the RFC 3393 ipdv for the pairs of packets
+ *              with consecutive seqno's that are completed by the
+ *              arrival of this packet. (The pair is completed by
+ *              whichever packet arrives second, so each pair is only
+ *              counted once even with reordering.)
+ *
+ * In Args:    
+ *
+ * Out Args:    
+ *
+ * Scope:    
+ * Returns:    
+ * Side Effect:    
+ */
+static OWPBoolean
+IPDVUpdate(
+        OWPStats    stats,
+        OWPPacket   node
+        )
+{
+    OWPPacket   pair[2] = {NULL,NULL};
+    double      ipdv;
+    int         i;
+
+    if(node->seq > stats->first){
+        pair[0] = PacketFind(stats,node->seq-1);
+    }
+    if(node->seq+1 < stats->last){
+        pair[1] = PacketFind(stats,node->seq+1);
+    }
+
+    for(i=0;i<2;i++){
+        if(!pair[i] || !pair[i]->seen || pair[i]->lost){
+            continue;
+        }
+
+        /* ipdv is always the later seqno minus the earlier seqno */
+        ipdv = (i)? pair[i]->delay - node->delay:
+            node->delay - pair[i]->delay;
+
+        if(!stats->ipdv_n){
+            stats->ipdv_min = stats->ipdv_max = ipdv;
+        }
+        else{
+            stats->ipdv_min = MIN(stats->ipdv_min,ipdv);
+            stats->ipdv_max = MAX(stats->ipdv_max,ipdv);
+        }
+        stats->ipdv_n++;
+        stats->ipdv_sum += ipdv;
+        stats->ipdv_abssum += fabs(ipdv);
+
+        if( !BucketIncrementIPDV(stats,ipdv)){
+            return False;
+        }
+    }
+
+    return True;
+}
+
 /*
  * Stats utility functions:
  *
@@ -521,9 +637,17 @@ OWPStatsFree(
         free(stats->rn);
         stats->rn = NULL;
     }
-    if(stats->rseqno){
-        free(stats->rseqno);
-        stats->rseqno = NULL;
+    if(stats->rfen){
+        free(stats->rfen);
+        stats->rfen = NULL;
+    }
+    if(stats->rstack){
+        free(stats->rstack);
+        stats->rstack = NULL;
+    }
+    if(stats->rhigh){
+        free(stats->rhigh);
+        stats->rhigh = NULL;
     }
 
     if(stats->bsort){
@@ -531,6 +655,12 @@ OWPStatsFree(
         stats->bsort = NULL;
         stats->bsortlen = 0;
     }
+    if(stats->isort){
+        free(stats->isort);
+        stats->isort = NULL;
+        stats->isortlen = 0;
+    }
+    I2HashClose(stats->itable);
     I2HashClose(stats->btable);
     while(stats->ballocated){
         OWPBucket   t;
@@ -568,11 +698,13 @@ OWPStatsFree(
 }
 
 /*
- * Function:    OWPStatsCreate
+ * Function:    StatsCreate
  *
  * Description:    
- *              used to create a stats object that is used to manage
- *              statistics parsing for a given owp file.
+ *              Does the work for OWPStatsCreate and
+ *              OWPStatsCreateFromHeader. If fp is NULL, the slots and
+ *              skips are copied from hdr->test_spec.slots and skips
+ *              instead of being read from fp.
  *
  * In Args:    
  *
@@ -581,19 +713,13 @@ OWPStatsFree(
  * Scope:    
  * Returns:    
  * Side Effect:    
- *
- *
- * TODO: Create a more extensible interface for create. I'm in a hurry, so
- * for now I will just create an arg for every config option, but to
- * allow for other as yet unforseen stats it would be better to provide
- * a structure with some kind of bitmask to indicate which parts of the
- * structure are valid.
  */
-OWPStats
-OWPStatsCreate(
+static OWPStats
+StatsCreate(
         OWPContext          ctx,
         FILE                *fp,
         OWPSessionHeader    hdr,
+        OWPSkip             skips,
         char                *fromhost,
         char                *tohost,
         char                scale,
@@ -602,9 +728,11 @@ OWPStatsCreate(
 {
     char        *func = "OWPStatsCreate";
     OWPStats    stats=NULL;
+    OWPSlot     *slots = hdr->test_spec.slots;
     double      d;
     long int    i;
     size_t      s;
+    uint32_t    u32;
 
     /*
      * Verify args
@@ -671,6 +799,7 @@ OWPStatsCreate(
     /*
      * Scale for reports
      */
+    stats->scale = scale;
     s = sizeof(stats->scale_abrv);
     stats->scale_factor = OWPStatsScaleFactor(scale,stats->scale_abrv,&s);
     if(stats->scale_factor == 0.0){
@@ -696,7 +825,16 @@ OWPStatsCreate(
             goto error;
         }
 
-        if( !OWPReadDataHeaderSlots(stats->ctx,stats->fp,
+        if(!stats->fp){
+            if(!slots){
+                OWPError(stats->ctx,OWPErrFATAL,EINVAL,
+                        "%s: No scheduling slots",func);
+                goto error;
+            }
+            memcpy(stats->hdr->test_spec.slots,slots,
+                    stats->hdr->test_spec.nslots*sizeof(OWPSlot));
+        }
+        else if( !OWPReadDataHeaderSlots(stats->ctx,stats->fp,
                     stats->hdr->test_spec.nslots,stats->hdr->test_spec.slots)){
             OWPError(stats->ctx,OWPErrFATAL,OWPErrUNKNOWN,
                     "%s: Unable to read scheduling slots from file",func);
@@ -715,8 +853,17 @@ OWPStatsCreate(
                     func,stats->hdr->num_skiprecs);
             goto error;
         }
-        if( !OWPReadDataSkips(stats->ctx,stats->fp,stats->hdr->num_skiprecs,
-                    stats->skips)){
+        if(!stats->fp){
+            if(!skips){
+                OWPError(stats->ctx,OWPErrFATAL,EINVAL,
+                        "%s: No skip records",func);
+                goto error;
+            }
+            memcpy(stats->skips,skips,
+                    stats->hdr->num_skiprecs*sizeof(OWPSkipRec));
+        }
+        else if( !OWPReadDataSkips(stats->ctx,stats->fp,
+                    stats->hdr->num_skiprecs,stats->skips)){
             OWPError(stats->ctx,OWPErrFATAL,errno,
                     "%s: Unable to read skip records from file",func);
             goto error;
@@ -824,6 +971,16 @@ OWPStatsCreate(
         goto error;
     }
 
+    /*
+     * IPDV bucket hash table (shares the bucket freelist)
+     */
+    if( !(stats->itable = I2HashInit(OWPContextErrHandle(stats->ctx),
+                    stats->blistlen,NULL,NULL))){
+        OWPError(stats->ctx,OWPErrFATAL,OWPErrUNKNOWN,
+                "%s: Unable to allocate ipdv BucketRec hash");
+        goto error;
+    }
+
     /*
      * [0] is used to track the list of allocated arrays so they can
      * be freed. (So, only index 1 and above from each array are actually
@@ -837,11 +994,28 @@ OWPStatsCreate(
 
     /*
      * reordering buffers
+     *
+     * The window defaults to the packet buffer size, but can be made
+     * larger using the OWPReorderWindow context variable. (The cost
+     * of each record is O(log(rlistlen)), so thousands is not a problem.)
      */
     stats->rlistlen = stats->plistlen;
-    if( !(stats->rseqno = calloc(stats->rlistlen,sizeof(uint32_t)))){
+    if(OWPContextConfigGetU32(stats->ctx,OWPReorderWindow,&u32) && u32){
+        stats->rlistlen = MIN(u32,0x7fffffffL);
+    }
+    if( !(stats->rstack = calloc(stats->rlistlen,sizeof(OWPReorderRec)))){
             OWPError(stats->ctx,OWPErrFATAL,errno,
-                    "%s: calloc(%lu,uint32_t): %M",func,stats->rlistlen);
+                    "%s: calloc(%lu,OWPReorderRec): %M",func,stats->rlistlen);
+            goto error;
+    }
+    if( !(stats->rhigh = calloc(stats->rlistlen,sizeof(OWPReorderRec)))){
+            OWPError(stats->ctx,OWPErrFATAL,errno,
+                    "%s: calloc(%lu,OWPReorderRec): %M",func,stats->rlistlen);
+            goto error;
+    }
+    if( !(stats->rfen = calloc(stats->rlistlen+1,sizeof(uint32_t)))){
+            OWPError(stats->ctx,OWPErrFATAL,errno,
+                    "%s: calloc(%lu,uint32_t): %M",func,stats->rlistlen+1);
             goto error;
     }
     if( !(stats->rn = calloc(stats->rlistlen,sizeof(uint32_t)))){
@@ -858,6 +1032,79 @@ error:
     return NULL;
 }
 
+/*
+ * Function:    OWPStatsCreate
+ *
+ * Description:    
+ *              used to create a stats object that is used to manage
+ *              statistics parsing for a given owp file.
+ *
+ * In Args:    
+ *
+ * Out Args:    
+ *
+ * Scope:    
+ * Returns:    
+ * Side Effect:    
+ *
+ *
+ * TODO: Create a more extensible interface for create. I'm in a hurry, so
+ * for now I will just create an arg for every config option, but to
+ * allow for other as yet unforseen stats it would be better to provide
+ * a structure with some kind of bitmask to indicate which parts of the
+ * structure are valid.
+ */
+OWPStats
+OWPStatsCreate(
+        OWPContext          ctx,
+        FILE                *fp,
+        OWPSessionHeader    hdr,
+        char                *fromhost,
+        char                *tohost,
+        char                scale,
+        double              bucketwidth
+        )
+{
+    if(!fp){
+        OWPError(ctx,OWPErrFATAL,EINVAL,"OWPStatsCreate: Invalid fp");
+        return NULL;
+    }
+
+    return StatsCreate(ctx,fp,hdr,NULL,fromhost,tohost,scale,bucketwidth);
+}
+
+/*
+ * Function:    OWPStatsCreateFromHeader
+ *
+ * Description:    
+ *              Like OWPStatsCreate, but for a session that is not in a
+ *              file. hdr->test_spec.slots must point at the scheduling
+ *              slots, and skips at hdr->num_skiprecs skip records (both
+ *              are copied). The records are fed to the stats object with
+ *              OWPStatsParseBegin/OWPStatsParseRecords/OWPStatsParseEnd.
+ *
+ * In Args:    
+ *
+ * Out Args:    
+ *
+ * Scope:    
+ * Returns:    
+ * Side Effect:    
+ */
+OWPStats
+OWPStatsCreateFromHeader(
+        OWPContext          ctx,
+        OWPSessionHeader    hdr,
+        OWPSkip             skips,
+        char                *fromhost,
+        char                *tohost,
+        char                scale,
+        double              bucketwidth
+        )
+{
+    return StatsCreate(ctx,NULL,hdr,skips,fromhost,tohost,scale,bucketwidth);
+}
+
 static OWPBoolean
 PacketBeginFlush(
         OWPStats    stats
@@ -922,49 +1169,258 @@ flush:
     return keep_parsing;
 }
 
-static int
-IterateSummarizeSession(
-        OWPDataRec  *rec,
-        void        *cdata
+/*
+ * Reordering utility functions:
+ *
+ * n-reordering (as defined by RFC 4737 and the earlier j-reordering draft)
+ * is computed by finding the number (k) of consecutive most recent
+ * arrivals that had a larger seqno than the current packet. The current
+ * packet is then counted as 1..k-reordered. k is found using a stack
+ * of arrivals with non-decreasing seqno's. (An arrival can be popped when
+ * a packet with a smaller seqno arrives, because that packet will always be
+ * the more recent answer.) The 1..k range is added to a Fenwick tree so
+ * the cost does not depend on k.
+ *
+ * The RFC 4737 reordering extent is the distance in the arrival stream
+ * between a reordered packet and the earliest arrival with a larger seqno.
+ * That arrival must have advanced NextExp, so the list of arrivals that
+ * advanced NextExp (increasing in both seqno and arrival index) can be
+ * binary searched.
+ */
+#define RINDEX(b,i) (((b) + (i)) % stats->rlistlen)
+
+static void
+ReorderFenwickAdd(
+        OWPStats    stats,
+        long int    n,
+        uint32_t    val
         )
 {
-    OWPStats    stats = cdata;
-    OWPPacket   node;
-    double      d;
-    double      derr;
-    long int    i;
-
-    /*
-     * Mark the first offset that has a seq greater than currently
-     * interested in. This allows the caller to know what offset to
-     * use for the "beginning" of the next summary.
-     */
-    if(!stats->next_oset && (rec->seq_no >= stats->last)){
-        stats->next_oset = stats->begin_oset + stats->i * stats->hdr->rec_size;
+    for(;n <= stats->rlistlen;n += (n & -n)){
+        stats->rfen[n] += val;
     }
 
-    /* increase file index */
-    stats->i++;
+    return;
+}
 
-    /*
-     * return (cont processing) if this record is not part of this sum-session
-     *
-     * XXX: This may not be completely correct with respect to reordering...
-     * If the first packet of the "next" session takes place before the
-     * last packet of the "previous" session - should reordering be counted?
-     *
-     */ 
-    if((rec->seq_no < stats->first) || (rec->seq_no >= stats->last)){
-        return 0;
+static uint32_t
+ReorderFenwickSum(
+        OWPStats    stats,
+        long int    n
+        )
+{
+    uint32_t    sum = 0;
+
+    for(;n > 0;n -= (n & -n)){
+        sum += stats->rfen[n];
     }
 
-    /*
-     * Flush OWPPacket buffer before dealing with this packet so the buffer
-     * only holds as many records as is needed.
-     *
-     */
-    if(OWPIsLostRecord(rec)){
-        /*
+    return sum;
+}
+
+/*
+ * Function:    ReorderUpdate
+ *
+ * Description:    
+ *              Updates the n-reordering and RFC 4737 reordering
+ *              information for a newly arrived packet.
+ *
+ * In Args:    
+ *              dup indicates the packet has been seen before. Duplicates
+ *              are counted for n-reordering (as they always have been)
+ *              but are not part of the RFC 4737 metrics.
+ *
+ * Out Args:    
+ *
+ * Scope:    
+ * Returns:    
+ * Side Effect:    
+ */
+static void
+ReorderUpdate(
+        OWPStats    stats,
+        uint32_t    seq,
+        OWPBoolean  dup
+        )
+{
+    long int    n = stats->rnumseqno;
+    long int    k;
+    long int    lo,hi,mid;
+    OWPReorder  r;
+
+    /*
+     * n-reordering
+     */
+
+    /* forget arrivals that are outside the window */
+    while(stats->rstackn && (stats->rstack[stats->rstackb].idx <
+                n - stats->rlistlen)){
+        stats->rstackb = RINDEX(stats->rstackb,1);
+        stats->rstackn--;
+    }
+
+    /* pop arrivals with larger seqno's */
+    while(stats->rstackn && (stats->rstack[RINDEX(stats->rstackb,
+                    stats->rstackn-1)].seq > seq)){
+        stats->rstackn--;
+    }
+
+    if(stats->rstackn){
+        k = n - stats->rstack[RINDEX(stats->rstackb,stats->rstackn-1)].idx - 1;
+    }
+    else{
+        k = MIN(n,stats->rlistlen);
+    }
+
+    if(k > 0){
+        ReorderFenwickAdd(stats,1,1);
+        ReorderFenwickAdd(stats,k+1,(uint32_t)-1);
+    }
+
+    /* make room if full - bottom is the oldest arrival in the window */
+    if(stats->rstackn == stats->rlistlen){
+        stats->rstackb = RINDEX(stats->rstackb,1);
+        stats->rstackn--;
+    }
+    r = &stats->rstack[RINDEX(stats->rstackb,stats->rstackn)];
+    r->seq = seq;
+    r->idx = n;
+    stats->rstackn++;
+    stats->rnumseqno++;
+
+    if(dup){
+        return;
+    }
+
+    /*
+     * RFC 4737
+     */
+    n = stats->rnumrecv++;
+
+    while(stats->rhighn && (stats->rhigh[stats->rhighb].idx <
+                n - stats->rlistlen)){
+        stats->rhighexp = True;
+        stats->rhighexpseq = stats->rhigh[stats->rhighb].seq;
+        stats->rhighb = RINDEX(stats->rhighb,1);
+        stats->rhighn--;
+    }
+
+    if(seq >= stats->rnextexp){
+        /*
+         * In order. If seq is beyond NextExp, this is a sequence
+         * discontinuity. The gap between two discontinuities is only
+         * of interest if the first was followed by reordering (and not
+         * just loss).
+         */
+        if(seq > stats->rnextexp){
+            if(stats->rdisc_valid && stats->rdisc_reordered){
+                uint32_t    gap = seq - stats->rdisc_seq;
+
+                stats->rgap_num++;
+                stats->rgap_sum += gap;
+                stats->rgap_max = MAX(stats->rgap_max,gap);
+            }
+            stats->rdisc_seq = seq;
+            stats->rdisc_valid = True;
+            stats->rdisc_reordered = False;
+        }
+        stats->rnextexp = seq + 1;
+
+        if(stats->rhighn == stats->rlistlen){
+            stats->rhighexp = True;
+            stats->rhighexpseq = stats->rhigh[stats->rhighb].seq;
+            stats->rhighb = RINDEX(stats->rhighb,1);
+            stats->rhighn--;
+        }
+        r = &stats->rhigh[RINDEX(stats->rhighb,stats->rhighn)];
+        r->seq = seq;
+        r->idx = n;
+        stats->rhighn++;
+
+        return;
+    }
+
+    /*
+     * Reordered.
+     */
+    stats->rreordered++;
+    stats->rdisc_reordered = True;
+
+    /*
+     * If the earliest arrival with a larger seqno has left the window,
+     * the extent is too large to compute.
+     */
+    if(stats->rhighexp && (stats->rhighexpseq > seq)){
+        stats->rextent_unknown++;
+        return;
+    }
+
+    /* find first entry with seqno larger than seq */
+    lo = 0;
+    hi = stats->rhighn;
+    while(lo < hi){
+        mid = lo + (hi - lo) / 2;
+        if(stats->rhigh[RINDEX(stats->rhighb,mid)].seq > seq){
+            hi = mid;
+        }
+        else{
+            lo = mid + 1;
+        }
+    }
+    assert(lo < stats->rhighn);
+
+    k = n - stats->rhigh[RINDEX(stats->rhighb,lo)].idx;
+    stats->rextent_sum += k;
+    stats->rextent_max = MAX(stats->rextent_max,(uint32_t)k);
+
+    return;
+}
+
+#undef RINDEX
+
+static int
+IterateSummarizeSession(
+        OWPDataRec  *rec,
+        void        *cdata
+        )
+{
+    OWPStats    stats = cdata;
+    OWPPacket   node;
+    double      d;
+    double      derr;
+    long int    i;
+
+    /*
+     * Mark the first offset that has a seq greater than currently
+     * interested in. This allows the caller to know what offset to
+     * use for the "beginning" of the next summary.
+     */
+    if(!stats->next_oset && (rec->seq_no >= stats->last)){
+        stats->next_oset = stats->begin_oset + stats->i * stats->hdr->rec_size;
+    }
+
+    /* increase file index */
+    stats->i++;
+
+    /*
+     * return (cont processing) if this record is not part of this sum-session
+     *
+     * XXX: This may not be completely correct with respect to reordering...
+     * If the first packet of the "next" session takes place before the
+     * last packet of the "previous" session - should reordering be counted?
+     *
+     */ 
+    if((rec->seq_no < stats->first) || (rec->seq_no >= stats->last)){
+        return 0;
+    }
+
+    /*
+     * Flush OWPPacket buffer before dealing with this packet so the buffer
+     * only holds as many records as is needed.
+     *
+     */
+    if(OWPIsLostRecord(rec)){
+        /*
          * if current rec is lost, then all seq nums less than this one
          * can be flushed.
          */
@@ -1032,8 +1488,8 @@ IterateSummarizeSession(
         derr = OWPGetTimeStampError(&rec->recv);
         stats->maxerr = MAX(stats->maxerr,derr);
 
-        if(stats->output){
-            fprintf(stats->output,"seq_no=%-10u *LOST*\n", rec->seq_no);
+        if(stats->formatter && !OWPRecFormatterWrite(stats->formatter,rec)){
+            return -1;
         }
 
         return 0;
@@ -1058,17 +1514,9 @@ IterateSummarizeSession(
      * j-reordering. See:
      * http://www.internet2.edu/~shalunov/ippm/\
      *                          draft-shalunov-reordering-definition-02.txt
+     * and RFC 4737 reordering extent/gap.
      */
-#define rseqindex(x)    ((x) >= 0? x: x + stats->rlistlen)
-    for(i=0;i < MIN(stats->rnumseqno,stats->rlistlen) &&
-            rec->seq_no < stats->rseqno[rseqindex(stats->rindex-i-1)];i++){
-        stats->rn[i]++;
-    }
-    stats->rseqno[stats->rindex] = rec->seq_no;
-    stats->rnumseqno++;
-    stats->rindex++;
-    stats->rindex %= stats->rlistlen;
-#undef rseqindex
+    ReorderUpdate(stats,rec->seq_no,(node->seen > 1));
 
     /* sync */
     if(!rec->send.sync || !rec->recv.sync){
@@ -1089,32 +1537,8 @@ IterateSummarizeSession(
     /*
      * Print individual packet record
      */
-    if(stats->output){
-        if(rec->send.sync && rec->recv.sync){
-	  if (stats->display_unix_ts == True) {
-	    /* print using unix timestamp */
-	    double epochdiff = (OWPULongToNum64(OWPJAN_1970))>>32;
-	    fprintf(stats->output,
-		    "seq_no=%d delay=%e %s (sync, err=%.3g %s) sent=%f recv=%f\n",
-		    rec->seq_no, d*stats->scale_factor, stats->scale_abrv,
-		    derr*stats->scale_factor, stats->scale_abrv,
-		    OWPNum64ToDouble(rec->send.owptime) - epochdiff,
-		    OWPNum64ToDouble(rec->recv.owptime) - epochdiff
-		    );
-	  } 
-	  else {
-	    /* print the default */
-	    fprintf(stats->output,
-		    "seq_no=%-10u delay=%.3g %s\t(sync, err=%.3g %s)\n",
-		    rec->seq_no, d*stats->scale_factor, stats->scale_abrv,
-		    derr*stats->scale_factor,stats->scale_abrv);
-	  }
-        }
-        else{
-            fprintf(stats->output,
-                    "seq_no=%-10u delay=%.3g %s\t(unsync)\n",
-                    rec->seq_no, d*stats->scale_factor,stats->scale_abrv);
-        }
+    if(stats->formatter && !OWPRecFormatterWrite(stats->formatter,rec)){
+        return -1;
     }
 
     /*
@@ -1140,6 +1564,16 @@ IterateSummarizeSession(
         return -1;
     }
 
+    /*
+     * IPDV with neighboring seqno's
+     */
+    node->delay = d;
+    if( !IPDVUpdate(stats,node)){
+        OWPError(stats->ctx,OWPErrFATAL,EINVAL,
+                "IterateSummarizeSession: Unable to increment ipdv bucket");
+        return -1;
+    }
+
     /*
      * TTL info
      */
@@ -1178,44 +1612,88 @@ BucketBufferSortCmp(
     return (b1->b - b2->b);
 }
 
+/*
+ * Function:    BucketBufferSort
+ *
+ * Description:    
+ *              Fills a sort array with the buckets of the given hash,
+ *              (growing it if needed) and sorts it by bucket index.
+ *
+ * In Args:    
+ *
+ * Out Args:    
+ *
+ * Scope:    
+ * Returns:    
+ * Side Effect:    
+ */
 static OWPBoolean
-BucketBufferSortPercentile(
+BucketBufferSort(
         OWPStats    stats,
-        double      alpha,
-        double      *delay_ret
+        I2Table     table,
+        OWPBucket   **sortp,
+        uint32_t    *sortsizep,
+        uint32_t    *sortlenp
         )
 {
-    uint32_t    i;
-    double      sum=0;
+    struct BucketSortFillRec    fill;
 
-    assert((0.0 <= alpha) && (alpha <= 1.0));
-
-    for(i=0;
-            (i < stats->bsortsize) &&
-            ((stats->bsort[i]->n + sum) < (alpha * stats->sent));
-            i++){
-        sum += stats->bsort[i]->n;
+    /* alloc sort array */
+    *sortsizep = I2HashNumEntries(table);
+    if(*sortlenp < *sortsizep){
+        OWPBucket   *tbp;
+        if( (tbp = realloc(*sortp,sizeof(OWPBucket)*(*sortsizep)))){
+            *sortlenp = *sortsizep;
+            *sortp = tbp;
+        }
+        else{
+            OWPError(stats->ctx,OWPErrFATAL,errno,
+                    "OWPStatsParse: allocating memory for sort array: %M");
+            return False;
+        }
     }
 
-    if(i >= stats->bsortsize){
-        return False;
-    }
+    /* fill sort array with entries */
+    fill.sort = *sortp;
+    fill.i = 0;
+    I2HashIterate(table,BucketBufferSortFill,&fill);
+    assert(fill.i == *sortsizep);
+
+    /* sort */
+    qsort(*sortp,*sortsizep,sizeof(OWPBucket),BucketBufferSortCmp);
 
-    *delay_ret = stats->bsort[i]->b * stats->bucketwidth;
     return True;
 }
 
+/*
+ * Function:    OWPStatsParseBegin
+ *
+ * Description:    
+ *              Resets the statistics in stats for the sample range
+ *              [first,last), and prints the stats header to output. The
+ *              data records are then passed in with OWPStatsParseRecords,
+ *              in file order, and the statistics are completed with
+ *              OWPStatsParseEnd.
+ *
+ *              OWPStatsParse does all three steps for a stats object
+ *              created with OWPStatsCreate.
+ *
+ * In Args:    
+ *
+ * Out Args:    
+ *
+ * Scope:    
+ * Returns:    
+ * Side Effect:    
+ */
 OWPBoolean
-OWPStatsParse(
+OWPStatsParseBegin(
         OWPStats    stats,
         FILE        *output,
-        off_t       begin_oset,
         uint32_t    first,
         uint32_t    last
         )
 {
-    off_t       fileend;
-    uint32_t    nrecs;
     long int    i;
 
     if(last == (uint32_t)~0){
@@ -1227,7 +1705,7 @@ OWPStatsParse(
         return False;
     }
 
-    stats->begin_oset = begin_oset;
+    stats->begin_oset = 0;
     stats->next_oset = 0;
     stats->first = first;
     stats->last = last;
@@ -1235,48 +1713,10 @@ OWPStatsParse(
     stats->sent = 0;
 
     /*
-     * Initialize file record information: oset's/ record index/ nrecs
+     * Initialize record index
      */
-
     stats->i = 0;
 
-    /*
-     * determine end of packet records in file.
-     */
-    if(stats->hdr->oset_skiprecs > stats->hdr->oset_datarecs){
-        fileend = stats->hdr->oset_skiprecs;
-    }
-    else{
-        if(fseeko(stats->fp,0,SEEK_END) != 0){
-            OWPError(stats->ctx,OWPErrFATAL,errno,
-                    "OWPStatsParse: fseeko(): %M");
-            return False;
-        }
-        if((fileend = ftello(stats->fp)) < 0){
-            OWPError(stats->ctx,OWPErrFATAL,errno,
-                    "OWPStatsParse: ftello(): %M");
-            return False;
-        }
-    }
-
-    /* determine position of first record */
-    if(stats->begin_oset < stats->hdr->oset_datarecs){
-        stats->begin_oset = stats->hdr->oset_datarecs;
-    }
-
-    /* position fp to start */
-    if(fseeko(stats->fp,stats->begin_oset,SEEK_SET) != 0){
-        OWPError(stats->ctx,OWPErrFATAL,errno,
-                "OWPStatsParse: fseeko(): %M");
-        return False;
-    }
-
-    /* determine how many records to look through */
-    nrecs = (fileend - stats->begin_oset) / stats->hdr->rec_size;
-
-    if ((stats->rec_limit > 0) && (stats->rec_limit < nrecs))
-      nrecs = stats->rec_limit;
-
     /*
      * Initialize statistics variables
      */
@@ -1323,6 +1763,12 @@ OWPStatsParse(
 
     /* clean up */
     I2HashIterate(stats->btable,BucketBufferClean,stats);
+    I2HashIterate(stats->itable,IPDVBufferClean,stats);
+
+    /* ipdv */
+    stats->ipdv_n = 0;
+    stats->ipdv_min = stats->ipdv_max = 0.0;
+    stats->ipdv_sum = stats->ipdv_abssum = 0.0;
 
     /* ttl */
     for(i=0;i<256;i++){
@@ -1331,9 +1777,22 @@ OWPStatsParse(
 
     /* re-order buffers */
     for(i=0;i<stats->rlistlen;i++){
-        stats->rseqno[i]=0;
         stats->rn[i]=0;
-    }
+        stats->rfen[i+1]=0;
+    }
+    stats->rnumseqno = stats->rnumrecv = 0;
+    stats->rstackb = stats->rstackn = 0;
+    stats->rhighb = stats->rhighn = 0;
+    stats->rhighexp = False;
+    stats->rhighexpseq = 0;
+    stats->rnextexp = first;
+    stats->rreordered = 0;
+    stats->rextent_max = stats->rextent_unknown = 0;
+    stats->rextent_sum = 0;
+    stats->rdisc_seq = 0;
+    stats->rdisc_valid = stats->rdisc_reordered = False;
+    stats->rgap_num = stats->rgap_max = 0;
+    stats->rgap_sum = 0;
 
     /* init min_delay to +inf, max_delay to -inf */
     stats->inf_delay = OWPNum64ToDouble(stats->hdr->test_spec.loss_timeout + 1);
@@ -1348,50 +1807,113 @@ OWPStatsParse(
     stats->dups = stats->lost = 0;
 
     /*
-     * Iterate function to read all data
+     * Per-record output
      */
     PrintStatsHeader(stats,output);
     stats->output = output;
-    if(OWPParseRecords(stats->ctx,stats->fp,nrecs,stats->hdr->version,
-                IterateSummarizeSession,(void*)stats) != OWPErrOK){
-        OWPError(stats->ctx,OWPErrFATAL,OWPErrUNKNOWN,
-                "OWPStatsParse: iteration of data records failed");
+    if(output && !(stats->formatter = OWPRecFormatterCreate(stats->ctx,
+                    output,(stats->display_unix_ts)?
+                    OWPRecFmtUnixTS:OWPRecFmtDefault,stats->scale))){
         stats->output = NULL;
         return False;
     }
-    stats->output = NULL;
 
-    /*
-     * Process remaining buffered packet records
-     */
-    while(stats->pbegin && PacketBeginFlush(stats));
+    return True;
+}
 
-    /*
-     * Sort Delay histogram
-     */
+/*
+ * Function:    OWPStatsParseRecords
+ *
+ * Description:    
+ *              Adds the next nrecs data records of the session to the
+ *              statistics started with OWPStatsParseBegin. Once
+ *              stats->rec_limit records have been seen, the rest are
+ *              ignored.
+ *
+ * In Args:    
+ *
+ * Out Args:    
+ *
+ * Scope:    
+ * Returns:    
+ *              False on error.
+ * Side Effect:    
+ */
+OWPBoolean
+OWPStatsParseRecords(
+        OWPStats    stats,
+        OWPDataRec  *recs,
+        uint32_t    nrecs
+        )
+{
+    uint32_t    i;
 
-    /* alloc sort array */
-    stats->bsortsize = I2HashNumEntries(stats->btable);
-    if(stats->bsortlen < stats->bsortsize){
-        OWPBucket   *tbp;
-        if( (tbp = realloc(stats->bsort,sizeof(OWPBucket)*stats->bsortsize))){
-            stats->bsortlen = stats->bsortsize;
-            stats->bsort = tbp;
+    for(i=0;i<nrecs;i++){
+        if((stats->rec_limit > 0) && (stats->i >= stats->rec_limit)){
+            break;
         }
-        else{
-            OWPError(stats->ctx,OWPErrFATAL,errno,
-                    "OWPStatsParse: allocating memory for sort array: %M");
+        if(IterateSummarizeSession(&recs[i],stats) < 0){
+            OWPError(stats->ctx,OWPErrFATAL,OWPErrUNKNOWN,
+                    "OWPStatsParse: iteration of data records failed");
             return False;
         }
     }
 
-    /* fill sort array with entries */
-    stats->bsorti = 0;
-    I2HashIterate(stats->btable,BucketBufferSortFill,stats);
-    assert(stats->bsorti == stats->bsortsize);
-
-    /* sort */
-    qsort(stats->bsort,stats->bsortsize,sizeof(OWPBucket),BucketBufferSortCmp);
+    return True;
+}
+
+/*
+ * Function:    OWPStatsParseEnd
+ *
+ * Description:    
+ *              Completes the statistics started with OWPStatsParseBegin.
+ *              Must be called (even after an error) to release the
+ *              per-record output state.
+ *
+ * In Args:    
+ *
+ * Out Args:    
+ *
+ * Scope:    
+ * Returns:    
+ * Side Effect:    
+ */
+OWPBoolean
+OWPStatsParseEnd(
+        OWPStats    stats
+        )
+{
+    long int    i;
+    OWPBoolean  rc;
+
+    rc = OWPRecFormatterFree(stats->formatter);
+    stats->formatter = NULL;
+    stats->output = NULL;
+    if(!rc){
+        return False;
+    }
+
+    /*
+     * Process remaining buffered packet records
+     */
+    while(stats->pbegin && PacketBeginFlush(stats));
+
+    /*
+     * Fill in n-reordering counts
+     */
+    for(i=0;i<stats->rlistlen;i++){
+        stats->rn[i] = ReorderFenwickSum(stats,i+1);
+    }
+
+    /*
+     * Sort Delay and IPDV histograms
+     */
+    if( !BucketBufferSort(stats,stats->btable,&stats->bsort,
+                &stats->bsortsize,&stats->bsortlen) ||
+            !BucketBufferSort(stats,stats->itable,&stats->isort,
+                &stats->isortsize,&stats->isortlen)){
+        return False;
+    }
 
     /*
      * Stats structure now holds complete statistics information
@@ -1400,6 +1922,160 @@ OWPStatsParse(
     return True;
 }
 
+/*
+ * Release the per-record output state after a failed parse.
+ */
+static void
+StatsParseAbort(
+        OWPStats    stats
+        )
+{
+    (void)OWPRecFormatterFree(stats->formatter);
+    stats->formatter = NULL;
+    stats->output = NULL;
+}
+
+OWPBoolean
+OWPStatsParse(
+        OWPStats    stats,
+        FILE        *output,
+        off_t       begin_oset,
+        uint32_t    first,
+        uint32_t    last
+        )
+{
+    off_t       fileend;
+    off_t       ioset;
+    uint32_t    nrecs;
+    uint32_t    inrecs;
+
+    if(!stats->fp){
+        OWPError(stats->ctx,OWPErrFATAL,OWPErrINVALID,
+                "OWPStatsParse: stats object has no file");
+        return False;
+    }
+
+    if( !OWPStatsParseBegin(stats,output,first,last)){
+        return False;
+    }
+    first = stats->first;
+    last = stats->last;
+    stats->begin_oset = begin_oset;
+
+    /*
+     * determine end of packet records in file.
+     */
+    if(stats->hdr->oset_skiprecs > stats->hdr->oset_datarecs){
+        fileend = stats->hdr->oset_skiprecs;
+    }
+    else if(stats->hdr->finished == OWP_SESSION_FINISHED_NORMAL){
+        /* finished files can end with a block index */
+        fileend = stats->hdr->oset_datarecs +
+            (off_t)stats->hdr->num_datarecs * stats->hdr->rec_size;
+    }
+    else{
+        if(fseeko(stats->fp,0,SEEK_END) != 0){
+            OWPError(stats->ctx,OWPErrFATAL,errno,
+                    "OWPStatsParse: fseeko(): %M");
+            goto error;
+        }
+        if((fileend = ftello(stats->fp)) < 0){
+            OWPError(stats->ctx,OWPErrFATAL,errno,
+                    "OWPStatsParse: ftello(): %M");
+            goto error;
+        }
+    }
+
+    /* determine position of first record */
+    if(stats->begin_oset < stats->hdr->oset_datarecs){
+        stats->begin_oset = stats->hdr->oset_datarecs;
+    }
+
+    /*
+     * Version 4 records are not at fixed offsets. Parse from the first
+     * block; records outside [first,last) are ignored as usual.
+     */
+    if(stats->hdr->version == 4){
+        stats->begin_oset = stats->hdr->oset_datarecs;
+        fileend = stats->begin_oset +
+            (off_t)stats->hdr->num_datarecs * stats->hdr->rec_size;
+    }
+
+    /*
+     * If the file is indexed, only read the records that can be in
+     * [first,last).
+     */
+    if((stats->hdr->finished == OWP_SESSION_FINISHED_NORMAL) &&
+            (first < last) &&
+            OWPReadDataIndex(stats->ctx,stats->fp,stats->hdr->num_datarecs,
+                OWP_DATAINDEX_SEQ,first,last-1,&ioset,&inrecs)){
+        if(!inrecs){
+            fileend = stats->begin_oset;
+        }
+        else if(stats->hdr->version == 4){
+            stats->begin_oset = ioset;
+            fileend = ioset + (off_t)inrecs * stats->hdr->rec_size;
+        }
+        else{
+            stats->begin_oset = MAX(stats->begin_oset,ioset);
+            fileend = MIN(fileend,ioset + (off_t)inrecs*stats->hdr->rec_size);
+            fileend = MAX(fileend,stats->begin_oset);
+        }
+    }
+
+    /* position fp to start */
+    if(fseeko(stats->fp,stats->begin_oset,SEEK_SET) != 0){
+        OWPError(stats->ctx,OWPErrFATAL,errno,
+                "OWPStatsParse: fseeko(): %M");
+        goto error;
+    }
+
+    /* determine how many records to look through */
+    nrecs = (fileend - stats->begin_oset) / stats->hdr->rec_size;
+
+    if ((stats->rec_limit > 0) && (stats->rec_limit < nrecs))
+      nrecs = stats->rec_limit;
+
+    /*
+     * Iterate function to read all data
+     */
+    if(OWPParseRecords(stats->ctx,stats->fp,nrecs,stats->hdr->version,
+                IterateSummarizeSession,(void*)stats) != OWPErrOK){
+        OWPError(stats->ctx,OWPErrFATAL,OWPErrUNKNOWN,
+                "OWPStatsParse: iteration of data records failed");
+        goto error;
+    }
+
+    return OWPStatsParseEnd(stats);
+
+error:
+    StatsParseAbort(stats);
+    return False;
+}
+
+/*
+ * Summarize the records of the session with a send time in [begin,end)
+ * without going through the full parse. Ranges aligned with the groups
+ * of the session index are answered from the per-group summaries; only
+ * the groups at the edges are parsed. (See OWPReadDataSummary.)
+ */
+OWPBoolean
+OWPStatsSummarizeRange(
+        OWPStats        stats,
+        OWPNum64        begin,
+        OWPNum64        end,
+        OWPDataSummary  sum
+        )
+{
+    if(!stats->fp){
+        OWPError(stats->ctx,OWPErrFATAL,OWPErrINVALID,
+                "OWPStatsSummarizeRange: stats object has no file");
+        return False;
+    }
+
+    return OWPReadDataSummary(stats->ctx,stats->fp,stats->hdr,begin,end,sum);
+}
+
 /*
  * Return the correct scale factor to use for the given scale indication.
  * The abbreviation used for this scale is returned, if abrv is non-null
@@ -1457,16 +2133,61 @@ OWPStatsPrintSummary(
         float       *percentiles,
         uint32_t   npercentiles
         )
+{
+    OWPStatsResult  result;
+    OWPBoolean      rc;
+
+    if( !(result = OWPStatsResultCreate(stats))){
+        return False;
+    }
+
+    rc = OWPStatsResultPrintSummary(stats->ctx,result,output,stats->scale,
+            percentiles,npercentiles);
+
+    OWPStatsResultFree(result);
+
+    return rc;
+}
+
+/*
+ * Function:    OWPStatsResultPrintSummary
+ *
+ * Description:    
+ *              Prints the human-readable (owping) form of a result
+ *              record. Values are printed in the units given by scale.
+ *              (See OWPStatsScaleFactor.)
+ *
+ * In Args:    
+ *
+ * Out Args:    
+ *
+ * Scope:    
+ * Returns:    
+ * Side Effect:    
+ */
+OWPBoolean
+OWPStatsResultPrintSummary(
+        OWPContext      ctx,
+        OWPStatsResult  result,
+        FILE            *output,
+        char            scale,
+        float           *percentiles,
+        uint32_t        npercentiles
+        )
 {
     long int        i;
     uint32_t        ui;
     uint8_t    	    nttl=0;
     uint8_t    	    minttl=255;
     uint8_t    	    maxttl=0;
+    char            sid_name[sizeof(OWPSID)*2+1];
     char            minval[80];
     char            maxval[80];
     char            n1val[80];
     double          d1, d2;
+    float           scale_factor;
+    char            scale_abrv[3];
+    size_t          s;
     struct timespec sspec;
     struct timespec espec;
     struct timespec *sspecp,*especp;
@@ -1475,7 +2196,17 @@ OWPStatsPrintSummary(
     char            stval[50],etval[50];
     OWPTimeStamp    ttstamp;
 
-    PrintStatsHeader(stats,output);
+    s = sizeof(scale_abrv);
+    if( !(scale_factor = OWPStatsScaleFactor(scale,scale_abrv,&s))){
+        OWPError(ctx,OWPErrFATAL,EINVAL,
+                "OWPStatsResultPrintSummary: Invalid scale \'%c\'",scale);
+        return False;
+    }
+
+    fprintf(output,"\n--- owping statistics from [%s]:%s to [%s]:%s ---\n",
+            result->fromhost,result->fromserv,result->tohost,result->toserv);
+    I2HexEncode(sid_name,result->sid,sizeof(OWPSID));
+    fprintf(output,"SID:\t%s\n",sid_name);
 
     /*
      * Print out timerange
@@ -1486,37 +2217,37 @@ OWPStatsPrintSummary(
     memset(&espec,0,sizeof(espec));
 
     /* set start-time string */
-    ttstamp.owptime = stats->start_time;
+    ttstamp.owptime = result->start_time;
     if( !(sspecp = OWPTimestampToTimespec(&sspec,&ttstamp))){
-        OWPError(stats->ctx,OWPErrWARNING,errno,
+        OWPError(ctx,OWPErrWARNING,errno,
                     "OWPStatsPrintSummary: OWPTimestampToTimespec(): Unable to convert time value");
         strncpy(stval,"XXX",sizeof(stval));
     }
     else if( !(stmp = localtime_r(&sspecp->tv_sec,&stm))){
-        OWPError(stats->ctx,OWPErrWARNING,errno,
+        OWPError(ctx,OWPErrWARNING,errno,
                     "OWPStatsPrintSummary: localtime_r(): Unable to convert time value");
         strncpy(stval,"XXX",sizeof(stval));
     }
     else if( !strftime(stval,sizeof(stval),"%FT%T",stmp)){
-        OWPError(stats->ctx,OWPErrWARNING,errno,
+        OWPError(ctx,OWPErrWARNING,errno,
                     "OWPStatsPrintSummary: strftime(): Unable to convert time value");
         strncpy(stval,"XXX",sizeof(stval));
     }
 
     /* set end-time string */
-    ttstamp.owptime = stats->end_time;
+    ttstamp.owptime = result->end_time;
     if( !(especp = OWPTimestampToTimespec(&espec,&ttstamp))){
-        OWPError(stats->ctx,OWPErrWARNING,errno,
+        OWPError(ctx,OWPErrWARNING,errno,
                     "OWPStatsPrintSummary: OWPTimestampToTimespec(): Unable to convert time value");
         strncpy(etval,"XXX",sizeof(etval));
     }
     else if( !(etmp = localtime_r(&especp->tv_sec,&etm))){
-        OWPError(stats->ctx,OWPErrWARNING,errno,
+        OWPError(ctx,OWPErrWARNING,errno,
                     "OWPStatsPrintSummary: localtime_r(): Unable to convert time value");
         strncpy(etval,"XXX",sizeof(etval));
     }
     else if( !strftime(etval,sizeof(etval),"%FT%T",etmp)){
-        OWPError(stats->ctx,OWPErrWARNING,errno,
+        OWPError(ctx,OWPErrWARNING,errno,
                     "OWPStatsPrintSummary: strftime(): Unable to convert time value");
         strncpy(etval,"XXX",sizeof(etval));
     }
@@ -1533,14 +2264,9 @@ OWPStatsPrintSummary(
     /*
      * lost % is 0 if sent == 0.
      */
-    if(stats->sent > 0){
-        d1 = (double)stats->lost/stats->sent;
-    }
-    else{
-        d1 = 0.0;
-    }
     fprintf(output,"%u sent, %u lost (%.3f%%), %u duplicates\n",
-            stats->sent,stats->lost,100.0*d1,stats->dups);
+            result->sent,result->lost,100.0*OWPStatsResultLossRatio(result),
+            result->dups);
 
     /*
      * Min, Median
@@ -1549,43 +2275,41 @@ OWPStatsPrintSummary(
     /*
      * parse min/max - Sure would be easier if C99 soft-float were portable...
      * XXX: Just use NAN as the float value once that works everywhere!
-     *      (BucketBufferSortPercentile would be WAY easier!!!)
      */
-    if(stats->min_delay >= stats->inf_delay){
+    if(!result->have_delay){
         strncpy(minval,"nan",sizeof(minval));
-    }
-    else if( (snprintf(minval,sizeof(minval),"%.3g",
-                    stats->min_delay * stats->scale_factor) < 0)){
-        OWPError(stats->ctx,OWPErrWARNING,errno,
-                    "OWPStatsPrintSummary: snprintf(): %M");
-        strncpy(minval,"XXX",sizeof(minval));
-    }
-    if(stats->max_delay <= -stats->inf_delay){
         strncpy(maxval,"nan",sizeof(maxval));
     }
-    else if( (snprintf(maxval,sizeof(maxval),"%.3g",
-                    stats->max_delay * stats->scale_factor) < 0)){
-        OWPError(stats->ctx,OWPErrWARNING,errno,
+    else{
+        if( (snprintf(minval,sizeof(minval),"%.3g",
+                        result->min_delay * scale_factor) < 0)){
+            OWPError(ctx,OWPErrWARNING,errno,
+                    "OWPStatsPrintSummary: snprintf(): %M");
+            strncpy(minval,"XXX",sizeof(minval));
+        }
+        if( (snprintf(maxval,sizeof(maxval),"%.3g",
+                        result->max_delay * scale_factor) < 0)){
+            OWPError(ctx,OWPErrWARNING,errno,
                     "OWPStatsPrintSummary: snprintf(): %M");
-        strncpy(maxval,"XXX",sizeof(maxval));
+            strncpy(maxval,"XXX",sizeof(maxval));
+        }
     }
 
-    if( !BucketBufferSortPercentile(stats,0.5,&d1)){
+    if( !OWPStatsResultPercentile(result,0.5,&d1)){
         strncpy(n1val,"nan",sizeof(n1val));
     }
-    else if(snprintf(n1val,sizeof(n1val),"%.3g",
-                      d1 * stats->scale_factor) < 0){
-        OWPError(stats->ctx,OWPErrWARNING,errno,
+    else if(snprintf(n1val,sizeof(n1val),"%.3g",d1 * scale_factor) < 0){
+        OWPError(ctx,OWPErrWARNING,errno,
                     "OWPStatsPrintSummary: snprintf(): %M");
         strncpy(n1val,"XXX",sizeof(n1val));
     }
 
 
     fprintf(output,"one-way delay min/median/max = %s/%s/%s %s, ",
-            minval,n1val,maxval,stats->scale_abrv);
-    if(stats->sync){
-        fprintf(output,"(err=%.3g %s)\n",stats->maxerr * stats->scale_factor,
-                stats->scale_abrv);
+            minval,n1val,maxval,scale_abrv);
+    if(result->sync){
+        fprintf(output,"(err=%.3g %s)\n",result->maxerr * scale_factor,
+                scale_abrv);
     }
     else{
         fprintf(output,"(unsync)\n");
@@ -1595,18 +2319,44 @@ OWPStatsPrintSummary(
     /*
      * "jitter"
      */
-    if( !BucketBufferSortPercentile(stats,0.95,&d1) ||
-        !BucketBufferSortPercentile(stats,0.5,&d2)){
+    if( !OWPStatsResultPercentile(result,0.95,&d1) ||
+        !OWPStatsResultPercentile(result,0.5,&d2)){
         strncpy(n1val,"nan",sizeof(n1val));
     }
-    else if(snprintf(n1val,sizeof(n1val),"%.3g",
-                      (d1-d2) * stats->scale_factor) < 0){
-        OWPError(stats->ctx,OWPErrWARNING,errno,
+    else if(snprintf(n1val,sizeof(n1val),"%.3g",(d1-d2) * scale_factor) < 0){
+        OWPError(ctx,OWPErrWARNING,errno,
                     "OWPStatsPrintSummary: snprintf(): %M");
         strncpy(n1val,"XXX",sizeof(n1val));
     }
-    fprintf(output,"one-way jitter = %s %s (P95-P50)\n",
-            n1val,stats->scale_abrv);
+    fprintf(output,"one-way jitter = %s %s (P95-P50)\n",n1val,scale_abrv);
+
+    /*
+     * ipdv (RFC 3393) between consecutive seqno's
+     */
+    if(result->ipdv_n){
+        if( !OWPStatsResultIPDVPercentile(result,0.5,&d1)){
+            strncpy(n1val,"nan",sizeof(n1val));
+        }
+        else if(snprintf(n1val,sizeof(n1val),"%.3g",d1 * scale_factor) < 0){
+            OWPError(ctx,OWPErrWARNING,errno,
+                    "OWPStatsPrintSummary: snprintf(): %M");
+            strncpy(n1val,"XXX",sizeof(n1val));
+        }
+        fprintf(output,"one-way ipdv min/median/max = %.3g/%s/%.3g %s, "
+                "mean |ipdv| = %.3g %s\n",
+                result->ipdv_min * scale_factor,n1val,
+                result->ipdv_max * scale_factor,scale_abrv,
+                result->ipdv_abssum / result->ipdv_n * scale_factor,
+                scale_abrv);
+    }
+
+    /*
+     * pdv (relative to the minimum delay)
+     */
+    if(result->have_delay && OWPStatsResultPercentile(result,0.95,&d1)){
+        fprintf(output,"one-way pdv = %.3g %s (P95-min)\n",
+                (d1 - result->min_delay) * scale_factor,scale_abrv);
+    }
 
     /*
      * Print out random percentiles
@@ -1614,17 +2364,17 @@ OWPStatsPrintSummary(
     if(npercentiles){
         fprintf(output,"Percentiles:\n");
         for(ui=0;ui<npercentiles;ui++){
-            if( !BucketBufferSortPercentile(stats,percentiles[ui]/100.0,&d1)){
+            if( !OWPStatsResultPercentile(result,percentiles[ui]/100.0,&d1)){
                 strncpy(n1val,"nan",sizeof(n1val));
             }
             else if(snprintf(n1val,sizeof(n1val),"%.3g",
-                        d1 * stats->scale_factor) < 0){
-                OWPError(stats->ctx,OWPErrWARNING,errno,
+                        d1 * scale_factor) < 0){
+                OWPError(ctx,OWPErrWARNING,errno,
                         "OWPStatsPrintSummary: snprintf(): %M");
                 strncpy(n1val,"XXX",sizeof(n1val));
             }
             fprintf(output,"\t%.1f: %s %s\n",
-                    percentiles[ui],n1val,stats->scale_abrv);
+                    percentiles[ui],n1val,scale_abrv);
         }
     }
 
@@ -1632,7 +2382,7 @@ OWPStatsPrintSummary(
      * Report ttl's
      */
     for(i=0;i<255;i++){
-        if(!stats->ttl_count[i])
+        if(!result->ttl_count[i])
             continue;
         nttl++;
         if(i<minttl)
@@ -1653,20 +2403,46 @@ OWPStatsPrintSummary(
     }
 
     /*
-     * Report j-reordering
+     * Report j-reordering (reordering only holds the non-zero prefix)
      */
-    for(i=0;((i<stats->rlistlen) && (stats->rn[i]));i++){
-        fprintf(output,"%ld-reordering = %f%%\n",i+1,
-                100.0*stats->rn[i]/(stats->rnumseqno));
+    for(ui=0;ui<result->nreordering;ui++){
+        fprintf(output,"%u-reordering = %f%%\n",ui+1,
+                100.0*result->reordering[ui]/(result->narrived));
     }
-    if(i==0){
+    if(ui==0){
         fprintf(output,"no reordering\n");
     }
-    else if(i < stats->rlistlen){
-        fprintf(output,"no %ld-reordering\n", i+1);
+    else if(ui < result->reorder_window){
+        fprintf(output,"no %u-reordering\n", ui+1);
     }
     else{
-        fprintf(output,"%ld-reordering not handled\n",stats->rlistlen+1);
+        fprintf(output,"%u-reordering not handled\n",result->reorder_window+1);
+    }
+
+    /*
+     * Report RFC 4737 reordering extent/gap
+     */
+    if(result->reordered){
+        uint32_t    nextent = result->reordered - result->extent_unknown;
+
+        fprintf(output,"reordered = %f%%, ",
+                100.0*result->reordered/result->nrecv);
+        if(nextent){
+            fprintf(output,"extent mean/max = %.3g/%u packets",
+                    (double)result->extent_sum/nextent,result->extent_max);
+        }
+        else{
+            fprintf(output,"extent mean/max = nan/nan packets");
+        }
+        if(result->extent_unknown){
+            fprintf(output," (%u > %u)",result->extent_unknown,
+                    result->reorder_window);
+        }
+        fprintf(output,"\n");
+        if(result->gap_num){
+            fprintf(output,"reordering gap mean/max = %.3g/%u packets\n",
+                    (double)result->gap_sum/result->gap_num,result->gap_max);
+        }
     }
 
     fprintf(output,"\n");
@@ -1675,97 +2451,458 @@ OWPStatsPrintSummary(
 }
 
 /*
- * Program-readable statistics summary
+ * Function:    OWPStatsResultCreate
+ *
+ * Description:    
+ *              Copies the results of the most recent OWPStatsParse into
+ *              a self contained result record. The record does not
+ *              reference the stats object, so it can be kept after the
+ *              stats object is re-used or freed.
+ *
+ * In Args:    
+ *
+ * Out Args:    
+ *
+ * Scope:    
+ * Returns:    
+ *              NULL on failure.
+ * Side Effect:    
  */
-OWPBoolean
-OWPStatsPrintMachine(
-        OWPStats    stats,
-        FILE        *output
+OWPStatsResult
+OWPStatsResultCreate(
+        OWPStats    stats
         )
 {
-    /* Version 3.0 of stats output */
-    float       version=3.0;
-    char        sid_name[sizeof(OWPSID)*2+1];
-    uint32_t    i;
-    long int    j;
-    uint8_t     nttl=0;
-    uint8_t     minttl=255;
-    uint8_t     maxttl=0;
-
-    I2HexEncode(sid_name,stats->hdr->sid,sizeof(OWPSID));
+    char            *func = "OWPStatsResultCreate";
+    OWPStatsResult  result;
+    uint32_t        i;
+    long int        j;
 
+    if( !(result = calloc(1,sizeof(OWPStatsResultRec)))){
+        OWPError(stats->ctx,OWPErrFATAL,errno,"%s: calloc(): %M",func);
+        return NULL;
+    }
 
     /*
-     * Basic session information
+     * Session information
      */
-    fprintf(output,"SUMMARY\t%.2f\n",version);
-    fprintf(output,"SID\t%s\n",sid_name);
-    fprintf(output,"FROM_HOST\t%s\n",stats->fromhost);
-    fprintf(output,"FROM_ADDR\t%s\n",stats->fromaddr);
-    fprintf(output,"FROM_PORT\t%s\n",stats->fromserv);
-    fprintf(output,"TO_HOST\t%s\n",stats->tohost);
-    fprintf(output,"TO_ADDR\t%s\n",stats->toaddr);
-    fprintf(output,"TO_PORT\t%s\n",stats->toserv);
-
-    fprintf(output,"START_TIME\t" OWP_TSTAMPFMT "\n",stats->start_time);
-    fprintf(output,"END_TIME\t" OWP_TSTAMPFMT "\n",stats->end_time);
-    
-    /* print unix versions of timestamp */
-    if (stats->display_unix_ts == True) {
-        double epochdiff = (OWPULongToNum64(OWPJAN_1970))>>32;
-        fprintf(output,"UNIX_START_TIME\t%f\n", OWPNum64ToDouble(stats->start_time) - epochdiff);
-        fprintf(output,"UNIX_END_TIME\t%f\n", OWPNum64ToDouble(stats->end_time) - epochdiff);
-    }
+    memcpy(result->sid,stats->hdr->sid,sizeof(OWPSID));
+    strcpy(result->fromhost,stats->fromhost);
+    strcpy(result->fromaddr,stats->fromaddr);
+    strcpy(result->fromserv,stats->fromserv);
+    strcpy(result->tohost,stats->tohost);
+    strcpy(result->toaddr,stats->toaddr);
+    strcpy(result->toserv,stats->toserv);
+    result->start_time = stats->start_time;
+    result->end_time = stats->end_time;
+    result->display_unix_ts = stats->display_unix_ts;
+    result->typeP = stats->hdr->test_spec.typeP;
+    result->loss_timeout = stats->hdr->test_spec.loss_timeout;
+    result->packet_padding = stats->hdr->test_spec.packet_size_padding;
+    result->session_npackets = stats->hdr->test_spec.npackets;
+    result->sample_npackets = stats->last - stats->first;
+    result->bucketwidth = stats->bucketwidth;
+    result->finished = (stats->hdr->finished == OWP_SESSION_FINISHED_NORMAL);
 
     /*
-     * If typeP is specified as a DSCP code-byte, then output it too.
-     * (If any bits are set outside of the low-order 6 bits of the
-     * high-order byte, then it is not a DSCP.)
+     * Counts
      */
-    if( !(stats->hdr->test_spec.typeP & ~0x3F000000)){
-        uint8_t dscp = stats->hdr->test_spec.typeP >> 24;
-        fprintf(output,"DSCP\t0x%2.2x\n",dscp);
-    }
-    fprintf(output,"LOSS_TIMEOUT\t%"PRIu64"\n",stats->hdr->test_spec.loss_timeout);
-    fprintf(output,"PACKET_PADDING\t%u\n",
-            stats->hdr->test_spec.packet_size_padding);
-    fprintf(output,"SESSION_PACKET_COUNT\t%u\n",stats->hdr->test_spec.npackets);
-    fprintf(output,"SAMPLE_PACKET_COUNT\t%u\n", stats->last - stats->first);
-    fprintf(output,"BUCKET_WIDTH\t%g\n",stats->bucketwidth);
-    fprintf(output,"SESSION_FINISHED\t%d\n",
-            (stats->hdr->finished == OWP_SESSION_FINISHED_NORMAL)?1:0);
+    result->sent = stats->sent;
+    result->lost = stats->lost;
+    result->dups = stats->dups;
+    result->sync = (stats->sync)? True: False;
+    result->maxerr = stats->maxerr;
 
     /*
-     * Summary results
+     * Delay
      */
-    fprintf(output,"SENT\t%u\n",stats->sent);
-    fprintf(output,"SYNC\t%" PRIuPTR "\n",stats->sync);
-    fprintf(output,"MAXERR\t%g\n",stats->maxerr);
-    fprintf(output,"DUPS\t%u\n",stats->dups);
-    fprintf(output,"LOST\t%u\n",stats->lost);
-
     if(stats->min_delay < stats->inf_delay){
-        fprintf(output,"MIN\t%g\n",stats->min_delay);
-    }
-    if(stats->max_delay > -stats->inf_delay){
-        fprintf(output,"MAX\t%g\n",stats->max_delay);
+        result->have_delay = True;
+        result->min_delay = stats->min_delay;
+        result->max_delay = stats->max_delay;
+    }
+    if(stats->bsortsize){
+        if( !(result->buckets = calloc(stats->bsortsize,
+                        sizeof(OWPStatsBucketRec)))){
+            OWPError(stats->ctx,OWPErrFATAL,errno,"%s: calloc(): %M",func);
+            goto error;
+        }
+        for(i=0;i<stats->bsortsize;i++){
+            result->buckets[i].b = stats->bsort[i]->b;
+            result->buckets[i].n = stats->bsort[i]->n;
+        }
+        result->nbuckets = stats->bsortsize;
     }
 
     /*
-     * Delay histogram
+     * IPDV
      */
-    if(stats->sent > stats->lost){
-        fprintf(output,"<BUCKETS>\n");
-        I2HashIterate(stats->btable,BucketBufferPrint,output);
-        fprintf(output,"</BUCKETS>\n");
+    result->ipdv_n = stats->ipdv_n;
+    result->ipdv_min = stats->ipdv_min;
+    result->ipdv_max = stats->ipdv_max;
+    result->ipdv_sum = stats->ipdv_sum;
+    result->ipdv_abssum = stats->ipdv_abssum;
+    if(stats->isortsize){
+        if( !(result->ipdvbuckets = calloc(stats->isortsize,
+                        sizeof(OWPStatsBucketRec)))){
+            OWPError(stats->ctx,OWPErrFATAL,errno,"%s: calloc(): %M",func);
+            goto error;
+        }
+        for(i=0;i<stats->isortsize;i++){
+            result->ipdvbuckets[i].b = stats->isort[i]->b;
+            result->ipdvbuckets[i].n = stats->isort[i]->n;
+        }
+        result->nipdvbuckets = stats->isortsize;
     }
 
     /*
-     * TTL histogram
+     * TTL
      */
-    for(i=0;i<255;i++){
-        if(!stats->ttl_count[i])
-            continue;
+    for(i=0;i<256;i++){
+        result->ttl_count[i] = stats->ttl_count[i];
+    }
+
+    /*
+     * Reordering (only the non-zero prefix of rn is interesting)
+     */
+    result->reorder_window = stats->rlistlen;
+    result->narrived = stats->rnumseqno;
+    for(j=0;((j<stats->rlistlen) && (stats->rn[j]));j++);
+    if(j){
+        if( !(result->reordering = calloc(j,sizeof(uint32_t)))){
+            OWPError(stats->ctx,OWPErrFATAL,errno,"%s: calloc(): %M",func);
+            goto error;
+        }
+        memcpy(result->reordering,stats->rn,j*sizeof(uint32_t));
+        result->nreordering = j;
+    }
+    result->nrecv = stats->rnumrecv;
+    result->reordered = stats->rreordered;
+    result->extent_max = stats->rextent_max;
+    result->extent_sum = stats->rextent_sum;
+    result->extent_unknown = stats->rextent_unknown;
+    result->gap_num = stats->rgap_num;
+    result->gap_max = stats->rgap_max;
+    result->gap_sum = stats->rgap_sum;
+
+    return result;
+
+error:
+    OWPStatsResultFree(result);
+
+    return NULL;
+}
+
+/*
+ * Function:    OWPStatsResultFree
+ *
+ * Description:    
+ *              Frees a result record allocated by OWPStatsResultCreate
+ *              or OWPStatsResultRead.
+ *
+ * In Args:    
+ *
+ * Out Args:    
+ *
+ * Scope:    
+ * Returns:    
+ * Side Effect:    
+ */
+void
+OWPStatsResultFree(
+        OWPStatsResult  result
+        )
+{
+    if(!result)
+        return;
+
+    if(result->buckets){
+        free(result->buckets);
+    }
+    if(result->ipdvbuckets){
+        free(result->ipdvbuckets);
+    }
+    if(result->reordering){
+        free(result->reordering);
+    }
+    free(result);
+
+    return;
+}
+
+static OWPBoolean
+ResultBucketPercentile(
+        OWPStatsBucketRec   *buckets,
+        uint32_t            nbuckets,
+        uint32_t            nsamples,
+        double              bucketwidth,
+        double              alpha,
+        double              *delay_ret
+        )
+{
+    uint32_t    i;
+    double      sum=0;
+
+    if((alpha < 0.0) || (alpha > 1.0)){
+        return False;
+    }
+
+    for(i=0;
+            (i < nbuckets) && ((buckets[i].n + sum) < (alpha * nsamples));
+            i++){
+        sum += buckets[i].n;
+    }
+
+    if(i >= nbuckets){
+        return False;
+    }
+
+    *delay_ret = buckets[i].b * bucketwidth;
+    return True;
+}
+
+/*
+ * Function:    OWPStatsResultPercentile
+ *
+ * Description:    
+ *              Returns the alpha percentile of delay. (Lost packets are
+ *              treated as infinite delay, so this will fail if alpha
+ *              lands in the lost packets.)
+ *
+ * In Args:    
+ *
+ * Out Args:    
+ *
+ * Scope:    
+ * Returns:    
+ * Side Effect:    
+ */
+OWPBoolean
+OWPStatsResultPercentile(
+        OWPStatsResult  result,
+        double          alpha,
+        double          *delay_ret
+        )
+{
+    return ResultBucketPercentile(result->buckets,result->nbuckets,
+            result->sent,result->bucketwidth,alpha,delay_ret);
+}
+
+/*
+ * Function:    OWPStatsResultIPDVPercentile
+ *
+ * Description:    
+ *              Returns the alpha percentile of ipdv.
+ *
+ * In Args:    
+ *
+ * Out Args:    
+ *
+ * Scope:    
+ * Returns:    
+ * Side Effect:    
+ */
+OWPBoolean
+OWPStatsResultIPDVPercentile(
+        OWPStatsResult  result,
+        double          alpha,
+        double          *ipdv_ret
+        )
+{
+    return ResultBucketPercentile(result->ipdvbuckets,result->nipdvbuckets,
+            result->ipdv_n,result->bucketwidth,alpha,ipdv_ret);
+}
+
+/*
+ * Function:    OWPStatsResultLossRatio
+ *
+ * Description:    
+ *              Fraction of sent packets that were lost.
+ *
+ * In Args:    
+ *
+ * Out Args:    
+ *
+ * Scope:    
+ * Returns:    
+ * Side Effect:    
+ */
+double
+OWPStatsResultLossRatio(
+        OWPStatsResult  result
+        )
+{
+    if(!result->sent){
+        return 0.0;
+    }
+
+    return (double)result->lost / result->sent;
+}
+
+/*
+ * Program-readable statistics summary
+ */
+OWPBoolean
+OWPStatsPrintMachine(
+        OWPStats    stats,
+        FILE        *output
+        )
+{
+    OWPStatsResult  result;
+    OWPBoolean      rc;
+
+    if( !(result = OWPStatsResultCreate(stats))){
+        return False;
+    }
+
+    rc = OWPStatsResultPrintMachine(result,output);
+
+    OWPStatsResultFree(result);
+
+    return rc;
+}
+
+/*
+ * Function:    OWPStatsResultPrintMachine
+ *
+ * Description:    
+ *              Prints the key/value text form of a result record. (This
+ *              is the format of the powstream .sum files.)
+ *
+ * In Args:    
+ *
+ * Out Args:    
+ *
+ * Scope:    
+ * Returns:    
+ * Side Effect:    
+ */
+OWPBoolean
+OWPStatsResultPrintMachine(
+        OWPStatsResult  result,
+        FILE            *output
+        )
+{
+    /* Version 3.0 of stats output */
+    float       version=3.0;
+    char        sid_name[sizeof(OWPSID)*2+1];
+    uint32_t    i;
+    uint32_t    nttl=0;
+    uint32_t    minttl=255;
+    uint32_t    maxttl=0;
+    double      d;
+
+    I2HexEncode(sid_name,result->sid,sizeof(OWPSID));
+
+
+    /*
+     * Basic session information
+     */
+    fprintf(output,"SUMMARY\t%.2f\n",version);
+    fprintf(output,"SID\t%s\n",sid_name);
+    fprintf(output,"FROM_HOST\t%s\n",result->fromhost);
+    fprintf(output,"FROM_ADDR\t%s\n",result->fromaddr);
+    fprintf(output,"FROM_PORT\t%s\n",result->fromserv);
+    fprintf(output,"TO_HOST\t%s\n",result->tohost);
+    fprintf(output,"TO_ADDR\t%s\n",result->toaddr);
+    fprintf(output,"TO_PORT\t%s\n",result->toserv);
+
+    fprintf(output,"START_TIME\t" OWP_TSTAMPFMT "\n",result->start_time);
+    fprintf(output,"END_TIME\t" OWP_TSTAMPFMT "\n",result->end_time);
+    
+    /* print unix versions of timestamp */
+    if (result->display_unix_ts == True) {
+        double epochdiff = (OWPULongToNum64(OWPJAN_1970))>>32;
+        fprintf(output,"UNIX_START_TIME\t%f\n", OWPNum64ToDouble(result->start_time) - epochdiff);
+        fprintf(output,"UNIX_END_TIME\t%f\n", OWPNum64ToDouble(result->end_time) - epochdiff);
+    }
+
+    /*
+     * If typeP is specified as a DSCP code-byte, then output it too.
+     * (If any bits are set outside of the low-order 6 bits of the
+     * high-order byte, then it is not a DSCP.)
+     */
+    if( !(result->typeP & ~0x3F000000)){
+        uint8_t dscp = result->typeP >> 24;
+        fprintf(output,"DSCP\t0x%2.2x\n",dscp);
+    }
+    fprintf(output,"LOSS_TIMEOUT\t%"PRIu64"\n",result->loss_timeout);
+    fprintf(output,"PACKET_PADDING\t%u\n",result->packet_padding);
+    fprintf(output,"SESSION_PACKET_COUNT\t%u\n",result->session_npackets);
+    fprintf(output,"SAMPLE_PACKET_COUNT\t%u\n", result->sample_npackets);
+    fprintf(output,"BUCKET_WIDTH\t%g\n",result->bucketwidth);
+    fprintf(output,"SESSION_FINISHED\t%d\n",(result->finished)?1:0);
+
+    /*
+     * Summary results
+     */
+    fprintf(output,"SENT\t%u\n",result->sent);
+    fprintf(output,"SYNC\t%u\n",(unsigned)result->sync);
+    fprintf(output,"MAXERR\t%g\n",result->maxerr);
+    fprintf(output,"DUPS\t%u\n",result->dups);
+    fprintf(output,"LOST\t%u\n",result->lost);
+
+    if(result->have_delay){
+        fprintf(output,"MIN\t%g\n",result->min_delay);
+        fprintf(output,"MAX\t%g\n",result->max_delay);
+    }
+
+    /*
+     * Delay variation
+     */
+    if(result->have_delay){
+        if(OWPStatsResultPercentile(result,0.5,&d)){
+            fprintf(output,"PDV_P50\t%g\n",d - result->min_delay);
+        }
+        if(OWPStatsResultPercentile(result,0.95,&d)){
+            fprintf(output,"PDV_P95\t%g\n",d - result->min_delay);
+        }
+    }
+    fprintf(output,"IPDV_COUNT\t%u\n",result->ipdv_n);
+    if(result->ipdv_n){
+        fprintf(output,"IPDV_MIN\t%g\n",result->ipdv_min);
+        fprintf(output,"IPDV_MAX\t%g\n",result->ipdv_max);
+        fprintf(output,"IPDV_MEAN\t%g\n",result->ipdv_sum/result->ipdv_n);
+        fprintf(output,"IPDV_MEAN_ABS\t%g\n",
+                result->ipdv_abssum/result->ipdv_n);
+        if(OWPStatsResultIPDVPercentile(result,0.5,&d)){
+            fprintf(output,"IPDV_P50\t%g\n",d);
+        }
+        if(OWPStatsResultIPDVPercentile(result,0.95,&d)){
+            fprintf(output,"IPDV_P95\t%g\n",d);
+        }
+    }
+
+    /*
+     * Delay histogram
+     */
+    if(result->sent > result->lost){
+        fprintf(output,"<BUCKETS>\n");
+        for(i=0;i<result->nbuckets;i++){
+            fprintf(output,"\t%d\t%u\n",result->buckets[i].b,
+                    result->buckets[i].n);
+        }
+        fprintf(output,"</BUCKETS>\n");
+    }
+
+    /*
+     * IPDV histogram
+     */
+    if(result->ipdv_n){
+        fprintf(output,"<IPDVBUCKETS>\n");
+        for(i=0;i<result->nipdvbuckets;i++){
+            fprintf(output,"\t%d\t%u\n",result->ipdvbuckets[i].b,
+                    result->ipdvbuckets[i].n);
+        }
+        fprintf(output,"</IPDVBUCKETS>\n");
+    }
+
+    /*
+     * TTL histogram
+     */
+    for(i=0;i<255;i++){
+        if(!result->ttl_count[i])
+            continue;
         nttl++;
         if(i<minttl)
             minttl = i;
@@ -1775,12 +2912,12 @@ OWPStatsPrintMachine(
 
     if(nttl > 0){
         fprintf(output,"MINTTL\t%u\n",minttl);
-        fprintf(output,"MAXTTL\t%u\n",minttl);
+        fprintf(output,"MAXTTL\t%u\n",maxttl);
         fprintf(output,"<TTLBUCKETS>\n");
         for(i=0;i<255;i++){
-            if(!stats->ttl_count[i])
+            if(!result->ttl_count[i])
                 continue;
-            fprintf(output,"\t%u\t%u\n",i,stats->ttl_count[i]);
+            fprintf(output,"\t%u\t%u\n",i,result->ttl_count[i]);
         }
         fprintf(output,"</TTLBUCKETS>\n");
 
@@ -1792,14 +2929,474 @@ OWPStatsPrintMachine(
      * Reordering histogram
      */
     fprintf(output,"<NREORDERING>\n");
-    for(j=0;((j<stats->rlistlen) && (stats->rn[j]));j++){
-        fprintf(output,"\t%u\t%u\n",(uint32_t)j+1,
-                stats->rn[j]);
+    for(i=0;i<result->nreordering;i++){
+        fprintf(output,"\t%u\t%u\n",i+1,result->reordering[i]);
     }
-    if((j==0) || (j >= stats->rlistlen)){
-        fprintf(output,"\t%u\t%u\n",(uint32_t)j+1,0);
+    if((i==0) || (i >= result->reorder_window)){
+        fprintf(output,"\t%u\t%u\n",i+1,0);
     }
     fprintf(output,"</NREORDERING>\n");
 
+    /*
+     * RFC 4737 reordering metrics
+     */
+    fprintf(output,"REORDER_WINDOW\t%u\n",result->reorder_window);
+    fprintf(output,"REORDERED\t%u\n",result->reordered);
+    if(result->reordered > result->extent_unknown){
+        fprintf(output,"REORDER_EXTENT_MEAN\t%g\n",
+                (double)result->extent_sum /
+                (result->reordered - result->extent_unknown));
+        fprintf(output,"REORDER_EXTENT_MAX\t%u\n",result->extent_max);
+    }
+    fprintf(output,"REORDER_EXTENT_UNKNOWN\t%u\n",result->extent_unknown);
+    fprintf(output,"REORDER_GAPS\t%u\n",result->gap_num);
+    if(result->gap_num){
+        fprintf(output,"REORDER_GAP_MEAN\t%g\n",
+                (double)result->gap_sum/result->gap_num);
+        fprintf(output,"REORDER_GAP_MAX\t%u\n",result->gap_max);
+    }
+
+    return True;
+}
+
+/*
+ * Binary result encoding:
+ *
+ * All integers are in network byte order. doubles are encoded as the
+ * network byte order of their IEEE 754 bit pattern. Strings are encoded
+ * as a 32 bit length followed by the characters (no nul byte). Variable
+ * length arrays are preceded by their 32 bit element count.
+ *
+ *      "OwS\0"         magic
+ *      version         (_OWP_RESULT_VERSION)
+ *      sid             16 bytes
+ *      fromhost,fromaddr,fromserv,tohost,toaddr,toserv (strings)
+ *      start_time,end_time (64)
+ *      flags           (32) display_unix_ts|finished|sync|have_delay
+ *      typeP,packet_padding,session_npackets,sample_npackets (32)
+ *      loss_timeout    (64)
+ *      bucketwidth     (double)
+ *      sent,lost,dups  (32)
+ *      maxerr,min_delay,max_delay (double)
+ *      buckets         (count, then b,n (32) pairs)
+ *      ipdv_n          (32)
+ *      ipdv_min,ipdv_max,ipdv_sum,ipdv_abssum (double)
+ *      ipdvbuckets     (count, then b,n (32) pairs)
+ *      ttl             (count, then ttl,n (32) pairs - non-zero only)
+ *      reorder_window,narrived,nrecv (32)
+ *      reordering      (count, then n (32))
+ *      reordered,extent_max,extent_unknown (32)
+ *      extent_sum      (64)
+ *      gap_num,gap_max (32)
+ *      gap_sum         (64)
+ */
+#define _OWP_RESULT_MAGIC   "OwS"
+#define _OWP_RESULT_VERSION 1
+
+#define _OWP_RESULT_F_UNIXTS    0x1
+#define _OWP_RESULT_F_FINISHED  0x2
+#define _OWP_RESULT_F_SYNC      0x4
+#define _OWP_RESULT_F_DELAY     0x8
+
+static OWPBoolean
+ResultWrite32(
+        FILE        *fp,
+        uint32_t    val
+        )
+{
+    val = htonl(val);
+
+    return (fwrite(&val,sizeof(val),1,fp) == 1);
+}
+
+static OWPBoolean
+ResultWrite64(
+        FILE        *fp,
+        uint64_t    val
+        )
+{
+    return ResultWrite32(fp,(uint32_t)(val >> 32)) &&
+        ResultWrite32(fp,(uint32_t)(val & 0xFFFFFFFFUL));
+}
+
+static OWPBoolean
+ResultWriteDouble(
+        FILE        *fp,
+        double      val
+        )
+{
+    uint64_t    u64;
+
+    memcpy(&u64,&val,sizeof(u64));
+
+    return ResultWrite64(fp,u64);
+}
+
+static OWPBoolean
+ResultWriteString(
+        FILE        *fp,
+        const char  *str
+        )
+{
+    uint32_t    len = strlen(str);
+
+    return ResultWrite32(fp,len) &&
+        (!len || (fwrite(str,len,1,fp) == 1));
+}
+
+static OWPBoolean
+ResultWriteBuckets(
+        FILE                *fp,
+        OWPStatsBucketRec   *buckets,
+        uint32_t            nbuckets
+        )
+{
+    uint32_t    i;
+
+    if(!ResultWrite32(fp,nbuckets))
+        return False;
+    for(i=0;i<nbuckets;i++){
+        if(!ResultWrite32(fp,(uint32_t)buckets[i].b) ||
+                !ResultWrite32(fp,buckets[i].n)){
+            return False;
+        }
+    }
+
+    return True;
+}
+
+static OWPBoolean
+ResultRead32(
+        FILE        *fp,
+        uint32_t    *val
+        )
+{
+    if(fread(val,sizeof(*val),1,fp) != 1)
+        return False;
+    *val = ntohl(*val);
+
+    return True;
+}
+
+static OWPBoolean
+ResultRead64(
+        FILE        *fp,
+        uint64_t    *val
+        )
+{
+    uint32_t    hi,lo;
+
+    if(!ResultRead32(fp,&hi) || !ResultRead32(fp,&lo))
+        return False;
+    *val = ((uint64_t)hi << 32) | lo;
+
+    return True;
+}
+
+static OWPBoolean
+ResultReadDouble(
+        FILE        *fp,
+        double      *val
+        )
+{
+    uint64_t    u64;
+
+    if(!ResultRead64(fp,&u64))
+        return False;
+    memcpy(val,&u64,sizeof(*val));
+
+    return True;
+}
+
+static OWPBoolean
+ResultReadString(
+        FILE        *fp,
+        char        *str,
+        size_t      size
+        )
+{
+    uint32_t    len;
+
+    if(!ResultRead32(fp,&len) || (len >= size))
+        return False;
+    if(len && (fread(str,len,1,fp) != 1))
+        return False;
+    str[len] = '\0';
+
+    return True;
+}
+
+/*
+ * Each bucket holds at least one sample, so there can never be more
+ * than nsamples buckets. (nbuckets comes from the file, so it must be
+ * checked before it is used to size the allocation.)
+ */
+static OWPBoolean
+ResultReadBuckets(
+        FILE                *fp,
+        uint32_t            nsamples,
+        OWPStatsBucketRec   **buckets,
+        uint32_t            *nbuckets
+        )
+{
+    uint32_t    i,b;
+
+    if(!ResultRead32(fp,nbuckets))
+        return False;
+    if(!*nbuckets)
+        return True;
+    if(*nbuckets > nsamples){
+        errno = EINVAL;
+        goto error;
+    }
+    if( !(*buckets = calloc(*nbuckets,sizeof(OWPStatsBucketRec))))
+        goto error;
+    for(i=0;i<*nbuckets;i++){
+        if(!ResultRead32(fp,&b) || !ResultRead32(fp,&(*buckets)[i].n)){
+            goto error;
+        }
+        (*buckets)[i].b = (int32_t)b;
+    }
+
+    return True;
+
+error:
+    if(*buckets){
+        free(*buckets);
+        *buckets = NULL;
+    }
+    *nbuckets = 0;
+
+    return False;
+}
+
+/*
+ * Function:    OWPStatsResultWrite
+ *
+ * Description:    
+ *              Writes the compact binary encoding of a result record
+ *              to fp. (See the format description above.)
+ *
+ * In Args:    
+ *
+ * Out Args:    
+ *
+ * Scope:    
+ * Returns:    
+ * Side Effect:    
+ */
+OWPBoolean
+OWPStatsResultWrite(
+        OWPContext      ctx,
+        OWPStatsResult  result,
+        FILE            *fp
+        )
+{
+    uint32_t    flags = 0;
+    uint32_t    i,nttl;
+
+    if(result->display_unix_ts) flags |= _OWP_RESULT_F_UNIXTS;
+    if(result->finished) flags |= _OWP_RESULT_F_FINISHED;
+    if(result->sync) flags |= _OWP_RESULT_F_SYNC;
+    if(result->have_delay) flags |= _OWP_RESULT_F_DELAY;
+
+    for(i=0,nttl=0;i<256;i++){
+        if(result->ttl_count[i]) nttl++;
+    }
+
+    if((fwrite(_OWP_RESULT_MAGIC,sizeof(_OWP_RESULT_MAGIC),1,fp) != 1) ||
+            !ResultWrite32(fp,_OWP_RESULT_VERSION) ||
+            (fwrite(result->sid,sizeof(OWPSID),1,fp) != 1) ||
+            !ResultWriteString(fp,result->fromhost) ||
+            !ResultWriteString(fp,result->fromaddr) ||
+            !ResultWriteString(fp,result->fromserv) ||
+            !ResultWriteString(fp,result->tohost) ||
+            !ResultWriteString(fp,result->toaddr) ||
+            !ResultWriteString(fp,result->toserv) ||
+            !ResultWrite64(fp,result->start_time) ||
+            !ResultWrite64(fp,result->end_time) ||
+            !ResultWrite32(fp,flags) ||
+            !ResultWrite32(fp,result->typeP) ||
+            !ResultWrite32(fp,result->packet_padding) ||
+            !ResultWrite32(fp,result->session_npackets) ||
+            !ResultWrite32(fp,result->sample_npackets) ||
+            !ResultWrite64(fp,result->loss_timeout) ||
+            !ResultWriteDouble(fp,result->bucketwidth) ||
+            !ResultWrite32(fp,result->sent) ||
+            !ResultWrite32(fp,result->lost) ||
+            !ResultWrite32(fp,result->dups) ||
+            !ResultWriteDouble(fp,result->maxerr) ||
+            !ResultWriteDouble(fp,result->min_delay) ||
+            !ResultWriteDouble(fp,result->max_delay) ||
+            !ResultWriteBuckets(fp,result->buckets,result->nbuckets) ||
+            !ResultWrite32(fp,result->ipdv_n) ||
+            !ResultWriteDouble(fp,result->ipdv_min) ||
+            !ResultWriteDouble(fp,result->ipdv_max) ||
+            !ResultWriteDouble(fp,result->ipdv_sum) ||
+            !ResultWriteDouble(fp,result->ipdv_abssum) ||
+            !ResultWriteBuckets(fp,result->ipdvbuckets,result->nipdvbuckets)||
+            !ResultWrite32(fp,nttl)){
+        goto error;
+    }
+
+    for(i=0;i<256;i++){
+        if(!result->ttl_count[i])
+            continue;
+        if(!ResultWrite32(fp,i) || !ResultWrite32(fp,result->ttl_count[i]))
+            goto error;
+    }
+
+    if(!ResultWrite32(fp,result->reorder_window) ||
+            !ResultWrite32(fp,result->narrived) ||
+            !ResultWrite32(fp,result->nrecv) ||
+            !ResultWrite32(fp,result->nreordering)){
+        goto error;
+    }
+    for(i=0;i<result->nreordering;i++){
+        if(!ResultWrite32(fp,result->reordering[i]))
+            goto error;
+    }
+
+    if(!ResultWrite32(fp,result->reordered) ||
+            !ResultWrite32(fp,result->extent_max) ||
+            !ResultWrite32(fp,result->extent_unknown) ||
+            !ResultWrite64(fp,result->extent_sum) ||
+            !ResultWrite32(fp,result->gap_num) ||
+            !ResultWrite32(fp,result->gap_max) ||
+            !ResultWrite64(fp,result->gap_sum)){
+        goto error;
+    }
+
     return True;
+
+error:
+    OWPError(ctx,OWPErrFATAL,errno,"OWPStatsResultWrite: fwrite(): %M");
+    return False;
+}
+
+/*
+ * Function:    OWPStatsResultRead
+ *
+ * Description:    
+ *              Reads a result record that was written by
+ *              OWPStatsResultWrite.
+ *
+ * In Args:    
+ *
+ * Out Args:    
+ *
+ * Scope:    
+ * Returns:    
+ *              NULL on failure. The returned record must be freed
+ *              with OWPStatsResultFree.
+ * Side Effect:    
+ */
+OWPStatsResult
+OWPStatsResultRead(
+        OWPContext  ctx,
+        FILE        *fp
+        )
+{
+    OWPStatsResult  result;
+    char            magic[sizeof(_OWP_RESULT_MAGIC)];
+    uint32_t        version,flags;
+    uint32_t        i,nttl,ttl,n;
+
+    if( !(result = calloc(1,sizeof(OWPStatsResultRec)))){
+        OWPError(ctx,OWPErrFATAL,errno,"OWPStatsResultRead: calloc(): %M");
+        return NULL;
+    }
+
+    if((fread(magic,sizeof(magic),1,fp) != 1) ||
+            memcmp(magic,_OWP_RESULT_MAGIC,sizeof(magic)) ||
+            !ResultRead32(fp,&version) ||
+            (version != _OWP_RESULT_VERSION)){
+        OWPError(ctx,OWPErrFATAL,OWPErrINVALID,
+                "OWPStatsResultRead: Invalid stats result record");
+        goto error;
+    }
+
+    if((fread(result->sid,sizeof(OWPSID),1,fp) != 1) ||
+            !ResultReadString(fp,result->fromhost,sizeof(result->fromhost)) ||
+            !ResultReadString(fp,result->fromaddr,sizeof(result->fromaddr)) ||
+            !ResultReadString(fp,result->fromserv,sizeof(result->fromserv)) ||
+            !ResultReadString(fp,result->tohost,sizeof(result->tohost)) ||
+            !ResultReadString(fp,result->toaddr,sizeof(result->toaddr)) ||
+            !ResultReadString(fp,result->toserv,sizeof(result->toserv)) ||
+            !ResultRead64(fp,&result->start_time) ||
+            !ResultRead64(fp,&result->end_time) ||
+            !ResultRead32(fp,&flags) ||
+            !ResultRead32(fp,&result->typeP) ||
+            !ResultRead32(fp,&result->packet_padding) ||
+            !ResultRead32(fp,&result->session_npackets) ||
+            !ResultRead32(fp,&result->sample_npackets) ||
+            !ResultRead64(fp,&result->loss_timeout) ||
+            !ResultReadDouble(fp,&result->bucketwidth) ||
+            !ResultRead32(fp,&result->sent) ||
+            !ResultRead32(fp,&result->lost) ||
+            !ResultRead32(fp,&result->dups) ||
+            !ResultReadDouble(fp,&result->maxerr) ||
+            !ResultReadDouble(fp,&result->min_delay) ||
+            !ResultReadDouble(fp,&result->max_delay) ||
+            !ResultReadBuckets(fp,result->sent,&result->buckets,
+                &result->nbuckets) ||
+            !ResultRead32(fp,&result->ipdv_n) ||
+            !ResultReadDouble(fp,&result->ipdv_min) ||
+            !ResultReadDouble(fp,&result->ipdv_max) ||
+            !ResultReadDouble(fp,&result->ipdv_sum) ||
+            !ResultReadDouble(fp,&result->ipdv_abssum) ||
+            !ResultReadBuckets(fp,result->ipdv_n,&result->ipdvbuckets,
+                &result->nipdvbuckets) ||
+            !ResultRead32(fp,&nttl) || (nttl > 256)){
+        goto bad;
+    }
+
+    result->display_unix_ts = (flags & _OWP_RESULT_F_UNIXTS)? True: False;
+    result->finished = (flags & _OWP_RESULT_F_FINISHED)? True: False;
+    result->sync = (flags & _OWP_RESULT_F_SYNC)? True: False;
+    result->have_delay = (flags & _OWP_RESULT_F_DELAY)? True: False;
+
+    for(i=0;i<nttl;i++){
+        if(!ResultRead32(fp,&ttl) || (ttl > 255) || !ResultRead32(fp,&n))
+            goto bad;
+        result->ttl_count[ttl] = n;
+    }
+
+    if(!ResultRead32(fp,&result->reorder_window) ||
+            !ResultRead32(fp,&result->narrived) ||
+            !ResultRead32(fp,&result->nrecv) ||
+            !ResultRead32(fp,&n) || (n > result->reorder_window) ||
+            (n > result->narrived)){
+        goto bad;
+    }
+    if(n){
+        if( !(result->reordering = calloc(n,sizeof(uint32_t)))){
+            OWPError(ctx,OWPErrFATAL,errno,"OWPStatsResultRead: calloc(): %M");
+            goto error;
+        }
+        result->nreordering = n;
+        for(i=0;i<n;i++){
+            if(!ResultRead32(fp,&result->reordering[i]))
+                goto bad;
+        }
+    }
+
+    if(!ResultRead32(fp,&result->reordered) ||
+            !ResultRead32(fp,&result->extent_max) ||
+            !ResultRead32(fp,&result->extent_unknown) ||
+            !ResultRead64(fp,&result->extent_sum) ||
+            !ResultRead32(fp,&result->gap_num) ||
+            !ResultRead32(fp,&result->gap_max) ||
+            !ResultRead64(fp,&result->gap_sum)){
+        goto bad;
+    }
+
+    return result;
+
+bad:
+    OWPError(ctx,OWPErrFATAL,OWPErrINVALID,
+            "OWPStatsResultRead: Invalid or truncated stats result record");
+error:
+    OWPStatsResultFree(result);
+    return NULL;
 }
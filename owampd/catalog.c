@@ -0,0 +1,989 @@
+/*
+ *      $Id$
+ */
+/************************************************************************
+ *                                                                      *
+ *                             Copyright (C)  2026                      *
+ *                                Internet2                             *
+ *                             All Rights Reserved                      *
+ *                                                                      *
+ ************************************************************************/
+/*
+ *        File:         catalog.c
+ *
+ *        Description:
+ *                      Session catalog of the owampd datastore. (See
+ *                      catalog.h)
+ */
+#include <owamp/owamp.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+
+#include "catalog.h"
+
+/*
+ * The log is a header record followed by one record per change, all
+ * OWPDCAT_RECSIZE bytes with integers in network byte order:
+ *
+ *      0       sid
+ *      16      state
+ *      20      check (OWPDCAT_CHECK)
+ *      24      size
+ *      32      start
+ *      40      end
+ *      48      class name (nul padded, but not nul terminated when it
+ *              is OWPDMAXCLASSLEN long - OWPDCAT_MAGIC in the header)
+ *
+ * A record is only appended while holding a write lock on the log, after
+ * checking that the log has not been replaced by OWPDCatalogCompact.
+ * Compaction holds the same lock, so every record is either in the log
+ * it rewrites or appended to the new one.
+ */
+typedef struct OWPDCatRecordRec{
+    OWPSID      sid;
+    uint32_t    state;
+    uint32_t    check;      /* OWPDCAT_CHECK */
+    int64_t     size;
+    int64_t     start;
+    int64_t     end;
+    char        cname[OWPDMAXCLASSLEN+1];
+} OWPDCatRecordRec;
+
+#define OWPDCAT_MAGIC   "owampd session catalog 2"
+#define OWPDCAT_CHECK   0x4f574344
+#define OWPDCAT_RECSIZE 136
+#define OWPDCAT_NREAD   64          /* records per read */
+
+/*
+ * OWPDCatalogMaintain compacts the log once it holds more than twice
+ * as many records as there are sessions (plus this many).
+ */
+#define OWPDCAT_SLACK   1024
+
+OWPDCatalog
+OWPDCatalogCreate(
+        OWPDPolicy  policy,
+        const char  *path
+        )
+{
+    OWPDCatalog cat;
+
+    if(!(cat = calloc(1,sizeof(*cat)))){
+        OWPError(policy->ctx,OWPErrFATAL,errno,"calloc(OWPDCatalog): %M");
+        return NULL;
+    }
+    cat->policy = policy;
+    cat->fd = cat->wfd = -1;
+
+    if(!(cat->path = strdup(path))){
+        OWPError(policy->ctx,OWPErrFATAL,errno,"strdup(): %M");
+        free(cat);
+        return NULL;
+    }
+
+    if(!(cat->sids = I2HashInit(OWPContextErrHandle(policy->ctx),0,
+                    NULL,NULL))){
+        OWPError(policy->ctx,OWPErrFATAL,OWPErrUNKNOWN,
+                "OWPDCatalogCreate: Unable to allocate hash");
+        free(cat->path);
+        free(cat);
+        return NULL;
+    }
+
+    return cat;
+}
+
+static void
+EntryFree(
+        OWPDCatalog     cat,
+        OWPDCatEntry    entry
+        )
+{
+    I2Datum key;
+
+    key.dptr = entry->sid;
+    key.dsize = sizeof(OWPSID);
+    (void)I2HashDelete(cat->sids,key);
+
+    if(entry->prev){
+        entry->prev->next = entry->next;
+    }
+    else{
+        cat->head = entry->next;
+    }
+    if(entry->next){
+        entry->next->prev = entry->prev;
+    }
+    else{
+        cat->tail = entry->prev;
+    }
+
+    free(entry);
+
+    return;
+}
+
+/*
+ * Function:        OWPDCatalogReset
+ *
+ * Description:
+ *         Forgets all entries. (The log is not modified.)
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+void
+OWPDCatalogReset(
+        OWPDCatalog cat
+        )
+{
+    while(cat->head){
+        EntryFree(cat,cat->head);
+    }
+
+    return;
+}
+
+/*
+ * Function:        OWPDCatalogInsert
+ *
+ * Description:
+ *         Sets the entry for sid, adding it at the end of the list if it
+ *         is new. Only the in-memory catalog is changed - use
+ *         OWPDCatalogAppend to log it.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ *         The entry, or NULL on a memory error.
+ * Side Effect:
+ */
+OWPDCatEntry
+OWPDCatalogInsert(
+        OWPDCatalog     cat,
+        OWPSID          sid,
+        OWPDPolicyNode  node,
+        OWPDCatState    state,
+        off_t           size,
+        time_t          start,
+        time_t          end
+        )
+{
+    OWPDCatEntry    entry;
+    I2Datum         key,val;
+
+    key.dptr = sid;
+    key.dsize = sizeof(OWPSID);
+    if(I2HashFetch(cat->sids,key,&val)){
+        entry = val.dptr;
+    }
+    else{
+        if(!(entry = calloc(1,sizeof(*entry)))){
+            OWPError(cat->policy->ctx,OWPErrFATAL,errno,
+                    "calloc(OWPDCatEntry): %M");
+            return NULL;
+        }
+        memcpy(entry->sid,sid,sizeof(OWPSID));
+
+        key.dptr = entry->sid;
+        val.dptr = entry;
+        val.dsize = sizeof(*entry);
+        if(I2HashStore(cat->sids,key,val) != 0){
+            OWPError(cat->policy->ctx,OWPErrFATAL,OWPErrUNKNOWN,
+                    "Unable to store catalog entry");
+            free(entry);
+            return NULL;
+        }
+
+        entry->prev = cat->tail;
+        if(cat->tail){
+            cat->tail->next = entry;
+        }
+        else{
+            cat->head = entry;
+        }
+        cat->tail = entry;
+    }
+
+    entry->node = node;
+    entry->gen = cat->gen;
+    entry->state = state;
+    entry->size = size;
+    entry->start = start;
+    entry->end = end;
+
+    return entry;
+}
+
+static int
+EntryCmp(
+        const void  *a,
+        const void  *b
+        )
+{
+    const OWPDCatEntry  ea = *(const OWPDCatEntry *)a;
+    const OWPDCatEntry  eb = *(const OWPDCatEntry *)b;
+
+    if(ea->start != eb->start){
+        return (ea->start < eb->start)? -1: 1;
+    }
+    if(ea->end != eb->end){
+        return (ea->end < eb->end)? -1: 1;
+    }
+
+    return memcmp(ea->sid,eb->sid,sizeof(OWPSID));
+}
+
+/*
+ * Function:        OWPDCatalogSort
+ *
+ * Description:
+ *         Orders the list by start time. Entries added as sessions are
+ *         created are already in order - this is for a catalog rebuilt
+ *         from the datadir hierarchy.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+void
+OWPDCatalogSort(
+        OWPDCatalog cat
+        )
+{
+    OWPDCatEntry    *entries;
+    OWPDCatEntry    entry;
+    size_t          n,i;
+
+    if(!(n = I2HashNumEntries(cat->sids))){
+        return;
+    }
+
+    if(!(entries = malloc(n * sizeof(*entries)))){
+        OWPError(cat->policy->ctx,OWPErrWARNING,errno,
+                "OWPDCatalogSort: malloc(): %M");
+        return;
+    }
+
+    for(i=0,entry=cat->head;entry && (i<n);entry=entry->next){
+        entries[i++] = entry;
+    }
+    n = i;
+
+    qsort(entries,n,sizeof(*entries),EntryCmp);
+
+    cat->head = cat->tail = NULL;
+    for(i=0;i<n;i++){
+        entries[i]->prev = cat->tail;
+        entries[i]->next = NULL;
+        if(cat->tail){
+            cat->tail->next = entries[i];
+        }
+        else{
+            cat->head = entries[i];
+        }
+        cat->tail = entries[i];
+    }
+
+    free(entries);
+
+    return;
+}
+
+static void
+FillRecord(
+        OWPDCatRecordRec    *rec,
+        OWPDCatEntry        entry
+        )
+{
+    memset(rec,0,sizeof(*rec));
+    memcpy(rec->sid,entry->sid,sizeof(OWPSID));
+    rec->state = entry->state;
+    rec->check = OWPDCAT_CHECK;
+    rec->size = entry->size;
+    rec->start = entry->start;
+    rec->end = entry->end;
+    memcpy(rec->cname,entry->node->nodename,
+            strnlen(entry->node->nodename,OWPDMAXCLASSLEN));
+
+    return;
+}
+
+static void
+FillHeader(
+        OWPDCatRecordRec    *rec
+        )
+{
+    memset(rec,0,sizeof(*rec));
+    rec->check = OWPDCAT_CHECK;
+    strcpy(rec->cname,OWPDCAT_MAGIC);
+
+    return;
+}
+
+static void
+Encode32(
+        uint8_t     *buf,
+        uint32_t    val
+        )
+{
+    val = htonl(val);
+    memcpy(buf,&val,4);
+
+    return;
+}
+
+static uint32_t
+Decode32(
+        const uint8_t   *buf
+        )
+{
+    uint32_t    val;
+
+    memcpy(&val,buf,4);
+
+    return ntohl(val);
+}
+
+static void
+Encode64(
+        uint8_t     *buf,
+        int64_t     val
+        )
+{
+    Encode32(&buf[0],(uint32_t)((uint64_t)val >> 32));
+    Encode32(&buf[4],(uint32_t)((uint64_t)val & 0xFFFFFFFFUL));
+
+    return;
+}
+
+static int64_t
+Decode64(
+        const uint8_t   *buf
+        )
+{
+    return (int64_t)(((uint64_t)Decode32(&buf[0]) << 32) |
+            (uint64_t)Decode32(&buf[4]));
+}
+
+static void
+EncodeRecord(
+        uint8_t             *buf,
+        OWPDCatRecordRec    *rec
+        )
+{
+    memset(buf,0,OWPDCAT_RECSIZE);
+    memcpy(&buf[0],rec->sid,sizeof(OWPSID));
+    Encode32(&buf[16],rec->state);
+    Encode32(&buf[20],rec->check);
+    Encode64(&buf[24],rec->size);
+    Encode64(&buf[32],rec->start);
+    Encode64(&buf[40],rec->end);
+    memcpy(&buf[48],rec->cname,strnlen(rec->cname,OWPDMAXCLASSLEN));
+
+    return;
+}
+
+static void
+DecodeRecord(
+        OWPDCatRecordRec    *rec,
+        const uint8_t       *buf
+        )
+{
+    memcpy(rec->sid,&buf[0],sizeof(OWPSID));
+    rec->state = Decode32(&buf[16]);
+    rec->check = Decode32(&buf[20]);
+    rec->size = Decode64(&buf[24]);
+    rec->start = Decode64(&buf[32]);
+    rec->end = Decode64(&buf[40]);
+    memcpy(rec->cname,&buf[48],OWPDMAXCLASSLEN);
+    rec->cname[OWPDMAXCLASSLEN] = '\0';
+
+    return;
+}
+
+static OWPBoolean
+ApplyRecord(
+        OWPDCatalog         cat,
+        OWPDCatRecordRec    *rec
+        )
+{
+    I2Datum key,val;
+
+    if(rec->check != OWPDCAT_CHECK){
+        OWPError(cat->policy->ctx,OWPErrFATAL,OWPErrINVALID,
+                "%s: Invalid record at offset %lld",cat->path,
+                (long long)cat->offset);
+        return False;
+    }
+
+    key.dptr = rec->sid;
+    key.dsize = sizeof(OWPSID);
+
+    if(rec->state == OWPDCatDeleted){
+        if(I2HashFetch(cat->sids,key,&val)){
+            EntryFree(cat,val.dptr);
+        }
+        return True;
+    }
+
+    /*
+     * Sessions of a class that no longer exists are left out, the same
+     * way the datadir walk skips their directories.
+     */
+    key.dptr = rec->cname;
+    key.dsize = strlen(rec->cname);
+    if(!I2HashFetch(cat->policy->limits,key,&val)){
+        return True;
+    }
+
+    return (OWPDCatalogInsert(cat,rec->sid,val.dptr,rec->state,rec->size,
+                rec->start,rec->end))? True: False;
+}
+
+/*
+ * Opens the log at cat->path for reading and checks the header.
+ * Returns the fd, or -1.
+ */
+static int
+OpenLog(
+        OWPDCatalog cat
+        )
+{
+    uint8_t             buf[OWPDCAT_RECSIZE];
+    OWPDCatRecordRec    rec;
+    int                 fd;
+
+    if((fd = open(cat->path,O_RDONLY)) < 0){
+        if(errno != ENOENT){
+            OWPError(cat->policy->ctx,OWPErrWARNING,errno,"open(%s): %M",
+                    cat->path);
+        }
+        return -1;
+    }
+
+    if(pread(fd,buf,sizeof(buf),0) != sizeof(buf)){
+        goto invalid;
+    }
+    DecodeRecord(&rec,buf);
+    if((rec.check != OWPDCAT_CHECK) || strcmp(rec.cname,OWPDCAT_MAGIC)){
+        goto invalid;
+    }
+
+    return fd;
+
+invalid:
+    OWPError(cat->policy->ctx,OWPErrWARNING,OWPErrINVALID,
+            "%s: Invalid session catalog",cat->path);
+    (void)close(fd);
+
+    return -1;
+}
+
+/*
+ * Reads the log from cat->offset to the end.
+ */
+static OWPBoolean
+ReplayLog(
+        OWPDCatalog cat
+        )
+{
+    uint8_t             buf[OWPDCAT_NREAD * OWPDCAT_RECSIZE];
+    OWPDCatRecordRec    rec;
+    ssize_t             n;
+    size_t              i,nrecs;
+
+    while(1){
+        if((n = pread(cat->fd,buf,sizeof(buf),cat->offset)) < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            OWPError(cat->policy->ctx,OWPErrFATAL,errno,"pread(%s): %M",
+                    cat->path);
+            return False;
+        }
+
+        /*
+         * A partial record at the end is still being written - it is
+         * picked up next time.
+         */
+        nrecs = (size_t)n / OWPDCAT_RECSIZE;
+        for(i=0;i<nrecs;i++){
+            DecodeRecord(&rec,&buf[i * OWPDCAT_RECSIZE]);
+            if(!ApplyRecord(cat,&rec)){
+                return False;
+            }
+            cat->offset += OWPDCAT_RECSIZE;
+        }
+
+        if(nrecs < OWPDCAT_NREAD){
+            break;
+        }
+    }
+
+    return True;
+}
+
+/*
+ * Returns True if fd is no longer the file at cat->path. (A log that
+ * has been removed altogether is still followed - see
+ * OWPDCatalogAppend.)
+ */
+static OWPBoolean
+LogReplaced(
+        OWPDCatalog cat,
+        int         fd
+        )
+{
+    struct stat fbuf,pbuf;
+
+    if((fstat(fd,&fbuf) != 0) || (stat(cat->path,&pbuf) != 0)){
+        return False;
+    }
+
+    return ((fbuf.st_dev != pbuf.st_dev) || (fbuf.st_ino != pbuf.st_ino))?
+        True: False;
+}
+
+/*
+ * Takes the write lock on the current log, re-opening cat->wfd if the
+ * log was compacted since it was opened.
+ */
+static OWPBoolean
+LockLog(
+        OWPDCatalog cat
+        )
+{
+    struct flock    fl;
+
+    while(1){
+        if((cat->wfd < 0) &&
+                ((cat->wfd = open(cat->path,O_WRONLY|O_APPEND)) < 0)){
+            if(errno != ENOENT){
+                OWPError(cat->policy->ctx,OWPErrFATAL,errno,
+                        "open(%s): %M",cat->path);
+            }
+            return False;
+        }
+
+        memset(&fl,0,sizeof(fl));
+        fl.l_type = F_WRLCK;
+        fl.l_whence = SEEK_SET;
+        if(fcntl(cat->wfd,F_SETLKW,&fl) != 0){
+            if(errno == EINTR){
+                continue;
+            }
+            OWPError(cat->policy->ctx,OWPErrFATAL,errno,
+                    "fcntl(%s,F_SETLKW): %M",cat->path);
+            return False;
+        }
+
+        if(!LogReplaced(cat,cat->wfd)){
+            return True;
+        }
+
+        /*
+         * Closing the fd releases the lock.
+         */
+        (void)close(cat->wfd);
+        cat->wfd = -1;
+    }
+}
+
+static void
+UnlockLog(
+        OWPDCatalog cat
+        )
+{
+    struct flock    fl;
+
+    memset(&fl,0,sizeof(fl));
+    fl.l_type = F_UNLCK;
+    fl.l_whence = SEEK_SET;
+    (void)fcntl(cat->wfd,F_SETLK,&fl);
+
+    return;
+}
+
+/*
+ * Function:        OWPDCatalogUpdate
+ *
+ * Description:
+ *         Replays the records other processes have appended to the log
+ *         since the last update. If the log has been compacted since, the
+ *         new log is read from the start and the entries it no longer
+ *         holds are dropped.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ *         False if the log could not be read.
+ * Side Effect:
+ */
+OWPBoolean
+OWPDCatalogUpdate(
+        OWPDCatalog cat
+        )
+{
+    OWPDCatEntry    entry,next;
+    int             fd;
+
+    if(cat->fd < 0){
+        return False;
+    }
+
+    if(!ReplayLog(cat)){
+        return False;
+    }
+
+    if(!LogReplaced(cat,cat->fd)){
+        return True;
+    }
+
+    if((fd = OpenLog(cat)) < 0){
+        return False;
+    }
+    (void)close(cat->fd);
+    cat->fd = fd;
+    cat->offset = OWPDCAT_RECSIZE;
+    cat->gen++;
+
+    if(!ReplayLog(cat)){
+        return False;
+    }
+
+    for(entry=cat->head;entry;entry=next){
+        next = entry->next;
+        if(entry->gen != cat->gen){
+            EntryFree(cat,entry);
+        }
+    }
+
+    return True;
+}
+
+/*
+ * Function:        OWPDCatalogLoad
+ *
+ * Description:
+ *         Replaces the in-memory catalog with the contents of the log,
+ *         and opens the log for OWPDCatalogAppend.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ *         False if there is no (valid) log.
+ * Side Effect:
+ */
+OWPBoolean
+OWPDCatalogLoad(
+        OWPDCatalog cat
+        )
+{
+    OWPDCatalogReset(cat);
+    if(cat->fd >= 0){
+        (void)close(cat->fd);
+        cat->fd = -1;
+    }
+    if(cat->wfd >= 0){
+        (void)close(cat->wfd);
+        cat->wfd = -1;
+    }
+
+    if((cat->fd = OpenLog(cat)) < 0){
+        return False;
+    }
+    cat->offset = OWPDCAT_RECSIZE;
+
+    if(!ReplayLog(cat)){
+        OWPDCatalogReset(cat);
+        (void)close(cat->fd);
+        cat->fd = -1;
+        return False;
+    }
+
+    return True;
+}
+
+/*
+ * Function:        OWPDCatalogCompact
+ *
+ * Description:
+ *         Replaces the log with one record per entry. The new log is
+ *         written to a temporary file and renamed over the old one while
+ *         holding the log lock, so other processes can keep appending
+ *         - they move to the new log the next time they do.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+OWPBoolean
+OWPDCatalogCompact(
+        OWPDCatalog cat
+        )
+{
+    char                tpath[PATH_MAX+1];
+    FILE                *fp = NULL;
+    uint8_t             buf[OWPDCAT_RECSIZE];
+    OWPDCatRecordRec    rec;
+    OWPDCatEntry        entry;
+    off_t               offset;
+    OWPBoolean          locked;
+    int                 fd,wfd;
+
+    if(strlen(cat->path) + 4 > PATH_MAX){
+        OWPError(cat->policy->ctx,OWPErrFATAL,OWPErrINVALID,
+                "%s: path too long",cat->path);
+        return False;
+    }
+    strcpy(tpath,cat->path);
+    strcat(tpath,".tmp");
+
+    /*
+     * There is no lock to take if there is no log yet. (The catalog
+     * was rebuilt from datadir at startup.)
+     */
+    if(!(locked = LockLog(cat)) && (errno != ENOENT)){
+        return False;
+    }
+
+    /*
+     * Pick up what was appended up to now - nothing more can be until
+     * the lock is released.
+     */
+    if(locked && (cat->fd >= 0) && !OWPDCatalogUpdate(cat)){
+        goto unlock;
+    }
+
+    if(!(fp = fopen(tpath,"wb"))){
+        goto error;
+    }
+
+    FillHeader(&rec);
+    EncodeRecord(buf,&rec);
+    if(fwrite(buf,sizeof(buf),1,fp) != 1){
+        goto error;
+    }
+    offset = sizeof(buf);
+
+    for(entry=cat->head;entry;entry=entry->next){
+        FillRecord(&rec,entry);
+        EncodeRecord(buf,&rec);
+        if(fwrite(buf,sizeof(buf),1,fp) != 1){
+            goto error;
+        }
+        offset += sizeof(buf);
+    }
+
+    if(fclose(fp) != 0){
+        fp = NULL;
+        goto error;
+    }
+    fp = NULL;
+
+    if(rename(tpath,cat->path) != 0){
+        goto error;
+    }
+
+    if(((fd = open(cat->path,O_RDONLY)) < 0) ||
+            ((wfd = open(cat->path,O_WRONLY|O_APPEND)) < 0)){
+        OWPError(cat->policy->ctx,OWPErrFATAL,errno,"open(%s): %M",
+                cat->path);
+        if(fd >= 0){
+            (void)close(fd);
+        }
+        goto unlock;
+    }
+
+    /*
+     * Closing the old wfd releases the lock.
+     */
+    if(cat->fd >= 0){
+        (void)close(cat->fd);
+    }
+    if(cat->wfd >= 0){
+        (void)close(cat->wfd);
+    }
+    cat->fd = fd;
+    cat->wfd = wfd;
+    cat->offset = offset;
+
+    return True;
+
+error:
+    OWPError(cat->policy->ctx,OWPErrFATAL,errno,"Unable to write %s: %M",
+            tpath);
+    if(fp){
+        (void)fclose(fp);
+    }
+    (void)unlink(tpath);
+unlock:
+    if(locked){
+        UnlockLog(cat);
+    }
+
+    return False;
+}
+
+/*
+ * Function:        OWPDCatalogMaintain
+ *
+ * Description:
+ *         Catches up with the log, and compacts it once most of its
+ *         records are superseded. Called periodically by the parent, so
+ *         the children it forks start out (nearly) up to date and the
+ *         log does not grow without bound.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+OWPBoolean
+OWPDCatalogMaintain(
+        OWPDCatalog cat
+        )
+{
+    off_t   nrecs;
+
+    if(!OWPDCatalogUpdate(cat)){
+        return False;
+    }
+
+    nrecs = (cat->offset / OWPDCAT_RECSIZE) - 1;
+    if(nrecs <= (off_t)(2 * I2HashNumEntries(cat->sids) + OWPDCAT_SLACK)){
+        return True;
+    }
+
+    return OWPDCatalogCompact(cat);
+}
+
+/*
+ * Function:        OWPDCatalogAppend
+ *
+ * Description:
+ *         Logs the current state of entry. If the state is
+ *         OWPDCatDeleted, the entry is freed.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+OWPBoolean
+OWPDCatalogAppend(
+        OWPDCatalog     cat,
+        OWPDCatEntry    entry
+        )
+{
+    uint8_t             buf[OWPDCAT_RECSIZE];
+    OWPDCatRecordRec    rec;
+    ssize_t             n;
+
+    FillRecord(&rec,entry);
+    EncodeRecord(buf,&rec);
+
+    if(entry->state == OWPDCatDeleted){
+        EntryFree(cat,entry);
+    }
+
+    if(!LockLog(cat)){
+        OWPError(cat->policy->ctx,OWPErrFATAL,OWPErrUNKNOWN,
+                "%s: session catalog not open",cat->path);
+        return False;
+    }
+
+    while(((n = write(cat->wfd,buf,sizeof(buf))) < 0) && (errno == EINTR));
+    if(n != sizeof(buf)){
+        OWPError(cat->policy->ctx,OWPErrFATAL,errno,"write(%s): %M",
+                cat->path);
+        /*
+         * A partial record leaves the rest of the log unreadable -
+         * have the next startup rebuild it from the datadir.
+         */
+        if(n > 0){
+            (void)unlink(cat->path);
+        }
+        UnlockLog(cat);
+        return False;
+    }
+
+    UnlockLog(cat);
+
+    return True;
+}
+
+/*
+ * Function:        OWPDCatalogFind
+ *
+ * Description:
+ *         Returns the entry for sid, catching up with the log if it is
+ *         not known yet.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ *         NULL if there is no such session.
+ * Side Effect:
+ */
+OWPDCatEntry
+OWPDCatalogFind(
+        OWPDCatalog cat,
+        OWPSID      sid
+        )
+{
+    I2Datum key,val;
+
+    key.dptr = sid;
+    key.dsize = sizeof(OWPSID);
+
+    if(I2HashFetch(cat->sids,key,&val)){
+        return val.dptr;
+    }
+
+    if(OWPDCatalogUpdate(cat) && I2HashFetch(cat->sids,key,&val)){
+        return val.dptr;
+    }
+
+    return NULL;
+}
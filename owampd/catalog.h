@@ -0,0 +1,136 @@
+/*
+ *      $Id$
+ */
+/************************************************************************
+ *                                                                      *
+ *                             Copyright (C)  2026                      *
+ *                                Internet2                             *
+ *                             All Rights Reserved                      *
+ *                                                                      *
+ ************************************************************************/
+/*
+ *        File:         catalog.h
+ *
+ *        Description:
+ *                      Session catalog of the owampd datastore. Maps
+ *                      the SID of every buffered session file to its
+ *                      class, size, times and state.
+ *
+ *                      The catalog is an append-only log of fixed size
+ *                      records in datadir, replayed into a hash (by SID)
+ *                      and a list (by start time). Every process keeps
+ *                      its own copy and catches up with the records the
+ *                      others appended when it needs to. The parent
+ *                      catches up periodically and rewrites the log
+ *                      with one record per session once it has grown
+ *                      (OWPDCatalogMaintain).
+ *
+ *                      The class name is stored in a fixed field of
+ *                      OWPDMAXCLASSLEN bytes, nul padded. A name that
+ *                      fills the field is not nul terminated in the log;
+ *                      readers must bound it by the field length.
+ */
+#ifndef _OWPD_CATALOG_H
+#define _OWPD_CATALOG_H
+
+#include "policy.h"
+
+typedef enum{
+    OWPDCatInvalid=0,
+    OWPDCatOpen,        /* session file being written   */
+    OWPDCatFinished,    /* complete, not fetched yet    */
+    OWPDCatFetched,     /* complete, fetched            */
+    OWPDCatDeleted      /* only in the log              */
+} OWPDCatState;
+
+typedef struct OWPDCatEntryRec OWPDCatEntryRec, *OWPDCatEntry;
+struct OWPDCatEntryRec{
+    OWPSID          sid;
+    OWPDPolicyNode  node;
+    OWPDCatState    state;
+    off_t           size;
+    time_t          start;
+    time_t          end;
+    uint32_t        scan;       /* OWPDDiskRescan pass that saw it */
+    uint32_t        gen;        /* log (compaction) it was last read from */
+    OWPDCatEntry    prev;       /* by start time */
+    OWPDCatEntry    next;
+};
+
+struct OWPDCatalogRec{
+    OWPDPolicy      policy;
+    char            *path;
+    int             fd;         /* log being replayed */
+    off_t           offset;     /* fd replayed up to here */
+    uint32_t        gen;        /* compactions seen */
+    int             wfd;        /* O_APPEND, locked while writing */
+
+    /* sids:
+     *         key = OWPSID
+     *         val = OWPDCatEntry
+     */
+    I2Table         sids;
+    OWPDCatEntry    head;       /* oldest */
+    OWPDCatEntry    tail;
+};
+
+extern OWPDCatalog
+OWPDCatalogCreate(
+        OWPDPolicy  policy,
+        const char  *path
+        );
+
+extern OWPBoolean
+OWPDCatalogLoad(
+        OWPDCatalog cat
+        );
+
+extern void
+OWPDCatalogReset(
+        OWPDCatalog cat
+        );
+
+extern OWPDCatEntry
+OWPDCatalogInsert(
+        OWPDCatalog     cat,
+        OWPSID          sid,
+        OWPDPolicyNode  node,
+        OWPDCatState    state,
+        off_t           size,
+        time_t          start,
+        time_t          end
+        );
+
+extern void
+OWPDCatalogSort(
+        OWPDCatalog cat
+        );
+
+extern OWPBoolean
+OWPDCatalogCompact(
+        OWPDCatalog cat
+        );
+
+extern OWPBoolean
+OWPDCatalogMaintain(
+        OWPDCatalog cat
+        );
+
+extern OWPBoolean
+OWPDCatalogUpdate(
+        OWPDCatalog cat
+        );
+
+extern OWPBoolean
+OWPDCatalogAppend(
+        OWPDCatalog     cat,
+        OWPDCatEntry    entry
+        );
+
+extern OWPDCatEntry
+OWPDCatalogFind(
+        OWPDCatalog cat,
+        OWPSID      sid
+        );
+
+#endif /* _OWPD_CATALOG_H */
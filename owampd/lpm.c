@@ -0,0 +1,262 @@
+/*
+ *      $Id$
+ */
+/************************************************************************
+ *                                                                      *
+ *                             Copyright (C)  2026                      *
+ *                                Internet2                             *
+ *                             All Rights Reserved                      *
+ *                                                                      *
+ ************************************************************************/
+/*
+ *        File:         lpm.c
+ *
+ *        Description:
+ *                      Path-compressed binary trie for longest-prefix
+ *                      matching of addresses against "assign net" lines.
+ *
+ *                      Every node holds a complete prefix (key/bitlen).
+ *                      Nodes only exist where a prefix was inserted or
+ *                      where two prefixes diverge, so a lookup visits at
+ *                      most one node per distinct prefix length on the
+ *                      path to the address - and usually far fewer -
+ *                      instead of probing every possible mask length.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "lpm.h"
+
+typedef struct OWPDLpmNodeRec OWPDLpmNodeRec, *OWPDLpmNode;
+struct OWPDLpmNodeRec{
+    OWPDLpmNode child[2];
+    void        *val;
+    uint8_t     hasval;
+    uint8_t     bitlen;
+    uint8_t     key[16];
+};
+
+struct OWPDLpmRec{
+    OWPDLpmNode root4;
+    OWPDLpmNode root6;
+};
+
+#define LPMBIT(k,i) (((k)[(i)>>3] >> (7 - ((i)&7))) & 0x1)
+
+OWPDLpm
+OWPDLpmCreate(
+        void
+        )
+{
+    return calloc(1,sizeof(OWPDLpmRec));
+}
+
+static void
+FreeNode(
+        OWPDLpmNode node
+        )
+{
+    if(!node)
+        return;
+    FreeNode(node->child[0]);
+    FreeNode(node->child[1]);
+    free(node);
+}
+
+void
+OWPDLpmFree(
+        OWPDLpm lpm
+        )
+{
+    if(!lpm)
+        return;
+    FreeNode(lpm->root4);
+    FreeNode(lpm->root6);
+    free(lpm);
+}
+
+/*
+ * Function:    CommonBits
+ *
+ * Description:
+ *              Returns the number of leading bits a and b have in common,
+ *              looking at no more than maxbits.
+ */
+static unsigned int
+CommonBits(
+        const uint8_t   *a,
+        const uint8_t   *b,
+        unsigned int    maxbits
+        )
+{
+    unsigned int    i;
+    uint8_t         x;
+
+    for(i=0;i<maxbits;i+=8){
+        if((x = a[i>>3] ^ b[i>>3])){
+            while(!(x & 0x80)){
+                x <<= 1;
+                i++;
+            }
+            return (i < maxbits)? i: maxbits;
+        }
+    }
+
+    return maxbits;
+}
+
+static OWPDLpmNode
+NewNode(
+        const uint8_t   *addr,
+        size_t          addrsize,
+        unsigned int    bitlen
+        )
+{
+    OWPDLpmNode node;
+    size_t      nbytes = bitlen/8;
+
+    if(!(node = calloc(1,sizeof(*node)))){
+        return NULL;
+    }
+
+    /*
+     * Only keep the first bitlen bits of the address.
+     */
+    memcpy(node->key,addr,nbytes);
+    if((nbytes < addrsize) && (bitlen%8)){
+        node->key[nbytes] = addr[nbytes] & (0xFF << (8-(bitlen%8)));
+    }
+    node->bitlen = bitlen;
+
+    return node;
+}
+
+static OWPDLpmNode *
+RootForSize(
+        OWPDLpm lpm,
+        size_t  addrsize
+        )
+{
+    switch(addrsize){
+        case 4:
+            return &lpm->root4;
+        case 16:
+            return &lpm->root6;
+        default:
+            return NULL;
+    }
+}
+
+int
+OWPDLpmInsert(
+        OWPDLpm         lpm,
+        const uint8_t   *addr,
+        size_t          addrsize,
+        uint8_t         mask_len,
+        void            *val
+        )
+{
+    OWPDLpmNode *pp;
+    OWPDLpmNode node,split,leaf;
+    unsigned int    common;
+
+    if(!(pp = RootForSize(lpm,addrsize)) || (mask_len > addrsize*8)){
+        errno = EINVAL;
+        return -1;
+    }
+
+    while((node = *pp)){
+        common = CommonBits(node->key,addr,
+                (node->bitlen < mask_len)? node->bitlen: mask_len);
+
+        if(common < node->bitlen){
+            /*
+             * The new prefix diverges from (or is a prefix of) this
+             * node: put a node at the divergence point above it.
+             */
+            if(!(split = NewNode(addr,addrsize,common))){
+                return -1;
+            }
+            split->child[LPMBIT(node->key,common)] = node;
+
+            if(common == mask_len){
+                split->val = val;
+                split->hasval = 1;
+            }
+            else{
+                if(!(leaf = NewNode(addr,addrsize,mask_len))){
+                    free(split);
+                    return -1;
+                }
+                leaf->val = val;
+                leaf->hasval = 1;
+                split->child[LPMBIT(addr,common)] = leaf;
+            }
+            *pp = split;
+
+            return 0;
+        }
+
+        if(node->bitlen == mask_len){
+            node->val = val;
+            node->hasval = 1;
+            return 0;
+        }
+
+        pp = &node->child[LPMBIT(addr,node->bitlen)];
+    }
+
+    if(!(leaf = NewNode(addr,addrsize,mask_len))){
+        return -1;
+    }
+    leaf->val = val;
+    leaf->hasval = 1;
+    *pp = leaf;
+
+    return 0;
+}
+
+void *
+OWPDLpmLookup(
+        OWPDLpm         lpm,
+        const uint8_t   *addr,
+        size_t          addrsize
+        )
+{
+    OWPDLpmNode     *pp;
+    OWPDLpmNode     node;
+    unsigned int    nbytes,nbits;
+    void            *best = NULL;
+
+    if(!(pp = RootForSize(lpm,addrsize))){
+        return NULL;
+    }
+
+    for(node = *pp;node;node = node->child[LPMBIT(addr,node->bitlen)]){
+        /*
+         * Does addr fall within this node's prefix?
+         */
+        nbytes = node->bitlen/8;
+        nbits = node->bitlen%8;
+        if(memcmp(node->key,addr,nbytes) ||
+                (nbits && ((addr[nbytes] ^ node->key[nbytes]) &
+                           (0xFF << (8-nbits))))){
+            break;
+        }
+
+        /*
+         * A /0 prefix never matched when every mask length was probed
+         * (the probe stopped at 1) - keep it that way.
+         */
+        if(node->hasval && node->bitlen){
+            best = node->val;
+        }
+
+        if(node->bitlen >= addrsize*8){
+            break;
+        }
+    }
+
+    return best;
+}
@@ -0,0 +1,68 @@
+/*
+ *      $Id$
+ */
+/************************************************************************
+ *                                                                      *
+ *                             Copyright (C)  2026                      *
+ *                                Internet2                             *
+ *                             All Rights Reserved                      *
+ *                                                                      *
+ ************************************************************************/
+/*
+ *        File:         lpm.h
+ *
+ *        Description:
+ *                      Longest-prefix-match table used by owampd to map
+ *                      a client address to the "assign net" class that
+ *                      best matches it. IPv4 and IPv6 prefixes are kept
+ *                      in separate path-compressed binary tries.
+ *
+ *                      This module does not depend on the rest of owampd
+ *                      so it can be linked into the bench programs.
+ */
+#ifndef _OWPD_LPM_H
+#define _OWPD_LPM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct OWPDLpmRec OWPDLpmRec, *OWPDLpm;
+
+/*
+ * Returns NULL (errno set) on failure.
+ */
+extern OWPDLpm
+OWPDLpmCreate(
+        void
+        );
+
+extern void
+OWPDLpmFree(
+        OWPDLpm lpm
+        );
+
+/*
+ * addr is addrsize (4 or 16) bytes in network order. Bits of addr past
+ * mask_len must be 0. An existing entry for the same prefix is replaced.
+ * Returns 0 on success, -1 (errno set) on failure.
+ */
+extern int
+OWPDLpmInsert(
+        OWPDLpm         lpm,
+        const uint8_t   *addr,
+        size_t          addrsize,
+        uint8_t         mask_len,
+        void            *val
+        );
+
+/*
+ * Returns the val of the longest prefix that contains addr, or NULL.
+ */
+extern void *
+OWPDLpmLookup(
+        OWPDLpm         lpm,
+        const uint8_t   *addr,
+        size_t          addrsize
+        );
+
+#endif /* _OWPD_LPM_H */
@@ -45,22 +45,27 @@
 
 #include "owampdP.h"
 #include "policy.h"
+#include "catalog.h"
 
 /* Global variable - the total number of allowed Control connections. */
 static pid_t                mypid;
 static int                  owpd_chld = 0;
 static int                  owpd_int = 0;
 static int                  owpd_exit = 0;
+static int                  owpd_hup = 0;
 static int                  owpd_alrm = 0;
 static int                  owpd_intr = 0;
 static owampd_opts          opts;
 static OWPPortRangeRec      portrec;
 static I2ErrLogSyslogAttr   syslogattr;
 static I2ErrHandle          errhand=NULL;
-static I2Table              fdtable=NULL;
+static int                  chldpipe[2] = {-1,-1};
 static I2Table              pidtable=NULL;
 static OWPNum64             uptime;
 static uint32_t             control_sessions = 0;
+static pid_t                rescanpid = 0;
+static pid_t                reaperpid = 0;
+static OWPBoolean           reapstart = False;
 
 #if defined HAVE_DECL_OPTRESET && !HAVE_DECL_OPTRESET
 int optreset;
@@ -105,6 +110,26 @@ usage(
     return;
 }
 
+/*
+ * Wake up the poll in the main loop through the SIGCHLD pipe. (Even if
+ * the signal came just before it blocked.) If the pipe is full, it will
+ * wake anyway.
+ */
+static void
+wake_poll(
+        void
+        )
+{
+    int save_errno = errno;
+
+    if(chldpipe[1] >= 0){
+        while((write(chldpipe[1],"",1) < 0) && (errno == EINTR));
+    }
+    errno = save_errno;
+
+    return;
+}
+
 /*
  ** Handler function for SIG_CHLD. It updates the number
  ** of available Control connections.
@@ -119,15 +144,24 @@ signal_catch(
             owpd_int = 1;
             /* fallthru*/
         case SIGTERM:
-        case SIGHUP:
         case SIGUSR1:
         case SIGUSR2:
             if(!owpd_exit){
                 owpd_exit = 1;
             }
             break;
+        case SIGHUP:
+            /*
+             * Reload the policy (parent) or retire (prefork worker, disk
+             * reaper). Not an interrupt - control connections in
+             * progress carry on.
+             */
+            owpd_hup = 1;
+            wake_poll();
+            return;
         case SIGCHLD:
             owpd_chld = 1;
+            wake_poll();
             break;
         case SIGALRM:
             owpd_alrm = 1;
@@ -149,10 +183,97 @@ struct ChldStateRec{
     int             fd;
     OWPDPolicyNode  node;
     OWPDLimRec      used[2];    /* disk/bandwidth */
+    int             slot;       /* shared accounting ledger row */
+    nfds_t          pollidx;    /* in pollfds/pollchld */
 };
 
 typedef struct ChldStateRec ChldStateRec, *ChldState;
 
+/*
+ * Poll set of the parent: the listen socket, the read end of the SIGCHLD
+ * pipe, and one entry for the pipe of each child. Each child holds its
+ * slot (pollidx) for its lifetime. Freed slots (fd -1, ignored by poll)
+ * are reused before the arrays grow, and the arrays never shrink, so
+ * adding and removing a child does not move the others.
+ */
+#define OWPD_POLL_LISTEN    0
+#define OWPD_POLL_CHLD      1
+#define OWPD_POLL_SLAB      2
+
+static struct pollfd        *pollfds = NULL;
+static ChldState            *pollchld = NULL;   /* by pollfds index */
+static nfds_t               *pollfree = NULL;   /* stack of free slots */
+static nfds_t               npollfree = 0;
+static nfds_t               npollfds = 0;       /* slots handed out */
+static nfds_t               maxpollfds = 0;     /* slots allocated */
+
+static OWPBoolean
+SlabAlloc(
+        ChldState   cstate
+        )
+{
+    nfds_t  i;
+
+    if(npollfree){
+        i = pollfree[--npollfree];
+    }
+    else{
+        if(npollfds >= maxpollfds){
+            nfds_t          newmax = maxpollfds * 2;
+            struct pollfd   *newfds;
+            ChldState       *newchld;
+            nfds_t          *newfree;
+
+            /*
+             * Each array is reassigned as soon as it is realloc'd, so
+             * a failure part way through does not leak.
+             */
+            if(!(newfds = realloc(pollfds,newmax * sizeof(*newfds)))){
+                goto nomem;
+            }
+            pollfds = newfds;
+            if(!(newchld = realloc(pollchld,newmax * sizeof(*newchld)))){
+                goto nomem;
+            }
+            pollchld = newchld;
+            if(!(newfree = realloc(pollfree,newmax * sizeof(*newfree)))){
+                goto nomem;
+            }
+            pollfree = newfree;
+            maxpollfds = newmax;
+        }
+        i = npollfds++;
+    }
+
+    pollfds[i].fd = cstate->fd;
+    pollfds[i].events = POLLIN;
+    pollfds[i].revents = 0;
+    pollchld[i] = cstate;
+    cstate->pollidx = i;
+
+    return True;
+
+nomem:
+    OWPError(cstate->policy->ctx,OWPErrFATAL,ENOMEM,
+            "unable to grow poll fds: %M");
+    return False;
+}
+
+static void
+SlabFree(
+        ChldState   cstate
+        )
+{
+    nfds_t  i = cstate->pollidx;
+
+    pollfds[i].fd = -1;
+    pollfds[i].revents = 0;
+    pollchld[i] = NULL;
+    pollfree[npollfree++] = i;
+
+    return;
+}
+
 static ChldState
 AllocChldState(
         OWPDPolicy  policy,
@@ -173,28 +294,22 @@ AllocChldState(
     cstate->fd = fd;
 
     /*
-     * Add cstate into the hash's.
+     * add cstate to the poll set
      */
-    v.dptr = (void*)cstate;
-    v.dsize = sizeof(*cstate);
+    if(!SlabAlloc(cstate)){
+        free(cstate);
+        return NULL;
+    }
 
     /*
      * add cstate to the pidtable hash
      */
+    v.dptr = (void*)cstate;
+    v.dsize = sizeof(*cstate);
     k.dptr = NULL;
     k.dsize = pid;
     if(I2HashStore(pidtable,k,v) != 0){
-        free(cstate);
-        return NULL;
-    }
-
-    /*
-     * add cstate to the fdtable hash
-     */
-    k.dsize = fd;
-    if(I2HashStore(fdtable,k,v) != 0){
-        k.dsize = pid;
-        I2HashDelete(pidtable,k);
+        SlabFree(cstate);
         free(cstate);
         return NULL;
     }
@@ -206,69 +321,17 @@ AllocChldState(
 
 static void
 FreeChldState(
-        ChldState   cstate,
-        struct pollfd **fds,
-        nfds_t      *nfds
+        ChldState   cstate
         )
 {
     I2Datum k;
-    nfds_t i;
-    struct pollfd *newfds;
-
-    k.dptr = NULL;
 
     if(cstate->fd >= 0){
-
         while((close(cstate->fd) < 0) && (errno == EINTR));
-
-        /*
-         * Find index of pollfd element
-         */
-        for (i = 0; i < *nfds; i++) {
-            if (cstate->fd == (*fds)[i].fd) {
-                break;
-            }
-        }
-        if (i == *nfds) {
-            OWPError(cstate->policy->ctx,OWPErrWARNING,
-                    OWPErrUNKNOWN,
-                    "fd(%d) not in poll fds!?!",cstate->fd);
-            return;
-        }
-        /*
-         * Remove the element from the array
-         */
-        if (i < *nfds - 1) {
-            memmove(&(*fds)[i], &(*fds)[i + 1], (*nfds - 1 - i) * sizeof(**fds));
-        }
-
-        if (*nfds - 1 == 0) {
-            free(*fds);
-            newfds = NULL;
-        } else {
-            /*
-             * Ensure that we don't leak memory by overwriting *fds on
-             * failure
-             */
-            newfds = realloc(*fds, (*nfds - 1) * sizeof(**fds));
-            if (!newfds) {
-                OWPError(cstate->policy->ctx,OWPErrWARNING,
-                         OWPErrUNKNOWN,
-                         "unable to realloc poll fds: %M");
-                return;
-            }
-        }
-        *fds = newfds;
-        (*nfds)--;
-
-        k.dsize = cstate->fd;
-        if(I2HashDelete(fdtable,k) != 0){
-            OWPError(cstate->policy->ctx,OWPErrWARNING,
-                    OWPErrUNKNOWN,
-                    "fd(%d) not in fdtable!?!",cstate->fd);
-        }
     }
+    SlabFree(cstate);
 
+    k.dptr = NULL;
     k.dsize = cstate->pid;
     if(I2HashDelete(pidtable,k) != 0){
         OWPError(cstate->policy->ctx,OWPErrWARNING,OWPErrUNKNOWN,
@@ -276,8 +339,10 @@ FreeChldState(
     }
 
     /*
-     * TODO: Release bandwidth resources here if there are any left.
+     * Release bandwidth resources left in the child's shared ledger row.
+     * TODO: Release bandwidth resources of children using the pipe.
      */
+    OWPDSlotFree(cstate->policy,cstate->slot);
     control_sessions--;
 
     /*
@@ -292,77 +357,65 @@ FreeChldState(
 
 static void
 ReapChildren(
-        struct pollfd **fds,
-        nfds_t      *nfds
+        void
         )
 {
     int         status;
     pid_t       child;
     I2Datum     key;
     I2Datum     val;
-    ChldState   cstate;
+    char        buf[64];
 
     if(!owpd_chld)
         return;
 
+    /*
+     * Clear the flag (and drain the pipe) before waiting, so a child
+     * that exits from here on is seen on the next call.
+     */
+    owpd_chld = 0;
+    while(read(chldpipe[0],buf,sizeof(buf)) > 0);
+
     key.dptr = NULL;
     while ( (child = waitpid(-1, &status, WNOHANG)) > 0){
+        if(child == rescanpid){
+            rescanpid = 0;
+            continue;
+        }
+        if(child == reaperpid){
+            I2ErrLog(errhand,"Disk reaper (pid=%d) exited",child);
+            reaperpid = 0;
+            continue;
+        }
         key.dsize = child;
         if(!I2HashFetch(pidtable,key,&val)){
-            OWPError(cstate->policy->ctx,OWPErrWARNING,
-                    OWPErrUNKNOWN,
-                    "pid(%d) not in pidtable!?!",child);
+            I2ErrLog(errhand,"pid(%d) not in pidtable!?!",child);
+            continue;
         }
-        cstate = val.dptr;
 
-        FreeChldState(cstate,fds,nfds);
+        FreeChldState(val.dptr);
     }
 
-
-    owpd_chld = 0;
+    return;
 }
 
-struct CleanPipeArgRec{
-    struct pollfd *fds;
-    nfds_t        nfds;
-    int           nready;
-};
-
-static I2Boolean
-CheckFD(
-        I2Datum fdkey       __attribute__((unused)),
-        I2Datum fdval,
-        void    *app_data
+/*
+ * Handle a message from the child on the pipe in slot i.
+ */
+static void
+CheckPipe(
+        nfds_t  i
        )
 {
-    struct CleanPipeArgRec  *arg = (struct CleanPipeArgRec *)app_data;
-    ChldState               cstate = fdval.dptr;
-    int                     err=1;
-    nfds_t                  i;
-
-    /*
-     * If this fd is not ready, return.
-     */
-    for (i = 0; i < arg->nfds; i++) {
-        if (arg->fds[i].fd == cstate->fd) {
-            break;
-        }
-    }
-    if (i == arg->nfds || !(arg->fds[i].revents & POLLIN))
-        return True;
-
-    arg->fds[i].revents = 0;
-
-    /*
-     * This fd needs processing - reduce the "ready" count.
-     */
-    arg->nready--;
+    ChldState   cstate = pollchld[i];
+    int         err=1;
 
     /*
      * child initialization - first message.
      * Get classname and find policy node for that class.
+     * (Prefork workers send a new class for each connection.)
      */
-    if(!cstate->node){
+    if(!cstate->node || OWPDPeekClass(cstate->fd)){
         cstate->node = OWPDReadClass(cstate->policy,cstate->fd,&err);
     }
     else{
@@ -394,154 +447,93 @@ done:
         (void)kill(cstate->pid,SIGTERM);
     }
 
-    /*
-     * Return true if there are more fd's to process.
-     */
-    return (arg->nready > 0);
+    return;
 }
 
 /*
- * avail contains the fd_set of fd's that are currently readable, readfds is
- * the set of all fd's that the server needs to pay attention to.
+ * Process the child pipes poll found ready - nready of them.
  */
 static void
 CleanPipes(
-        struct pollfd *fds,
-        nfds_t      nfds,
         int     nready
         )
 {
-    struct CleanPipeArgRec  cpargs;
+    nfds_t  i;
 
-    cpargs.fds = fds;
-    cpargs.nfds = nfds;
-    cpargs.nready = nready;
-
-    I2HashIterate(fdtable,CheckFD,&cpargs);
+    for(i=OWPD_POLL_SLAB;(i < npollfds) && (nready > 0);i++){
+        if(!pollfds[i].revents){
+            continue;
+        }
+        nready--;
+        if(pollfds[i].revents & POLLIN){
+            CheckPipe(i);
+        }
+        pollfds[i].revents = 0;
+    }
 
     return;
 }
 
-static I2Boolean
+/*
+ * Close the pipes to all children. (In the parent, shutdown is set when
+ * terminating so child processes will not wait for responses when
+ * releasing resources. A new child only closes its copies.)
+ */
+static void
 ClosePipes(
-        I2Datum key,
-        I2Datum value,
-        void    *app_data
+        OWPBoolean  shut
         )
 {
-    ChldState   cstate = value.dptr;
-    int         sd = 0;
+    nfds_t      i;
+    ChldState   cstate;
 
-    if(app_data){
-        sd = *(int *)app_data;
-    }
+    for(i=OWPD_POLL_SLAB;i < npollfds;i++){
+        if(!(cstate = pollchld[i]) || (cstate->fd < 0)){
+            continue;
+        }
 
-    /*
-     * shutdown the socket if terminating so child processes will
-     * not wait for responses when releasing resources.
-     */
-    if(sd){
-        if( (shutdown(cstate->fd,SHUT_RDWR) != 0)){
-            OWPError(cstate->policy->ctx,OWPErrWARNING,OWPErrUNKNOWN,
-                    "shutdown(%d,SHUT_RDWR): %M", cstate->fd);
+        if(shut){
+            if( (shutdown(cstate->fd,SHUT_RDWR) != 0)){
+                OWPError(cstate->policy->ctx,OWPErrWARNING,OWPErrUNKNOWN,
+                        "shutdown(%d,SHUT_RDWR): %M", cstate->fd);
+            }
         }
-    }
 
-    while((close(cstate->fd) < 0) && (errno == EINTR));
-    if(I2HashDelete(fdtable,key) != 0){
-        OWPError(cstate->policy->ctx,OWPErrWARNING,OWPErrUNKNOWN,
-                "fd(%d) not in fdtable!?!",cstate->fd);
+        while((close(cstate->fd) < 0) && (errno == EINTR));
+        cstate->fd = -1;
+        pollfds[i].fd = -1;
     }
-    cstate->fd = -1;
 
-    return True;
+    return;
 }
 
 
 /*
  * This function needs to create a new child process with a pipe to
- * communicate with it. It needs to add the new pipefd into the readfds,
- * and update maxfd if the new pipefd is greater than the current max.
+ * communicate with it. In the parent, it adds the new pipefd into a
+ * slot of the poll set and returns the pid of the child. In the child, it saves the
+ * pipefd in the policy record and returns 0. Returns -1 on error.
  */
-static void
-NewConnection(
-        OWPDPolicy  policy,
-        I2Addr      listenaddr,
-        struct pollfd **fds,
-        nfds_t      *nfds
+static pid_t
+NewChild(
+        OWPDPolicy  policy
         )
 {
-    int                     connfd;
-    struct sockaddr_storage sbuff;
-    socklen_t               sbufflen;
     int                     new_pipe[2];
     pid_t                   pid;
-    OWPSessionMode          mode = opts.auth_mode;
-    int                     listenfd = I2AddrFD(listenaddr);
-    OWPControl              cntrl=NULL;
-    OWPErrSeverity          out;
-    struct itimerval        itval;
-    OWPRequestType          msgtype=OWPReqInvalid;
-    struct pollfd           *newfds;
-
-ACCEPT:
-    sbufflen = sizeof(sbuff);
-    connfd = accept(listenfd, (struct sockaddr *)&sbuff, &sbufflen);
-    if (connfd < 0){
-        switch(errno){
-            case EINTR:
-                /*
-                 * Exit signal received, no reason to do more.
-                 */
-                if(owpd_exit){
-                    return;
-                }
-
-                /*
-                 * Go ahead and reap before re-entering
-                 * accept since it could make more free
-                 * connections.
-                 */
-                ReapChildren(fds,nfds);
-                goto ACCEPT;
-                break;
-            case ECONNABORTED:
-                return;
-                break;
-            default:
-                OWPError(policy->ctx,OWPErrFATAL,OWPErrUNKNOWN,
-                        "accept(): %M");
-                return;
-                break;
-        }
-    }
-
-    if (opts.maxcontrolsessions &&
-        (control_sessions + 1 > opts.maxcontrolsessions)) {
-        /*
-         * Go ahead and reap before declaring this to have exceeded
-         * the max control sessions since it could make more free
-         * connections.
-         */
-        ReapChildren(fds,nfds);
-        if (control_sessions + 1 > opts.maxcontrolsessions) {
-            OWPError(policy->ctx,OWPErrWARNING,OWPErrPOLICY,
-                     "Resource usage exceeds limits %s "
-                     "(used = %" PRIu32 ", limit = %" PRIu32 ")",
-                     "maxcontrolsessions",
-                     control_sessions,opts.maxcontrolsessions);
-            OWPError(policy->ctx,OWPErrFATAL,OWPErrUNKNOWN,"socketpair(): %M");
-            (void)close(connfd);
-            return;
-        }
-    }
+    int                     slot;
 
     if (socketpair(AF_UNIX,SOCK_STREAM,0,new_pipe) < 0){
         OWPError(policy->ctx,OWPErrFATAL,OWPErrUNKNOWN,"socketpair(): %M");
-        (void)close(connfd);
-        return;
+        return -1;
     }
 
+    /*
+     * Give the child a row in the shared accounting ledger if there is
+     * one free. (Otherwise it sends its requests over the pipe.)
+     */
+    slot = OWPDSlotAlloc(policy);
+
     pid = fork();
 
     /* fork error */
@@ -549,8 +541,8 @@ ACCEPT:
         OWPError(policy->ctx,OWPErrFATAL,OWPErrUNKNOWN,"fork(): %M");
         (void)close(new_pipe[0]);
         (void)close(new_pipe[1]);
-        (void)close(connfd);
-        return;
+        OWPDSlotFree(policy,slot);
+        return -1;
     }
 
     /* Parent */
@@ -563,35 +555,16 @@ ACCEPT:
          * otherwise, ignore the error.
          */
         while((close(new_pipe[1]) < 0) && (errno == EINTR));
-        while((close(connfd) < 0) && (errno == EINTR));
 
         if(!(chld = AllocChldState(policy,pid,new_pipe[0]))){
             (void)close(new_pipe[0]);
             (void)kill(pid,SIGKILL);
-            return;
-        }
-
-        /*
-         * Ensure that we don't leak memory by overwriting *fds on
-         * failure
-         */
-        newfds = realloc(*fds, (*nfds + 1) * sizeof(**fds));
-        if (!newfds) {
-            OWPError(policy->ctx,OWPErrWARNING,
-                    OWPErrUNKNOWN,
-                    "unable to realloc poll fds: %M");
-            return;
+            OWPDSlotFree(policy,slot);
+            return -1;
         }
-        /*
-         * Add new element to end of newly (re-)allocated array
-         */
-        newfds[*nfds].fd = chld->fd;
-        newfds[*nfds].events = POLLIN;
-        newfds[*nfds].revents = 0;
-        *fds = newfds;
-        (*nfds)++;
+        chld->slot = slot;
 
-        return;
+        return pid;
     }
 
     /* Rest of function is child */
@@ -621,191 +594,1171 @@ ACCEPT:
     /*
      * Close unneeded fd's (these are used by the parent)
      */
-    I2HashIterate(fdtable,ClosePipes,NULL);
+    ClosePipes(False);
+    while((close(chldpipe[0]) < 0) && (errno == EINTR));
+    while((close(chldpipe[1]) < 0) && (errno == EINTR));
+    chldpipe[0] = chldpipe[1] = -1;
+
+    /*
+     * reset error logging
+     */
+    I2ErrReset(errhand);
+
+    /*
+     * check/set signal vars.
+     */
+    if(owpd_exit){
+        exit(0);
+    }
+    owpd_intr = 0;
+
+    /*
+     * save the pipe fd and ledger row in the policy record for the
+     * hooks to pick up.
+     */
+    policy->fd = new_pipe[1];
+    policy->slot = slot;
+
+    return 0;
+}
+
+/*
+ * Run the OWAMP-Control connection setup on connfd. Returns the new
+ * control connection, or NULL with err_ret set if it was not accepted.
+ * (connfd is closed in that case.) The setup is abandoned if it takes
+ * longer than timeout seconds.
+ */
+static OWPControl
+AcceptControl(
+        OWPDPolicy      policy,
+        int             connfd,
+        struct sockaddr *sa,
+        socklen_t       salen,
+        uint32_t        timeout,
+        OWPErrSeverity  *err_ret
+        )
+{
+    OWPSessionMode          mode = opts.auth_mode;
+    struct itimerval        itval;
+
+    /*
+     * Initialize itimer struct. The it_value.tv_sec will be
+     * set to interrupt socket i/o if the message is not received
+     * within the timeout as described by owdp draft section 4
+     * (OWAMP-Control).
+     */
+    memset(&itval,0,sizeof(itval));
+
+    /*
+     * If the daemon is configured to do open_mode, check if
+     * there is an open_mode limit defined for the given
+     * address.
+     */
+    if((mode & OWP_MODE_OPEN) && !OWPDAllowOpenMode(policy,sa,err_ret)){
+        if(*err_ret != OWPErrOK){
+            while((close(connfd) < 0) && (errno == EINTR));
+            return NULL;
+        }
+        mode &= ~OWP_MODE_OPEN;
+    }
+
+    owpd_intr = 0;
+    itval.it_value.tv_sec = timeout;
+    if(setitimer(ITIMER_REAL,&itval,NULL) != 0){
+        I2ErrLog(errhand,"setitimer(): %M");
+        while((close(connfd) < 0) && (errno == EINTR));
+        *err_ret = OWPErrFATAL;
+        return NULL;
+    }
+
+    return OWPControlAccept(policy->ctx,connfd,sa,salen,
+            mode,uptime,&owpd_intr,err_ret);
+}
+
+/*
+ * Read the type of the next request on cntrl, and start the timer that
+ * abandons the request (including the reply) if it takes longer than
+ * timeout seconds.
+ */
+static OWPRequestType
+ReadRequest(
+        OWPControl      cntrl,
+        uint32_t        timeout
+        )
+{
+    struct itimerval    itval;
+
+    /*
+     * reset signal vars
+     */
+    memset(&itval,0,sizeof(itval));
+    owpd_intr = owpd_alrm = owpd_chld = 0;
+    itval.it_value.tv_sec = timeout;
+    if(setitimer(ITIMER_REAL,&itval,NULL) != 0){
+        I2ErrLog(errhand,"setitimer(): %M");
+        return OWPReqInvalid;
+    }
+
+    return OWPReadRequestType(cntrl,&owpd_intr);
+}
+
+/*
+ * Process the rest of a request of type msgtype (see ReadRequest). Test
+ * sessions started by a StartSessions request are left running for the
+ * caller to wait on.
+ */
+static OWPErrSeverity
+HandleRequest(
+        OWPControl      cntrl,
+        OWPRequestType  msgtype
+        )
+{
+    OWPErrSeverity      rc = OWPErrOK;
+
+    switch (msgtype){
+
+        case OWPReqTest:
+            rc = OWPProcessTestRequest(cntrl,&owpd_intr);
+            break;
+
+        case OWPReqStartSessions:
+            rc = OWPProcessStartSessions(cntrl,&owpd_intr);
+            break;
+
+        case OWPReqFetchSession:
+            /*
+             * TODO: Should the timeout be suspended
+             * for fetchsession?
+             * (If session files take longer than
+             * the timeout - this will fail... The
+             * default is 30 min. Leave for now.
+             * (The fix would be to leave the timeout in
+             * place for completing the fetchsession
+             * read, and then process the write
+             * of the session separately.)
+             */
+            rc = OWPProcessFetchSession(cntrl,&owpd_intr);
+            break;
+
+        case OWPReqSockClose:
+        default:
+            rc = OWPErrFATAL;
+            break;
+    }
+
+    return rc;
+}
+
+/*
+ * Read and process the next request on cntrl, within timeout seconds.
+ * msgtype is set to the request read.
+ */
+static OWPErrSeverity
+ProcessRequest(
+        OWPControl      cntrl,
+        uint32_t        timeout,
+        OWPRequestType  *msgtype
+        )
+{
+    *msgtype = ReadRequest(cntrl,timeout);
+
+    return HandleRequest(cntrl,*msgtype);
+}
+
+/*
+ * Process all requests from the control connection connfd - return
+ * when complete. The return value is the exit status for the child
+ * process serving the connection.
+ */
+static int
+ServeConnection(
+        OWPDPolicy      policy,
+        int             connfd,
+        struct sockaddr *sa,
+        socklen_t       salen
+        )
+{
+    OWPControl              cntrl=NULL;
+    OWPErrSeverity          out;
+    struct itimerval        itval;
+    OWPRequestType          msgtype=OWPReqInvalid;
+
+    memset(&itval,0,sizeof(itval));
+
+    cntrl = AcceptControl(policy,connfd,sa,salen,opts.controltimeout,&out);
+    /*
+     * session not accepted.
+     */
+    if(!cntrl){
+        return out;
+    }
+
+    /*
+     * Process all requests - return when complete.
+     */
+    while(1){
+        OWPErrSeverity  rc;
+
+        rc = ProcessRequest(cntrl,opts.controltimeout,&msgtype);
+
+        if((msgtype == OWPReqStartSessions) && (rc >= OWPErrOK)){
+            /*
+             * Test session started - unset timer - wait
+             * until all sessions are complete, then
+             * reset the timer and wait for stopsessions
+             * to complete.
+             */
+            owpd_intr = 0;
+            itval.it_value.tv_sec = 0;
+            if(setitimer(ITIMER_REAL,&itval,NULL) != 0){
+                I2ErrLog(errhand,"setitimer(): %M");
+                goto done;
+            }
+            while(OWPSessionsActive(cntrl,NULL)){
+                int        wstate;
+
+                rc = OWPErrOK;
+                owpd_intr = 0;
+                wstate = OWPStopSessionsWait(cntrl,NULL,
+                        &owpd_intr,NULL,&rc);
+                if(owpd_int){
+                    goto done;
+                }
+                else if(owpd_exit){
+                    /*
+                     * wstate == 2 indicates gracefull shutdown...
+                     * Continue on and let StopSessions happen.
+                     */
+                    if(wstate != 2){
+                        goto done;
+                    }
+                    break;
+                }
+                if(wstate == 0){
+                    goto nextreq;
+                }
+            }
+            /*
+             * Sessions are complete, but StopSessions
+             * message has not been exchanged - set the
+             * timer and trade StopSessions messages
+             */
+            owpd_intr = 0;
+            itval.it_value.tv_sec = opts.controltimeout;
+            if(setitimer(ITIMER_REAL,&itval,NULL) != 0){
+                I2ErrLog(errhand,"setitimer(): %M");
+                goto done;
+            }
+            rc = OWPStopSessions(cntrl,&owpd_intr,NULL);
+        }
+nextreq:
+        if(rc < OWPErrWARNING){
+            break;
+        }
+        if(owpd_exit){
+            break;
+        }
+    }
+
+done:
+    OWPControlClose(cntrl);
+
+    if(owpd_exit){
+        return 0;
+    }
+
+    /*
+     * Normal socket close
+     */
+    if(msgtype == OWPReqSockClose){
+        return 0;
+    }
+
+    I2ErrLog(errhand,"Control session terminated abnormally...");
+
+    return 1;
+}
+
+/*
+ * Accept a new control connection and fork a child process to
+ * handle it.
+ */
+static void
+NewConnection(
+        OWPDPolicy  policy,
+        I2Addr      listenaddr
+        )
+{
+    int                     connfd;
+    struct sockaddr_storage sbuff;
+    socklen_t               sbufflen;
+    pid_t                   pid;
+    int                     listenfd = I2AddrFD(listenaddr);
+
+ACCEPT:
+    sbufflen = sizeof(sbuff);
+    connfd = accept(listenfd, (struct sockaddr *)&sbuff, &sbufflen);
+    if (connfd < 0){
+        switch(errno){
+            case EINTR:
+                /*
+                 * Exit signal received, no reason to do more.
+                 * (Exited children are reaped by the main loop.)
+                 */
+                if(owpd_exit){
+                    return;
+                }
+                goto ACCEPT;
+                break;
+            case ECONNABORTED:
+                return;
+                break;
+            default:
+                OWPError(policy->ctx,OWPErrFATAL,OWPErrUNKNOWN,
+                        "accept(): %M");
+                return;
+                break;
+        }
+    }
+
+    if (opts.maxcontrolsessions &&
+        (control_sessions + 1 > opts.maxcontrolsessions)) {
+        /*
+         * Go ahead and reap before declaring this to have exceeded
+         * the max control sessions since it could make more free
+         * connections.
+         */
+        ReapChildren();
+        if (control_sessions + 1 > opts.maxcontrolsessions) {
+            OWPError(policy->ctx,OWPErrWARNING,OWPErrPOLICY,
+                     "Resource usage exceeds limits %s "
+                     "(used = %" PRIu32 ", limit = %" PRIu32 ")",
+                     "maxcontrolsessions",
+                     control_sessions,opts.maxcontrolsessions);
+            OWPError(policy->ctx,OWPErrFATAL,OWPErrUNKNOWN,"socketpair(): %M");
+            (void)close(connfd);
+            return;
+        }
+    }
+
+    /*
+     * Parent (or error) - the child owns connfd now.
+     */
+    if ( (pid = NewChild(policy)) != 0){
+        while((close(connfd) < 0) && (errno == EINTR));
+        return;
+    }
+
+    /* Rest of function is child */
+
+    exit(ServeConnection(policy,connfd,(struct sockaddr *)&sbuff,sbufflen));
+}
+
+/*
+ * Prefork worker: accept control connections on the shared listen socket
+ * and serve them one at a time, reusing the policy state inherited from
+ * the parent. The worker exits after opts.preforkmaxconns connections so
+ * the parent can replace it with a fresh process. (Or once the parent has
+ * reloaded the policy, so the replacement gets the new one.)
+ */
+static void
+PreforkWorker(
+        OWPDPolicy  policy,
+        I2Addr      listenaddr
+        )
+{
+    int                     connfd;
+    struct sockaddr_storage sbuff;
+    socklen_t               sbufflen;
+    struct itimerval        itval;
+    int                     listenfd = I2AddrFD(listenaddr);
+    uint32_t                nconns = 0;
+
+    memset(&itval,0,sizeof(itval));
+
+    while(!opts.preforkmaxconns || (nconns < opts.preforkmaxconns)){
+
+        if(owpd_exit || owpd_hup){
+            exit(0);
+        }
+
+        sbufflen = sizeof(sbuff);
+        connfd = accept(listenfd, (struct sockaddr *)&sbuff, &sbufflen);
+        if (connfd < 0){
+            switch(errno){
+                case EINTR:
+                case ECONNABORTED:
+                    continue;
+                    break;
+                default:
+                    OWPError(policy->ctx,OWPErrFATAL,OWPErrUNKNOWN,
+                            "accept(): %M");
+                    exit(1);
+                    break;
+            }
+        }
+        nconns++;
+
+        (void)ServeConnection(policy,connfd,(struct sockaddr *)&sbuff,
+                sbufflen);
+
+        /*
+         * Clear the control timeout so it does not fire while
+         * waiting in accept.
+         */
+        itval.it_value.tv_sec = 0;
+        if(setitimer(ITIMER_REAL,&itval,NULL) != 0){
+            I2ErrLog(errhand,"setitimer(): %M");
+            exit(1);
+        }
+        owpd_intr = owpd_alrm = owpd_chld = 0;
+    }
+
+    exit(0);
+}
+
+/*
+ * State of a control connection held by a multiplexing prefork worker.
+ * Only the waits between protocol messages are multiplexed - a message
+ * that has started to arrive is processed synchronously. Those steps
+ * block every other connection of the worker, so they are bounded by
+ * opts.muxtimeout instead of the (much longer) control timeout. The one
+ * exception is the data transfer of FetchSession, which is handed to a
+ * process of its own (MuxFetch).
+ */
+typedef enum{
+    OWPDCONN_REQUEST=0,     /* waiting for the next request     */
+    OWPDCONN_TEST,          /* test sessions in progress        */
+    OWPDCONN_FETCH          /* FetchSession done by fetchfd     */
+} OWPDConnState;
+
+struct OWPDConnRec{
+    OWPControl      cntrl;
+    OWPDConnState   state;
+    time_t          timeout;    /* OWPDCONN_REQUEST: give up at */
+    int             fetchfd;    /* OWPDCONN_FETCH: result pipe  */
+};
+
+/*
+ * What the fetch process (MuxFetch) hands back on fetchfd.
+ */
+struct OWPDFetchResultRec{
+    OWPErrSeverity      rc;
+    OWPControlStateRec  state;
+};
+
+typedef struct OWPDConnRec OWPDConnRec, *OWPDConn;
+
+static void
+MuxClose(
+        OWPDPolicy      policy,
+        OWPDConn        conn,
+        OWPErrSeverity  rc,
+        OWPRequestType  msgtype
+        )
+{
+    (void)OWPDSwitchClass(policy,conn->cntrl);
+    OWPControlClose(conn->cntrl);
+    conn->cntrl = NULL;
+
+    if((rc < OWPErrWARNING) && (msgtype != OWPReqSockClose) && !owpd_exit){
+        I2ErrLog(errhand,"Control session terminated abnormally...");
+    }
+
+    return;
+}
+
+/*
+ * Accept one connection from the (non-blocking) listen socket into conn.
+ * Returns True if a connection was taken off the listen queue.
+ */
+static OWPBoolean
+MuxAccept(
+        OWPDPolicy  policy,
+        int         listenfd,
+        OWPDConn    conn
+        )
+{
+    int                     connfd;
+    struct sockaddr_storage sbuff;
+    socklen_t               sbufflen;
+    int                     flags;
+    OWPErrSeverity          out;
+    struct itimerval        itval;
+
+    sbufflen = sizeof(sbuff);
+    connfd = accept(listenfd, (struct sockaddr *)&sbuff, &sbufflen);
+    if (connfd < 0){
+        /*
+         * Another worker may have taken the connection.
+         */
+        if((errno != EINTR) && (errno != ECONNABORTED) &&
+                (errno != EAGAIN) && (errno != EWOULDBLOCK)){
+            OWPError(policy->ctx,OWPErrFATAL,OWPErrUNKNOWN,
+                    "accept(): %M");
+        }
+        return False;
+    }
+
+    /*
+     * The library expects a blocking control socket. (Some systems
+     * pass O_NONBLOCK from the listen socket on to accepted sockets.)
+     */
+    if(((flags = fcntl(connfd,F_GETFL,0)) < 0) ||
+            (fcntl(connfd,F_SETFL,flags & ~O_NONBLOCK) < 0)){
+        OWPError(policy->ctx,OWPErrFATAL,OWPErrUNKNOWN,"fcntl(): %M");
+        while((close(connfd) < 0) && (errno == EINTR));
+        return True;
+    }
+
+    conn->cntrl = AcceptControl(policy,connfd,(struct sockaddr *)&sbuff,
+            sbufflen,opts.muxtimeout,&out);
+
+    memset(&itval,0,sizeof(itval));
+    (void)setitimer(ITIMER_REAL,&itval,NULL);
+
+    if(conn->cntrl){
+        conn->state = OWPDCONN_REQUEST;
+        conn->timeout = time(NULL) + opts.controltimeout;
+    }
+
+    return True;
+}
+
+/*
+ * Leave conn waiting for what comes after the request msgtype, or close
+ * it if the request failed.
+ */
+static void
+MuxRequestDone(
+        OWPDPolicy      policy,
+        OWPDConn        conn,
+        OWPErrSeverity  rc,
+        OWPRequestType  msgtype
+        )
+{
+    if(rc < OWPErrWARNING){
+        MuxClose(policy,conn,rc,msgtype);
+        return;
+    }
+
+    if((msgtype == OWPReqStartSessions) && (rc >= OWPErrOK)){
+        conn->state = OWPDCONN_TEST;
+    }
+    else{
+        conn->state = OWPDCONN_REQUEST;
+        conn->timeout = time(NULL) + opts.controltimeout;
+    }
+
+    return;
+}
+
+/*
+ * A FetchSession request has been read on conn. The rest of it - waiting
+ * for the session file to be finalized, and sending the records - can
+ * take much longer than muxtimeout, so it is done by a process of its
+ * own, bounded by the control timeout like a forked connection. (Its
+ * parent exits right away, so the worker is not interrupted by a SIGCHLD
+ * when it is done.) The process hands the state it left the connection
+ * in back through a pipe, and conn is resumed from that (MuxFetchDone).
+ *
+ * Without shared accounting the fetch process would share the pipe to
+ * the parent with the worker, so the fetch is done here instead - still
+ * bounded by the control timeout rather than muxtimeout.
+ *
+ * conns are all connections of the worker: the fetch process closes the
+ * others, so closing them in the worker still closes them.
+ */
+static void
+MuxFetch(
+        OWPDPolicy  policy,
+        OWPDConn    conns,
+        OWPDConn    conn
+        )
+{
+    struct OWPDFetchResultRec   res;
+    struct itimerval            itval;
+    int                         fds[2];
+    pid_t                       pid;
+    uint32_t                    i;
+    int                         fail_on_intr=1;
+
+    /*
+     * (muxtimeout only bounded reading the request type.)
+     */
+    memset(&itval,0,sizeof(itval));
+    (void)setitimer(ITIMER_REAL,&itval,NULL);
+
+    if(policy->slot < 0){
+        goto here;
+    }
+    if(pipe(fds) != 0){
+        OWPError(policy->ctx,OWPErrWARNING,errno,"pipe(): %M");
+        goto here;
+    }
+
+    if((pid = fork()) < 0){
+        OWPError(policy->ctx,OWPErrWARNING,errno,"fork(): %M");
+        while((close(fds[0]) < 0) && (errno == EINTR));
+        while((close(fds[1]) < 0) && (errno == EINTR));
+        goto here;
+    }
+
+    if(pid > 0){
+        while((close(fds[1]) < 0) && (errno == EINTR));
+        while((waitpid(pid,NULL,0) < 0) && (errno == EINTR));
+        conn->state = OWPDCONN_FETCH;
+        conn->fetchfd = fds[0];
+        return;
+    }
+
+    /*
+     * Child: fork again so the fetch is not a child of the worker.
+     */
+    while((close(fds[0]) < 0) && (errno == EINTR));
+    if((pid = fork()) != 0){
+        if(pid < 0){
+            OWPError(policy->ctx,OWPErrWARNING,errno,"fork(): %M");
+        }
+        exit((pid < 0)? 1: 0);
+    }
+
+    for(i=0;i<opts.preforkconns;i++){
+        if(&conns[i] == conn){
+            continue;
+        }
+        if(conns[i].cntrl){
+            while((close(OWPControlFD(conns[i].cntrl)) < 0) &&
+                    (errno == EINTR));
+        }
+        if(conns[i].fetchfd >= 0){
+            while((close(conns[i].fetchfd) < 0) && (errno == EINTR));
+        }
+    }
+
+    owpd_intr = 0;
+    itval.it_value.tv_sec = opts.controltimeout;
+    if(setitimer(ITIMER_REAL,&itval,NULL) != 0){
+        I2ErrLog(errhand,"setitimer(): %M");
+        exit(1);
+    }
+
+    memset(&res,0,sizeof(res));
+    res.rc = OWPProcessFetchSession(conn->cntrl,&owpd_intr);
+    OWPControlGetState(conn->cntrl,&res.state);
+    if(I2Writeni(fds[1],&res,sizeof(res),&fail_on_intr) != sizeof(res)){
+        exit(1);
+    }
+
+    exit(0);
+
+here:
+    owpd_intr = 0;
+    itval.it_value.tv_sec = opts.controltimeout;
+    if(setitimer(ITIMER_REAL,&itval,NULL) != 0){
+        I2ErrLog(errhand,"setitimer(): %M");
+        MuxClose(policy,conn,OWPErrFATAL,OWPReqFetchSession);
+        return;
+    }
+    res.rc = OWPProcessFetchSession(conn->cntrl,&owpd_intr);
+    itval.it_value.tv_sec = 0;
+    (void)setitimer(ITIMER_REAL,&itval,NULL);
+
+    MuxRequestDone(policy,conn,res.rc,OWPReqFetchSession);
+
+    return;
+}
+
+/*
+ * The fetch process of conn has finished (fetchfd is readable) - take
+ * the connection back in the state it left it. (If it died without a
+ * result, the connection is in an unknown state, and is closed.)
+ */
+static void
+MuxFetchDone(
+        OWPDPolicy  policy,
+        OWPDConn    conn
+        )
+{
+    struct OWPDFetchResultRec   res;
+    OWPErrSeverity              rc = OWPErrFATAL;
+    int                         fail_on_intr=0;
+
+    if(I2Readni(conn->fetchfd,&res,sizeof(res),&fail_on_intr) ==
+            sizeof(res)){
+        OWPControlSetState(conn->cntrl,&res.state);
+        rc = res.rc;
+    }
+    while((close(conn->fetchfd) < 0) && (errno == EINTR));
+    conn->fetchfd = -1;
+
+    MuxRequestDone(policy,conn,rc,OWPReqFetchSession);
+
+    return;
+}
+
+/*
+ * The control fd of conn is readable - process the request.
+ */
+static void
+MuxRequest(
+        OWPDPolicy  policy,
+        OWPDConn    conns,
+        OWPDConn    conn
+        )
+{
+    OWPRequestType      msgtype = OWPReqInvalid;
+    OWPErrSeverity      rc;
+    struct itimerval    itval;
+
+    if(!OWPDSwitchClass(policy,conn->cntrl)){
+        MuxClose(policy,conn,OWPErrFATAL,msgtype);
+        return;
+    }
+
+    msgtype = ReadRequest(conn->cntrl,opts.muxtimeout);
+    if(msgtype == OWPReqFetchSession){
+        MuxFetch(policy,conns,conn);
+        return;
+    }
+    rc = HandleRequest(conn->cntrl,msgtype);
+
+    memset(&itval,0,sizeof(itval));
+    (void)setitimer(ITIMER_REAL,&itval,NULL);
+
+    MuxRequestDone(policy,conn,rc,msgtype);
+
+    return;
+}
+
+/*
+ * Check on the test sessions of conn. If they are complete, or the
+ * client sent StopSessions (ready), trade StopSessions messages and go
+ * back to waiting for requests.
+ */
+static void
+MuxTest(
+        OWPDPolicy  policy,
+        OWPDConn    conn,
+        OWPBoolean  ready
+        )
+{
+    OWPAcceptType       aval = OWP_CNTRL_ACCEPT;
+    OWPErrSeverity      rc = OWPErrOK;
+    OWPTimeStamp        currstamp;
+    struct itimerval    itval;
+    int                 wstate;
+
+    if(!ready && OWPSessionsActive(conn->cntrl,&aval) && !aval){
+        return;
+    }
+
+    if(!OWPDSwitchClass(policy,conn->cntrl)){
+        MuxClose(policy,conn,OWPErrFATAL,OWPReqInvalid);
+        return;
+    }
+
+    if(!OWPGetTimeOfDay(policy->ctx,&currstamp)){
+        OWPError(policy->ctx,OWPErrFATAL,OWPErrUNKNOWN,
+                "OWPGetTimeOfDay(): %M");
+        MuxClose(policy,conn,OWPErrFATAL,OWPReqInvalid);
+        return;
+    }
+
+    /*
+     * Waking "now" makes this a non-blocking check, except for the
+     * StopSessions exchange itself - that is bounded by the timer.
+     */
+    memset(&itval,0,sizeof(itval));
+    owpd_intr = 0;
+    itval.it_value.tv_sec = opts.muxtimeout;
+    if(setitimer(ITIMER_REAL,&itval,NULL) != 0){
+        I2ErrLog(errhand,"setitimer(): %M");
+        MuxClose(policy,conn,OWPErrFATAL,OWPReqInvalid);
+        return;
+    }
+    wstate = OWPStopSessionsWait(conn->cntrl,&currstamp.owptime,&owpd_intr,
+            NULL,&rc);
+    itval.it_value.tv_sec = 0;
+    (void)setitimer(ITIMER_REAL,&itval,NULL);
+
+    if((wstate < 0) || (rc < OWPErrWARNING)){
+        MuxClose(policy,conn,OWPErrFATAL,OWPReqInvalid);
+        return;
+    }
+
+    if(wstate == 0){
+        conn->state = OWPDCONN_REQUEST;
+        conn->timeout = time(NULL) + opts.controltimeout;
+    }
+
+    return;
+}
+
+/*
+ * Multiplexing prefork worker: hold up to opts.preforkconns control
+ * connections at once and wait on all of them with one poll(), so an
+ * idle connection or a running test session does not need a process
+ * of its own. Like PreforkWorker, the worker stops accepting after
+ * opts.preforkmaxconns connections (or a policy reload) and exits once
+ * they are done.
+ */
+static void
+MuxWorker(
+        OWPDPolicy  policy,
+        I2Addr      listenaddr
+        )
+{
+    int             listenfd = I2AddrFD(listenaddr);
+    OWPDConn        conns;
+    struct pollfd   *pfds;
+    uint32_t        nconns = 0;
+    uint32_t        nactive;
+    uint32_t        i;
+    int             timeout,t;
+    int             nfound;
+    time_t          now;
+    OWPBoolean      ready;
+
+    conns = calloc(opts.preforkconns,sizeof(*conns));
+    pfds = calloc(opts.preforkconns+1,sizeof(*pfds));
+    if(!conns || !pfds){
+        OWPError(policy->ctx,OWPErrFATAL,ENOMEM,"calloc(): %M");
+        exit(1);
+    }
+    for(i=0;i<opts.preforkconns;i++){
+        conns[i].fetchfd = -1;
+    }
+
+    while(!owpd_exit){
+
+        now = time(NULL);
+        nactive = 0;
+        timeout = -1;
+        for(i=0;i<opts.preforkconns;i++){
+            pfds[i+1].fd = -1;
+            pfds[i+1].events = POLLIN;
+            pfds[i+1].revents = 0;
+
+            if(!conns[i].cntrl){
+                continue;
+            }
+            nactive++;
+            if(conns[i].state == OWPDCONN_FETCH){
+                pfds[i+1].fd = conns[i].fetchfd;
+                continue;
+            }
+            pfds[i+1].fd = OWPControlFD(conns[i].cntrl);
+
+            if(conns[i].state == OWPDCONN_TEST){
+                t = OWPD_TEST_POLL * 1000;
+            }
+            else if(conns[i].timeout > now){
+                t = (conns[i].timeout - now) * 1000;
+            }
+            else{
+                t = 0;
+            }
+            if((timeout < 0) || (t < timeout)){
+                timeout = t;
+            }
+        }
+
+        /*
+         * Only accept while there is a free slot, and stop accepting
+         * once this worker has served its share of connections.
+         */
+        pfds[0].fd = -1;
+        pfds[0].events = POLLIN;
+        pfds[0].revents = 0;
+        if(owpd_hup ||
+                (opts.preforkmaxconns && (nconns >= opts.preforkmaxconns))){
+            if(!nactive){
+                break;
+            }
+        }
+        else if(nactive < opts.preforkconns){
+            pfds[0].fd = listenfd;
+        }
+
+        nfound = poll(pfds,opts.preforkconns+1,timeout);
+        if((nfound < 0) && (errno != EINTR)){
+            OWPError(policy->ctx,OWPErrFATAL,errno,"poll(): %M");
+            break;
+        }
+
+        now = time(NULL);
+        for(i=0;i<opts.preforkconns;i++){
+            if(!conns[i].cntrl){
+                continue;
+            }
+            ready = (pfds[i+1].revents & (POLLIN|POLLERR|POLLHUP))?
+                True: False;
+
+            if(conns[i].state == OWPDCONN_TEST){
+                MuxTest(policy,&conns[i],ready);
+            }
+            else if(conns[i].state == OWPDCONN_FETCH){
+                if(ready){
+                    MuxFetchDone(policy,&conns[i]);
+                }
+            }
+            else if(ready){
+                MuxRequest(policy,conns,&conns[i]);
+            }
+            else if(now >= conns[i].timeout){
+                MuxClose(policy,&conns[i],OWPErrFATAL,OWPReqSockIntr);
+            }
+        }
+
+        if(pfds[0].revents & POLLIN){
+            for(i=0;(i < opts.preforkconns) && conns[i].cntrl;i++);
+            if((i < opts.preforkconns) &&
+                    MuxAccept(policy,listenfd,&conns[i])){
+                nconns++;
+            }
+        }
+    }
+
+    /*
+     * Let running test sessions stop gracefully, and fetches complete,
+     * unless interrupted.
+     */
+    for(i=0;i<opts.preforkconns;i++){
+        struct itimerval    itval;
+
+        if(conns[i].cntrl && (conns[i].state == OWPDCONN_FETCH)){
+            if(!owpd_int){
+                MuxFetchDone(policy,&conns[i]);
+            }
+            else{
+                while((close(conns[i].fetchfd) < 0) && (errno == EINTR));
+                conns[i].fetchfd = -1;
+            }
+        }
+        if(!conns[i].cntrl){
+            continue;
+        }
+        if(!owpd_int && (conns[i].state == OWPDCONN_TEST) &&
+                OWPDSwitchClass(policy,conns[i].cntrl)){
+            memset(&itval,0,sizeof(itval));
+            owpd_intr = 0;
+            itval.it_value.tv_sec = opts.muxtimeout;
+            if(setitimer(ITIMER_REAL,&itval,NULL) == 0){
+                (void)OWPStopSessions(conns[i].cntrl,&owpd_intr,NULL);
+            }
+        }
+        MuxClose(policy,&conns[i],OWPErrOK,OWPReqSockClose);
+    }
+
+    free(conns);
+    free(pfds);
+
+    exit(0);
+}
+
+/*
+ * Prefork mode: fork new workers until the pool is full again.
+ */
+static void
+FillWorkerPool(
+        OWPDPolicy  policy,
+        I2Addr      listenaddr
+        )
+{
+    pid_t   pid;
+
+    while(!owpd_exit && (control_sessions < opts.prefork)){
+        if( (pid = NewChild(policy)) < 0){
+            return;
+        }
+        if(pid == 0){
+            if(opts.preforkconns > 1){
+                MuxWorker(policy,listenaddr);
+            }
+            else{
+                PreforkWorker(policy,listenaddr);
+            }
+            /* UNREACHED */
+        }
+    }
+
+    return;
+}
+
+/*
+ * The disk usage was taken from the usage journal - walk datadir in
+ * the background to make sure it was right.
+ */
+static void
+StartDiskRescan(
+        OWPDPolicy  policy,
+        int         listenfd
+        )
+{
+    struct sigaction    dflact;
+
+    if( (rescanpid = fork()) < 0){
+        OWPError(policy->ctx,OWPErrWARNING,OWPErrUNKNOWN,"fork(): %M");
+        rescanpid = 0;
+        return;
+    }
+
+    if(rescanpid > 0){
+        return;
+    }
 
     /*
-     * reset error logging
+     * Child: nothing to shut down gracefully, so just die with the
+     * rest of the process group.
      */
+    memset(&dflact,0,sizeof(dflact));
+    dflact.sa_handler = SIG_DFL;
+    sigemptyset(&dflact.sa_mask);
+    (void)sigaction(SIGTERM,&dflact,NULL);
+    (void)sigaction(SIGINT,&dflact,NULL);
+    (void)sigaction(SIGHUP,&dflact,NULL);
+
+    (void)close(listenfd);
     I2ErrReset(errhand);
 
-    /*
-     * check/set signal vars.
-     */
-    if(owpd_exit){
-        exit(0);
+    exit((OWPDDiskRescan(policy))? 0: 1);
+}
+
+/*
+ * Some classes let sessions be removed to make room (retention,
+ * disk_high) - check on them every opts.reapinterval seconds in the
+ * background. Room asked for by denied disk requests is freed within
+ * OWPD_RECLAIM_POLL seconds.
+ */
+static void
+StartDiskReaper(
+        OWPDPolicy  policy,
+        int         listenfd
+        )
+{
+    struct sigaction    dflact;
+    time_t              next;
+
+    if( (reaperpid = fork()) < 0){
+        OWPError(policy->ctx,OWPErrWARNING,OWPErrUNKNOWN,"fork(): %M");
+        reaperpid = 0;
+        return;
     }
-    owpd_intr = 0;
 
-    /*
-     * Initialize itimer struct. The it_value.tv_sec will be
-     * set to interrupt socket i/o if the message is not received
-     * within the timeout as described by owdp draft section 4
-     * (OWAMP-Control).
-     */
-    memset(&itval,0,sizeof(itval));
+    if(reaperpid > 0){
+        return;
+    }
 
-    /*
-     * save the pipe fd in the policy record for the hooks to
-     * pick it up.
-     */
-    policy->fd = new_pipe[1];
+    memset(&dflact,0,sizeof(dflact));
+    dflact.sa_handler = SIG_DFL;
+    sigemptyset(&dflact.sa_mask);
+    (void)sigaction(SIGTERM,&dflact,NULL);
+    (void)sigaction(SIGINT,&dflact,NULL);
+
+    (void)close(listenfd);
+    while((close(chldpipe[0]) < 0) && (errno == EINTR));
+    while((close(chldpipe[1]) < 0) && (errno == EINTR));
+    chldpipe[0] = chldpipe[1] = -1;
+    I2ErrReset(errhand);
 
     /*
-     * If the daemon is configured to do open_mode, check if
-     * there is an open_mode limit defined for the given
-     * address.
+     * SIGHUP: the policy was reloaded - finish the pass and exit so the
+     * parent can start a reaper with the new one.
      */
-    if((mode & OWP_MODE_OPEN) && !OWPDAllowOpenMode(policy,
-                (struct sockaddr *)&sbuff,&out)){
-        if(out != OWPErrOK){
-            exit(out);
+    owpd_hup = 0;
+    next = time(NULL) + opts.reapinterval;
+    while(!owpd_hup){
+        (void)sleep(OWPD_RECLAIM_POLL);
+        if(owpd_hup){
+            break;
         }
-        mode &= ~OWP_MODE_OPEN;
+        if(!OWPDDiskReclaim(policy,opts.reaprate)){
+            exit(1);
+        }
+        if(time(NULL) < next){
+            continue;
+        }
+        if(!OWPDDiskReap(policy,opts.reaprate)){
+            exit(1);
+        }
+        next = time(NULL) + opts.reapinterval;
     }
 
-    owpd_intr = 0;
-    itval.it_value.tv_sec = opts.controltimeout;
-    if(setitimer(ITIMER_REAL,&itval,NULL) != 0){
-        I2ErrLog(errhand,"setitimer(): %M");
-        exit(OWPErrFATAL);
+    exit(0);
+}
+
+/*
+ * SIGHUP: read the policy files (owamp-server.limits, owamp-server.pfs)
+ * again. Connections in progress keep the classes they have - only
+ * their accounting moves to the new tree. Prefork workers and the disk
+ * reaper are asked to finish what they are doing and exit, and are
+ * replaced from the new policy. If the new files can not be used, the
+ * current policy is kept.
+ */
+static OWPDPolicy
+ReloadPolicy(
+        OWPDPolicy  policy
+        )
+{
+    OWPDPolicy  newpolicy;
+    char        *lbuf = NULL;
+    size_t      lbuf_max = 0;
+    ChldState   cstate;
+    nfds_t      i;
+
+    I2ErrLog(errhand,"SIGHUP: reloading policy from %s",opts.confdir);
+
+    newpolicy = OWPDPolicyLoad(policy,opts.confdir,&lbuf,&lbuf_max);
+    if(lbuf){
+        free(lbuf);
     }
-    cntrl = OWPControlAccept(policy->ctx,connfd,
-            (struct sockaddr *)&sbuff,sbufflen,
-            mode,uptime,&owpd_intr,&out);
-    /*
-     * session not accepted.
-     */
-    if(!cntrl){
-        exit(out);        
+    if(!newpolicy){
+        goto failed;
     }
 
     /*
-     * Process all requests - return when complete.
+     * Every child has to find its class in the new tree.
      */
-    while(1){
-        OWPErrSeverity  rc;
-
-        rc = OWPErrOK;
-        /*
-         * reset signal vars
-         */
-        owpd_intr = owpd_alrm = owpd_chld = 0;
-        itval.it_value.tv_sec = opts.controltimeout;
-        if(setitimer(ITIMER_REAL,&itval,NULL) != 0){
-            I2ErrLog(errhand,"setitimer(): %M");
-            goto done;
+    for(i=OWPD_POLL_SLAB;i < npollfds;i++){
+        if(!(cstate = pollchld[i]) || !cstate->node){
+            continue;
         }
+        if(!OWPDPolicyMapNode(newpolicy,cstate->node)){
+            I2ErrLog(errhand,"Class %s removed while in use by pid=%d",
+                    cstate->node->nodename,cstate->pid);
+            goto failed;
+        }
+    }
 
-        msgtype = OWPReadRequestType(cntrl,&owpd_intr);
-
-        switch (msgtype){
-
-            case OWPReqTest:
-                rc = OWPProcessTestRequest(cntrl,&owpd_intr);
-                break;
-
-            case OWPReqStartSessions:
-                rc = OWPProcessStartSessions(cntrl,&owpd_intr);
-                if(rc < OWPErrOK){
-                    break;
-                }
-                /*
-                 * Test session started - unset timer - wait
-                 * until all sessions are complete, then
-                 * reset the timer and wait for stopsessions
-                 * to complete.
-                 */
-                owpd_intr = 0;
-                itval.it_value.tv_sec = 0;
-                if(setitimer(ITIMER_REAL,&itval,NULL) != 0){
-                    I2ErrLog(errhand,"setitimer(): %M");
-                    goto done;
-                }
-                while(OWPSessionsActive(cntrl,NULL)){
-                    int        wstate;
-
-                    rc = OWPErrOK;
-                    owpd_intr = 0;
-                    wstate = OWPStopSessionsWait(cntrl,NULL,
-                            &owpd_intr,NULL,&rc);
-                    if(owpd_int){
-                        goto done;
-                    }
-                    else if(owpd_exit){
-                        /*
-                         * wstate == 2 indicates gracefull shutdown...
-                         * Continue on and let StopSessions happen.
-                         */
-                        if(wstate != 2){
-                            goto done;
-                        }
-                        break;
-                    }
-                    if(wstate == 0){
-                        goto nextreq;
-                    }
-                }
-                /*
-                 * Sessions are complete, but StopSessions
-                 * message has not been exchanged - set the
-                 * timer and trade StopSessions messages
-                 */
-                owpd_intr = 0;
-                itval.it_value.tv_sec = opts.controltimeout;
-                if(setitimer(ITIMER_REAL,&itval,NULL) != 0){
-                    I2ErrLog(errhand,"setitimer(): %M");
-                    goto done;
-                }
-                rc = OWPStopSessions(cntrl,&owpd_intr,NULL);
-
-                break;
-
-            case OWPReqFetchSession:
-                /*
-                 * TODO: Should the timeout be suspended
-                 * for fetchsession?
-                 * (If session files take longer than
-                 * the timeout - this will fail... The
-                 * default is 30 min. Leave for now.
-                 * (The fix would be to leave the timeout in
-                 * place for completing the fetchsession
-                 * read, and then process the write
-                 * of the session separately.)
-                 */
-                rc = OWPProcessFetchSession(cntrl,&owpd_intr);
-                break;
+    if(!OWPDPolicySwap(policy,newpolicy)){
+        goto failed;
+    }
 
-            case OWPReqSockClose:
-            default:
-                rc = OWPErrFATAL;
-                break;
-        }
-nextreq:
-        if(rc < OWPErrWARNING){
-            break;
+    for(i=OWPD_POLL_SLAB;i < npollfds;i++){
+        if(!(cstate = pollchld[i])){
+            continue;
         }
-        if(owpd_exit){
-            break;
+        cstate->node = OWPDPolicyMapNode(newpolicy,cstate->node);
+        cstate->policy = newpolicy;
+        if(opts.prefork){
+            (void)kill(cstate->pid,SIGHUP);
         }
     }
+    OWPDPolicyFree(policy);
 
-done:
-    OWPControlClose(cntrl);
-
-    if(owpd_exit){
-        exit(0);
+    if(reaperpid){
+        (void)kill(reaperpid,SIGHUP);
     }
+    reapstart = True;
 
-    /*
-     * Normal socket close
-     */
-    if(msgtype == OWPReqSockClose){
-        exit(0);
-    }
+    return newpolicy;
 
-    I2ErrLog(errhand,"Control session terminated abnormally...");
+failed:
+    OWPDPolicyFree(newpolicy);
+    I2ErrLog(errhand,"Policy reload failed - keeping the current policy");
 
-    exit(1);
+    return policy;
 }
 
 /*
@@ -1060,6 +2013,27 @@ LoadConfig(
                 break;
             }
         }
+        else if(!strncasecmp(key,"reapinterval",13)){
+            char        *end=NULL;
+            uint32_t    tlng;
+
+            errno = 0;
+            tlng = strtoul(val,&end,10);
+            if((end == val) || (errno == ERANGE)){
+                fprintf(stderr,"strtoul(): %s\n",
+                        strerror(errno));
+                rc=-rc;
+                break;
+            }
+            opts.reapinterval = tlng;
+        }
+        else if(!strncasecmp(key,"reaprate",9)){
+            if(I2StrToNum(&opts.reaprate,val)){
+                fprintf(stderr,"Invalid reaprate \"%s\"\n",val);
+                rc=-rc;
+                break;
+            }
+        }
         else if(!strncasecmp(key,"dieby",6)){
             char                *end=NULL;
             uint32_t        tlng;
@@ -1088,6 +2062,20 @@ LoadConfig(
             }
             opts.controltimeout = tlng;
         }
+        else if(!strncasecmp(key,"muxtimeout",11)){
+            char            *end=NULL;
+            uint32_t        tlng;
+
+            errno = 0;
+            tlng = strtoul(val,&end,10);
+            if((end == val) || (errno == ERANGE) || !tlng){
+                fprintf(stderr,"Invalid muxtimeout \"%s\":"
+                        "positive value expected",val);
+                rc=-rc;
+                break;
+            }
+            opts.muxtimeout = tlng;
+        }
         else if(!strncasecmp(key,"pbkdf2_count",13)){
             char        *end=NULL;
             uint32_t    tlng;
@@ -1141,6 +2129,48 @@ LoadConfig(
             }
             opts.maxcontrolsessions = tlng;
         }
+        else if(!strncasecmp(key,"prefork",8)){
+            char            *end=NULL;
+            uint32_t        tlng;
+
+            errno = 0;
+            tlng = strtoul(val,&end,10);
+            if((end == val) || (errno == ERANGE)){
+                fprintf(stderr,"strtoul(): %s\n",
+                        strerror(errno));
+                rc=-rc;
+                break;
+            }
+            opts.prefork = tlng;
+        }
+        else if(!strncasecmp(key,"preforkmaxconns",16)){
+            char            *end=NULL;
+            uint32_t        tlng;
+
+            errno = 0;
+            tlng = strtoul(val,&end,10);
+            if((end == val) || (errno == ERANGE)){
+                fprintf(stderr,"strtoul(): %s\n",
+                        strerror(errno));
+                rc=-rc;
+                break;
+            }
+            opts.preforkmaxconns = tlng;
+        }
+        else if(!strncasecmp(key,"preforkconns",13)){
+            char            *end=NULL;
+            uint32_t        tlng;
+
+            errno = 0;
+            tlng = strtoul(val,&end,10);
+            if((end == val) || (errno == ERANGE) || !tlng){
+                fprintf(stderr,"Invalid preforkconns \"%s\":"
+                        "positive value expected",val);
+                rc=-rc;
+                break;
+            }
+            opts.preforkconns = tlng;
+        }
         else{
             fprintf(stderr,"Unknown key=%s\n",key);
             rc = -rc;
@@ -1167,8 +2197,6 @@ int main(
     char                pid_file[MAXPATHLEN],
                         info_file[MAXPATHLEN];
 
-    struct pollfd       *fds;
-    nfds_t              nfds;
     OWPContext          ctx;
     OWPDPolicy          policy;
     I2Addr              listenaddr = NULL;
@@ -1184,6 +2212,7 @@ int main(
     gid_t               setgroup=0;
     char                *lbuf=NULL;
     size_t              lbuf_max=0;
+    time_t              catalogcheck;
 
     struct sigaction    ignact,setact;
     sigset_t            sigs;
@@ -1219,10 +2248,16 @@ int main(
     opts.daemon = 1;
     opts.user = opts.group = NULL;
     opts.diskfudge = 1.0;
+    opts.reapinterval = 60;
+    opts.reaprate = 8*1024*1024;
     opts.dieby = 5;
     opts.controltimeout = 1800;
+    opts.muxtimeout = 10;
     opts.portspec = NULL;
     opts.maxcontrolsessions = 0;
+    opts.prefork = 0;
+    opts.preforkmaxconns = 0;
+    opts.preforkconns = 1;
 
     if(!getcwd(opts.cwd,sizeof(opts.cwd))){
         perror("getcwd()");
@@ -1422,6 +2457,22 @@ int main(
     if(!opts.datadir)
         opts.datadir = opts.cwd;
 
+    /*
+     * The policy files are read again on SIGHUP - after the chdir("/")
+     * of a daemon.
+     */
+    if(strncmp(opts.confdir,OWP_PATH_SEPARATOR,strlen(OWP_PATH_SEPARATOR))){
+        char    *confdir;
+
+        if(!(confdir = malloc(strlen(opts.cwd) + strlen(OWP_PATH_SEPARATOR) +
+                        strlen(opts.confdir) + 1))){
+            I2ErrLog(errhand,"malloc(): %M");
+            exit(1);
+        }
+        sprintf(confdir,"%s%s%s",opts.cwd,OWP_PATH_SEPARATOR,opts.confdir);
+        opts.confdir = confdir;
+    }
+
     /*  Get exclusive lock for pid file. */
     strcpy(pid_file, opts.vardir);
     strcat(pid_file, OWP_PATH_SEPARATOR);
@@ -1465,6 +2516,20 @@ int main(
     lbuf = NULL;
     lbuf_max = 0;
 
+    /*
+     * In prefork mode each worker serves up to preforkconns control
+     * sessions at a time, so the pool determines the control session
+     * limit.
+     */
+    if (opts.maxcontrolsessions && opts.prefork) {
+        if (opts.preforkconns > opts.maxcontrolsessions) {
+            opts.preforkconns = opts.maxcontrolsessions;
+        }
+        if (opts.prefork * opts.preforkconns > opts.maxcontrolsessions) {
+            opts.prefork = opts.maxcontrolsessions / opts.preforkconns;
+        }
+    }
+
     if (opts.maxcontrolsessions) {
         struct rlimit rlim;
         rc = getrlimit(RLIMIT_NOFILE, &rlim);
@@ -1567,6 +2632,18 @@ int main(
         exit(1);
     };
 
+    /*
+     * Share the resource accounting with the children so they do not
+     * need a round trip through this process for every request. Each
+     * prefork worker gets a ledger row - otherwise one row per allowed
+     * control session.
+     */
+    if(!OWPDPolicyShare(policy,(opts.prefork)? opts.prefork:
+                ((opts.maxcontrolsessions)? opts.maxcontrolsessions:
+                 OWPD_SHARED_SLOTS)) && opts.verbose){
+        I2ErrLog(errhand,"Resource accounting is not shared with children");
+    }
+
     /*
      * Setup the "default_mode".
      */
@@ -1610,8 +2687,7 @@ int main(
     }
 
     pidtable = I2HashInit(errhand,0,intcmp,inthash);
-    fdtable = I2HashInit(errhand,0,intcmp,inthash);
-    if(!pidtable || !fdtable){
+    if(!pidtable){
         I2ErrLogP(errhand,0,"Unable to setup hash tables...");
         exit(1);
     }
@@ -1790,24 +2866,122 @@ int main(
     }
 
     listenfd = I2AddrFD(listenaddr);
-    nfds = 1;
-    fds = malloc(sizeof(*fds));
-    if (!fds) {
+    maxpollfds = OWPD_POLL_SLAB + ((opts.prefork)? opts.prefork: 16);
+    pollfds = calloc(maxpollfds,sizeof(*pollfds));
+    pollchld = calloc(maxpollfds,sizeof(*pollchld));
+    pollfree = calloc(maxpollfds,sizeof(*pollfree));
+    if (!pollfds || !pollchld || !pollfree) {
         I2ErrLog(errhand,"unable to allocate memory: %M");
         exit(1);
     }
-    fds[0].fd = listenfd;
-    fds[0].events = POLLIN;
-    fds[0].revents = 0;
+    npollfds = OWPD_POLL_SLAB;
+
+    /*
+     * SIGCHLD is turned into a readable pipe in the poll set.
+     */
+    if(pipe(chldpipe) != 0){
+        I2ErrLog(errhand,"pipe(): %M");
+        exit(1);
+    }
+    {
+        int i,flags;
+
+        for(i=0;i<2;i++){
+            if(((flags = fcntl(chldpipe[i],F_GETFL,0)) < 0) ||
+                    (fcntl(chldpipe[i],F_SETFL,flags | O_NONBLOCK) < 0)){
+                I2ErrLog(errhand,"fcntl(): %M");
+                exit(1);
+            }
+        }
+    }
+    pollfds[OWPD_POLL_CHLD].fd = chldpipe[0];
+    pollfds[OWPD_POLL_CHLD].events = POLLIN;
+    pollfds[OWPD_POLL_CHLD].revents = 0;
+
+    /*
+     * In prefork mode the workers accept connections themselves, so
+     * the parent only polls the pipes to them.
+     */
+    pollfds[OWPD_POLL_LISTEN].fd = (opts.prefork)? -1: listenfd;
+
+    /*
+     * Multiplexing workers poll the listen socket along with their
+     * connections, so only one of them should win each accept.
+     */
+    if(opts.prefork && (opts.preforkconns > 1)){
+        int flags;
+
+        if(((flags = fcntl(listenfd,F_GETFL,0)) < 0) ||
+                (fcntl(listenfd,F_SETFL,flags | O_NONBLOCK) < 0)){
+            I2ErrLog(errhand,"fcntl(): %M");
+            exit(1);
+        }
+    }
+    pollfds[OWPD_POLL_LISTEN].events = POLLIN;
+    pollfds[OWPD_POLL_LISTEN].revents = 0;
+
+    if(policy->rescan){
+        StartDiskRescan(policy,listenfd);
+    }
+
+    /*
+     * The reaper gives space back through the shared counters, so it
+     * can only run if they are.
+     */
+    if(policy->reap && opts.reapinterval){
+        if(policy->shm){
+            StartDiskReaper(policy,listenfd);
+        }
+        else{
+            I2ErrLog(errhand,"Resource accounting is not shared with "
+                    "children: disk reaper disabled");
+        }
+    }
+
+    catalogcheck = time(NULL) + OWPD_CATALOG_INTERVAL;
 
     while (1) {
         int     nfound;
+        time_t  now;
 
         if(owpd_exit){
             break;
         }
 
-        nfound = poll(fds,nfds,-1);
+        if(owpd_hup){
+            owpd_hup = 0;
+            policy = ReloadPolicy(policy);
+        }
+
+        /*
+         * A reaper asked to exit by ReloadPolicy is replaced once it has.
+         */
+        if(reapstart && !reaperpid){
+            reapstart = False;
+            if(policy->reap && opts.reapinterval && policy->shm){
+                StartDiskReaper(policy,listenfd);
+            }
+        }
+
+        if(opts.prefork){
+            FillWorkerPool(policy,listenaddr);
+        }
+
+        /*
+         * Keep up with the session catalog, so new children do not have
+         * to replay it all.
+         */
+        now = time(NULL);
+        if(now >= catalogcheck){
+            catalogcheck = now + OWPD_CATALOG_INTERVAL;
+            if(policy->catalog){
+                (void)OWPDCatalogMaintain(policy->catalog);
+            }
+            now = time(NULL);
+        }
+
+        nfound = poll(pollfds,npollfds,
+                (catalogcheck > now)? (catalogcheck - now) * 1000: 0);
 
         /*
          * Handle select interupts/errors.
@@ -1817,7 +2991,7 @@ int main(
                 if(owpd_exit){
                     break;
                 }
-                ReapChildren(&fds,&nfds);
+                ReapChildren();
                 continue;
             }
             OWPError(ctx,OWPErrFATAL,errno,"select(): %M");
@@ -1830,19 +3004,30 @@ int main(
         if(nfound == 0)
             continue;
 
-        if(fds[0].revents & POLLIN){ /* new connection */
-            NewConnection(policy,listenaddr,&fds,&nfds);
-            fds[0].revents = 0;
+        /*
+         * Exited children - reaped below, after their last messages.
+         */
+        if(pollfds[OWPD_POLL_CHLD].revents){
+            pollfds[OWPD_POLL_CHLD].revents = 0;
+            owpd_chld = 1;
+            nfound--;
+        }
+
+        if(pollfds[OWPD_POLL_LISTEN].revents & POLLIN){ /* new connection */
+            NewConnection(policy,listenaddr);
+            pollfds[OWPD_POLL_LISTEN].revents = 0;
+            nfound--;
         }
-        else{
-            CleanPipes(fds,nfds,nfound);
+
+        if(nfound > 0){
+            CleanPipes(nfound);
         }
 
         if(owpd_exit){
             break;
         }
 
-        ReapChildren(&fds,&nfds);
+        ReapChildren();
     }
 
     I2ErrLog(errhand,"%s: exiting...",progname);
@@ -1851,7 +3036,7 @@ int main(
      * won't confuse later ReapChildren calls.
      */
     I2AddrFree(listenaddr);
-    fds[0].fd = -1;
+    pollfds[OWPD_POLL_LISTEN].fd = -1;
 
     /*
      * Signal the process group to exit.
@@ -1868,8 +3053,7 @@ int main(
      * Close all the pipes so pipe i/o can stay simple. (Don't have
      * to deal with interrupts for this.)
      */
-    rc=1;
-    I2HashIterate(fdtable,ClosePipes,&rc);
+    ClosePipes(True);
 
     /*
      * Loop until all children have been waited for, or until
@@ -1880,7 +3064,7 @@ int main(
         if(!owpd_chld){
             (void)sigsuspend(&sigs);
         }
-        ReapChildren(&fds,&nfds);
+        ReapChildren();
     }
 
     /*
@@ -25,6 +25,30 @@
 #define OWAMPD_CONF_FILE        "owamp-server.conf"
 #endif
 
+/*
+ * How often (seconds) a multiplexing worker checks on running test
+ * sessions if nothing else wakes it.
+ */
+#define OWPD_TEST_POLL          1
+
+/*
+ * How often (seconds) the disk reaper checks for room asked for by
+ * denied disk requests.
+ */
+#define OWPD_RECLAIM_POLL       1
+
+/*
+ * How often (seconds) the parent catches up with the session catalog
+ * (and compacts it if it has grown).
+ */
+#define OWPD_CATALOG_INTERVAL   60
+
+/*
+ * Number of children at a time that do their own resource accounting
+ * if neither prefork nor maxcontrolsessions bound the number.
+ */
+#define OWPD_SHARED_SLOTS       1024
+
 /*
  * Types
  */
@@ -52,10 +76,16 @@ typedef struct {
     OWPBoolean      allowroot;
 
     double          diskfudge;
+    uint32_t        reapinterval;       /* secs between reaper passes */
+    I2numT          reaprate;           /* bytes/sec the reaper removes */
     uint32_t        dieby;
     uint32_t        controltimeout;
+    uint32_t        muxtimeout;         /* per-message, preforkconns */
     uint32_t        pbkdf2_count;
     uint32_t        maxcontrolsessions;
+    uint32_t        prefork;            /* size of worker pool  */
+    uint32_t        preforkmaxconns;    /* recycle worker after */
+    uint32_t        preforkconns;       /* conns per worker     */
 #ifndef        NDEBUG
     void            *childwait;
 #endif
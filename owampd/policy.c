@@ -23,16 +23,27 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <time.h>
 #include <string.h>
 #include <errno.h>
 #include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <assert.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#if !defined(MAP_ANON) && defined(MAP_ANONYMOUS)
+#define MAP_ANON MAP_ANONYMOUS
+#endif
 
 #include "policy.h"
+#include "catalog.h"
 #include "fts.h"
 
 /*
@@ -137,6 +148,9 @@ static struct limdesc        limkeys[] = {
 {OWPDLimDeleteOnFetch,  "delete_on_fetch",  LIMBOOLVAL, 0,  0},
 {OWPDLimAllowOpenMode,  "allow_open_mode",  LIMBOOLVAL, 0,  1},
 {OWPDLimTestSessions,   "test_sessions",    LIMINTVAL,  0,  0},
+{OWPDLimRetention,      "retention",        LIMINTVAL,  0,  0},
+{OWPDLimDiskHigh,       "disk_high",        LIMINTVAL,  0,  0},
+{OWPDLimDiskLow,        "disk_low",         LIMINTVAL,  0,  0},
 };
 
 static OWPDLimitT
@@ -171,6 +185,40 @@ GetLimName(
     return "unknown";
 }
 
+/*
+ * The "used" counters of a node are kept by limit type - one record for
+ * each entry of limkeys - so a counter stays where it is when a reload
+ * reorders or changes the limits of its class. (see OWPDPolicySwap)
+ */
+static size_t
+LimIndex(
+        OWPDMesgT   lim
+        )
+{
+    size_t  i;
+
+    for(i=0;i<I2Number(limkeys);i++){
+        if(lim == limkeys[i].limit){
+            break;
+        }
+    }
+
+    return i;
+}
+
+static OWPDLimitT *
+UsedPtr(
+        OWPDPolicyNode  node,
+        OWPDMesgT       lim
+        )
+{
+    size_t  i = LimIndex(lim);
+
+    assert(i < I2Number(limkeys));
+
+    return &node->used[i].value;
+}
+
 static int
 parselimitline(
         OWPDPolicy  policy,
@@ -384,16 +432,22 @@ override:
     if(!(node = malloc(sizeof(*node))) ||
             !(tnode.nodename = strdup(cname)) ||
             !(tnode.limits = calloc(maxlim,sizeof(OWPDLimRec))) ||
-            !(tnode.used = calloc(maxlim,sizeof(OWPDLimRec)))){
+            !(tnode.used = calloc(I2Number(limkeys),sizeof(OWPDLimRec)))){
         OWPError(policy->ctx,OWPErrFATAL,errno,"alloc(): %M");
         return 1;
     }
     memcpy(node,&tnode,sizeof(*node));
+    for(i=0;i<I2Number(limkeys);i++){
+        node->used[i].limit = limkeys[i].limit;
+    }
     if(tnode.ilim){
         memcpy(node->limits,limtemp,sizeof(OWPDLimRec)*tnode.ilim);
-        memcpy(node->used,limtemp,sizeof(OWPDLimRec)*tnode.ilim);
         for(i=0;i<tnode.ilim;i++){
-            node->used[i].value = 0;
+            if(((node->limits[i].limit == OWPDLimRetention) ||
+                        (node->limits[i].limit == OWPDLimDiskHigh)) &&
+                    node->limits[i].value){
+                policy->reap = True;
+            }
         }
     }
 
@@ -619,6 +673,18 @@ parseassignline(
         return 1;
     }
 
+    /*
+     * Netmasks are matched by GetNodeFromAddr using the prefix trie.
+     */
+    if((tpid.id_type == OWPDPidNetmaskType) &&
+            (OWPDLpmInsert(policy->nets,tpid.net.addrval,
+                           tpid.net.addrsize,tpid.net.mask_len,
+                           val.dptr) != 0)){
+        OWPError(policy->ctx,OWPErrFATAL,errno,
+                "Unable to store assign net: %M");
+        return 1;
+    }
+
     return 0;
 }
 
@@ -791,6 +857,37 @@ node_dir(
     return path;
 }
 
+/*
+ * Sets path to the session file for sid in the directory of node.
+ */
+static char *
+session_path(
+        OWPContext      ctx,
+        OWPBoolean      make,
+        OWPDPolicyNode  node,
+        OWPSID          sid,
+        char            *path
+        )
+{
+    char    sid_name[sizeof(OWPSID)*2+1];
+
+    if(!node_dir(ctx,make,node->policy->datadir,node,
+                OWP_PATH_SEPARATOR_LEN + (sizeof(OWPSID)*2) +
+                strlen(OWP_FILE_EXT),path)){
+        return NULL;
+    }
+
+    I2HexEncode(sid_name,sid,sizeof(OWPSID));
+    strcat(path,OWP_PATH_SEPARATOR);
+    strcat(path,sid_name);
+    strcat(path,OWP_FILE_EXT);
+
+    return path;
+}
+
+/*
+ * Removes the catalog directory of SID symlinks older versions used.
+ */
 static OWPBoolean
 clean_catalog(
         OWPContext  ctx,
@@ -800,18 +897,14 @@ clean_catalog(
     char        *ftsargv[2];
     FTS         *fts;
     FTSENT      *p;
+    struct stat sbuf;
     OWPBoolean  ret=False;
 
     ftsargv[0] = path;
     ftsargv[1] = NULL;
 
-    /*
-     * Make sure catalog dir exists.
-     */
-    if((mkdir(path,0755) != 0) && (errno != EEXIST)){
-        OWPError(ctx,OWPErrFATAL,OWPErrUNKNOWN,
-                "Unable to mkdir(%s): %M",path);
-        return False;
+    if((lstat(path,&sbuf) != 0) && (errno == ENOENT)){
+        return True;
     }
 
     if(!(fts = fts_open(ftsargv, FTS_PHYSICAL,NULL))){
@@ -833,12 +926,6 @@ clean_catalog(
                 break;
             case FTS_DNR:
             case FTS_DP:
-                /*
-                 * Keep the catalog dir itself.
-                 */
-                if(p->fts_level < 1){
-                    break;
-                }
                 /*
                  * Shouldn't really be any directories in here...
                  * But delete any that show up.
@@ -872,11 +959,18 @@ OWPDResourceUsage(
         OWPDLimRec      lim
         );
 
+/*
+ * Walks the nodes directory, rebuilding the catalog and totalling the
+ * disk used by each node. When rescan is set, sessions missing from the
+ * catalog are appended to it, the ones found are marked with scan, and
+ * the node usage is left in owndisk instead of being installed.
+ */
 static OWPBoolean
 verify_datadir(
         OWPDPolicy  policy,
-        char        *cpath, /* catalog  */
-        char        *npath  /* nodes    */
+        char        *npath, /* nodes    */
+        OWPBoolean  rescan,
+        uint32_t    scan
         )
 {
     char            *ftsargv[2];
@@ -888,6 +982,7 @@ verify_datadir(
     char            pathname[PATH_MAX+1];
     OWPDLimRec      lim;
     OWPSID          tsid;
+    OWPDCatEntry    entry;
     size_t          len;
 
     ftsargv[0] = npath;
@@ -896,7 +991,7 @@ verify_datadir(
     lim.limit = OWPDLimDisk;
 
     /*
-     * Need FTS_NOCHDIR because symlink could be created from
+     * Need FTS_NOCHDIR because session files could be opened from
      * a relative path. (i.e. if datadir is not set, it is relative
      * to the current directory of the owampd process.)
      */
@@ -945,6 +1040,7 @@ verify_datadir(
                          (p->fts_parent->fts_pointer ==
                           node->parent))){
                     p->fts_pointer = node;
+                    node->scanmtime = p->fts_statp->st_mtime;
                     break;
                 }
 
@@ -974,7 +1070,7 @@ verify_datadir(
                  * that don't coorespond to nodes - but check just
                  * in case.
                  */
-                if(!p->fts_pointer){
+                if(!p->fts_pointer || rescan){
                     break;
                 }
                 node = p->fts_pointer;
@@ -1022,21 +1118,34 @@ verify_datadir(
                 }
 
                 /*
-                 * build symlink in catalog to this file.
+                 * Add the file to the catalog. (Only the time it was
+                 * last written is known.)
                  */
-                strcpy(pathname,cpath);
-                strcat(pathname,OWP_PATH_SEPARATOR);
-                strcat(pathname,p->fts_name);
-                if(symlink(p->fts_path,pathname) != 0){
-                    OWPError(policy->ctx,OWPErrFATAL,errno,
-                            "symlink(%s,%s): %M",
-                            p->fts_path,pathname);
+                if(rescan && (entry = OWPDCatalogFind(policy->catalog,
+                                tsid))){
+                    entry->scan = scan;
+                }
+                else if(!(entry = OWPDCatalogInsert(policy->catalog,tsid,
+                                node,OWPDCatFinished,
+                                p->fts_statp->st_size,
+                                p->fts_statp->st_mtime,
+                                p->fts_statp->st_mtime))){
                     goto err;
                 }
+                else if(rescan){
+                    entry->scan = scan;
+                    OWPError(policy->ctx,OWPErrINFO,OWPErrPOLICY,
+                            "Adding %s to the session catalog",
+                            p->fts_path);
+                    if(!OWPDCatalogAppend(policy->catalog,entry)){
+                        goto err;
+                    }
+                }
 
                 /*
                  * Add size of this file to node.
                  */
+                node->owndisk += p->fts_statp->st_size;
                 node->initdisk += p->fts_statp->st_size;
 
                 break;
@@ -1050,788 +1159,2682 @@ err:
     return ret;
 }
 
-static OWPBoolean
-InitializeDiskUsage(
+/*
+ * The disk usage journal (OWP_USAGE_FILE) is a text file with one record
+ * per line:
+ *
+ *      classname bytes opens mtime
+ *
+ * bytes is the change in the size of the files directly in the class
+ * directory, opens is +1 when a session file is created and -1 when it
+ * is finished, and mtime is the mtime of the class directory after the
+ * change. The snapshot written at startup is one such line per class.
+ *
+ * The children only ever append to an existing journal, so removing it
+ * (UsageInvalidate) is enough to have the next startup walk the whole
+ * hierarchy again.
+ */
+struct UsageArgRec{
+    OWPDPolicy  policy;
+    FILE        *fp;
+    OWPBoolean  ok;
+};
+
+static void
+UsageInvalidate(
         OWPDPolicy  policy
         )
 {
-    char    cpath[PATH_MAX+1];
-    char    npath[PATH_MAX+1];
-    size_t  len1,len2;
+    if(!policy->usagefile){
+        return;
+    }
 
-    /*
-     * Verify length of "catalog" symlink pathnames.
-     * {datadir}/{OWP_CATALOG_DIR}/{SIDHEXNAME}{OWP_FILE_EXT}
-     *
-     * Verify length of the root of the "nodes" directory.
-     * {datadir}/{OWP_HIER_DIR} - individual node paths will be
-     * verified as the node hierarchy is validated and the catalog
-     * is rebuilt.
-     */
-    len1 = strlen(policy->datadir) + OWP_PATH_SEPARATOR_LEN*2 +
-        strlen(OWP_CATALOG_DIR) + sizeof(OWPSID)*2 +
-        strlen(OWP_FILE_EXT);
-    len2 = strlen(policy->datadir) + OWP_PATH_SEPARATOR_LEN +
-        strlen(OWP_HIER_DIR);
-    if(MAX(len1,len2) > PATH_MAX){
-        OWPError(policy->ctx,OWPErrFATAL,OWPErrINVALID,
-                "InitializeDiskUsage: datadir too long (%s)",
-                policy->datadir);
-        return False;
+    if((unlink(policy->usagefile) != 0) && (errno != ENOENT)){
+        OWPError(policy->ctx,OWPErrWARNING,errno,"unlink(%s): %M",
+                policy->usagefile);
+        return;
     }
 
-    /*
-     * verify datadir exists!
-     */
-    if((strlen(policy->datadir) > 0) &&
-            (mkdir(policy->datadir,0755) != 0) &&
-            (errno != EEXIST)){
-        OWPError(policy->ctx,OWPErrFATAL,OWPErrUNKNOWN,
-                "Unable to mkdir(%s): %M",policy->datadir);
-        return False;
+    OWPError(policy->ctx,OWPErrINFO,OWPErrPOLICY,
+            "Disk usage journal %s removed - next start will rescan %s",
+            policy->usagefile,policy->datadir);
+
+    return;
+}
+
+/*
+ * Appends a record for node. dirpath is the node directory (or a file in
+ * it if isfile is set). When a file is being created, the mtime of each
+ * parent directory is recorded as well - node_dir may have just created
+ * the directory below it.
+ */
+static void
+UsageRecord(
+        OWPDPolicyNode  node,
+        const char      *dirpath,
+        OWPBoolean      isfile,
+        off_t           bytes,
+        long            opens
+        )
+{
+    OWPDPolicy  policy = node->policy;
+    char        path[PATH_MAX+1];
+    char        buf[1024];
+    char        *sep;
+    struct stat sbuf;
+    size_t      len = 0;
+    int         rc;
+    int         fd;
+
+    if(!policy->usagefile){
+        return;
     }
 
-    /*
-     * Clean the catalog out. It is recreated each time owampd is
-     * re-initialized.
-     */
-    strcpy(cpath,policy->datadir);
-    strcat(cpath,OWP_PATH_SEPARATOR);
-    strcat(cpath,OWP_CATALOG_DIR);
+    strncpy(path,dirpath,PATH_MAX);
+    path[PATH_MAX] = '\0';
+    if(isfile && (sep = strrchr(path,OWP_PATH_SEPARATOR[0]))){
+        *sep = '\0';
+    }
 
-    if(!clean_catalog(policy->ctx,cpath)){
-        OWPError(policy->ctx,OWPErrFATAL,OWPErrINVALID,
-                "InitializeDiskUsage: Invalid catalog directory: %s",
-                cpath);
-        return False;
+    while(node){
+        if(stat(path,&sbuf) != 0){
+            OWPError(policy->ctx,OWPErrWARNING,errno,"stat(%s): %M",path);
+            goto invalid;
+        }
+
+        rc = snprintf(&buf[len],sizeof(buf)-len,"%s %lld %ld %ld\n",
+                node->nodename,(long long)bytes,opens,(long)sbuf.st_mtime);
+        if((rc < 0) || ((size_t)rc >= sizeof(buf)-len)){
+            goto invalid;
+        }
+        len += rc;
+
+        if((opens <= 0) || !(sep = strrchr(path,OWP_PATH_SEPARATOR[0]))){
+            break;
+        }
+        *sep = '\0';
+        node = node->parent;
+        bytes = 0;
+        opens = 0;
     }
 
     /*
-     * Verify the datadir hierarchy - this determines the current disk
-     * usage of each user-class and rebuilds the catalog.
+     * One write, so records from different children do not interleave.
      */
-    strcpy(npath,policy->datadir);
-    strcat(npath,OWP_PATH_SEPARATOR);
-    strcat(npath,OWP_HIER_DIR);
-
-    if(!verify_datadir(policy,cpath,npath)){
-        OWPError(policy->ctx,OWPErrFATAL,OWPErrINVALID,
-                "InitializeDiskUsage: Invalid datadir directory: %s",
-                policy->datadir);
-        return False;
+    if((fd = open(policy->usagefile,O_WRONLY|O_APPEND)) < 0){
+        if(errno == ENOENT){
+            return;
+        }
+        OWPError(policy->ctx,OWPErrWARNING,errno,"open(%s): %M",
+                policy->usagefile);
+        goto invalid;
     }
+    if(write(fd,buf,len) != (ssize_t)len){
+        OWPError(policy->ctx,OWPErrWARNING,errno,"write(%s): %M",
+                policy->usagefile);
+        (void)close(fd);
+        goto invalid;
+    }
+    (void)close(fd);
+
+    return;
+
+invalid:
+    UsageInvalidate(policy);
+
+    return;
+}
+
+static I2Boolean
+UsageReset(
+        I2Datum key     __attribute__((unused)),
+        I2Datum value,
+        void    *app_data   __attribute__((unused))
+        )
+{
+    OWPDPolicyNode  node = (OWPDPolicyNode)value.dptr;
+
+    node->jdisk = 0;
+    node->jopens = 0;
+    node->jmtime = 0;
 
     return True;
 }
 
 /*
- * Function:        OWPDPolicyInstall
- *
- * Description:        
- *         This function installs the functions defined in this file as
- *         the "policy" hooks within the owamp application.
- *
- *         The main reason for defining the policy in the owamp library
- *         like this was that it made it possible to share the policy
- *         code between client/server applications such as owping and
- *         owampd. Also, it is a good example of how this can be done for
- *         custom appliations (such as powstream).
- *
- * In Args:        
- *
- * Out Args:        
- *
- * Scope:        
- * Returns:        
- * Side Effect:        
- *         This function does no clean-up of memory it allocates in the event
- *         of failure. It is expected that the application will report
- *         an error and exit if this function fails.
- *
- *         TODO: I really should fix this - it is lazy, and makes looking for
- *         memory leaks more difficult.
+ * Sums the journal into jdisk/jopens/jmtime of each node. Returns False
+ * if there is no journal, or it does not fit the current classes.
  */
-OWPDPolicy
-OWPDPolicyInstall(
-        OWPContext  ctx,
-        char        *datadir,
-        char        *confdir,
-        double      diskfudge,
-        char        **lbuf,
-        size_t      *lbuf_max
+static OWPBoolean
+ReadUsageJournal(
+        OWPDPolicy  policy
         )
 {
-    OWPDPolicy  policy;
-    I2ErrHandle eh;
-    char        pfname[MAXPATHLEN+1];
-    char        lfname[MAXPATHLEN+1];
-    int         len;
-    FILE        *kfp,*lfp;
-    int         rc;        /* row count */
+    FILE            *fp;
+    char            line[OWPDMAXCLASSLEN+80];
+    char            cname[OWPDMAXCLASSLEN+1];
+    long long       bytes;
+    long            opens,mtime;
+    unsigned long   lnum = 0;
+    I2Datum         key,val;
+    OWPDPolicyNode  node;
+    OWPBoolean      ret = False;
 
-    /*
-     * use variables for the func pointers so the compiler can give
-     * type-mismatch warnings.
-     */
-    OWPGetPFFunc                getpf = OWPDGetPF;
-    OWPCheckControlPolicyFunc   checkcontrolfunc = OWPDCheckControlPolicy;
-    OWPCheckTestPolicyFunc      checktestfunc = OWPDCheckTestPolicy;
-    OWPCheckFetchPolicyFunc     checkfetchfunc = OWPDCheckFetchPolicy;
-    OWPTestCompleteFunc         testcompletefunc = OWPDTestComplete;
-    OWPOpenFileFunc             openfilefunc = OWPDOpenFile;
-    OWPCloseFileFunc            closefilefunc = OWPDCloseFile;
+    I2HashIterate(policy->limits,UsageReset,NULL);
 
+    if(!(fp = fopen(policy->usagefile,"r"))){
+        if(errno != ENOENT){
+            OWPError(policy->ctx,OWPErrWARNING,errno,"fopen(%s): %M",
+                    policy->usagefile);
+        }
+        return False;
+    }
 
-    eh = OWPContextErrHandle(ctx);
+    while(fgets(line,sizeof(line),fp)){
+        lnum++;
+        if(line[0] == '#'){
+            continue;
+        }
 
-    /*
-     * Alloc main policy record
-     */
-    if(!(policy = calloc(1,sizeof(*policy)))){
-        OWPError(ctx,OWPErrFATAL,errno,"calloc(policy rec): %M");
-        return NULL;
-    }
+        /*
+         * A partial last line means a record was cut off.
+         */
+        if(!strchr(line,'\n') ||
+                (sscanf(line,"%80s %lld %ld %ld",
+                        cname,&bytes,&opens,&mtime) != 4)){
+            OWPError(policy->ctx,OWPErrWARNING,OWPErrPOLICY,
+                    "%s:%lu: Invalid record",policy->usagefile,lnum);
+            goto done;
+        }
 
-    policy->ctx = ctx;
-    policy->diskfudge = diskfudge;
+        key.dptr = cname;
+        key.dsize = strlen(cname);
+        if(!I2HashFetch(policy->limits,key,&val)){
+            OWPError(policy->ctx,OWPErrINFO,OWPErrPOLICY,
+                    "%s:%lu: Unknown class \"%s\"",
+                    policy->usagefile,lnum,cname);
+            goto done;
+        }
+        node = val.dptr;
 
-    /*
-     * copy datadir
-     */
-    if(!datadir){
-        datadir = ".";
-    }
-    if(!(policy->datadir = strdup(datadir))){
-        OWPError(ctx,OWPErrFATAL,errno,"strdup(datadir): %M");
-        return NULL;
+        node->jdisk += bytes;
+        node->jopens += opens;
+        if(mtime > node->jmtime){
+            node->jmtime = mtime;
+        }
     }
 
-    /*
-     * Alloc hashes.
-     */
-    if(!(policy->limits = I2HashInit(eh,0,NULL,NULL)) ||
-            !(policy->idents =
-                I2HashInit(eh,0,NULL,NULL)) ||
-            !(policy->pfs = I2HashInit(eh,0,NULL,NULL))){
-        OWPError(ctx,OWPErrFATAL,OWPErrUNKNOWN,
-                "OWPDPolicyInstall: Unable to allocate hashes");
-        return NULL;
+    if(ferror(fp)){
+        OWPError(policy->ctx,OWPErrWARNING,errno,"fgets(%s): %M",
+                policy->usagefile);
+        goto done;
     }
 
-    /*
-     * Open the pass-phrase file.
-     */
-    pfname[0] = '\0';
-    len = strlen(OWP_PFS_FILE);
-    if(len > MAXPATHLEN){
-        OWPError(ctx,OWPErrFATAL,OWPErrUNKNOWN,
-                "strlen(OWP_PFS_FILE > MAXPATHLEN)");
-        return NULL;
-    }
+    ret = True;
 
-    len += strlen(confdir) + strlen(OWP_PATH_SEPARATOR);
-    if(len > MAXPATHLEN){
-        OWPError(ctx,OWPErrFATAL,OWPErrINVALID,
-                "Path to %s > MAXPATHLEN",OWP_PFS_FILE);
-        return NULL;
+done:
+    fclose(fp);
+
+    return ret;
+}
+
+/*
+ * The journal is only good for a node if no files were left open and the
+ * directory has not been modified since the last record for it.
+ */
+static I2Boolean
+UsageCheck(
+        I2Datum key     __attribute__((unused)),
+        I2Datum value,
+        void    *app_data
+        )
+{
+    struct UsageArgRec  *uarg = (struct UsageArgRec *)app_data;
+    OWPDPolicyNode      node = (OWPDPolicyNode)value.dptr;
+    char                path[PATH_MAX+1];
+    struct stat         sbuf;
+
+    if(!node_dir(uarg->policy->ctx,False,uarg->policy->datadir,node,0,
+                path)){
+        uarg->ok = False;
+        return False;
     }
-    strcpy(pfname,confdir);
-    strcat(pfname,OWP_PATH_SEPARATOR);
-    strcat(pfname,OWP_PFS_FILE);
-    if(!(kfp = fopen(pfname,"r")) && (errno != ENOENT)){
-        OWPError(ctx,OWPErrFATAL,errno,"Unable to open %s: %M",pfname);
-        return NULL;
+
+    if(stat(path,&sbuf) != 0){
+        if((errno == ENOENT) && !node->jdisk && !node->jopens){
+            return True;
+        }
+    }
+    else if(!node->jopens && (node->jdisk >= 0) &&
+            (sbuf.st_mtime == node->jmtime)){
+        return True;
+    }
+
+    OWPError(uarg->policy->ctx,OWPErrINFO,OWPErrPOLICY,
+            "Disk usage journal out of date for %s",path);
+    uarg->ok = False;
+
+    return False;
+}
+
+static I2Boolean
+UsageApply(
+        I2Datum key     __attribute__((unused)),
+        I2Datum value,
+        void    *app_data   __attribute__((unused))
+        )
+{
+    OWPDPolicyNode  node = (OWPDPolicyNode)value.dptr;
+    OWPDPolicyNode  pnode;
+
+    node->owndisk = node->jdisk;
+    for(pnode = node;pnode;pnode = pnode->parent){
+        pnode->initdisk += node->jdisk;
+    }
+
+    return True;
+}
+
+static I2Boolean
+UsageInstall(
+        I2Datum key     __attribute__((unused)),
+        I2Datum value,
+        void    *app_data   __attribute__((unused))
+        )
+{
+    OWPDPolicyNode  node = (OWPDPolicyNode)value.dptr;
+    OWPDLimRec      lim;
+
+    lim.limit = OWPDLimDisk;
+    lim.value = node->initdisk;
+    OWPDResourceUsage(node,lim);
+
+    return True;
+}
+
+static I2Boolean
+UsageSnapshot(
+        I2Datum key     __attribute__((unused)),
+        I2Datum value,
+        void    *app_data
+        )
+{
+    struct UsageArgRec  *uarg = (struct UsageArgRec *)app_data;
+    OWPDPolicyNode      node = (OWPDPolicyNode)value.dptr;
+    char                path[PATH_MAX+1];
+    struct stat         sbuf;
+    time_t              mtime = 0;
+
+    if(!node_dir(uarg->policy->ctx,False,uarg->policy->datadir,node,0,
+                path)){
+        uarg->ok = False;
+        return False;
+    }
+    if(stat(path,&sbuf) == 0){
+        mtime = sbuf.st_mtime;
+    }
+
+    if(fprintf(uarg->fp,"%s %lld 0 %ld\n",node->nodename,
+                (long long)node->owndisk,(long)mtime) < 0){
+        uarg->ok = False;
+        return False;
+    }
+
+    return True;
+}
+
+/*
+ * Replaces the journal with a snapshot of the current (owndisk) usage.
+ * Must be called before any children are forked.
+ */
+static void
+WriteUsageSnapshot(
+        OWPDPolicy  policy
+        )
+{
+    char                tpath[PATH_MAX+1];
+    struct UsageArgRec  uarg;
+
+    strcpy(tpath,policy->usagefile);
+    strcat(tpath,".tmp");
+
+    if(!(uarg.fp = fopen(tpath,"w"))){
+        OWPError(policy->ctx,OWPErrWARNING,errno,"fopen(%s): %M",tpath);
+        UsageInvalidate(policy);
+        return;
+    }
+    uarg.policy = policy;
+    uarg.ok = True;
+
+    fprintf(uarg.fp,"# owampd disk usage: class bytes opens mtime\n");
+    I2HashIterate(policy->limits,UsageSnapshot,&uarg);
+
+    if((fclose(uarg.fp) != 0) || !uarg.ok ||
+            (rename(tpath,policy->usagefile) != 0)){
+        OWPError(policy->ctx,OWPErrWARNING,errno,
+                "Unable to write disk usage journal %s: %M",
+                policy->usagefile);
+        (void)unlink(tpath);
+        UsageInvalidate(policy);
+    }
+
+    return;
+}
+
+/*
+ * Entries still open at startup are left from sessions that did not
+ * finish - keep what was written, if anything.
+ */
+static OWPBoolean
+RecoverCatalog(
+        OWPDPolicy  policy
+        )
+{
+    OWPDCatEntry    entry,next;
+    char            path[PATH_MAX+1];
+    struct stat     sbuf;
+
+    for(entry=policy->catalog->head;entry;entry=next){
+        next = entry->next;
+        if(entry->state != OWPDCatOpen){
+            continue;
+        }
+
+        if(!session_path(policy->ctx,False,entry->node,entry->sid,path)){
+            return False;
+        }
+        if(stat(path,&sbuf) == 0){
+            entry->state = OWPDCatFinished;
+            entry->size = sbuf.st_size;
+            entry->end = sbuf.st_mtime;
+        }
+        else{
+            entry->state = OWPDCatDeleted;
+            (void)OWPDCatalogAppend(policy->catalog,entry);
+        }
     }
 
+    return True;
+}
+
+static OWPBoolean
+InitializeDiskUsage(
+        OWPDPolicy  policy
+        )
+{
+    char                cpath[PATH_MAX+1];
+    char                npath[PATH_MAX+1];
+    size_t              len1,len2,len3;
+    struct UsageArgRec  uarg;
+
     /*
-     * Open the limits file.
+     * Verify length of the old catalog directory and of the
+     * catalog log (and its temp file).
+     * {datadir}/{OWP_CATALOG_FILE}.tmp
+     *
+     * Verify length of the root of the "nodes" directory.
+     * {datadir}/{OWP_HIER_DIR} - individual node paths will be
+     * verified as the node hierarchy is validated and the catalog
+     * is rebuilt.
+     *
+     * Verify length of the usage journal (and its temp file).
+     * {datadir}/{OWP_USAGE_FILE}.tmp
      */
-    lfname[0] = '\0';
-    len = strlen(OWP_LIMITS_FILE);
-    if(len > MAXPATHLEN){
-        OWPError(ctx,OWPErrFATAL,OWPErrUNKNOWN,
-                "strlen(OWP_LIMITS_FILE > MAXPATHLEN)");
-        return NULL;
+    len1 = strlen(policy->datadir) + OWP_PATH_SEPARATOR_LEN +
+        MAX(strlen(OWP_CATALOG_DIR),strlen(OWP_CATALOG_FILE) + 4);
+    len2 = strlen(policy->datadir) + OWP_PATH_SEPARATOR_LEN +
+        strlen(OWP_HIER_DIR);
+    len3 = strlen(policy->datadir) + OWP_PATH_SEPARATOR_LEN +
+        strlen(OWP_USAGE_FILE) + 4;
+    if(MAX(MAX(len1,len2),len3) > PATH_MAX){
+        OWPError(policy->ctx,OWPErrFATAL,OWPErrINVALID,
+                "InitializeDiskUsage: datadir too long (%s)",
+                policy->datadir);
+        return False;
     }
 
-    len += strlen(confdir) + strlen(OWP_PATH_SEPARATOR);
-    if(len > MAXPATHLEN){
-        OWPError(ctx,OWPErrFATAL,OWPErrINVALID,
-                "Path to %s > MAXPATHLEN",OWP_LIMITS_FILE);
-        return NULL;
+    if(!(policy->usagefile = malloc(len3+1))){
+        OWPError(policy->ctx,OWPErrFATAL,errno,"malloc(): %M");
+        return False;
     }
-    strcpy(lfname,confdir);
-    strcat(lfname,OWP_PATH_SEPARATOR);
-    strcat(lfname,OWP_LIMITS_FILE);
+    strcpy(policy->usagefile,policy->datadir);
+    strcat(policy->usagefile,OWP_PATH_SEPARATOR);
+    strcat(policy->usagefile,OWP_USAGE_FILE);
 
-    if(!(lfp = fopen(lfname,"r"))){
-        if(errno != ENOENT){
-            OWPError(ctx,OWPErrFATAL,errno,"Unable to open %s: %M",
-                    lfname);
-            return NULL;
-        }
+    /*
+     * verify datadir exists!
+     */
+    if((strlen(policy->datadir) > 0) &&
+            (mkdir(policy->datadir,0755) != 0) &&
+            (errno != EEXIST)){
+        OWPError(policy->ctx,OWPErrFATAL,OWPErrUNKNOWN,
+                "Unable to mkdir(%s): %M",policy->datadir);
+        return False;
+    }
+
+    strcpy(cpath,policy->datadir);
+    strcat(cpath,OWP_PATH_SEPARATOR);
+    strcat(cpath,OWP_CATALOG_FILE);
+    if(!(policy->catalog = OWPDCatalogCreate(policy,cpath))){
+        return False;
     }
 
+    strcpy(npath,policy->datadir);
+    strcat(npath,OWP_PATH_SEPARATOR);
+    strcat(npath,OWP_HIER_DIR);
+
     /*
-     * lbuf is a char buffer that grows as needed in I2GetConfLine
-     * lbuf will be realloc'd repeatedly as needed. Once conf file
-     * parsing is complete - it is free'd from this function.
+     * If the usage journal still matches the node directories, take
+     * the disk usage from it and the sessions from the catalog log.
+     * The hierarchy is walked later, in the background.
+     * (OWPDDiskRescan)
      */
-    if((rc = parsepfs(policy,kfp,lbuf,lbuf_max)) < 0){
-        OWPError(ctx,OWPErrFATAL,OWPErrINVALID,
-                "%s:%d Invalid file syntax",pfname,-rc);
-        return NULL;
+    uarg.policy = policy;
+    uarg.fp = NULL;
+    uarg.ok = ReadUsageJournal(policy);
+    if(uarg.ok){
+        I2HashIterate(policy->limits,UsageCheck,&uarg);
     }
+    if(uarg.ok && OWPDCatalogLoad(policy->catalog)){
+        I2HashIterate(policy->limits,UsageApply,NULL);
+        I2HashIterate(policy->limits,UsageInstall,NULL);
+        policy->rescan = True;
 
-    if((rc = parselimits(policy,lfp,lbuf,lbuf_max)) < 0){
-        OWPError(ctx,OWPErrFATAL,OWPErrINVALID,
-                "%s:%d Invalid file syntax",lfname,-rc);
-        return NULL;
+        OWPError(policy->ctx,OWPErrINFO,OWPErrPOLICY,
+                "Disk usage loaded from %s",policy->usagefile);
     }
+    else{
+        /*
+         * Remove the catalog directory of older versions.
+         */
+        strcpy(cpath,policy->datadir);
+        strcat(cpath,OWP_PATH_SEPARATOR);
+        strcat(cpath,OWP_CATALOG_DIR);
 
-    if(kfp && (fclose(kfp) != 0)){
-        OWPError(ctx,OWPErrFATAL,errno,"fclose(%s): %M",pfname);
-        return NULL;
+        if(!clean_catalog(policy->ctx,cpath)){
+            OWPError(policy->ctx,OWPErrFATAL,OWPErrINVALID,
+                    "InitializeDiskUsage: Invalid catalog directory: %s",
+                    cpath);
+            return False;
+        }
+
+        /*
+         * Verify the datadir hierarchy - this determines the current
+         * disk usage of each user-class and rebuilds the catalog.
+         */
+        OWPDCatalogReset(policy->catalog);
+        if(!verify_datadir(policy,npath,False,0)){
+            OWPError(policy->ctx,OWPErrFATAL,OWPErrINVALID,
+                    "InitializeDiskUsage: Invalid datadir directory: %s",
+                    policy->datadir);
+            return False;
+        }
+        OWPDCatalogSort(policy->catalog);
     }
 
-    if(lfp && (fclose(lfp) != 0)){
-        OWPError(ctx,OWPErrFATAL,errno,"fclose(%s): %M",lfname);
-        return NULL;
+    if(!RecoverCatalog(policy) || !OWPDCatalogCompact(policy->catalog)){
+        return False;
     }
 
+    WriteUsageSnapshot(policy);
+
+    return True;
+}
+
+static I2Boolean
+FreeNodes(
+        I2Datum key     __attribute__((unused)),
+        I2Datum value,
+        void    *app_data
+        )
+{
+    OWPDPolicy      policy = (OWPDPolicy)app_data;
+    OWPDPolicyNode  node = (OWPDPolicyNode)value.dptr;
+
     /*
-     * Policy files were parsed and loaded ok. Now, install policy
-     * hook functions that will use it.
-     *
-     * Use func pointers to ensure we have functions of the correct
-     * type.
+     * Counters in the shared mapping are not this node's to free.
      */
+    if(node->used && !policy->shm){
+        free(node->used);
+    }
+    free(node->limits);
+    free(node->nodename);
+    free(node);
 
-    if(!OWPContextConfigSetV(ctx,OWPDPOLICY,policy)){
-        return NULL;
+    return True;
+}
+
+static I2Boolean
+FreeKeys(
+        I2Datum key,
+        I2Datum value   __attribute__((unused)),
+        void    *app_data   __attribute__((unused))
+        )
+{
+    free(key.dptr);
+
+    return True;
+}
+
+static I2Boolean
+FreeKeysVals(
+        I2Datum key,
+        I2Datum value,
+        void    *app_data   __attribute__((unused))
+        )
+{
+    free(key.dptr);
+    free(value.dptr);
+
+    return True;
+}
+
+/*
+ * Function:        OWPDPolicyFree
+ *
+ * Description:        
+ *         Frees a policy record that is not (or no longer) installed:
+ *         one returned by OWPDPolicyLoad, or the old record once
+ *         OWPDPolicySwap has moved the resource accounting off it.
+ *
+ * In Args:        
+ *
+ * Out Args:        
+ *
+ * Scope:        
+ * Returns:        
+ * Side Effect:        
+ *         The catalog and the shared mapping are left alone - a policy
+ *         record that still holds them is the installed one.
+ */
+void
+OWPDPolicyFree(
+        OWPDPolicy  policy
+        )
+{
+    if(!policy){
+        return;
     }
-    if(!OWPContextConfigSetF(ctx,OWPGetPF,(OWPFunc)getpf)){
-        return NULL;
+
+    if(policy->limits){
+        I2HashIterate(policy->limits,FreeNodes,policy);
+        I2HashClose(policy->limits);
     }
-    if(!OWPContextConfigSetF(ctx,OWPCheckControlPolicy,
-                (OWPFunc)checkcontrolfunc)){
-        return NULL;
+    if(policy->idents){
+        I2HashIterate(policy->idents,FreeKeys,NULL);
+        I2HashClose(policy->idents);
     }
-    if(!OWPContextConfigSetF(ctx,OWPCheckTestPolicy,
-                (OWPFunc)checktestfunc)){
-        return NULL;
+    if(policy->pfs){
+        I2HashIterate(policy->pfs,FreeKeysVals,NULL);
+        I2HashClose(policy->pfs);
     }
-    if(!OWPContextConfigSetF(ctx,OWPCheckFetchPolicy,
-                (OWPFunc)checkfetchfunc)){
-        return NULL;
+    OWPDLpmFree(policy->nets);
+
+    if(policy->nodes){
+        free(policy->nodes);
     }
-    if(!OWPContextConfigSetF(ctx,OWPTestComplete,
-                (OWPFunc)testcompletefunc)){
-        return NULL;
+    if(policy->slotused){
+        free(policy->slotused);
+    }
+    if(policy->usagefile){
+        free(policy->usagefile);
+    }
+    if(policy->datadir){
+        free(policy->datadir);
+    }
+    free(policy);
+
+    return;
+}
+
+/*
+ * Function:        PolicyParse
+ *
+ * Description:        
+ *         Allocates a policy record and fills it from the pass-phrase
+ *         and limits files in confdir.
+ *
+ * In Args:        
+ *
+ * Out Args:        
+ *
+ * Scope:        
+ * Returns:        
+ *         The record, or NULL after reporting the error. (Everything
+ *         allocated is free'd in that case.)
+ * Side Effect:        
+ */
+static OWPDPolicy
+PolicyParse(
+        OWPContext  ctx,
+        char        *datadir,
+        char        *confdir,
+        double      diskfudge,
+        char        **lbuf,
+        size_t      *lbuf_max
+        )
+{
+    OWPDPolicy  policy;
+    I2ErrHandle eh;
+    char        pfname[MAXPATHLEN+1];
+    char        lfname[MAXPATHLEN+1];
+    int         len;
+    FILE        *kfp=NULL,*lfp=NULL;
+    int         rc;        /* row count */
+
+    eh = OWPContextErrHandle(ctx);
+
+    /*
+     * Alloc main policy record
+     */
+    if(!(policy = calloc(1,sizeof(*policy)))){
+        OWPError(ctx,OWPErrFATAL,errno,"calloc(policy rec): %M");
+        return NULL;
+    }
+
+    policy->ctx = ctx;
+    policy->diskfudge = diskfudge;
+    policy->slot = -1;
+
+    /*
+     * copy datadir
+     */
+    if(!datadir){
+        datadir = ".";
+    }
+    if(!(policy->datadir = strdup(datadir))){
+        OWPError(ctx,OWPErrFATAL,errno,"strdup(datadir): %M");
+        goto error;
+    }
+
+    /*
+     * Alloc hashes.
+     */
+    if(!(policy->limits = I2HashInit(eh,0,NULL,NULL)) ||
+            !(policy->idents =
+                I2HashInit(eh,0,NULL,NULL)) ||
+            !(policy->pfs = I2HashInit(eh,0,NULL,NULL))){
+        OWPError(ctx,OWPErrFATAL,OWPErrUNKNOWN,
+                "OWPDPolicyInstall: Unable to allocate hashes");
+        goto error;
+    }
+    if(!(policy->nets = OWPDLpmCreate())){
+        OWPError(ctx,OWPErrFATAL,errno,"OWPDLpmCreate(): %M");
+        goto error;
+    }
+
+    /*
+     * Open the pass-phrase file.
+     */
+    pfname[0] = '\0';
+    len = strlen(OWP_PFS_FILE);
+    if(len > MAXPATHLEN){
+        OWPError(ctx,OWPErrFATAL,OWPErrUNKNOWN,
+                "strlen(OWP_PFS_FILE > MAXPATHLEN)");
+        goto error;
+    }
+
+    len += strlen(confdir) + strlen(OWP_PATH_SEPARATOR);
+    if(len > MAXPATHLEN){
+        OWPError(ctx,OWPErrFATAL,OWPErrINVALID,
+                "Path to %s > MAXPATHLEN",OWP_PFS_FILE);
+        goto error;
+    }
+    strcpy(pfname,confdir);
+    strcat(pfname,OWP_PATH_SEPARATOR);
+    strcat(pfname,OWP_PFS_FILE);
+    if(!(kfp = fopen(pfname,"r")) && (errno != ENOENT)){
+        OWPError(ctx,OWPErrFATAL,errno,"Unable to open %s: %M",pfname);
+        goto error;
+    }
+
+    /*
+     * Open the limits file.
+     */
+    lfname[0] = '\0';
+    len = strlen(OWP_LIMITS_FILE);
+    if(len > MAXPATHLEN){
+        OWPError(ctx,OWPErrFATAL,OWPErrUNKNOWN,
+                "strlen(OWP_LIMITS_FILE > MAXPATHLEN)");
+        goto error;
+    }
+
+    len += strlen(confdir) + strlen(OWP_PATH_SEPARATOR);
+    if(len > MAXPATHLEN){
+        OWPError(ctx,OWPErrFATAL,OWPErrINVALID,
+                "Path to %s > MAXPATHLEN",OWP_LIMITS_FILE);
+        goto error;
+    }
+    strcpy(lfname,confdir);
+    strcat(lfname,OWP_PATH_SEPARATOR);
+    strcat(lfname,OWP_LIMITS_FILE);
+
+    if(!(lfp = fopen(lfname,"r"))){
+        if(errno != ENOENT){
+            OWPError(ctx,OWPErrFATAL,errno,"Unable to open %s: %M",
+                    lfname);
+            goto error;
+        }
+    }
+
+    /*
+     * lbuf is a char buffer that grows as needed in I2GetConfLine
+     * lbuf will be realloc'd repeatedly as needed. Once conf file
+     * parsing is complete - it is free'd from this function.
+     */
+    if((rc = parsepfs(policy,kfp,lbuf,lbuf_max)) < 0){
+        OWPError(ctx,OWPErrFATAL,OWPErrINVALID,
+                "%s:%d Invalid file syntax",pfname,-rc);
+        goto error;
+    }
+
+    if((rc = parselimits(policy,lfp,lbuf,lbuf_max)) < 0){
+        OWPError(ctx,OWPErrFATAL,OWPErrINVALID,
+                "%s:%d Invalid file syntax",lfname,-rc);
+        goto error;
+    }
+
+    rc = (kfp)? fclose(kfp): 0;
+    kfp = NULL;
+    if(rc != 0){
+        OWPError(ctx,OWPErrFATAL,errno,"fclose(%s): %M",pfname);
+        goto error;
+    }
+
+    rc = (lfp)? fclose(lfp): 0;
+    lfp = NULL;
+    if(rc != 0){
+        OWPError(ctx,OWPErrFATAL,errno,"fclose(%s): %M",lfname);
+        goto error;
+    }
+
+    return policy;
+
+error:
+    if(kfp){
+        fclose(kfp);
+    }
+    if(lfp){
+        fclose(lfp);
+    }
+    OWPDPolicyFree(policy);
+
+    return NULL;
+}
+
+/*
+ * Function:        OWPDPolicyInstall
+ *
+ * Description:        
+ *         This function installs the functions defined in this file as
+ *         the "policy" hooks within the owamp application.
+ *
+ *         The main reason for defining the policy in the owamp library
+ *         like this was that it made it possible to share the policy
+ *         code between client/server applications such as owping and
+ *         owampd. Also, it is a good example of how this can be done for
+ *         custom appliations (such as powstream).
+ *
+ * In Args:        
+ *
+ * Out Args:        
+ *
+ * Scope:        
+ * Returns:        
+ * Side Effect:        
+ *         The policy files are parsed by PolicyParse, which cleans up
+ *         after itself. If installing the hooks fails, the policy record
+ *         is left to the application - which is expected to report an
+ *         error and exit.
+ */
+OWPDPolicy
+OWPDPolicyInstall(
+        OWPContext  ctx,
+        char        *datadir,
+        char        *confdir,
+        double      diskfudge,
+        char        **lbuf,
+        size_t      *lbuf_max
+        )
+{
+    OWPDPolicy  policy;
+
+    /*
+     * use variables for the func pointers so the compiler can give
+     * type-mismatch warnings.
+     */
+    OWPGetPFFunc                getpf = OWPDGetPF;
+    OWPCheckControlPolicyFunc   checkcontrolfunc = OWPDCheckControlPolicy;
+    OWPCheckTestPolicyFunc      checktestfunc = OWPDCheckTestPolicy;
+    OWPCheckFetchPolicyFunc     checkfetchfunc = OWPDCheckFetchPolicy;
+    OWPTestCompleteFunc         testcompletefunc = OWPDTestComplete;
+    OWPOpenFileFunc             openfilefunc = OWPDOpenFile;
+    OWPCloseFileFunc            closefilefunc = OWPDCloseFile;
+
+    if(!(policy = PolicyParse(ctx,datadir,confdir,diskfudge,
+                    lbuf,lbuf_max))){
+        return NULL;
+    }
+
+    /*
+     * Policy files were parsed and loaded ok. Now, install policy
+     * hook functions that will use it.
+     *
+     * Use func pointers to ensure we have functions of the correct
+     * type.
+     */
+
+    if(!OWPContextConfigSetV(ctx,OWPDPOLICY,policy)){
+        return NULL;
+    }
+    if(!OWPContextConfigSetF(ctx,OWPGetPF,(OWPFunc)getpf)){
+        return NULL;
+    }
+    if(!OWPContextConfigSetF(ctx,OWPCheckControlPolicy,
+                (OWPFunc)checkcontrolfunc)){
+        return NULL;
+    }
+    if(!OWPContextConfigSetF(ctx,OWPCheckTestPolicy,
+                (OWPFunc)checktestfunc)){
+        return NULL;
+    }
+    if(!OWPContextConfigSetF(ctx,OWPCheckFetchPolicy,
+                (OWPFunc)checkfetchfunc)){
+        return NULL;
+    }
+    if(!OWPContextConfigSetF(ctx,OWPTestComplete,
+                (OWPFunc)testcompletefunc)){
+        return NULL;
+    }
+    if(!OWPContextConfigSetF(ctx,OWPOpenFile,(OWPFunc)openfilefunc)){
+        return NULL;
+    }
+    if(!OWPContextConfigSetF(ctx,OWPCloseFile,(OWPFunc)closefilefunc)){
+        return NULL;
+    }
+
+    return policy;
+}
+
+OWPBoolean
+OWPDPolicyPostInstall(
+    OWPDPolicy  policy
+        )
+{
+    /*
+     * Now that the "user class" hierarchy is loaded - take a look
+     * at datadir and initialize disk usage.
+     */
+    if(!InitializeDiskUsage(policy)){
+        return False;
+    }
+
+    return True;
+}
+
+#if defined(HAVE_ATOMIC64) && defined(HAVE_SYS_MMAN_H) && defined(MAP_ANON)
+static I2Boolean
+ShareNodesIndex(
+        I2Datum key     __attribute__((unused)),
+        I2Datum value,
+        void    *app_data
+        )
+{
+    OWPDPolicy      policy = (OWPDPolicy)app_data;
+    OWPDPolicyNode  node = (OWPDPolicyNode)value.dptr;
+
+    node->index = policy->nnodes++;
+    policy->nodes[node->index] = node;
+
+    return True;
+}
+#endif
+
+/*
+ * Function:        OWPDPolicyShare
+ *
+ * Description:        
+ *         This function is called from the parent perspective.
+ *
+ *         It moves the "used" counters of the policy tree into memory
+ *         that is shared with the children forked after this, so a child
+ *         can claim and release resources with atomic updates instead of
+ *         a round trip to the parent for every OWPDQuery.
+ *
+ *         Up to nslots children at a time are given a row in a bandwidth
+ *         ledger (see OWPDSlotAlloc) that lets the parent release what a
+ *         child still held when it exited. Children without a row keep
+ *         sending their requests to the parent.
+ *
+ *         Room is left for classes added by later reloads (see
+ *         OWPDPolicySwap) - the mapping can not grow once children
+ *         have inherited it.
+ *
+ *         Must be called after OWPDPolicyPostInstall and before any
+ *         children are forked.
+ *
+ * In Args:        
+ *
+ * Out Args:        
+ *
+ * Scope:        
+ * Returns:        
+ *         False if the counters are not shared (not supported on this
+ *         system, or an error that has been reported).
+ * Side Effect:        
+ */
+OWPBoolean
+OWPDPolicyShare(
+        OWPDPolicy  policy,
+        uint32_t    nslots
+        )
+{
+#if defined(HAVE_ATOMIC64) && defined(HAVE_SYS_MMAN_H) && defined(MAP_ANON)
+    OWPDLimRec              *used;
+    void                    *shm;
+    size_t                  len;
+    size_t                  i;
+
+    policy->maxnodes = 2 * I2HashNumEntries(policy->limits) + 16;
+    if(!(policy->nodes = calloc(policy->maxnodes,sizeof(OWPDPolicyNode))) ||
+            !(policy->slotused = calloc(nslots,sizeof(uint8_t)))){
+        OWPError(policy->ctx,OWPErrFATAL,errno,"calloc(): %M");
+        goto error;
+    }
+    policy->nnodes = 0;
+    I2HashIterate(policy->limits,ShareNodesIndex,policy);
+
+    len = policy->maxnodes * I2Number(limkeys) * sizeof(OWPDLimRec) +
+        ((size_t)nslots + 1) * policy->maxnodes * sizeof(OWPDLimitT);
+    shm = mmap(NULL,len,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANON,-1,0);
+    if(shm == MAP_FAILED){
+        OWPError(policy->ctx,OWPErrWARNING,errno,"mmap(): %M");
+        goto error;
+    }
+
+    /*
+     * Copy the current counters (initial disk usage) into the shared
+     * block and point the nodes at them.
+     */
+    used = (OWPDLimRec *)shm;
+    for(i=0;i<policy->nnodes;i++){
+        OWPDPolicyNode  node = policy->nodes[i];
+
+        memcpy(&used[i * I2Number(limkeys)],node->used,
+                sizeof(OWPDLimRec)*I2Number(limkeys));
+        free(node->used);
+        node->used = &used[i * I2Number(limkeys)];
+    }
+
+    policy->shm = shm;
+    policy->shmlen = len;
+    policy->ledger = (OWPDLimitT *)&used[policy->maxnodes * I2Number(limkeys)];
+    policy->nslots = nslots;
+    policy->reclaim = &policy->ledger[(size_t)nslots * policy->maxnodes];
+
+    return True;
+
+error:
+    if(policy->nodes){
+        free(policy->nodes);
+        policy->nodes = NULL;
+    }
+    if(policy->slotused){
+        free(policy->slotused);
+        policy->slotused = NULL;
+    }
+    policy->nnodes = 0;
+    policy->maxnodes = 0;
+
+    return False;
+#else
+    (void)policy;
+    (void)nslots;
+
+    return False;
+#endif
+}
+
+/*
+ * Function:        OWPDSlotAlloc
+ *
+ * Description:        
+ *         This function is called from the parent perspective before
+ *         forking a child. The child should set policy->slot to the
+ *         returned ledger row.
+ *
+ * In Args:        
+ *
+ * Out Args:        
+ *
+ * Scope:        
+ * Returns:        
+ *         The row, or -1 if accounting is not shared or all rows are
+ *         in use. (The child will use the pipe.)
+ * Side Effect:        
+ */
+int
+OWPDSlotAlloc(
+        OWPDPolicy  policy
+        )
+{
+    uint32_t    i;
+
+    for(i=0;i<policy->nslots;i++){
+        if(!policy->slotused[i]){
+            policy->slotused[i] = 1;
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Function:        OWPDSlotFree
+ *
+ * Description:        
+ *         This function is called from the parent perspective once the
+ *         child using the given ledger row has exited. Bandwidth the
+ *         child did not release is returned to the tree.
+ *
+ * In Args:        
+ *
+ * Out Args:        
+ *
+ * Scope:        
+ * Returns:        
+ * Side Effect:        
+ */
+void
+OWPDSlotFree(
+        OWPDPolicy  policy,
+        int         slot
+        )
+{
+    OWPDLimitT  *row;
+    OWPDLimRec  lim;
+    size_t      i;
+
+    if((slot < 0) || ((uint32_t)slot >= policy->nslots)){
+        return;
+    }
+
+    row = &policy->ledger[(size_t)slot * policy->maxnodes];
+    lim.limit = OWPDLimBandwidth;
+    for(i=0;i<policy->nnodes;i++){
+        if(!(lim.value = row[i]) || !policy->nodes[i]){
+            continue;
+        }
+        OWPError(policy->ctx,OWPErrINFO,OWPErrPOLICY,
+                "Releasing %s:%s = %" PRIu64 " held by exited child",
+                policy->nodes[i]->nodename,GetLimName(lim.limit),
+                lim.value);
+        (void)OWPDResourceDemand(policy->nodes[i],OWPDMESGRELEASE,lim);
+        row[i] = 0;
+    }
+
+    policy->slotused[slot] = 0;
+
+    return;
+}
+
+/*
+ * Function:        OWPDGetPF
+ *
+ * Description:        
+ *         Fetch the 128 bit AES key for a given userid and return it.
+ *
+ *         Returns True if successful.
+ *         If False is returned err_ret can be checked to determine if
+ *         the key store had a problem(ErrFATAL) or if the userid is
+ *         invalid(ErrOK).
+ *
+ * In Args:        
+ *
+ * Out Args:        
+ *
+ * Scope:        
+ * Returns:        T/F
+ * Side Effect:        
+ */
+extern OWPBoolean
+OWPDGetPF(
+        OWPContext      ctx,
+        const OWPUserID userid,
+        uint8_t         **pf,
+        size_t          *pf_len,
+        void            **pf_free,
+        OWPErrSeverity  *err_ret
+        )
+{
+    OWPDPolicy  policy;
+    I2Datum     key,val;
+
+    *err_ret = OWPErrOK;
+
+    if(!(policy = (OWPDPolicy)OWPContextConfigGetV(ctx,OWPDPOLICY))){
+        OWPError(ctx,OWPErrFATAL,OWPErrINVALID,
+                "OWPDGetPF: OWPDPOLICY not set");
+        *err_ret = OWPErrFATAL;
+        return False;
+    }
+
+    key.dptr = (void*)userid;
+    key.dsize = strlen(userid);
+    if(!I2HashFetch(policy->pfs,key,&val)){
+        OWPError(policy->ctx,OWPErrFATAL,OWPErrPOLICY,
+                "userid \"%s\" unknown",userid);
+        return False;
+    }
+
+    /* just point directly at memory in store */
+    *pf = val.dptr;
+    *pf_len = val.dsize;
+    *pf_free = NULL;
+
+    return True;
+}
+
+static OWPDPolicyNode
+GetNodeDefault(
+        OWPDPolicy  policy
+        )
+{
+    OWPDPidRec  tpid;
+    I2Datum     key,val;
+
+    memset(&tpid,0,sizeof(tpid));
+
+    tpid.id_type = OWPDPidDefaultType;
+    key.dptr = &tpid;
+    key.dsize = sizeof(tpid);
+    if(I2HashFetch(policy->idents,key,&val)){
+        return (OWPDPolicyNode)val.dptr;
+    }
+
+    return policy->root;
+}
+
+static OWPDPolicyNode
+GetNodeFromUserID(
+        OWPDPolicy      policy,
+        const OWPUserID userid  /* MUST BE VALID MEMORY */
+        )
+{
+    OWPDPidRec  pid;
+    I2Datum     key,val;
+
+    memset(&pid,0,sizeof(pid));
+
+    pid.id_type = OWPDPidUserType;
+    key.dptr = &pid;
+    key.dsize = sizeof(pid);
+
+    memcpy(pid.user.userid,userid,sizeof(pid.user.userid));
+
+    if(I2HashFetch(policy->idents,key,&val)){
+        return (OWPDPolicyNode)val.dptr;
+    }
+
+    return NULL;
+}
+
+static OWPDPolicyNode
+GetNodeFromAddr(
+        OWPDPolicy      policy,
+        struct sockaddr *remote_sa_addr
+        )
+{
+    const uint8_t   *addr;
+    size_t          addrsize;
+    OWPDPolicyNode  node;
+
+    switch(remote_sa_addr->sa_family){
+        struct sockaddr_in        *saddr4;
+#ifdef        AF_INET6
+        struct sockaddr_in6        *saddr6;
+
+        case AF_INET6:
+        saddr6 = (struct sockaddr_in6*)remote_sa_addr;
+        /*
+         * If this is a v4 mapped address - match it as a v4 address.
+         */
+        if(IN6_IS_ADDR_V4MAPPED(&saddr6->sin6_addr)){
+            addr = &saddr6->sin6_addr.s6_addr[12];
+            addrsize = 4;
+        }
+        else{
+            addr = saddr6->sin6_addr.s6_addr;
+            addrsize = 16;
+        }
+        break;
+#endif
+        case AF_INET:
+        saddr4 = (struct sockaddr_in*)remote_sa_addr;
+        addr = (const uint8_t *)&saddr4->sin_addr.s_addr;
+        addrsize = 4;
+        break;
+
+        default:
+        OWPError(policy->ctx,OWPErrFATAL,OWPErrUNKNOWN,
+                "Unknown address protocol family.");
+        return NULL;
+        break;
+    }
+
+    /*
+     * One walk down the prefix trie finds the longest "assign net"
+     * mask that contains the address.
+     */
+    if((node = OWPDLpmLookup(policy->nets,addr,addrsize))){
+        return node;
+    }
+
+    return GetNodeDefault(policy);
+}
+
+static OWPDLimitT
+GetLimit(
+        OWPDPolicyNode  node,
+        OWPDMesgT       lim
+        )
+{
+    size_t  i;
+
+    for(i=0;i<node->ilim;i++){
+        if(lim == node->limits[i].limit){
+            return node->limits[i].value;
+        }
+    }
+
+    return GetDefLimit(lim);
+}
+
+/*
+ * The "used" counters may be shared with the child processes (see
+ * OWPDPolicyShare), so they are only read and updated through these.
+ */
+static OWPDLimitT
+UsedLoad(
+        OWPDLimitT  *used
+        )
+{
+#ifdef HAVE_ATOMIC64
+    return __atomic_load_n(used,__ATOMIC_ACQUIRE);
+#else
+    return *used;
+#endif
+}
+
+/*
+ * Sets *used to desired if it is still *expected. Otherwise, *expected
+ * is updated to the current value and False is returned.
+ */
+static OWPBoolean
+UsedCAS(
+        OWPDLimitT  *used,
+        OWPDLimitT  *expected,
+        OWPDLimitT  desired
+        )
+{
+#ifdef HAVE_ATOMIC64
+    return __atomic_compare_exchange_n(used,expected,desired,0,
+            __ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE)? True: False;
+#else
+    if(*used != *expected){
+        *expected = *used;
+        return False;
+    }
+    *used = desired;
+    return True;
+#endif
+}
+
+static void
+UsedAdd(
+        OWPDLimitT  *used,
+        OWPDLimitT  val
+        )
+{
+#ifdef HAVE_ATOMIC64
+    (void)__atomic_add_fetch(used,val,__ATOMIC_ACQ_REL);
+#else
+    *used += val;
+#endif
+}
+
+static void
+UsedSub(
+        OWPDLimitT  *used,
+        OWPDLimitT  val
+        )
+{
+#ifdef HAVE_ATOMIC64
+    (void)__atomic_sub_fetch(used,val,__ATOMIC_ACQ_REL);
+#else
+    *used -= val;
+#endif
+}
+
+static OWPDLimitT
+GetUsed(
+        OWPDPolicyNode  node,
+        OWPDMesgT       lim
+       )
+{
+    size_t  i;
+
+    for(i=0;i<node->ilim;i++){
+        if(lim == node->limits[i].limit){
+            return UsedLoad(UsedPtr(node,lim));
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Returns True if the usage is less than the limit - false if it is greater.
+ * It sets the usage to the value passed in either way. (well - only if the
+ * resource is being tracked.)
+ */
+static void
+IntegerResourceUsage(
+        OWPDPolicyNode  node,
+        OWPDLimRec      lim
+        )
+{
+    size_t  i;
+
+    for(i=0;i<node->ilim;i++){
+        if(node->limits[i].limit == lim.limit){
+            goto found;
+        }
+    }
+
+    /*
+     * If there is not limit record, then the default must be 0 or the
+     * logic breaks.
+     */
+    assert(!GetDefLimit(lim.limit));
+
+    /*
+     * No reason to keep track if this resource is unlimited all the
+     * way up the tree - so just return true.
+     */
+    return;
+
+found:
+    /*
+     * Ok - found the resource limits
+     */
+
+    /*
+     * If no limit at this level, just return true
+     */
+    if(!node->limits[i].value){
+        return;
+    }
+
+    *UsedPtr(node,lim.limit) = lim.value;
+
+    if(lim.value > node->limits[i].value){
+        OWPError(node->policy->ctx,OWPErrWARNING,OWPErrPOLICY,
+                "Resource usage exceeds limits %s:%s "
+                "(used = %" PRIu64 ", limit = %" PRIu64 ")",node->nodename,
+                GetLimName(lim.limit),lim.value,
+                node->limits[i].value);
+    }
+
+    return;
+}
+
+static void
+OWPDResourceUsage(
+        OWPDPolicyNode  node,
+        OWPDLimRec      lim
+        )
+{
+    size_t          maxdef = I2Number(limkeys);
+    size_t          i;
+    enum limtype    limkind = LIMNOT;
+
+    for(i=0;i<maxdef;i++){
+        if(lim.limit == limkeys[i].limit){
+            limkind = limkeys[i].ltype;
+            break;
+        }
+    }
+
+    if(limkind != LIMINTVAL){
+        return;
+    }
+
+    OWPError(node->policy->ctx,OWPErrDEBUG,OWPErrPOLICY,
+            "ResInit %s:%s = %" PRIu64,node->nodename,
+            GetLimName(lim.limit),lim.value);
+    IntegerResourceUsage(node,lim);
+
+    return;
+}
+
+/*
+ * Adds delta (the disk usage that was found to be missing - or extra)
+ * to the disk counters of node and its parents.
+ */
+static void
+DiskUsageAdjust(
+        OWPDPolicyNode  node,
+        off_t           delta
+        )
+{
+    size_t      i;
+    OWPDLimitT  *cnt;
+    OWPDLimitT  used,want;
+
+    for(;node;node = node->parent){
+        for(i=0;i<node->ilim;i++){
+            if(node->limits[i].limit == OWPDLimDisk){
+                break;
+            }
+        }
+        if((i >= node->ilim) || !node->limits[i].value){
+            continue;
+        }
+
+        cnt = UsedPtr(node,OWPDLimDisk);
+        if(delta > 0){
+            UsedAdd(cnt,delta);
+            continue;
+        }
+
+        used = UsedLoad(cnt);
+        do{
+            want = ((OWPDLimitT)-delta > used)? 0: used - (OWPDLimitT)-delta;
+        }while(!UsedCAS(cnt,&used,want));
+    }
+
+    return;
+}
+
+static I2Boolean
+UsageScanReset(
+        I2Datum key     __attribute__((unused)),
+        I2Datum value,
+        void    *app_data   __attribute__((unused))
+        )
+{
+    OWPDPolicyNode  node = (OWPDPolicyNode)value.dptr;
+
+    node->owndisk = 0;
+    node->scanmtime = 0;
+
+    return True;
+}
+
+static I2Boolean
+UsageReconcile(
+        I2Datum key     __attribute__((unused)),
+        I2Datum value,
+        void    *app_data
+        )
+{
+    struct UsageArgRec  *uarg = (struct UsageArgRec *)app_data;
+    OWPDPolicyNode      node = (OWPDPolicyNode)value.dptr;
+    char                path[PATH_MAX+1];
+    struct stat         sbuf;
+    time_t              mtime = 0;
+    off_t               drift;
+
+    if(!node_dir(uarg->policy->ctx,False,uarg->policy->datadir,node,0,
+                path)){
+        return True;
+    }
+    if(stat(path,&sbuf) == 0){
+        mtime = sbuf.st_mtime;
+    }
+
+    /*
+     * Only trust the walk if the directory did not change under it, and
+     * the journal has caught up with what it saw.
+     */
+    if(node->jopens || (mtime != node->scanmtime) ||
+            (mtime && (mtime != node->jmtime))){
+        return True;
+    }
+
+    if(!(drift = node->owndisk - node->jdisk)){
+        return True;
+    }
+
+    OWPError(uarg->policy->ctx,OWPErrWARNING,OWPErrPOLICY,
+            "Disk usage of %s off by %lld bytes - reconciling",
+            node->nodename,(long long)drift);
+    if(mtime){
+        UsageRecord(node,path,False,drift,0);
+    }
+    else{
+        UsageInvalidate(uarg->policy);
+    }
+    DiskUsageAdjust(node,drift);
+    uarg->ok = False;
+
+    return True;
+}
+
+/*
+ * Removes catalog entries the walk did not find (scan not set) whose
+ * files are really gone.
+ */
+static OWPBoolean
+prune_catalog(
+        OWPDPolicy  policy,
+        uint32_t    scan
+        )
+{
+    OWPDCatEntry    entry,next;
+    char            path[PATH_MAX+1];
+    struct stat     sbuf;
+
+    for(entry=policy->catalog->head;entry;entry=next){
+        next = entry->next;
+        if((entry->scan == scan) || (entry->state == OWPDCatOpen)){
+            continue;
+        }
+
+        if(!session_path(policy->ctx,False,entry->node,entry->sid,path)){
+            return False;
+        }
+        if((stat(path,&sbuf) == 0) || (errno != ENOENT)){
+            continue;
+        }
+
+        OWPError(policy->ctx,OWPErrINFO,OWPErrPOLICY,
+                "Removing %s from the session catalog",path);
+        entry->state = OWPDCatDeleted;
+        if(!OWPDCatalogAppend(policy->catalog,entry)){
+            return False;
+        }
+    }
+
+    return True;
+}
+
+/*
+ * Function:        OWPDDiskRescan
+ *
+ * Description:        
+ *         This function is called in a child the parent forks when the
+ *         disk usage was loaded from the usage journal at startup
+ *         (policy->rescan), so a damaged journal does not go unnoticed.
+ *
+ *         It walks the hierarchy the way startup would have, adding
+ *         sessions missing from the catalog and removing the ones whose
+ *         files are gone, and compares each class with the journal.
+ *         Classes with session files open, or whose directory changed
+ *         during the walk, are skipped. A difference is appended to the
+ *         journal and applied to the disk counters - which only reaches
+ *         the parent if the counters are shared. (OWPDPolicyShare)
+ *
+ * In Args:        
+ *
+ * Out Args:        
+ *
+ * Scope:        
+ * Returns:        
+ *         False if the hierarchy could not be walked.
+ * Side Effect:        
+ */
+OWPBoolean
+OWPDDiskRescan(
+        OWPDPolicy  policy
+        )
+{
+    char                npath[PATH_MAX+1];
+    struct UsageArgRec  uarg;
+
+    /*
+     * Length was verified by InitializeDiskUsage.
+     */
+    strcpy(npath,policy->datadir);
+    strcat(npath,OWP_PATH_SEPARATOR);
+    strcat(npath,OWP_HIER_DIR);
+
+    I2HashIterate(policy->limits,UsageScanReset,NULL);
+    if(!OWPDCatalogUpdate(policy->catalog) ||
+            !verify_datadir(policy,npath,True,1) ||
+            !prune_catalog(policy,1)){
+        return False;
+    }
+
+    /*
+     * If the journal has been removed since startup, the next start
+     * walks the hierarchy anyway.
+     */
+    if(!ReadUsageJournal(policy)){
+        return True;
+    }
+
+    uarg.policy = policy;
+    uarg.fp = NULL;
+    uarg.ok = True;
+    I2HashIterate(policy->limits,UsageReconcile,&uarg);
+
+    OWPError(policy->ctx,OWPErrINFO,OWPErrPOLICY,
+            "Disk usage rescan of %s complete%s",policy->datadir,
+            (uarg.ok)? "": " (reconciled)");
+
+    return True;
+}
+
+/*
+ * Disk reaper: removes session files to keep each class below its disk
+ * limit. Classes opt in with the "retention" (max age in seconds of a
+ * finished session) and "disk_high"/"disk_low" (percent of "disk")
+ * limits. Fetched sessions go before unfetched ones, oldest first, and
+ * sessions still being written are never touched.
+ */
+static OWPBoolean
+NodeWithin(
+        OWPDPolicyNode  node,
+        OWPDPolicyNode  ancestor
+        )
+{
+    for(;node;node = node->parent){
+        if(node == ancestor){
+            return True;
+        }
+    }
+
+    return False;
+}
+
+/*
+ * Sleeps long enough that removing size bytes does not go faster
+ * than rate bytes/second. (rate 0 is unthrottled.)
+ */
+static void
+ReapThrottle(
+        off_t       size,
+        OWPDLimitT  rate
+        )
+{
+    struct timespec ts;
+    double          secs;
+
+    if(!rate || (size <= 0)){
+        return;
+    }
+
+    secs = (double)size / rate;
+    ts.tv_sec = (time_t)secs;
+    ts.tv_nsec = (long)((secs - ts.tv_sec) * 1e9);
+    while((nanosleep(&ts,&ts) != 0) && (errno == EINTR));
+
+    return;
+}
+
+/*
+ * Removes the session file of entry and gives its disk space back to
+ * the class. The entry is freed. Returns the bytes freed, or -1 on
+ * error.
+ */
+static off_t
+ReapSession(
+        OWPDPolicy      policy,
+        OWPDCatEntry    entry,
+        const char      *why
+        )
+{
+    OWPDPolicyNode  node = entry->node;
+    char            path[PATH_MAX+1];
+    struct stat     sbuf;
+    off_t           size = 0;
+
+    if(!session_path(policy->ctx,False,node,entry->sid,path)){
+        return -1;
+    }
+
+    /*
+     * If the file is already gone, whoever removed it (delete_on_fetch)
+     * has released its space.
+     */
+    if(stat(path,&sbuf) == 0){
+        if(unlink(path) == 0){
+            size = sbuf.st_size;
+        }
+        else if(errno != ENOENT){
+            OWPError(policy->ctx,OWPErrWARNING,errno,"unlink(%s): %M",path);
+            return -1;
+        }
+    }
+    else if(errno != ENOENT){
+        OWPError(policy->ctx,OWPErrWARNING,errno,"stat(%s): %M",path);
+        return -1;
+    }
+
+    if(size){
+        OWPError(policy->ctx,OWPErrINFO,OWPErrPOLICY,
+                "Reaped %s (%s, %lld bytes)",path,why,(long long)size);
+        UsageRecord(node,path,True,-size,0);
+        DiskUsageAdjust(node,-size);
+    }
+
+    entry->state = OWPDCatDeleted;
+    (void)OWPDCatalogAppend(policy->catalog,entry);
+
+    return size;
+}
+
+/*
+ * Removes the oldest fetched - then the oldest unfetched - sessions of
+ * node and the classes below it until want bytes have been freed.
+ */
+static off_t
+ReapNode(
+        OWPDPolicy      policy,
+        OWPDPolicyNode  node,
+        off_t           want,
+        OWPDLimitT      rate,
+        const char      *why
+        )
+{
+    OWPDCatState    pass[] = {OWPDCatFetched,OWPDCatFinished};
+    OWPDCatEntry    entry,next;
+    off_t           freed = 0;
+    off_t           n;
+    size_t          i;
+
+    for(i=0;(i < I2Number(pass)) && (freed < want);i++){
+        for(entry=policy->catalog->head;entry && (freed < want);entry=next){
+            next = entry->next;
+            if((entry->state != pass[i]) || !NodeWithin(entry->node,node)){
+                continue;
+            }
+            if((n = ReapSession(policy,entry,why)) < 0){
+                return freed;
+            }
+            freed += n;
+            ReapThrottle(n,rate);
+        }
     }
-    if(!OWPContextConfigSetF(ctx,OWPOpenFile,(OWPFunc)openfilefunc)){
-        return NULL;
+
+    return freed;
+}
+
+/*
+ * Byte counts of the disk_high/disk_low marks of node. (0 if the
+ * reaper is not enabled for it.)
+ */
+static OWPDLimitT
+DiskMark(
+        OWPDPolicyNode  node,
+        OWPDMesgT       mark
+        )
+{
+    OWPDLimitT  disk = GetLimit(node,OWPDLimDisk);
+    OWPDLimitT  high = GetLimit(node,OWPDLimDiskHigh);
+    OWPDLimitT  pct;
+
+    if(!disk || !high){
+        return 0;
     }
-    if(!OWPContextConfigSetF(ctx,OWPCloseFile,(OWPFunc)closefilefunc)){
-        return NULL;
+
+    pct = GetLimit(node,mark);
+    if(!pct || (pct > high)){
+        pct = high;
+    }
+    if(pct > 100){
+        pct = 100;
     }
 
-    return policy;
+    return (disk / 100) * pct + (disk % 100) * pct / 100;
 }
 
-OWPBoolean
-OWPDPolicyPostInstall(
-    OWPDPolicy  policy
+/*
+ * Called from OWPDResourceDemand when a disk request of value bytes was
+ * denied for node: if every level that is short lets the reaper free
+ * space (disk_high), mark how much each of them is short for the
+ * reaper (OWPDDiskReclaim). Nothing is removed here - this is on the
+ * request path. Returns True if the reaper was asked for room.
+ */
+static OWPBoolean
+DiskReclaimMark(
+        OWPDPolicyNode  node,
+        OWPDMesgT       query,
+        OWPDLimitT      value
         )
 {
-    /*
-     * Now that the "user class" hierarchy is loaded - take a look
-     * at datadir and initialize disk usage.
-     */
-    if(!InitializeDiskUsage(policy)){
+    OWPDPolicy      policy = node->policy;
+    double          fudge = 1.0;
+    OWPDPolicyNode  n;
+    OWPDLimitT      disk,used,room,want,cur;
+
+    if(!policy->reap || !policy->reclaim){
         return False;
     }
+    if(query == OWPDMESGCLAIM){
+        fudge = policy->diskfudge;
+    }
+
+    for(n=node;n;n = n->parent){
+        if(!(disk = GetLimit(n,OWPDLimDisk))){
+            continue;
+        }
+        room = disk * fudge;
+        if(((GetUsed(n,OWPDLimDisk) + value) > room) &&
+                !DiskMark(n,OWPDLimDiskHigh)){
+            return False;
+        }
+    }
+
+    for(n=node;n;n = n->parent){
+        if(!(disk = GetLimit(n,OWPDLimDisk))){
+            continue;
+        }
+        room = disk * fudge;
+        used = GetUsed(n,OWPDLimDisk);
+        if((used + value) <= room){
+            continue;
+        }
+        want = used + value - room;
+
+        /*
+         * Keep the largest shortfall asked for since the last pass.
+         */
+        cur = UsedLoad(&policy->reclaim[n->index]);
+        while((cur < want) && !UsedCAS(&policy->reclaim[n->index],&cur,want));
+
+        OWPError(policy->ctx,OWPErrINFO,OWPErrPOLICY,
+                "Disk of %s full - asking the reaper for %" PRIu64 " bytes",
+                n->nodename,want);
+    }
 
     return True;
 }
 
 /*
- * Function:        OWPDGetPF
+ * Function:        OWPDDiskReclaim
  *
  * Description:        
- *         Fetch the 128 bit AES key for a given userid and return it.
- *
- *         Returns True if successful.
- *         If False is returned err_ret can be checked to determine if
- *         the key store had a problem(ErrFATAL) or if the userid is
- *         invalid(ErrOK).
+ *         Run by the background reaper: removes sessions from the classes
+ *         that denied disk requests marked (see DiskReclaimMark), until
+ *         the shortfall is freed.
  *
  * In Args:        
+ *         rate: max bytes/second to remove (0 is unthrottled)
  *
  * Out Args:        
  *
  * Scope:        
- * Returns:        T/F
+ * Returns:        
+ *         False if the catalog could not be read.
  * Side Effect:        
  */
-extern OWPBoolean
-OWPDGetPF(
-        OWPContext      ctx,
-        const OWPUserID userid,
-        uint8_t         **pf,
-        size_t          *pf_len,
-        void            **pf_free,
-        OWPErrSeverity  *err_ret
+OWPBoolean
+OWPDDiskReclaim(
+        OWPDPolicy  policy,
+        OWPDLimitT  rate
         )
 {
-    OWPDPolicy  policy;
-    I2Datum     key,val;
-
-    *err_ret = OWPErrOK;
+    OWPDLimitT  want;
+    OWPBoolean  updated = False;
+    size_t      i;
 
-    if(!(policy = (OWPDPolicy)OWPContextConfigGetV(ctx,OWPDPOLICY))){
-        OWPError(ctx,OWPErrFATAL,OWPErrINVALID,
-                "OWPDGetPF: OWPDPOLICY not set");
-        *err_ret = OWPErrFATAL;
-        return False;
+    if(!policy->reclaim || !policy->catalog){
+        return True;
     }
 
-    key.dptr = (void*)userid;
-    key.dsize = strlen(userid);
-    if(!I2HashFetch(policy->pfs,key,&val)){
-        OWPError(policy->ctx,OWPErrFATAL,OWPErrPOLICY,
-                "userid \"%s\" unknown",userid);
-        return False;
-    }
+    for(i=0;i<policy->nnodes;i++){
+        want = UsedLoad(&policy->reclaim[i]);
+        while(want && !UsedCAS(&policy->reclaim[i],&want,0));
+        if(!want || !policy->nodes[i]){
+            continue;
+        }
 
-    /* just point directly at memory in store */
-    *pf = val.dptr;
-    *pf_len = val.dsize;
-    *pf_free = NULL;
+        if(!updated){
+            if(!OWPDCatalogUpdate(policy->catalog)){
+                return False;
+            }
+            updated = True;
+        }
+        (void)ReapNode(policy,policy->nodes[i],want,rate,"reclaim");
+    }
 
     return True;
 }
 
-static OWPDPolicyNode
-GetNodeDefault(
-        OWPDPolicy  policy
+struct ReapArgRec{
+    OWPDPolicy  policy;
+    OWPDLimitT  rate;
+};
+
+static I2Boolean
+ReapWatermark(
+        I2Datum key     __attribute__((unused)),
+        I2Datum value,
+        void    *app_data
         )
 {
-    OWPDPidRec  tpid;
-    I2Datum     key,val;
+    struct ReapArgRec   *rarg = (struct ReapArgRec *)app_data;
+    OWPDPolicyNode      node = (OWPDPolicyNode)value.dptr;
+    OWPDLimitT          high,low,used;
 
-    memset(&tpid,0,sizeof(tpid));
+    if(!(high = DiskMark(node,OWPDLimDiskHigh))){
+        return True;
+    }
 
-    tpid.id_type = OWPDPidDefaultType;
-    key.dptr = &tpid;
-    key.dsize = sizeof(tpid);
-    if(I2HashFetch(policy->idents,key,&val)){
-        return (OWPDPolicyNode)val.dptr;
+    if((used = GetUsed(node,OWPDLimDisk)) <= high){
+        return True;
     }
+    low = DiskMark(node,OWPDLimDiskLow);
 
-    return policy->root;
+    OWPError(rarg->policy->ctx,OWPErrINFO,OWPErrPOLICY,
+            "Disk usage of %s above disk_high (used = %" PRIu64
+            ", mark = %" PRIu64 ") - reaping",node->nodename,used,high);
+    (void)ReapNode(rarg->policy,node,used - low,rarg->rate,"disk_high");
+
+    return True;
 }
 
-static OWPDPolicyNode
-GetNodeFromUserID(
-        OWPDPolicy      policy,
-        const OWPUserID userid  /* MUST BE VALID MEMORY */
+/*
+ * Function:        OWPDDiskReap
+ *
+ * Description:        
+ *         One pass of the background reaper. (Run by a child the parent
+ *         forks - it only reaches the parent's disk counters if they
+ *         are shared. See OWPDPolicyShare.)
+ *
+ *         Removes finished sessions older than the "retention" of their
+ *         class, then brings each class that is above its "disk_high"
+ *         mark down to its "disk_low" mark.
+ *
+ * In Args:        
+ *         rate: max bytes/second to remove (0 is unthrottled)
+ *
+ * Out Args:        
+ *
+ * Scope:        
+ * Returns:        
+ *         False if the catalog could not be read.
+ * Side Effect:        
+ */
+OWPBoolean
+OWPDDiskReap(
+        OWPDPolicy  policy,
+        OWPDLimitT  rate
         )
 {
-    OWPDPidRec  pid;
-    I2Datum     key,val;
-
-    memset(&pid,0,sizeof(pid));
-
-    pid.id_type = OWPDPidUserType;
-    key.dptr = &pid;
-    key.dsize = sizeof(pid);
+    struct ReapArgRec   rarg;
+    OWPDCatEntry        entry,next;
+    OWPDLimitT          retention;
+    time_t              now;
+    off_t               n;
 
-    memcpy(pid.user.userid,userid,sizeof(pid.user.userid));
+    if(!OWPDCatalogUpdate(policy->catalog)){
+        return False;
+    }
 
-    if(I2HashFetch(policy->idents,key,&val)){
-        return (OWPDPolicyNode)val.dptr;
+    now = time(NULL);
+    for(entry=policy->catalog->head;entry;entry=next){
+        next = entry->next;
+        if(((entry->state != OWPDCatFetched) &&
+                    (entry->state != OWPDCatFinished)) ||
+                !(retention = GetLimit(entry->node,OWPDLimRetention)) ||
+                (entry->end > now) ||
+                ((OWPDLimitT)(now - entry->end) < retention)){
+            continue;
+        }
+        if((n = ReapSession(policy,entry,"retention")) > 0){
+            ReapThrottle(n,rate);
+        }
     }
 
-    return NULL;
+    rarg.policy = policy;
+    rarg.rate = rate;
+    I2HashIterate(policy->limits,ReapWatermark,&rarg);
+
+    return True;
 }
 
-static OWPDPolicyNode
-GetNodeFromAddr(
-        OWPDPolicy      policy,
-        struct sockaddr *remote_sa_addr
+static OWPBoolean
+IntegerResourceDemand(
+        OWPDPolicyNode  node,
+        OWPDMesgT       query,
+        OWPDLimRec      lim
         )
 {
-    OWPDPidRec  pid;
-    uint8_t    nbytes,nbits,*ptr;
-    I2Datum     key,val;
+    size_t      i;
+    double      fudge = 1.0;
+    OWPDLimitT  *cnt;
+    OWPDLimitT  used,want;
 
-    memset(&pid,0,sizeof(pid));
+    /*
+     * terminate recursion
+     */
+    if(!node){
+        return True;
+    }
 
-    pid.id_type = OWPDPidNetmaskType;
-    key.dptr = &pid;
-    key.dsize = sizeof(pid);
+    for(i=0;i<node->ilim;i++){
+        if(node->limits[i].limit == lim.limit){
+            goto found;
+        }
+    }
 
-    switch(remote_sa_addr->sa_family){
-        struct sockaddr_in        *saddr4;
-#ifdef        AF_INET6
-        struct sockaddr_in6        *saddr6;
+    /*
+     * If there is not limit record, then the default must be 0 or the
+     * logic breaks.
+     */
+    assert(!GetDefLimit(lim.limit));
 
-        case AF_INET6:
-        saddr6 = (struct sockaddr_in6*)remote_sa_addr;
-        /*
-         * If this is a v4 mapped address - match it as a v4 address.
-         */
-        if(IN6_IS_ADDR_V4MAPPED(&saddr6->sin6_addr)){
-            memcpy(pid.net.addrval,
-                    &saddr6->sin6_addr.s6_addr[12],4);
-            pid.net.addrsize = 4;
-        }
-        else{
-            memcpy(pid.net.addrval,saddr6->sin6_addr.s6_addr,16);
-            pid.net.addrsize = 16;
+    /*
+     * No reason to keep track if this resource is unlimited all the
+     * way up the tree - so just return true.
+     */
+    return True;
+
+found:
+    /*
+     * Ok - found the resource limits
+     */
+
+    /*
+     * If no limit at this level, go on to next.
+     */
+    if(!node->limits[i].value){
+        return IntegerResourceDemand(node->parent,query,lim);
+    }
+
+    cnt = UsedPtr(node,lim.limit);
+
+    /*
+     * Deal with resource releases.
+     */
+    if(query == OWPDMESGRELEASE){
+        used = UsedLoad(cnt);
+        do{
+            if(lim.value <= used){
+                want = used - lim.value;
+            }
+            /*
+             * A level that only started counting at a reload can be
+             * handed back resources claimed before that - stop at 0.
+             */
+            else if(node->seeded & (1U << LimIndex(lim.limit))){
+                want = 0;
+            }
+            else{
+                OWPError(node->policy->ctx,OWPErrFATAL,OWPErrPOLICY,
+                        "Request to release unallocated resouces: "
+                        "%s:%s (currently allocated = %u, "
+                        "release amount = %u)",node->nodename,
+                        GetLimName(lim.limit),used,
+                        lim.value);
+                return False;
+            }
+        }while(!UsedCAS(cnt,&used,want));
+
+        if(!IntegerResourceDemand(node->parent,query,lim)){
+            UsedAdd(cnt,used - want);
+            return False;
         }
-        break;
-#endif
-        case AF_INET:
-        saddr4 = (struct sockaddr_in*)remote_sa_addr;
-        memcpy(pid.net.addrval,&saddr4->sin_addr.s_addr,4);
-        pid.net.addrsize = 4;
-        break;
 
-        default:
-        OWPError(policy->ctx,OWPErrFATAL,OWPErrUNKNOWN,
-                "Unknown address protocol family.");
-        return NULL;
-        break;
+        return True;
+    }
+
+    /*
+     * The rest deals with resource requests.
+     */
+
+    /*
+     * If this is a OWPDMESGCLAIM request - apply the fudge.
+     */
+    if(query == OWPDMESGCLAIM){
+        switch(lim.limit){
+            case OWPDLimDisk:
+                fudge = node->policy->diskfudge;
+                break;
+
+            default:
+                OWPError(node->policy->ctx,OWPErrFATAL,OWPErrPOLICY,
+                        "Invalid \"CLAIM\" request");
+                return False;
+        }
+    }
+    else if(query != OWPDMESGREQUEST){
+        OWPError(node->policy->ctx,OWPErrFATAL,OWPErrPOLICY,
+                "Unknown resource request type: %u",query);
+        return False;
     }
 
     /*
-     * Start with the max mask size (full address) and keep decreasing
-     * the mask size until all possible address masks have been checked
-     * for the given address.
+     * If this level doesn't have the resources available - return false.
+     * Otherwise take them now, so a concurrent request from another
+     * process sees them as used.
      */
-    for(pid.net.mask_len=pid.net.addrsize*8;
-            pid.net.mask_len > 0; pid.net.mask_len--){
-        /*
-         * nbytes is number of complete bytes in "mask".
-         * nbits is number of bits in the following byte that
-         * are part of the "mask".
-         */
-        nbytes = pid.net.mask_len/8;
-        nbits = pid.net.mask_len%8;
-        ptr = &pid.net.addrval[nbytes];
-
-        /*
-         * Zero out one more bit each time through the loop.
-         * (The "if" skips the "max" case.)
-         */
-        if(nbytes < pid.net.addrsize){
-            *ptr &= (0xFF << (8-nbits));
+    used = UsedLoad(cnt);
+    do{
+        if((lim.value+used) > (node->limits[i].value * fudge)){
+            return False;
         }
+    }while(!UsedCAS(cnt,&used,used + lim.value));
 
-        if(I2HashFetch(policy->idents,key,&val)){
-            return (OWPDPolicyNode)val.dptr;
-        }
+    /*
+     * Are the resource available the next level up? (Give this level
+     * back if not.)
+     */
+    if(!IntegerResourceDemand(node->parent,query,lim)){
+        UsedSub(cnt,lim.value);
+        return False;
     }
 
-    return GetNodeDefault(policy);
+    return True;
 }
 
-static OWPDLimitT
-GetLimit(
+/*
+ * test_sessions limits the number of test sessions per control connection.
+ * The count is kept with the connection (OWPDPOLICY_TSESSIONS) instead of
+ * in the "used" part of the tree, because a prefork worker serves many
+ * connections with the same tree. Returns True if nsessions is within the
+ * limit all the way to the root of the hierarchy.
+ */
+static OWPBoolean
+TestSessionsAllowed(
         OWPDPolicyNode  node,
-        OWPDMesgT       lim
+        OWPDLimitT      nsessions
         )
 {
-    size_t  i;
+    OWPDLimitT  limit;
 
-    for(i=0;i<node->ilim;i++){
-        if(lim == node->limits[i].limit){
-            return node->limits[i].value;
+    for(;node;node = node->parent){
+        limit = GetLimit(node,OWPDLimTestSessions);
+        if(limit && (nsessions > limit)){
+            OWPError(node->policy->ctx,OWPErrFATAL,OWPErrPOLICY,
+                    "ResReq DENIED: %s:request:%s = %" PRIu64
+                    " (limit = %" PRIu64 ")",
+                    node->nodename,GetLimName(OWPDLimTestSessions),
+                    nsessions,limit);
+            return False;
         }
     }
 
-    return GetDefLimit(lim);
+    return True;
 }
 
-static OWPDLimitT
-GetUsed(
+/*
+ * Hold a disk request that DiskReclaimMark asked the reaper to make room
+ * for: try it again every OWPD_RECLAIM_STEP ms for up to
+ * OWPD_RECLAIM_WAIT seconds. Returns True once it fits.
+ */
+static OWPBoolean
+DiskReclaimWait(
         OWPDPolicyNode  node,
-        OWPDMesgT       lim
-       )
+        OWPDMesgT       query,
+        OWPDLimRec      lim
+        )
 {
-    size_t  i;
+    struct timespec ts;
+    unsigned int    i;
 
-    for(i=0;i<node->ilim;i++){
-        if(lim == node->limits[i].limit){
-            return node->used[i].value;
+    for(i=0;i < (OWPD_RECLAIM_WAIT * 1000) / OWPD_RECLAIM_STEP;i++){
+        ts.tv_sec = OWPD_RECLAIM_STEP / 1000;
+        ts.tv_nsec = (OWPD_RECLAIM_STEP % 1000) * 1000000L;
+        while((nanosleep(&ts,&ts) != 0) && (errno == EINTR));
+
+        if(IntegerResourceDemand(node,query,lim)){
+            return True;
         }
     }
 
-    return 0;
+    return False;
 }
 
-/*
- * Returns True if the usage is less than the limit - false if it is greater.
- * It sets the usage to the value passed in either way. (well - only if the
- * resource is being tracked.)
- */
-static void
-IntegerResourceUsage(
+OWPBoolean
+OWPDResourceDemand(
         OWPDPolicyNode  node,
+        OWPDMesgT       query,
         OWPDLimRec      lim
         )
 {
-    size_t  i;
+    size_t          maxdef = I2Number(limkeys);
+    size_t          i;
+    enum limtype    limkind = LIMNOT;
+    OWPDLimitT      val;
+    OWPBoolean      ret;
 
-    for(i=0;i<node->ilim;i++){
-        if(node->limits[i].limit == lim.limit){
-            goto found;
+    for(i=0;i<maxdef;i++){
+        if(lim.limit == limkeys[i].limit){
+            limkind = limkeys[i].ltype;
+            break;
         }
     }
 
-    /*
-     * If there is not limit record, then the default must be 0 or the
-     * logic breaks.
-     */
-    assert(!GetDefLimit(lim.limit));
+    if(limkind == LIMNOT){
+        return False;
+    }
 
-    /*
-     * No reason to keep track if this resource is unlimited all the
-     * way up the tree - so just return true.
-     */
-    return;
+    if(limkind == LIMBOOLVAL){
+        if(query == OWPDMESGRELEASE){
+            return True;
+        }
+        val = GetLimit(node,lim.limit);
+        return (val == lim.value);
+    }
+
+    ret = IntegerResourceDemand(node,query,lim);
 
-found:
     /*
-     * Ok - found the resource limits
+     * If the disk is full, but sessions can be removed, have the reaper
+     * make room - and wait a bounded time for it. Only a child that
+     * does its own accounting (slot) waits: the parent answers every
+     * other child, and must not block.
      */
+    if(!ret && (lim.limit == OWPDLimDisk) && (query != OWPDMESGRELEASE) &&
+            DiskReclaimMark(node,query,lim.value) &&
+            (node->policy->slot >= 0)){
+        ret = DiskReclaimWait(node,query,lim);
+    }
 
     /*
-     * If no limit at this level, just return true
+     * These messages are printed to DEBUG if allowed and FATAL if denied
      */
-    if(!node->limits[i].value){
-        return;
+    OWPError(node->policy->ctx,(ret)?OWPErrDEBUG:OWPErrFATAL,OWPErrPOLICY,
+            "ResReq %s: %s:%s:%s = %" PRIu64 " (result = %" PRIu64
+            ", limit = %" PRIu64 ")",
+            (ret)?"ALLOWED":"DENIED",
+            node->nodename,
+            (query == OWPDMESGRELEASE)?"release":"request",
+            GetLimName(lim.limit),
+            lim.value,
+            GetUsed(node,lim.limit),
+            GetLimit(node,lim.limit));
+    for(node = node->parent;!ret && node;node = node->parent){
+        OWPError(node->policy->ctx,(ret)?OWPErrDEBUG:OWPErrFATAL,OWPErrPOLICY,
+                "ResReq %s: %s:%s:%s = %" PRIu64
+                " (result = %" PRIu64 ", limit = %" PRIu64")",
+                (ret)?"ALLOWED":"DENIED",
+                node->nodename,
+                (query == OWPDMESGRELEASE)?"release":"request",
+                GetLimName(lim.limit),
+                lim.value,
+                GetUsed(node,lim.limit),
+                GetLimit(node,lim.limit));
     }
 
-    node->used[i].value = lim.value;
+    return ret;
+}
 
-    if(node->used[i].value > node->limits[i].value){
-        OWPError(node->policy->ctx,OWPErrWARNING,OWPErrPOLICY,
-                "Resource usage exceeds limits %s:%s "
-                "(used = %" PRIu64 ", limit = %" PRIu64 ")",node->nodename,
-                GetLimName(lim.limit),node->used[i].value,
-                node->limits[i].value);
-    }
+/*
+ * Policy reload - see OWPDPolicySwap.
+ */
+struct SwapArgRec{
+    OWPDPolicy  policy;     /* installed */
+    OWPDPolicy  newpolicy;
+    size_t      nadded;
+    size_t      nremoved;
+    OWPBoolean  ok;
+};
 
-    return;
+/*
+ * Function:        OWPDPolicyLoad
+ *
+ * Description:        
+ *         This function is called from the parent perspective.
+ *
+ *         It parses the policy files in confdir into a new policy
+ *         record for the same datadir as policy. Nothing is installed
+ *         yet (see OWPDPolicySwap).
+ *
+ * In Args:        
+ *
+ * Out Args:        
+ *
+ * Scope:        
+ * Returns:        
+ *         The new record, or NULL if the files could not be parsed.
+ *         (The error has been reported.)
+ * Side Effect:        
+ */
+OWPDPolicy
+OWPDPolicyLoad(
+        OWPDPolicy  policy,
+        char        *confdir,
+        char        **lbuf,
+        size_t      *lbuf_max
+        )
+{
+    return PolicyParse(policy->ctx,policy->datadir,confdir,
+            policy->diskfudge,lbuf,lbuf_max);
 }
 
-static void
-OWPDResourceUsage(
-        OWPDPolicyNode  node,
-        OWPDLimRec      lim
+/*
+ * Returns the node of policy with the same class name as node, or NULL.
+ */
+OWPDPolicyNode
+OWPDPolicyMapNode(
+        OWPDPolicy      policy,
+        OWPDPolicyNode  node
         )
 {
-    size_t          maxdef = I2Number(limkeys);
-    size_t          i;
-    enum limtype    limkind = LIMNOT;
+    I2Datum key,val;
 
-    for(i=0;i<maxdef;i++){
-        if(lim.limit == limkeys[i].limit){
-            limkind = limkeys[i].ltype;
-            break;
-        }
+    if(!node){
+        return NULL;
     }
 
-    if(limkind != LIMINTVAL){
-        return;
+    key.dptr = node->nodename;
+    key.dsize = strlen(node->nodename);
+    if(!I2HashFetch(policy->limits,key,&val)){
+        return NULL;
     }
 
-    OWPError(node->policy->ctx,OWPErrDEBUG,OWPErrPOLICY,
-            "ResInit %s:%s = %" PRIu64,node->nodename,
-            GetLimName(lim.limit),lim.value);
-    IntegerResourceUsage(node,lim);
-
-    return;
+    return val.dptr;
 }
 
-static OWPBoolean
-IntegerResourceDemand(
-        OWPDPolicyNode  node,
-        OWPDMesgT       query,
-        OWPDLimRec      lim
+/*
+ * A class that is kept must stay under the same parent - its sessions
+ * are in the directory named by the chain of class names.
+ */
+static I2Boolean
+SwapCheckNew(
+        I2Datum key     __attribute__((unused)),
+        I2Datum value,
+        void    *app_data
         )
 {
-    size_t  i;
-    double  fudge = 1.0;
+    struct SwapArgRec   *sarg = (struct SwapArgRec *)app_data;
+    OWPDPolicyNode      node = (OWPDPolicyNode)value.dptr;
+    OWPDPolicyNode      onode;
 
-    /*
-     * terminate recursion
-     */
-    if(!node){
+    if(!(onode = OWPDPolicyMapNode(sarg->policy,node))){
+        sarg->nadded++;
         return True;
     }
 
-    for(i=0;i<node->ilim;i++){
-        if(node->limits[i].limit == lim.limit){
-            goto found;
-        }
+    if((!node->parent != !onode->parent) || (node->parent &&
+                strcmp(node->parent->nodename,onode->parent->nodename))){
+        OWPError(sarg->policy->ctx,OWPErrFATAL,OWPErrPOLICY,
+                "Class %s moved from parent %s to %s - the class "
+                "hierarchy can only be rearranged by a restart",
+                node->nodename,
+                (onode->parent)? onode->parent->nodename: "(none)",
+                (node->parent)? node->parent->nodename: "(none)");
+        sarg->ok = False;
+        return False;
     }
 
-    /*
-     * If there is not limit record, then the default must be 0 or the
-     * logic breaks.
-     */
-    assert(!GetDefLimit(lim.limit));
-
-    /*
-     * No reason to keep track if this resource is unlimited all the
-     * way up the tree - so just return true.
-     */
     return True;
+}
 
-found:
-    /*
-     * Ok - found the resource limits
-     */
+/*
+ * A class that goes away must not hold any resources.
+ */
+static I2Boolean
+SwapCheckOld(
+        I2Datum key     __attribute__((unused)),
+        I2Datum value,
+        void    *app_data
+        )
+{
+    struct SwapArgRec   *sarg = (struct SwapArgRec *)app_data;
+    OWPDPolicyNode      node = (OWPDPolicyNode)value.dptr;
+    OWPDLimitT          used;
+    size_t              i;
 
-    /*
-     * If no limit at this level, go on to next.
-     */
-    if(!node->limits[i].value){
-        return IntegerResourceDemand(node->parent,query,lim);
+    if(OWPDPolicyMapNode(sarg->newpolicy,node)){
+        return True;
     }
+    sarg->nremoved++;
 
-    /*
-     * Deal with resource releases.
-     */
-    else if(query == OWPDMESGRELEASE){
-        if(lim.value > node->used[i].value){
-            OWPError(node->policy->ctx,OWPErrFATAL,OWPErrPOLICY,
-                    "Request to release unallocated resouces: "
-                    "%s:%s (currently allocated = %u, "
-                    "release amount = %u)",node->nodename,
-                    GetLimName(lim.limit),node->used[i].value,
-                    lim.value);
-            return False;
-        }
-
-        if(!IntegerResourceDemand(node->parent,query,lim)){
-            return False;
+    for(i=0;i<I2Number(limkeys);i++){
+        if((limkeys[i].ltype != LIMINTVAL) ||
+                !GetLimit(node,limkeys[i].limit) ||
+                !(used = UsedLoad(&node->used[i].value))){
+            continue;
         }
+        OWPError(sarg->policy->ctx,OWPErrFATAL,OWPErrPOLICY,
+                "Class %s removed while in use (%s = %" PRIu64 ")",
+                node->nodename,limkeys[i].lname,used);
+        sarg->ok = False;
+        return False;
+    }
 
-        node->used[i].value -= lim.value;
+    return True;
+}
 
+/*
+ * Moves the counters (and disk usage bookkeeping) of the old class onto
+ * the new node. A new class gets a fresh block in the shared mapping.
+ */
+static I2Boolean
+SwapAdopt(
+        I2Datum key     __attribute__((unused)),
+        I2Datum value,
+        void    *app_data
+        )
+{
+    struct SwapArgRec   *sarg = (struct SwapArgRec *)app_data;
+    OWPDPolicy          policy = sarg->policy;
+    OWPDPolicyNode      node = (OWPDPolicyNode)value.dptr;
+    OWPDPolicyNode      onode;
+    OWPDLimRec          *used;
+    OWPDCatEntry        entry;
+    OWPDPolicyNode      n;
+    size_t              i;
+
+    if(!(onode = OWPDPolicyMapNode(policy,node))){
+        if(policy->shm){
+            used = &((OWPDLimRec *)policy->shm)[
+                policy->nnodes * I2Number(limkeys)];
+            memcpy(used,node->used,sizeof(OWPDLimRec)*I2Number(limkeys));
+            free(node->used);
+            node->used = used;
+            node->index = policy->nnodes++;
+            policy->nodes[node->index] = node;
+        }
         return True;
     }
 
-    /*
-     * The rest deals with resource requests.
-     */
+    free(node->used);
+    node->used = onode->used;
+    onode->used = NULL;
+    node->index = onode->index;
+    if(policy->shm){
+        policy->nodes[node->index] = node;
+    }
+
+    node->seeded = onode->seeded;
+    node->initdisk = onode->initdisk;
+    node->owndisk = onode->owndisk;
+    node->scanmtime = onode->scanmtime;
+    node->jdisk = onode->jdisk;
+    node->jopens = onode->jopens;
+    node->jmtime = onode->jmtime;
 
     /*
-     * If this is a OWPDMESGCLAIM request - apply the fudge.
+     * A limit that was not counted at this level (0) starts from
+     * nothing - except disk, which starts with the sessions the
+     * catalog has under the class. Whatever was claimed before is
+     * released down to 0 rather than failing. (see IntegerResourceDemand)
      */
-    if(query == OWPDMESGCLAIM){
-        switch(lim.limit){
-            case OWPDLimDisk:
-                fudge = node->policy->diskfudge;
-                break;
+    for(i=0;i<I2Number(limkeys);i++){
+        if((limkeys[i].ltype != LIMINTVAL) ||
+                !GetLimit(node,limkeys[i].limit) ||
+                GetLimit(onode,limkeys[i].limit)){
+            continue;
+        }
 
-            default:
-                OWPError(node->policy->ctx,OWPErrFATAL,OWPErrPOLICY,
-                        "Invalid \"CLAIM\" request");
-                return False;
+        node->used[i].value = 0;
+        node->seeded |= (1U << i);
+
+        if((limkeys[i].limit != OWPDLimDisk) || !policy->catalog){
+            continue;
+        }
+        for(entry = policy->catalog->head;entry;entry = entry->next){
+            for(n = entry->node;n && (n != onode);n = n->parent);
+            if(n){
+                node->used[i].value += entry->size;
+            }
         }
-    }
-    else if(query != OWPDMESGREQUEST){
-        OWPError(node->policy->ctx,OWPErrFATAL,OWPErrPOLICY,
-                "Unknown resource request type: %u",query);
-        return False;
     }
 
-    /*
-     * If this level doesn't have the resources available - return false.
-     */
-    if((lim.value+node->used[i].value) > (node->limits[i].value * fudge)){
-        return False;
+    return True;
+}
+
+static I2Boolean
+SwapRemoved(
+        I2Datum key     __attribute__((unused)),
+        I2Datum value,
+        void    *app_data
+        )
+{
+    struct SwapArgRec   *sarg = (struct SwapArgRec *)app_data;
+    OWPDPolicyNode      node = (OWPDPolicyNode)value.dptr;
+
+    if(!node->used || !sarg->policy->shm){
+        return True;
     }
 
     /*
-     * Are the resource available the next level up?
+     * The block stays reserved - children forked before the reload
+     * may still know the class.
      */
-    if(!IntegerResourceDemand(node->parent,query,lim)){
-        return False;
-    }
-
-    node->used[i].value += lim.value;
+    sarg->policy->nodes[node->index] = NULL;
+    node->used = NULL;
 
     return True;
 }
 
+/*
+ * Function:        OWPDPolicySwap
+ *
+ * Description:        
+ *         This function is called from the parent perspective, between
+ *         events, with a record from OWPDPolicyLoad.
+ *
+ *         It checks that newpolicy can take over from policy, moves the
+ *         resource accounting of policy (counters, shared mapping and
+ *         ledger, catalog, disk usage journal) onto the classes of
+ *         newpolicy by name and installs newpolicy in the context.
+ *
+ *         Children keep the tree they were forked with. Only class
+ *         names go over the pipes, and a kept class has the same
+ *         counters (the same memory when they are shared) in both
+ *         trees, so their sessions are not disturbed.
+ *
+ *         Classes may be added and their limits changed. A class may
+ *         only be removed when it holds no resources or sessions, and
+ *         may not move to another parent.
+ *
+ * In Args:        
+ *
+ * Out Args:        
+ *
+ * Scope:        
+ * Returns:        
+ *         True if newpolicy is now installed. policy then only holds
+ *         its own tree, for OWPDPolicyMapNode, and should be free'd
+ *         with OWPDPolicyFree. On False (the reason has been reported)
+ *         nothing has changed.
+ * Side Effect:        
+ */
 OWPBoolean
-OWPDResourceDemand(
-        OWPDPolicyNode  node,
-        OWPDMesgT       query,
-        OWPDLimRec      lim
+OWPDPolicySwap(
+        OWPDPolicy  policy,
+        OWPDPolicy  newpolicy
         )
 {
-    size_t          maxdef = I2Number(limkeys);
-    size_t          i;
-    enum limtype    limkind = LIMNOT;
-    OWPDLimitT      val;
-    OWPBoolean      ret;
+    struct SwapArgRec   sarg;
+    OWPDCatEntry        entry;
 
-    for(i=0;i<maxdef;i++){
-        if(lim.limit == limkeys[i].limit){
-            limkind = limkeys[i].ltype;
-            break;
-        }
+    sarg.policy = policy;
+    sarg.newpolicy = newpolicy;
+    sarg.nadded = sarg.nremoved = 0;
+    sarg.ok = True;
+
+    I2HashIterate(newpolicy->limits,SwapCheckNew,&sarg);
+    if(sarg.ok){
+        I2HashIterate(policy->limits,SwapCheckOld,&sarg);
+    }
+    if(!sarg.ok){
+        return False;
     }
 
-    if(limkind == LIMNOT){
+    if(policy->shm && (sarg.nadded > policy->maxnodes - policy->nnodes)){
+        OWPError(policy->ctx,OWPErrFATAL,OWPErrPOLICY,
+                "No room to share the accounting of %lu new classes - "
+                "restart to add them",(unsigned long)sarg.nadded);
         return False;
     }
 
-    if(limkind == LIMBOOLVAL){
-        if(query == OWPDMESGRELEASE){
-            return True;
+    /*
+     * Catch up with the sessions the children have logged.
+     */
+    if(policy->catalog){
+        if(!OWPDCatalogUpdate(policy->catalog)){
+            return False;
+        }
+        for(entry = policy->catalog->head;entry;entry = entry->next){
+            if(!OWPDPolicyMapNode(newpolicy,entry->node)){
+                OWPError(policy->ctx,OWPErrFATAL,OWPErrPOLICY,
+                        "Class %s removed while it holds sessions",
+                        entry->node->nodename);
+                return False;
+            }
         }
-        val = GetLimit(node,lim.limit);
-        return (val == lim.value);
     }
 
-    ret = IntegerResourceDemand(node,query,lim);
+    if(!OWPContextConfigSetV(policy->ctx,OWPDPOLICY,newpolicy)){
+        return False;
+    }
 
     /*
-     * These messages are printed to DEBUG if allowed and FATAL if denied
+     * Nothing can fail from here on.
      */
-    OWPError(node->policy->ctx,(ret)?OWPErrDEBUG:OWPErrFATAL,OWPErrPOLICY,
-            "ResReq %s: %s:%s:%s = %" PRIu64 " (result = %" PRIu64
-            ", limit = %" PRIu64 ")",
-            (ret)?"ALLOWED":"DENIED",
-            node->nodename,
-            (query == OWPDMESGRELEASE)?"release":"request",
-            GetLimName(lim.limit),
-            lim.value,
-            GetUsed(node,lim.limit),
-            GetLimit(node,lim.limit));
-    for(node = node->parent;!ret && node;node = node->parent){
-        OWPError(node->policy->ctx,(ret)?OWPErrDEBUG:OWPErrFATAL,OWPErrPOLICY,
-                "ResReq %s: %s:%s:%s = %" PRIu64
-                " (result = %" PRIu64 ", limit = %" PRIu64")",
-                (ret)?"ALLOWED":"DENIED",
-                node->nodename,
-                (query == OWPDMESGRELEASE)?"release":"request",
-                GetLimName(lim.limit),
-                lim.value,
-                GetUsed(node,lim.limit),
-                GetLimit(node,lim.limit));
-    }
+    I2HashIterate(newpolicy->limits,SwapAdopt,&sarg);
+    I2HashIterate(policy->limits,SwapRemoved,&sarg);
 
-    return ret;
+    if(policy->catalog){
+        for(entry = policy->catalog->head;entry;entry = entry->next){
+            entry->node = OWPDPolicyMapNode(newpolicy,entry->node);
+        }
+        policy->catalog->policy = newpolicy;
+    }
+
+    newpolicy->fd = policy->fd;
+    newpolicy->slot = policy->slot;
+    newpolicy->nodes = policy->nodes;
+    newpolicy->nnodes = policy->nnodes;
+    newpolicy->maxnodes = policy->maxnodes;
+    newpolicy->shm = policy->shm;
+    newpolicy->shmlen = policy->shmlen;
+    newpolicy->ledger = policy->ledger;
+    newpolicy->nslots = policy->nslots;
+    newpolicy->reclaim = policy->reclaim;
+    newpolicy->slotused = policy->slotused;
+    newpolicy->usagefile = policy->usagefile;
+    newpolicy->catalog = policy->catalog;
+    newpolicy->rescan = policy->rescan;
+
+    policy->nodes = NULL;
+    policy->nnodes = policy->maxnodes = 0;
+    policy->shm = NULL;
+    policy->shmlen = 0;
+    policy->ledger = NULL;
+    policy->nslots = 0;
+    policy->reclaim = NULL;
+    policy->slotused = NULL;
+    policy->usagefile = NULL;
+    policy->catalog = NULL;
+
+    OWPError(policy->ctx,OWPErrINFO,OWPErrPOLICY,
+            "Policy reloaded: %lu classes (%lu added, %lu removed)",
+            (unsigned long)I2HashNumEntries(newpolicy->limits),
+            (unsigned long)sarg.nadded,(unsigned long)sarg.nremoved);
+
+    return True;
 }
 
 /*
@@ -1991,6 +3994,40 @@ OWPDReadClass(
     return NULL;
 }
 
+/*
+ * Function:        OWPDPeekClass
+ *
+ * Description:        
+ *         This function is called from the parent perspective.
+ *
+ *         It is used to determine if the next message from a child is
+ *         a new "usage class" message instead of a resource query. Prefork
+ *         workers send one of these at the start of every connection they
+ *         accept. The message is left in the socket for OWPDReadClass.
+ *
+ * In Args:        
+ *
+ * Out Args:        
+ *
+ * Scope:        
+ * Returns:        
+ * Side Effect:        
+ */
+OWPBoolean
+OWPDPeekClass(
+        int         fd
+        )
+{
+    OWPDMesgT   buf[2];
+    ssize_t     rc;
+
+    while(((rc = recv(fd,&buf[0],8,MSG_PEEK|MSG_WAITALL)) < 0) &&
+            (errno == EINTR));
+
+    return ((rc == 8) && (buf[0] == OWPDMESGMARK) &&
+            (buf[1] == OWPDMESGCLASS));
+}
+
 static OWPDMesgT
 OWPDSendClass(
         OWPDPolicy      policy,
@@ -2020,7 +4057,53 @@ OWPDSendClass(
         return OWPDMESGINVALID;
     }
 
-    return OWPDReadResponse(policy->fd);
+    if((mesg = OWPDReadResponse(policy->fd)) == OWPDMESGOK){
+        policy->classnode = node;
+    }
+
+    return mesg;
+}
+
+/*
+ * Function:        OWPDSwitchClass
+ *
+ * Description:        
+ *         This function is called from the child perspective.
+ *
+ *         A child that multiplexes several control connections shares
+ *         one pipe to the parent between them. The parent charges all
+ *         requests/releases to the most recent "usage class" it was
+ *         sent, so this re-sends the class of cntrl if it is not the
+ *         current one. It must be called before doing anything on cntrl
+ *         that could talk to the parent.
+ *
+ * In Args:        
+ *
+ * Out Args:        
+ *
+ * Scope:        
+ * Returns:        
+ *         False if the parent could not be told.
+ * Side Effect:        
+ */
+OWPBoolean
+OWPDSwitchClass(
+        OWPDPolicy      policy,
+        OWPControl      cntrl
+        )
+{
+    OWPDPolicyNode  node;
+
+    /*
+     * Connections that have not been assigned a class yet have not
+     * talked to the parent.
+     */
+    if(!(node = (OWPDPolicyNode)OWPControlConfigGetV(cntrl,
+                    OWPDPOLICY_NODE)) || (node == policy->classnode)){
+        return True;
+    }
+
+    return (OWPDSendClass(policy,node) == OWPDMESGOK);
 }
 
 /*
@@ -2083,6 +4166,32 @@ OWPDQuery(
     OWPDMesgT   buf[7];
     int         fail_on_intr=1;
 
+    /*
+     * With shared accounting, update the tree directly - charged to the
+     * class the parent would have used. Bandwidth is also kept in this
+     * child's ledger row so the parent can release it if we die.
+     */
+    if((policy->slot >= 0) && policy->classnode){
+        OWPDLimitT  *held;
+
+        if(!OWPDResourceDemand(policy->classnode,mesg,lim)){
+            return OWPDMESGDENIED;
+        }
+
+        if(lim.limit == OWPDLimBandwidth){
+            held = &policy->ledger[(size_t)policy->slot * policy->maxnodes +
+                policy->classnode->index];
+            if(mesg == OWPDMESGRELEASE){
+                *held -= MIN(*held,lim.value);
+            }
+            else{
+                *held += lim.value;
+            }
+        }
+
+        return OWPDMESGOK;
+    }
+
     buf[0] = buf[6] = OWPDMESGMARK;
     buf[1] = OWPDMESGRESOURCE;
     buf[2] = mesg;
@@ -2254,8 +4363,8 @@ OWPDCheckControlPolicy(
 typedef struct OWPDFileInformationRec{
     OWPDPolicyNode  node;   /* node specific to file, not connection */
     FILE            *fp;
+    OWPSID          sid;
     char            filepath[PATH_MAX+1];
-    char            linkpath[PATH_MAX+1];
 } OWPDFileInformationRec, *OWPDFileInformation;
 
 /*
@@ -2307,7 +4416,7 @@ OWPDCheckTestPolicy(
     OWPDPolicyNode  node;
     OWPDInfoTest    tinfo;
     OWPDMesgT       ret;
-    static const OWPDLimRec one_session = {OWPDLimTestSessions,1};
+    uint32_t        nsessions = 0;
 
     *err_ret = OWPErrOK;
 
@@ -2333,9 +4442,10 @@ OWPDCheckTestPolicy(
     tinfo->node = node;
 
     /*
-     * Stored in control session process, so query locally.
+     * Stored with the control connection, so check locally.
      */
-    if(!OWPDResourceDemand(node,OWPDMESGREQUEST,one_session)) {
+    (void)OWPControlConfigGetU32(cntrl,OWPDPOLICY_TSESSIONS,&nsessions);
+    if(!TestSessionsAllowed(node,(OWPDLimitT)nsessions + 1)){
         goto done;
     }
 
@@ -2347,7 +4457,6 @@ OWPDCheckTestPolicy(
             remote_sa_addr->sa_family,OWPGetMode(cntrl),test_spec);
     if((ret = OWPDQuery(node->policy,OWPDMESGREQUEST,tinfo->res[0]))
             == OWPDMESGDENIED){
-        OWPDResourceDemand(node,OWPDMESGRELEASE,one_session);
         goto done;
     }
     if(ret == OWPDMESGINVALID){
@@ -2369,7 +4478,6 @@ OWPDCheckTestPolicy(
 
         if((ret = OWPDQuery(node->policy,OWPDMESGREQUEST,tinfo->res[1]))
                 == OWPDMESGDENIED){
-            OWPDResourceDemand(node,OWPDMESGRELEASE,one_session);
             OWPDQuery(node->policy,OWPDMESGRELEASE,tinfo->res[0]);
             goto done;
         }
@@ -2379,6 +4487,17 @@ OWPDCheckTestPolicy(
         }
     }
 
+    if(!OWPControlConfigSetU32(cntrl,OWPDPOLICY_TSESSIONS,nsessions + 1)){
+        OWPError(ctx,OWPErrFATAL,OWPErrUNKNOWN,
+                "OWPDCheckTestPolicy: Unable to save test session count");
+        *err_ret = OWPErrFATAL;
+        OWPDQuery(node->policy,OWPDMESGRELEASE,tinfo->res[0]);
+        if(!local_sender){
+            OWPDQuery(node->policy,OWPDMESGRELEASE,tinfo->res[1]);
+        }
+        goto done;
+    }
+
     *closure = tinfo;
     return True;
 done:
@@ -2505,7 +4624,7 @@ OWPDOpenFile(
     OWPDInfoFetch       xinfo;
     OWPDFileInformation finfo;
     OWPDPolicyNode      node;
-    char                sid_name[sizeof(OWPSID)*2+1];
+    OWPDCatEntry        entry = NULL;
 
     if(!rinfo || (rinfo->itype == OWPDINFO_INVALID)){
         OWPError(ctx,OWPErrFATAL,OWPErrINVALID,
@@ -2513,59 +4632,32 @@ OWPDOpenFile(
         return NULL;
     }
 
-    /*
-     * Hex Encode the sid.
-     */
-    I2HexEncode(sid_name,sid,sizeof(OWPSID));
-
     if(!(finfo = (calloc(1,sizeof(*finfo))))){
         OWPError(ctx,OWPErrFATAL,errno,"calloc(OWPDFileInformation): %M");
         return NULL;
     }
+    memcpy(finfo->sid,sid,sizeof(OWPSID));
 
     if(rinfo->itype == OWPDINFO_TEST){
         tinfo = &rinfo->test;
 
         node = tinfo->node;
-
-        /*
-         * Now place pathname to catalog dir in finfo->linkpath.
-         */
-        strcpy(finfo->linkpath,node->policy->datadir);
-        strcat(finfo->linkpath,OWP_PATH_SEPARATOR);
-        strcat(finfo->linkpath,OWP_CATALOG_DIR);
-
         finfo->node = tinfo->node;
 
         /*
-         * Make sure the node directory exists first.
-         * (setting add_chars to the length of the filename part
-         * that needs to be concatenated on after the directory.
-         * This does not include the nul byte.)
+         * Make sure the node directory exists first, and build the
+         * filename.
          */
-        if(!node_dir(ctx,True,node->policy->datadir,node,
-                    OWP_PATH_SEPARATOR_LEN + (sizeof(OWPSID)*2) +
-                    strlen(OWP_FILE_EXT),finfo->filepath)){
+        if(!session_path(ctx,True,node,sid,finfo->filepath)){
             return NULL;
         }
 
-        strcat(finfo->filepath,OWP_PATH_SEPARATOR);
-        strcat(finfo->filepath,sid_name);
-        strcat(finfo->filepath,OWP_FILE_EXT);
-
         /*
-         * we know top-level datadir exists from last call to
-         * node_dir, now make sure "catalog" directory exists.
+         * Journal the file before creating it, so a file left behind
+         * by a crash is noticed at the next startup. (The size is
+         * journaled by OWPDCloseFile.)
          */
-        if((mkdir(finfo->linkpath,0755) != 0) && (errno != EEXIST)){
-            OWPError(ctx,OWPErrFATAL,OWPErrUNKNOWN,"Unable to mkdir(%s): %M",
-                    finfo->linkpath);
-            return NULL;
-        }
-
-        strcat(finfo->linkpath,OWP_PATH_SEPARATOR);
-        strcat(finfo->linkpath,sid_name);
-        strcat(finfo->linkpath,OWP_FILE_EXT);
+        UsageRecord(node,finfo->filepath,True,0,1);
 
         /*
          * Now open the file.
@@ -2577,12 +4669,12 @@ OWPDOpenFile(
         }
 
         /*
-         * Create the symlink first.
+         * Add it to the catalog.
          * This is how fetchsession will find the file.
          */
-        if(symlink(finfo->filepath,finfo->linkpath) != 0){
-            OWPError(ctx,OWPErrFATAL,errno,"symlink(%s,%s): %M",
-                    finfo->filepath,finfo->linkpath);
+        if(!(entry = OWPDCatalogInsert(node->policy->catalog,sid,node,
+                        OWPDCatOpen,0,time(NULL),0)) ||
+                !OWPDCatalogAppend(node->policy->catalog,entry)){
             goto error;
         }
 
@@ -2596,124 +4688,42 @@ OWPDOpenFile(
         tinfo->finfo = finfo;
     }
     else if(rinfo->itype == OWPDINFO_FETCH){
-        int     len1,len2;
-        char    tc;
-        char    *dname;
-        I2Datum key,val;
-
         xinfo = &rinfo->fetch;
 
         node = xinfo->node;
 
         /*
-         * Now place pathname to catalog dir in finfo->linkpath.
+         * Find the file in the catalog. Policy for this file
+         * (delete_on_fetch) is determined by the "user class" that
+         * created the file, not the "user class" of the current
+         * fetch session.
          */
-        strcpy(finfo->linkpath,node->policy->datadir);
-        strcat(finfo->linkpath,OWP_PATH_SEPARATOR);
-        strcat(finfo->linkpath,OWP_CATALOG_DIR);
-        strcat(finfo->linkpath,OWP_PATH_SEPARATOR);
-        strcat(finfo->linkpath,sid_name);
-        strcat(finfo->linkpath,OWP_FILE_EXT);
-        finfo->filepath[0] = '\0';
+        if(!(entry = OWPDCatalogFind(node->policy->catalog,sid)) ||
+                (entry->state == OWPDCatDeleted)){
+            char    sid_name[sizeof(OWPSID)*2+1];
 
-        /*
-         * Determine the "real" filename so it
-         * can be used to find the "policy" node for this file.
-         * Policy for this file (delete_on_fetch) is determined by
-         * the "user class" that created the file, not the
-         * "user class" of the current fetch session.
-         */
-
-        /*
-         * set len1 to length of path "after" last node.
-         */
-        len1 = OWP_PATH_SEPARATOR_LEN + sizeof(OWPSID)*2 +
-            strlen(OWP_FILE_EXT);
-
-        /*
-         * len2 becomes length of the full filepath
-         */
-        if((len2 = readlink(finfo->linkpath,finfo->filepath,
-                        PATH_MAX)) < 1){
-            OWPError(ctx,OWPErrFATAL,errno,
-                    "readlink(%s): %M",finfo->linkpath);
-            goto error;
-        }
-        /*
-         * If the filepath is longer than PATH_MAX or shorter than
-         * len1 - it can't be valid.
-         */
-        if(((size_t)len2 >= sizeof(finfo->filepath)) || (len2 < len1)){
+            I2HexEncode(sid_name,sid,sizeof(OWPSID));
             OWPError(ctx,OWPErrFATAL,OWPErrINVALID,
-                    "readlink(%s): Invalid link",
-                    finfo->linkpath);
+                    "OWPDOpenFile: Unknown session %s",sid_name);
             goto error;
         }
+        finfo->node = entry->node;
+        entry = NULL;
 
-        /*
-         * terminate full filepath
-         */
-        finfo->filepath[len2] = '\0';
-
-        /*
-         * temporarily terminate filepath just after last nodename
-         * to fetch dirname component. (Not using libgen "dirname"
-         * because libgen doesn't look to exist everywhere...)
-         *
-         * strrchr/rindex would probably be nicer than what I'm doing
-         * here...
-         */
-        tc = finfo->filepath[len2-len1];
-        finfo->filepath[len2-len1] = '\0';
-        dname = &finfo->filepath[len2-len1] - 1;
-        while(dname > finfo->filepath){
-            if(!strncmp(dname,OWP_PATH_SEPARATOR,
-                        OWP_PATH_SEPARATOR_LEN)){
-                dname += OWP_PATH_SEPARATOR_LEN;
-                break;
-            }
-            dname--;
-        }
-        if(dname <= finfo->filepath){
-            OWPError(node->policy->ctx,OWPErrFATAL,OWPErrPOLICY,
-                    "Unable to determine policy for %s",
-                    finfo->linkpath);
+        if(!session_path(ctx,False,finfo->node,sid,finfo->filepath)){
             goto error;
         }
 
-        /*
-         * Now that we have a dirname - try fetching the policy
-         * node for it.
-         */
-        key.dptr = dname;
-        key.dsize = &finfo->filepath[len2-len1] - dname;
-        if(!I2HashFetch(node->policy->limits,key,&val)){
-            OWPError(node->policy->ctx,OWPErrFATAL,OWPErrPOLICY,
-                    "Unable to determine policy for %s: class %s",
-                    finfo->linkpath,dname);
-        }
-
-        /*
-         * assign the node.
-         */
-        finfo->node = val.dptr;
-
-        /*
-         * reset the char pulled from the filepath to terminate
-         * the nodename.
-         */
-        finfo->filepath[len2-len1] = tc;
-
         /*
          * Now open the file.
          */
-        if(!(finfo->fp = fopen(finfo->linkpath,"rb"))){
+        if(!(finfo->fp = fopen(finfo->filepath,"rb"))){
             OWPError(ctx,OWPErrFATAL,errno,"fopen(%s,\"rb\"): %M",
-                    finfo->linkpath);
+                    finfo->filepath);
             goto error;
         }
         if(fname_ret){
-            strcpy(fname_ret,finfo->linkpath);
+            strcpy(fname_ret,finfo->filepath);
         }
 
         xinfo->finfo = finfo;
@@ -2728,8 +4738,12 @@ OWPDOpenFile(
 
 error:
     if(tinfo){
-        (void)unlink(finfo->linkpath);
         (void)unlink(finfo->filepath);
+        UsageRecord(finfo->node,finfo->filepath,True,0,-1);
+        if(entry){
+            entry->state = OWPDCatDeleted;
+            (void)OWPDCatalogAppend(finfo->node->policy->catalog,entry);
+        }
     }
 
     if(finfo->fp){
@@ -2774,6 +4788,9 @@ OWPDCloseFile(
     struct stat         sbuf;
     OWPDMesgT           mesg,ret;
     OWPDLimRec          lim;
+    off_t               jbytes = -1;    /* size to journal */
+    OWPBoolean          removed = False;
+    OWPDCatEntry        entry;
 
     if(!rinfo || (rinfo->itype == OWPDINFO_INVALID)){
         OWPError(ctx,OWPErrFATAL,OWPErrINVALID,
@@ -2814,10 +4831,11 @@ OWPDCloseFile(
              */
 
             /*
-             * Unlink the files
+             * Unlink the file
              */
-            (void)unlink(finfo->linkpath);
             (void)unlink(finfo->filepath);
+            removed = True;
+            jbytes = 0;
 
             assert(tinfo->res[1].limit == OWPDLimDisk);
             mesg = OWPDMESGRELEASE;
@@ -2826,7 +4844,7 @@ OWPDCloseFile(
         /*
          * Can we release some diskspace from the resource broker?
          */
-        else if(sbuf.st_size < (off_t)tinfo->res[1].value){
+        else if((jbytes = sbuf.st_size) < (off_t)tinfo->res[1].value){
             mesg = OWPDMESGRELEASE;
             lim.value = tinfo->res[1].value - sbuf.st_size;
         }
@@ -2855,8 +4873,9 @@ OWPDCloseFile(
             OWPError(ctx,OWPErrWARNING,OWPErrPOLICY,
                     "%s Too large! Deleting... (See diskfudge)",
                     finfo->filepath);
-            (void)unlink(finfo->linkpath);
             (void)unlink(finfo->filepath);
+            removed = True;
+            jbytes = 0;
             /*
              * Completely free the resource then.
              */
@@ -2890,13 +4909,28 @@ OWPDCloseFile(
                 OWPError(ctx,OWPErrFATAL,errno,
                         "OWPDCloseFile: fstat(): %M: Unable to determine filesize...");
                 sbuf.st_size = 0;
+                UsageInvalidate(finfo->node->policy);
+            }
+            else{
+                jbytes = sbuf.st_size;
             }
 
             /*
-             * Unlink the files
+             * Unlink the file. (If the reaper got to it first, it has
+             * already released the space.)
              */
-            (void)unlink(finfo->linkpath);
-            (void)unlink(finfo->filepath);
+            if(unlink(finfo->filepath) != 0){
+                jbytes = -1;
+                sbuf.st_size = 0;
+            }
+            if(jbytes >= 0){
+                UsageRecord(finfo->node,finfo->filepath,True,-jbytes,0);
+            }
+            if((entry = OWPDCatalogFind(finfo->node->policy->catalog,
+                            finfo->sid))){
+                entry->state = OWPDCatDeleted;
+                (void)OWPDCatalogAppend(finfo->node->policy->catalog,entry);
+            }
 
             /*
              * If we were able to stat - then free the resources.
@@ -2908,11 +4942,45 @@ OWPDCloseFile(
                                 OWPDMESGRELEASE,lim);
             }
         }
+        /*
+         * Otherwise, note that the complete session has been fetched.
+         */
+        else if((xinfo->begin == 0) && (xinfo->end == 0xFFFFFFFF) &&
+                (aval == OWP_CNTRL_ACCEPT) &&
+                (entry = OWPDCatalogFind(finfo->node->policy->catalog,
+                                         finfo->sid)) &&
+                (entry->state == OWPDCatFinished)){
+            entry->state = OWPDCatFetched;
+            (void)OWPDCatalogAppend(finfo->node->policy->catalog,entry);
+        }
     }
 end:
     if(tinfo){
         tinfo->res[1].limit = 0;
         tinfo->res[1].value = 0;
+
+        /*
+         * Journal what is left of the file. (If its size is unknown,
+         * have the next startup find out.)
+         */
+        if(finfo && (jbytes < 0)){
+            UsageInvalidate(finfo->node->policy);
+        }
+        else if(finfo){
+            UsageRecord(finfo->node,finfo->filepath,True,jbytes,-1);
+        }
+
+        /*
+         * The session is complete (or gone) as far as the catalog is
+         * concerned.
+         */
+        if(finfo && (entry = OWPDCatalogFind(finfo->node->policy->catalog,
+                        finfo->sid))){
+            entry->state = (removed)? OWPDCatDeleted: OWPDCatFinished;
+            entry->size = (jbytes > 0)? jbytes: 0;
+            entry->end = time(NULL);
+            (void)OWPDCatalogAppend(finfo->node->policy->catalog,entry);
+        }
     }
     if(finfo){
         free(finfo);
@@ -27,6 +27,8 @@
 #include <I2util/util.h>
 #include <owamp/owamp.h>
 
+#include "lpm.h"
+
 #ifndef OWP_PFS_FILE
 #define OWP_PFS_FILE    "owamp-server.pfs"
 #endif
@@ -38,15 +40,21 @@
 /*
  * Defines for path elements of the server datastore:
  *         datadir/
- *                 catalog/
- *                         (symlinks named by SID pointing to real files
- *                         in datadir/nodes.)
+ *                 catalog.log
+ *                         (session catalog - see catalog.h - mapping
+ *                         each SID to the real file in datadir/nodes.)
  *                 nodes/
  *                         (dir hier based on user classification hier.)
  *                         This allows filesystem based limits to be used
  *                         by mounting a particular filesystem into this
  *                         hierarchy.
+ *
+ * OWP_CATALOG_DIR is the directory of SID symlinks older versions used
+ * as the catalog. It is removed when the catalog is rebuilt.
  */
+#ifndef OWP_CATALOG_FILE
+#define OWP_CATALOG_FILE    "catalog.log"
+#endif
 #ifndef OWP_CATALOG_DIR
 #define OWP_CATALOG_DIR "catalog"
 #endif
@@ -54,6 +62,17 @@
 #define OWP_HIER_DIR    "hierarchy"
 #endif
 
+/*
+ * Disk usage journal, kept in datadir/. Holds a snapshot of the bytes
+ * in each node directory written at startup, followed by a record
+ * appended for every file created, sized or deleted. If it still
+ * matches the directories at the next startup, it is used instead of
+ * walking the hierarchy.
+ */
+#ifndef OWP_USAGE_FILE
+#define OWP_USAGE_FILE  "usage.journal"
+#endif
+
 /*
  * Holds the policy record that was parsed and contains all the "limits"
  * and identity information.
@@ -72,6 +91,23 @@
  */
 #define OWPDPOLICY_NODE "OWPDPOLICY_NODE"
 
+/*
+ * Holds the number of test sessions requested on the given control
+ * connection. (Checked against the test_sessions limit.)
+ *
+ * type: uint32_t
+ * location: Control Config
+ */
+#define OWPDPOLICY_TSESSIONS "OWPDPOLICY_TSESSIONS"
+
+/*
+ * How long (seconds) a child doing its own resource accounting holds a
+ * disk request for a full class while the reaper frees room for it, and
+ * how often (milliseconds) it looks again in the meantime.
+ */
+#define OWPD_RECLAIM_WAIT       5
+#define OWPD_RECLAIM_STEP       200
+
 /*
  * Types used by policy functions
  */
@@ -80,6 +116,10 @@
 typedef struct OWPDPolicyRec OWPDPolicyRec, *OWPDPolicy;
 typedef struct OWPDPolicyNodeRec OWPDPolicyNodeRec, *OWPDPolicyNode;
 typedef struct OWPDPolicyKeyRec OWPDPolicyKeyRec, *OWPDPolicyKey;
+typedef struct OWPDCatalogRec OWPDCatalogRec, *OWPDCatalog;
+
+typedef I2numT      OWPDLimitT;                /* values */
+typedef uint32_t    OWPDMesgT;
 
 struct OWPDPolicyRec{
     OWPContext      ctx;
@@ -87,7 +127,31 @@ struct OWPDPolicyRec{
     double          diskfudge;
 
     int             fd;        /* socket to parent. */
+    OWPDPolicyNode  classnode; /* class last sent to parent */
+
+    /*
+     * Shared resource accounting (OWPDPolicyShare): the "used" arrays of
+     * all nodes live in one shared mapping, followed by the bandwidth
+     * ledger - nslots rows of maxnodes counters - and one row of disk
+     * reclaim requests for the reaper. Indices past nnodes are
+     * left for classes added by a reload. (A class removed by a reload
+     * leaves a NULL entry - its index is not reused.)
+     */
+    OWPDPolicyNode  *nodes;     /* by node->index */
+    size_t          nnodes;     /* indices handed out */
+    size_t          maxnodes;
+    void            *shm;
+    size_t          shmlen;
+    OWPDLimitT      *ledger;
+    uint32_t        nslots;
+    OWPDLimitT      *reclaim;   /* by index: bytes for the reaper to free */
+    uint8_t         *slotused;  /* parent only */
+    int             slot;       /* child's ledger row, -1 if none */
     char            *datadir;
+    char            *usagefile;
+    OWPDCatalog     catalog;
+    OWPBoolean      rescan;     /* disk usage came from the journal */
+    OWPBoolean      reap;       /* retention or disk_high configured */
 
     OWPDPolicyNode  root;
 
@@ -103,6 +167,11 @@ struct OWPDPolicyRec{
      */
     I2Table         idents;
 
+    /* nets:
+     *         "assign net" lines by prefix (val = OWPDPolicyNode)
+     */
+    OWPDLpm         nets;
+
     /* pfs:
      *         key = OWPUserID (uint8_t[80])    (username from owamp protocol)
      *         val = uint8_t *
@@ -111,9 +180,6 @@ struct OWPDPolicyRec{
 
 };
 
-typedef I2numT      OWPDLimitT;                /* values */
-typedef uint32_t    OWPDMesgT;
-
 typedef struct OWPDLimRec{
     OWPDMesgT   limit;
     OWPDLimitT  value;
@@ -125,6 +191,9 @@ typedef struct OWPDLimRec{
 /* delete_on_fetch  on/(off)        */
 /* allow_open_mode  (on)/off        */
 /* test_sessions    uint            */
+/* retention        uint (seconds)  */
+/* disk_high        uint (% disk)   */
+/* disk_low         uint (% disk)   */
 
 #define OWPDLimParent           0
 #define OWPDLimBandwidth        1
@@ -132,6 +201,9 @@ typedef struct OWPDLimRec{
 #define OWPDLimDeleteOnFetch    4
 #define OWPDLimAllowOpenMode    5
 #define OWPDLimTestSessions     6
+#define OWPDLimRetention        7
+#define OWPDLimDiskHigh         8
+#define OWPDLimDiskLow          9
 
 struct OWPDPolicyNodeRec{
     OWPDPolicy      policy;
@@ -139,8 +211,21 @@ struct OWPDPolicyNodeRec{
     OWPDPolicyNode  parent;
     size_t          ilim;
     OWPDLimRec      *limits;
-    OWPDLimRec      *used;
+    OWPDLimRec      *used;      /* one per limit type */
+    uint32_t        seeded;     /* used counters started by a reload */
     off_t           initdisk;
+    size_t          index;      /* in policy->nodes */
+
+    /*
+     * Disk usage of files directly in this node's directory: as found
+     * by walking it (and the directory mtime seen), and as recorded in
+     * the usage journal.
+     */
+    off_t           owndisk;
+    time_t          scanmtime;
+    off_t           jdisk;
+    long            jopens;
+    time_t          jmtime;
 };
 
 typedef enum{
@@ -216,6 +301,10 @@ typedef union OWPDPidUnion{
  *        00|                      OWPDMESGMARK                             |
  *          +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
  *
+ * A prefork worker serves many connections over the same pipe. It sends
+ * this message again at the start of each connection, and all later
+ * requests/releases are relative to the most recent "usage class".
+ *
  * There is one other child message format. This message is used to either
  * request or release resources. (The parent should release all "temporary"
  * resources (i.e. bandwidth) on exit of the child if the child does not
@@ -266,6 +355,15 @@ OWPDReadClass(
         int         *err
         );
 
+/*
+ * returns True if the next message waiting on fd is a "usage class"
+ * message. (Does not consume it.)
+ */
+extern OWPBoolean
+OWPDPeekClass(
+        int         fd
+        );
+
 /*
  * returns True on success - query/lim_ret will contain request
  * err will be non-zero on error. 0 on empty read.
@@ -295,6 +393,16 @@ OWPDResourceDemand(
         OWPDMesgT       query,
         OWPDLimRec      lim
         );
+/*
+ * Used by a child that serves several control connections over the same
+ * pipe to make the parent charge resources to the class of cntrl.
+ */
+extern OWPBoolean
+OWPDSwitchClass(
+        OWPDPolicy      policy,
+        OWPControl      cntrl
+        );
+
 /*
  * Functions called directly from owampd regarding "policy" decisions
  * (If false, check err_ret to determine if it is an "error" condition,
@@ -393,4 +501,69 @@ OWPDPolicyPostInstall(
         OWPDPolicy  policy
         );
 
+/*
+ * Reload of the policy files by the parent: OWPDPolicyLoad parses them
+ * into a new tree, OWPDPolicySwap moves the live resource accounting of
+ * policy onto it and installs it. policy is then only good for mapping
+ * old nodes (OWPDPolicyMapNode) before it is free'd.
+ */
+extern OWPDPolicy
+OWPDPolicyLoad(
+        OWPDPolicy  policy,
+        char        *confdir,
+        char        **lbuf,
+        size_t      *lbuf_max
+        );
+
+extern OWPDPolicyNode
+OWPDPolicyMapNode(
+        OWPDPolicy      policy,
+        OWPDPolicyNode  node
+        );
+
+extern OWPBoolean
+OWPDPolicySwap(
+        OWPDPolicy  policy,
+        OWPDPolicy  newpolicy
+        );
+
+extern void
+OWPDPolicyFree(
+        OWPDPolicy  policy
+        );
+
+extern OWPBoolean
+OWPDDiskRescan(
+        OWPDPolicy  policy
+        );
+
+extern OWPBoolean
+OWPDDiskReap(
+        OWPDPolicy  policy,
+        OWPDLimitT  rate
+        );
+
+extern OWPBoolean
+OWPDDiskReclaim(
+        OWPDPolicy  policy,
+        OWPDLimitT  rate
+        );
+
+extern OWPBoolean
+OWPDPolicyShare(
+        OWPDPolicy  policy,
+        uint32_t    nslots
+        );
+
+extern int
+OWPDSlotAlloc(
+        OWPDPolicy  policy
+        );
+
+extern void
+OWPDSlotFree(
+        OWPDPolicy  policy,
+        int         slot
+        );
+
 #endif        /*        _OWP_DEFAULTS_H        */
@@ -94,10 +94,11 @@ print_output_args(
         void
         )
 {
-    fprintf(stderr, "%s\n\n%s\n%s\n%s\n%s\n%s\n%s\n%s\n%s\n",
+    fprintf(stderr, "%s\n\n%s\n%s\n%s\n%s\n%s\n%s\n%s\n%s\n%s\n",
             "              [Output Args]",
             "   -a alpha       report an additional percentile level for the delays",
             "   -b bucketwidth bin size for histogram calculations",
+            "   -C             print CSV data: \"seq_no,sent,recv,delay,err,sync,ttl\\n\"",
             "   -M             print machine (perl) readable summary",
             "   -n units       \'n\',\'u\',\'m\', or \'s\'",
             "   -N count       number of test packets (to summarize per sub-session)\n"
@@ -144,6 +145,14 @@ usage(
         fprintf(stderr,"\n%s\n",
                 "   -h             print this message and exit"
                );
+        fprintf(stderr,"%s\n%s\n",
+                "   -o file        write a copy of sessionfile in the -O version and exit",
+                "   -O version     file version for -o (3 or 4 [compact], default 4)"
+               );
+        fprintf(stderr,"%s\n%s\n",
+                "   -r begin:[end] summarize the packets sent from begin to end seconds",
+                "                  after the session start time (estimated from the index)"
+               );
 
         fprintf(stderr, "\n");
         print_output_args();
@@ -217,25 +226,113 @@ FailSession(
  * RS       recv synchronized   boolean unsigned
  * RERR     recv err estimate   float (%g)
  * TTL      ttl                 unsigned short
+ *
+ * (These are formatted by OWPRecFormatter - OWPRecFmtRaw, or OWPRecFmtCSV
+ * if -C was specified.)
+ */
+
+/*
+ * Open the file the summary of a sample range is printed to. This is a
+ * temporary name in dirpath if -d was specified (see print_sumfile),
+ * stdout otherwise.
+ */
+static FILE *
+open_sumfile(
+        OWPNum64    start_time,
+        char        *tfname
+        )
+{
+    char    startname[PATH_MAX];
+    FILE    *tfp;
+
+    if(!ping_ctx.opt.printfiles){
+        return stdout;
+    }
+
+    strcpy(tfname,dirpath);
+    sprintf(startname,OWP_TSTAMPFMT,start_time);
+    sprintf(&tfname[file_oset],"%s%s",startname,_OWPING_INC_EXT);
+    if( !(tfp = fopen(tfname,"w"))){
+        I2ErrLog(eh,"OWStatsParse: fopen(%s): %M",tfname);
+        return NULL;
+    }
+
+    return tfp;
+}
+
+/*
+ * Print the summary of the parsed stats to tfp, and if -d was specified
+ * close tfp and link it to its final name.
  */
-#define RAWFMT "%lu " OWP_TSTAMPFMT " %u %g " OWP_TSTAMPFMT " %u %g %u\n"
 static int
-printraw(
-        OWPDataRec    *rec,
-        void        *udata
+print_sumfile(
+        OWPStats    stats,
+        FILE        *tfp,
+        char        *tfname
         )
 {
-    FILE        *out = (FILE*)udata;
-
-    fprintf(out,RAWFMT,(unsigned long)rec->seq_no,
-            rec->send.owptime,rec->send.sync,
-            OWPGetTimeStampError(&rec->send),
-            rec->recv.owptime,rec->recv.sync,
-            OWPGetTimeStampError(&rec->recv),
-            rec->ttl);
+    char    sfname[PATH_MAX];
+    char    startname[PATH_MAX];
+    char    endname[PATH_MAX];
+    char    *ext;
+
+    /*
+     * Print out summary info
+     */
+    if(ping_ctx.opt.machine){
+        OWPStatsPrintMachine(stats,tfp);
+        ext = _OWPING_SUM_EXT;
+    }
+    else{
+        OWPStatsPrintSummary(stats,tfp,
+                ping_ctx.opt.percentiles,
+                ping_ctx.opt.npercentiles);
+        ext = _OWPING_DEF_EXT;
+    }
+
+    sprintf(startname,OWP_TSTAMPFMT,stats->start_time);
+    sprintf(endname,OWP_TSTAMPFMT,stats->end_time);
+
+    /*
+     * relink output file to correct name
+     */
+    if(ping_ctx.opt.printfiles){
+        fclose(tfp);
+        strcpy(sfname,dirpath);
+        sprintf(&sfname[file_oset],"%s%s%s%s",
+                startname,OWP_NAME_SEP,endname,ext);
+
+        if(link(tfname,sfname) != 0){
+            I2ErrLog(eh,"OWStatsParse: link(%s,%s): %M",tfname,sfname);
+            unlink(tfname);
+            return -1;
+        }
+        unlink(tfname);
+        fprintf(stdout,"%s\n",sfname);
+        fflush(stdout);
+    }
+
     return 0;
 }
 
+/*
+ * Apply the command line options that are set directly in the stats
+ * object.
+ */
+static void
+set_stats_options(
+        OWPStats    stats
+        )
+{
+    /* Set the limits here */
+    if (ping_ctx.opt.rec_limit > 0)
+      stats->rec_limit = ping_ctx.opt.rec_limit;
+
+    /* Set the timestamp flag here */
+    if (ping_ctx.opt.display_unix_ts == True)
+      stats->display_unix_ts = True;
+}
+
 /*
  * Does statistical output parsing.
  */
@@ -253,11 +350,8 @@ do_stats(
     uint32_t            num_sum;
     uint32_t            sum;
     char                tfname[PATH_MAX];
-    char                sfname[PATH_MAX];
-    char                startname[PATH_MAX];
-    char                endname[PATH_MAX];
     FILE                *tfp;
-    char                *ext;
+    OWPRecFormatter     formatter;
 
     if(!(num_rec = OWPReadDataHeader(ctx,fp,&hdr)) && !hdr.header){
         I2ErrLog(eh, "OWPReadDataHeader: Invalid file?");
@@ -268,9 +362,20 @@ do_stats(
      * If raw data is requested, no summary information is needed.
      */
     if(ping_ctx.opt.raw){
-        if(OWPParseRecords(ctx,fp,num_rec,hdr.version,printraw,stdout)
-                < OWPErrWARNING){
+        if( !(formatter = OWPRecFormatterCreate(ctx,stdout,
+                        (ping_ctx.opt.csv)?OWPRecFmtCSV:OWPRecFmtRaw,
+                        ping_ctx.opt.units))){
+            I2ErrLog(eh,"OWPRecFormatterCreate: failed");
+            return -1;
+        }
+        if(OWPParseRecords(ctx,fp,num_rec,hdr.version,OWPRecFormatterParse,
+                    formatter) < OWPErrWARNING){
             I2ErrLog(eh,"OWPParseRecords(): %M");
+            (void)OWPRecFormatterFree(formatter);
+            return -1;
+        }
+        if( !OWPRecFormatterFree(formatter)){
+            I2ErrLog(eh,"OWPRecFormatterFree(): %M");
             return -1;
         }
         return 0;
@@ -284,14 +389,7 @@ do_stats(
         I2ErrLog(eh,"OWPStatsCreate: failed");
         return -1;
     }
-
-    /* Set the limits here */
-    if (ping_ctx.opt.rec_limit > 0)
-      stats->rec_limit = ping_ctx.opt.rec_limit;
-
-    /* Set the timestamp flag here */
-    if (ping_ctx.opt.display_unix_ts == True)
-      stats->display_unix_ts = True;
+    set_stats_options(stats);
 
     /*
      * How many summaries?
@@ -314,17 +412,8 @@ do_stats(
         /*
          * Create temporary sum-session file.
          */
-        if(ping_ctx.opt.printfiles){
-            strcpy(tfname,dirpath);
-            sprintf(startname,OWP_TSTAMPFMT,hdr.test_spec.start_time);
-            sprintf(&tfname[file_oset],"%s%s",startname,_OWPING_INC_EXT);
-            if( !(tfp = fopen(tfname,"w"))){
-                I2ErrLog(eh,"OWStatsParse: fopen(%s): %M",tfname);
-                return -1;
-            }
-        }
-        else{
-            tfp = stdout;
+        if( !(tfp = open_sumfile(hdr.test_spec.start_time,tfname))){
+            return -1;
         }
 
         if( !OWPStatsParse(stats,(ping_ctx.opt.records?tfp:NULL),0,0,~0)){
@@ -338,41 +427,9 @@ do_stats(
             return -1;
         }
 
-        /*
-         * Print out summary info
-         */
-        if(ping_ctx.opt.machine){
-            OWPStatsPrintMachine(stats,tfp);
-            ext = _OWPING_SUM_EXT;
-        }
-        else{
-            OWPStatsPrintSummary(stats,tfp,
-                    ping_ctx.opt.percentiles,
-                    ping_ctx.opt.npercentiles);
-            ext = _OWPING_DEF_EXT;
-        }
-
-        sprintf(startname,OWP_TSTAMPFMT,stats->start_time);
-        sprintf(endname,OWP_TSTAMPFMT,stats->end_time);
-
-        /*
-         * relink output file to correct name
-         */
-        if(ping_ctx.opt.printfiles){
-            fclose(tfp);
-            strcpy(sfname,dirpath);
-            sprintf(&sfname[file_oset],"%s%s%s%s",
-                    startname,OWP_NAME_SEP,endname,ext);
-
-            if(link(tfname,sfname) != 0){
-                I2ErrLog(eh,"OWStatsParse: link(%s,%s): %M",tfname,sfname);
-                OWPStatsFree(stats);
-                unlink(tfname);
-                return -1;
-            }
-            unlink(tfname);
-            fprintf(stdout,"%s\n",sfname);
-            fflush(stdout);
+        if(print_sumfile(stats,tfp,tfname) != 0){
+            OWPStatsFree(stats);
+            return -1;
         }
     }
     else{
@@ -388,17 +445,8 @@ do_stats(
             /*
              * Create temporary sum-session file.
              */
-            if(ping_ctx.opt.printfiles){
-                strcpy(tfname,dirpath);
-                sprintf(startname,OWP_TSTAMPFMT,hdr.test_spec.start_time);
-                sprintf(&tfname[file_oset],"%s%s",startname,_OWPING_INC_EXT);
-                if( !(tfp = fopen(tfname,"w"))){
-                    I2ErrLog(eh,"OWStatsParse: fopen(%s): %M",tfname);
-                    return -1;
-                }
-            }
-            else{
-                tfp = stdout;
+            if( !(tfp = open_sumfile(hdr.test_spec.start_time,tfname))){
+                return -1;
             }
 
             if( !OWPStatsParse(stats,(ping_ctx.opt.records?tfp:NULL),
@@ -408,50 +456,223 @@ do_stats(
                 return -1;
             }
 
-            /*
-             * Print out summary info
-             */
-            if(ping_ctx.opt.machine){
-                OWPStatsPrintMachine(stats,tfp);
-                ext = _OWPING_SUM_EXT;
-            }
-            else{
-                OWPStatsPrintSummary(stats,tfp,
-                        ping_ctx.opt.percentiles,
-                        ping_ctx.opt.npercentiles);
-                ext = _OWPING_DEF_EXT;
+            if(print_sumfile(stats,tfp,tfname) != 0){
+                OWPStatsFree(stats);
+                return -1;
             }
+        }
+    }
 
-            sprintf(startname,OWP_TSTAMPFMT,stats->start_time);
-            sprintf(endname,OWP_TSTAMPFMT,stats->end_time);
+    OWPStatsFree(stats);
 
-            /*
-             * relink output file to correct name
-             */
-            if(ping_ctx.opt.printfiles){
-                fclose(tfp);
-                strcpy(sfname,dirpath);
-                sprintf(&sfname[file_oset],"%s%s%s%s",
-                        startname,OWP_NAME_SEP,endname,ext);
-
-                if(link(tfname,sfname) != 0){
-                    I2ErrLog(eh,"OWStatsParse: link(%s,%s): %M",tfname,sfname);
-                    OWPStatsFree(stats);
-                    unlink(tfname);
-                    return -1;
-                }
-                unlink(tfname);
-                fprintf(stdout,"%s\n",sfname);
-                fflush(stdout);
+    return 0;
+}
+
+/*
+ * Print the summary of the packets of the session in fp that were sent
+ * in the -r range (owstats). The per-group summaries in the session
+ * index are merged where possible, so only the groups at the edges of
+ * the range are parsed. The delay quantiles are estimated from the
+ * merged histogram, and duplicates are only counted within groups
+ * (see OWPReadDataSummary).
+ */
+static int
+do_range_stats(
+        OWPContext  ctx,
+        FILE        *fp
+        )
+{
+    OWPSessionHeaderRec hdr;
+    OWPStats            stats;
+    OWPDataSummaryRec   sum;
+    OWPNum64            begin,end;
+    double              scale;
+    uint32_t            ui;
+
+    if(!OWPReadDataHeader(ctx,fp,&hdr) && !hdr.header){
+        I2ErrLog(eh, "OWPReadDataHeader: Invalid file?");
+        return -1;
+    }
+
+    if( !(stats = OWPStatsCreate(ctx,fp,&hdr,NULL,NULL,
+                    ping_ctx.opt.units,ping_ctx.opt.bucket_width))){
+        I2ErrLog(eh,"OWPStatsCreate: failed");
+        return -1;
+    }
+
+    begin = OWPNum64Add(hdr.test_spec.start_time,
+            OWPDoubleToNum64(ping_ctx.opt.range_begin));
+    if(ping_ctx.opt.range_end < 0.0){
+        end = ~(OWPNum64)0;
+    }
+    else{
+        end = OWPNum64Add(hdr.test_spec.start_time,
+                OWPDoubleToNum64(ping_ctx.opt.range_end));
+    }
+
+    if( !OWPStatsSummarizeRange(stats,begin,end,&sum)){
+        I2ErrLog(eh,"OWPStatsSummarizeRange: failed");
+        OWPStatsFree(stats);
+        return -1;
+    }
+
+    scale = stats->scale_factor;
+    if(ping_ctx.opt.range_end < 0.0){
+        fprintf(stdout,"\n--- owamp statistics from %g seconds ---\n",
+                ping_ctx.opt.range_begin);
+    }
+    else{
+        fprintf(stdout,"\n--- owamp statistics from %g to %g seconds ---\n",
+                ping_ctx.opt.range_begin,ping_ctx.opt.range_end);
+    }
+    /*
+     * nrecs includes the duplicate records.
+     */
+    fprintf(stdout,"%u sent, %u lost (%.3f%%), %u duplicates\n",
+            sum.nrecs - sum.dups,sum.lost,
+            (sum.nrecs > sum.dups)?
+                100.0*sum.lost/(sum.nrecs - sum.dups): 0.0,sum.dups);
+
+    if(sum.nrecs > sum.lost){
+        fprintf(stdout,"one-way delay min/median/max = %.3g/%.3g/%.3g %s "
+                "(median estimated)\n",
+                sum.min_delay * scale,
+                OWPDataSummaryQuantile(&sum,0.5) * scale,
+                sum.max_delay * scale,stats->scale_abrv);
+        if(ping_ctx.opt.npercentiles){
+            fprintf(stdout,"Percentiles (estimated):\n");
+            for(ui=0;ui<ping_ctx.opt.npercentiles;ui++){
+                fprintf(stdout,"\t%.1f: %.3g %s\n",
+                        ping_ctx.opt.percentiles[ui],
+                        OWPDataSummaryQuantile(&sum,
+                            ping_ctx.opt.percentiles[ui]/100.0) * scale,
+                        stats->scale_abrv);
             }
         }
     }
+    else{
+        fprintf(stdout,"one-way delay min/median/max = nan/nan/nan %s\n",
+                stats->scale_abrv);
+    }
 
     OWPStatsFree(stats);
 
     return 0;
 }
 
+/*
+ * State for owp_stream_sid.
+ */
+typedef struct StreamStatsRec{
+    OWPContext  ctx;
+    char        *from;
+    char        *to;
+    OWPStats    stats;
+    FILE        *tfp;
+    char        tfname[PATH_MAX];
+} StreamStatsRec, *StreamStats;
+
+static OWPBoolean
+stream_stats_begin(
+        OWPSessionHeader    hdr,
+        OWPSkip             skips,
+        void                *udata
+        )
+{
+    StreamStats ss = (StreamStats)udata;
+
+    if( !(ss->stats = OWPStatsCreateFromHeader(ss->ctx,hdr,skips,
+                    ss->from,ss->to,
+                    ping_ctx.opt.units,ping_ctx.opt.bucket_width))){
+        I2ErrLog(eh,"OWPStatsCreateFromHeader: failed");
+        return False;
+    }
+    set_stats_options(ss->stats);
+
+    if( !(ss->tfp = open_sumfile(hdr->test_spec.start_time,ss->tfname))){
+        return False;
+    }
+
+    if( !OWPStatsParseBegin(ss->stats,(ping_ctx.opt.records?ss->tfp:NULL),
+                0,~0)){
+        I2ErrLog(eh,"OWPStatsParseBegin: failed");
+        return False;
+    }
+
+    return True;
+}
+
+static OWPBoolean
+stream_stats_records(
+        OWPDataRec  *recs,
+        uint32_t    nrecs,
+        void        *udata
+        )
+{
+    StreamStats ss = (StreamStats)udata;
+
+    return OWPStatsParseRecords(ss->stats,recs,nrecs);
+}
+
+/*
+ * Fetch the session with the given <sid> from the remote server and
+ * summarize it as the records arrive, without writing it to disk. This
+ * is only used for a single summary of the complete session (no -N,
+ * no raw output) when the session data is not saved.
+ */
+static int
+owp_stream_sid(
+        OWPContext  ctx,
+        OWPControl  cntrl,
+        OWPSID      sid,
+        char        *from,
+        char        *to
+        )
+{
+    StreamStatsRec  ss;
+    uint32_t        num_rec;
+    OWPErrSeverity  rc=OWPErrOK;
+    int             ret = -1;
+
+    memset(&ss,0,sizeof(ss));
+    ss.ctx = ctx;
+    ss.from = from;
+    ss.to = to;
+
+    num_rec = OWPFetchSessionStream(cntrl,0,(uint32_t)0xFFFFFFFF,sid,
+            stream_stats_begin,stream_stats_records,&ss,&rc);
+
+    if(!ss.stats){
+        if(rc == OWPErrOK){
+            I2ErrLog(eh,
+                    "owp_stream_sid:Server denied request for to session data - is your clock synchronized via NTP properly?");
+        }
+        goto done;
+    }
+    if(!ss.tfp){
+        goto done;
+    }
+
+    if( !OWPStatsParseEnd(ss.stats) || (rc != OWPErrOK)){
+        I2ErrLog(eh,"OWPStatsParse: failed (%lu records)",
+                (unsigned long)num_rec);
+        if(ping_ctx.opt.printfiles){
+            /* ignore errors */
+            fclose(ss.tfp);
+            unlink(ss.tfname);
+        }
+        goto done;
+    }
+
+    ret = print_sumfile(ss.stats,ss.tfp,ss.tfname);
+
+done:
+    if(ss.stats){
+        OWPStatsFree(ss.stats);
+    }
+
+    return ret;
+}
 
 static FILE *
 tfile(
@@ -1106,7 +1327,8 @@ main(
     char                optstring[128];
     static char         *conn_opts = "64A:k:S:u:";
     static char         *test_opts = "c:D:E:fF:i:L:P:s:tT:z:";
-    static char         *out_opts = "a:b:d:Mn:N:pQRv::U";
+    static char         *out_opts = "a:b:Cd:Mn:N:pQRv::U";
+    static char         *conv_opts = "o:O:r:";
     static char         *gen_opts = "h";
 #ifndef    NDEBUG
     static char         *debug_opts = "w";
@@ -1156,7 +1378,8 @@ main(
     /* Set default options. */
     ping_ctx.opt.v4only = ping_ctx.opt.v6only =
     ping_ctx.opt.records = ping_ctx.opt.from = ping_ctx.opt.to =
-    ping_ctx.opt.quiet = ping_ctx.opt.raw = ping_ctx.opt.machine = False;
+    ping_ctx.opt.quiet = ping_ctx.opt.raw = ping_ctx.opt.machine =
+    ping_ctx.opt.csv = False;
     ping_ctx.opt.childwait = NULL;
     ping_ctx.opt.save_from_test = ping_ctx.opt.save_to_test 
         = ping_ctx.opt.identity = ping_ctx.opt.pffile 
@@ -1170,6 +1393,9 @@ main(
     ping_ctx.opt.units = 'm';
     ping_ctx.opt.numBucketPackets = 0;
     ping_ctx.opt.bucket_width = 0.0001;
+    ping_ctx.opt.convfile = NULL;
+    ping_ctx.opt.convversion = 4;
+    ping_ctx.opt.range = False;
 
     ping_ctx.opt.portspec = &ping_ctx.portrec;
 
@@ -1183,6 +1409,7 @@ main(
         strcat(optstring, out_opts);
     } else if (!strcmp(progname, "owstats")) {
         strcpy(optstring, out_opts);
+        strcat(optstring, conv_opts);
     } else if (!strcmp(progname, "owfetch")) {
         strcpy(optstring, conn_opts);
         strcat(optstring, out_opts);
@@ -1397,6 +1624,9 @@ main(
             case 'R':
                 ping_ctx.opt.raw = True;
                 break;
+            case 'C':
+                ping_ctx.opt.raw = ping_ctx.opt.csv = True;
+                break;
             case 'a':
                 if(!parse_percentile(optarg,&ping_ctx.opt.percentiles,
                             &ping_ctx.opt.npercentiles)){
@@ -1407,6 +1637,43 @@ main(
 	case 'U':
 	  ping_ctx.opt.display_unix_ts = True;
 	  break;
+
+                /* Conversion options (owstats). */
+            case 'o':
+                if (!(ping_ctx.opt.convfile = strdup(optarg))) {
+                    I2ErrLog(eh,"malloc: %M");
+                    exit(1);
+                }
+                break;
+            case 'O':
+                ping_ctx.opt.convversion = strtoul(optarg, &endptr, 10);
+                if ((*endptr != '\0') || ((ping_ctx.opt.convversion != 3) &&
+                            (ping_ctx.opt.convversion != 4))) {
+                    usage(progname,
+                            "Invalid \"-O\" value. 3 or 4 expected");
+                    exit(1);
+                }
+                break;
+            case 'r':
+                ping_ctx.opt.range_begin = strtod(optarg, &endptr);
+                ping_ctx.opt.range_end = -1.0;
+                if((endptr == optarg) || (*endptr++ != ':') ||
+                        (ping_ctx.opt.range_begin < 0.0)){
+                    usage(progname,
+                            "Invalid \"-r\" value. begin:[end] seconds expected");
+                    exit(1);
+                }
+                if(*endptr != '\0'){
+                    ping_ctx.opt.range_end = strtod(endptr, &endptr);
+                    if((*endptr != '\0') || (ping_ctx.opt.range_end <=
+                                ping_ctx.opt.range_begin)){
+                        usage(progname,
+                                "Invalid \"-r\" value. end must be after begin");
+                        exit(1);
+                    }
+                }
+                ping_ctx.opt.range = True;
+                break;
 #ifndef    NDEBUG
             case 'w':
                 ping_ctx.opt.childwait = (void*)True;
@@ -1827,7 +2094,18 @@ main(
             I2AddrFree(laddr);
         }
 
-        if(ping_ctx.opt.to && (ping_ctx.opt.save_to_test ||
+        if(ping_ctx.opt.to && !ping_ctx.opt.save_to_test &&
+                !ping_ctx.opt.quiet && !ping_ctx.opt.raw &&
+                !ping_ctx.opt.numBucketPackets){
+            /*
+             * Nothing needs the session file - summarize the records
+             * as they are fetched.
+             */
+            if( owp_stream_sid(ctx,ping_ctx.cntrl,tosid,local,remote)){
+                I2ErrLog(eh, "do_stats(\"to\" session): %M");
+            }
+        }
+        else if(ping_ctx.opt.to && (ping_ctx.opt.save_to_test ||
                     !ping_ctx.opt.quiet || ping_ctx.opt.raw)){
             FILE    *tofp;
 
@@ -1864,6 +2142,39 @@ main(
     else if (!strcmp(progname, "owstats")) {
         int i;
 
+        /*
+         * Convert a session file instead of reporting on it.
+         */
+        if(ping_ctx.opt.convfile){
+            FILE        *fp;
+            FILE        *cfp;
+
+            if(argc != 1){
+                usage(progname,"-o requires exactly one sessionfile");
+                exit(1);
+            }
+            if(!(fp = fopen(argv[0],"rb"))){
+                I2ErrLog(eh,"fopen(%s): %M",argv[0]);
+                exit(1);
+            }
+            if(!(cfp = fopen(ping_ctx.opt.convfile,"w+b"))){
+                I2ErrLog(eh,"fopen(%s): %M",ping_ctx.opt.convfile);
+                exit(1);
+            }
+            if( !OWPConvertDataFile(ctx,fp,cfp,ping_ctx.opt.convversion)){
+                I2ErrLog(eh,"OWPConvertDataFile(%s): failed",argv[0]);
+                fclose(cfp);
+                (void)unlink(ping_ctx.opt.convfile);
+                exit(1);
+            }
+            if(fclose(cfp) != 0){
+                I2ErrLog(eh,"fclose(%s): %M",ping_ctx.opt.convfile);
+                exit(1);
+            }
+            fclose(fp);
+            exit(0);
+        }
+
         for(i = 0; i < argc; i++) {
             FILE        *fp;
 
@@ -1872,7 +2183,13 @@ main(
                 exit(1);
             }
 
-            if ( do_stats(ctx,fp,NULL,NULL)){
+            if(ping_ctx.opt.range){
+                if(do_range_stats(ctx,fp)){
+                    I2ErrLog(eh,"do_range_stats() failed.");
+                    exit(1);
+                }
+            }
+            else if ( do_stats(ctx,fp,NULL,NULL)){
                 I2ErrLog(eh,"do_stats() failed.");
                 exit(1);
             }
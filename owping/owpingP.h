@@ -54,6 +54,7 @@ typedef    struct {
         unsigned long   rec_limit;          /* -vN */
         I2Boolean       quiet;              /* -Q */
         I2Boolean       raw;                /* -R */
+        I2Boolean       csv;                /* -C */
         I2Boolean       machine;            /* -M */
         I2Boolean       display_unix_ts;    /* -U */
 
@@ -80,6 +81,11 @@ typedef    struct {
 
         char            *savedir;           /* -d */
         I2Boolean       printfiles;         /* -p */
+        char            *convfile;          /* -o (owstats) */
+        uint32_t        convversion;        /* -O (owstats) */
+        I2Boolean       range;              /* -r (owstats) */
+        double          range_begin;
+        double          range_end;          /* < 0: end of session */
         char            *srcaddr;           /* -S */
 
         OWPPortRange    portspec;           /* -P */
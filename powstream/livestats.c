@@ -0,0 +1,747 @@
+/*
+ *      $Id$
+ */
+/************************************************************************
+ *                                                                      *
+ *                             Copyright (C)  2026                      *
+ *                                Internet2                             *
+ *                             All Rights Reserved                      *
+ *                                                                      *
+ ************************************************************************/
+/*
+ *        File:         livestats.c
+ *
+ *        Description:
+ *
+ *        Sliding-window ("live") statistics for powstream.
+ *
+ *        Records are consumed incrementally from the session file as they
+ *        are written (only the records not already seen are read), and
+ *        accounted in one-second slices keyed by send time. Each window
+ *        keeps running totals and a delay histogram that are updated as
+ *        slices enter and expire, so a report never re-parses any data.
+ *
+ *        Windows end at the current time minus a lag (the loss timeout)
+ *        so every packet inside a window has been either received or
+ *        declared lost.
+ */
+#include <owamp/owamp.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "./powstreamP.h"
+
+/*
+ * Delay histogram: delay magnitude in nanoseconds. The first
+ * POW_LIVE_LINEAR values are exact, then each power of 2 is split into
+ * 2^POW_LIVE_SUBBITS buckets (~3% resolution). Negative delays are
+ * mirrored below zero so the bucket index is monotonic in delay.
+ */
+#define POW_LIVE_SUBBITS    5
+#define POW_LIVE_LINEAR     (1 << (POW_LIVE_SUBBITS+1))
+#define POW_LIVE_MAXEXP     44      /* 2^44 ns > 4.8 hours */
+#define POW_LIVE_HALF       (POW_LIVE_LINEAR + \
+        ((POW_LIVE_MAXEXP - POW_LIVE_SUBBITS - 1) << POW_LIVE_SUBBITS))
+#define POW_LIVE_NBUCKETS   (2 * POW_LIVE_HALF)
+
+/*
+ * Growth increment of the slice histograms, and the number of slices
+ * (seconds) kept beyond the lag for records that arrive "early".
+ */
+#define POW_LIVE_SLICEINC   8
+#define POW_LIVE_SLACK      4
+
+/*
+ * Sparse histogram entry of a slice.
+ */
+typedef struct pow_live_bucket_rec{
+    uint32_t    b;
+    uint32_t    n;
+} pow_live_bucket_rec, *pow_live_bucket;
+
+typedef struct pow_live_slice_rec{
+    uint32_t        sec;        /* send time (OWP seconds) of slice */
+    OWPBoolean      used;
+    uint32_t        sent;
+    uint32_t        lost;
+    uint32_t        dups;
+    double          min;
+    double          max;
+    uint32_t        nbuckets;
+    uint32_t        bsize;
+    pow_live_bucket buckets;
+} pow_live_slice_rec, *pow_live_slice;
+
+typedef struct pow_live_window_rec{
+    uint32_t        length;     /* seconds */
+    uint32_t        sent;
+    uint32_t        lost;
+    uint32_t        dups;
+    uint32_t        hist[POW_LIVE_NBUCKETS];
+} pow_live_window_rec, *pow_live_window;
+
+struct pow_live_rec{
+    OWPContext          ctx;
+    char                fname[PATH_MAX];
+    char                tfname[PATH_MAX];
+
+    uint32_t            lag;
+    uint32_t            end;        /* windows end here (exclusive) */
+
+    uint32_t            nwindows;
+    pow_live_window_rec windows[POW_LIVE_MAXWINDOWS];
+
+    uint32_t            nslices;
+    pow_live_slice      slices;
+
+    /*
+     * Feed state for the current session file.
+     */
+    uint32_t            nrecs;      /* records consumed */
+    uint32_t            seenlen;    /* bits in seen */
+    uint8_t             *seen;      /* seq_no's received (dups) */
+};
+
+static uint32_t
+LiveBucket(
+        double  d
+        )
+{
+    uint64_t    m;
+    uint32_t    idx;
+    int         e;
+    OWPBoolean  neg = False;
+
+    if(d < 0.0){
+        neg = True;
+        d = -d;
+    }
+    d *= 1e9;
+    if(d >= (double)(1ULL << POW_LIVE_MAXEXP)){
+        m = (1ULL << POW_LIVE_MAXEXP) - 1;
+    }
+    else{
+        m = (uint64_t)d;
+    }
+
+    if(m < POW_LIVE_LINEAR){
+        idx = (uint32_t)m;
+    }
+    else{
+        for(e=0;(m >> (e+1));e++);
+        idx = POW_LIVE_LINEAR +
+            ((e - POW_LIVE_SUBBITS - 1) << POW_LIVE_SUBBITS) +
+            ((m >> (e - POW_LIVE_SUBBITS)) & ((1 << POW_LIVE_SUBBITS) - 1));
+    }
+
+    return (neg)? (POW_LIVE_HALF - 1 - idx): (POW_LIVE_HALF + idx);
+}
+
+/*
+ * Representative (mid-point) delay of a bucket in seconds.
+ */
+static double
+LiveBucketDelay(
+        uint32_t    b
+        )
+{
+    OWPBoolean  neg = False;
+    uint32_t    idx;
+    int         e;
+    double      d;
+
+    if(b < POW_LIVE_HALF){
+        neg = True;
+        idx = POW_LIVE_HALF - 1 - b;
+    }
+    else{
+        idx = b - POW_LIVE_HALF;
+    }
+
+    if(idx < POW_LIVE_LINEAR){
+        d = idx;
+    }
+    else{
+        idx -= POW_LIVE_LINEAR;
+        e = (idx >> POW_LIVE_SUBBITS) + POW_LIVE_SUBBITS + 1;
+        d = (double)(((1ULL << POW_LIVE_SUBBITS) +
+                    (idx & ((1 << POW_LIVE_SUBBITS) - 1))) <<
+                (e - POW_LIVE_SUBBITS));
+        d += (double)(1ULL << (e - POW_LIVE_SUBBITS)) / 2.0;
+    }
+    d /= 1e9;
+
+    return (neg)? -d: d;
+}
+
+/*
+ * Add (sign == 1) or remove (sign == -1) a slice from a window.
+ */
+static void
+LiveWindowApply(
+        pow_live_window w,
+        pow_live_slice  s,
+        int             sign
+        )
+{
+    uint32_t    i;
+
+    w->sent += sign * s->sent;
+    w->lost += sign * s->lost;
+    w->dups += sign * s->dups;
+    for(i=0;i<s->nbuckets;i++){
+        w->hist[s->buckets[i].b] += sign * s->buckets[i].n;
+    }
+
+    return;
+}
+
+static void
+LiveSliceClear(
+        pow_live_slice  s,
+        uint32_t        sec
+        )
+{
+    s->sec = sec;
+    s->used = True;
+    s->sent = s->lost = s->dups = 0;
+    s->min = s->max = 0.0;
+    s->nbuckets = 0;
+
+    return;
+}
+
+/*
+ * Move the end of the windows forward to newend. Slices enter each
+ * window at its end and expire at its start.
+ */
+static void
+LiveAdvance(
+        pow_live    live,
+        uint32_t    newend
+        )
+{
+    pow_live_window w;
+    pow_live_slice  s;
+    uint32_t        i,sec,from,to;
+
+    if(newend <= live->end)
+        return;
+
+    if(!live->end){
+        live->end = newend;
+        return;
+    }
+
+    for(i=0;i<live->nwindows;i++){
+        w = &live->windows[i];
+
+        /* expire [end - length, min(end,newend - length)) */
+        from = live->end - w->length;
+        to = MIN(newend - w->length,live->end);
+        for(sec=from;sec<to;sec++){
+            s = &live->slices[sec % live->nslices];
+            if(s->used && (s->sec == sec)){
+                LiveWindowApply(w,s,-1);
+            }
+        }
+
+        /* enter [max(end,newend - length), newend) */
+        from = MAX(live->end,newend - w->length);
+        for(sec=from;sec<newend;sec++){
+            s = &live->slices[sec % live->nslices];
+            if(s->used && (s->sec == sec)){
+                LiveWindowApply(w,s,1);
+            }
+        }
+    }
+    live->end = newend;
+
+    return;
+}
+
+static OWPBoolean
+LiveSliceAddDelay(
+        pow_live        live,
+        pow_live_slice  s,
+        uint32_t        b
+        )
+{
+    uint32_t        i;
+    pow_live_bucket nb;
+
+    for(i=0;i<s->nbuckets;i++){
+        if(s->buckets[i].b == b){
+            s->buckets[i].n++;
+            return True;
+        }
+    }
+
+    if(s->nbuckets >= s->bsize){
+        if( !(nb = realloc(s->buckets,
+                        sizeof(*nb) * (s->bsize + POW_LIVE_SLICEINC)))){
+            OWPError(live->ctx,OWPErrFATAL,errno,"realloc(): %M");
+            return False;
+        }
+        s->buckets = nb;
+        s->bsize += POW_LIVE_SLICEINC;
+    }
+    s->buckets[s->nbuckets].b = b;
+    s->buckets[s->nbuckets].n = 1;
+    s->nbuckets++;
+
+    return True;
+}
+
+/*
+ * OWPDoDataRecord function used to consume new records.
+ */
+static int
+LiveParse(
+        OWPDataRec  *rec,
+        void        *udata
+        )
+{
+    pow_live        live = (pow_live)udata;
+    pow_live_slice  s;
+    pow_live_window w;
+    uint32_t        sec,i,b=0;
+    OWPBoolean      lost,dup=False;
+    double          d=0.0;
+
+    sec = (uint32_t)(rec->send.owptime >> 32);
+
+    /*
+     * Make room in the ring for records from the "future" (unsynchronized
+     * clocks).
+     */
+    if(sec >= (live->end + live->nslices - live->windows[0].length)){
+        LiveAdvance(live,
+                sec - (live->nslices - live->windows[0].length) + 1);
+    }
+
+    /*
+     * Too old - already expired from every window.
+     */
+    if(live->end && (sec < (live->end - live->windows[0].length))){
+        return 0;
+    }
+
+    s = &live->slices[sec % live->nslices];
+    if(!s->used || (s->sec != sec)){
+        LiveSliceClear(s,sec);
+    }
+
+    lost = OWPIsLostRecord(rec);
+    if(rec->seq_no < live->seenlen){
+        if(live->seen[rec->seq_no >> 3] & (1 << (rec->seq_no & 7))){
+            dup = True;
+        }
+        else if(!lost){
+            live->seen[rec->seq_no >> 3] |= (1 << (rec->seq_no & 7));
+        }
+    }
+
+    if(dup){
+        s->dups++;
+    }
+    else{
+        s->sent++;
+        if(lost){
+            s->lost++;
+        }
+        else{
+            d = OWPDelay(&rec->send,&rec->recv);
+            b = LiveBucket(d);
+            if(((s->sent - s->lost) == 1) || (d < s->min)){
+                s->min = d;
+            }
+            if(((s->sent - s->lost) == 1) || (d > s->max)){
+                s->max = d;
+            }
+            if(!LiveSliceAddDelay(live,s,b)){
+                return -1;
+            }
+        }
+    }
+
+    /*
+     * Update the windows that currently include this slice.
+     */
+    for(i=0;i<live->nwindows;i++){
+        w = &live->windows[i];
+        if((sec >= live->end) || (sec < (live->end - w->length))){
+            continue;
+        }
+        if(dup){
+            w->dups++;
+            continue;
+        }
+        w->sent++;
+        if(lost){
+            w->lost++;
+        }
+        else{
+            w->hist[b]++;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Function:        PowLiveCreate
+ *
+ * Description:
+ *              Create the live statistics engine. windows is a list of
+ *              window lengths in seconds. The report is written to
+ *              fname. lag is the number of seconds the end of the
+ *              windows trails the current time (the loss timeout).
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+pow_live
+PowLiveCreate(
+        OWPContext  ctx,
+        uint32_t    *windows,
+        uint32_t    nwindows,
+        uint32_t    lag,
+        const char  *fname
+        )
+{
+    pow_live    live;
+    uint32_t    i,j,t;
+
+    if(!nwindows || (nwindows > POW_LIVE_MAXWINDOWS)){
+        OWPError(ctx,OWPErrFATAL,EINVAL,
+                "PowLiveCreate: Invalid number of windows (%u)",nwindows);
+        return NULL;
+    }
+
+    if((strlen(fname) + strlen(POW_INC_EXT)) >= PATH_MAX){
+        OWPError(ctx,OWPErrFATAL,EINVAL,
+                "PowLiveCreate: Invalid report filename");
+        return NULL;
+    }
+
+    if( !(live = calloc(1,sizeof(*live)))){
+        OWPError(ctx,OWPErrFATAL,errno,"calloc(): %M");
+        return NULL;
+    }
+
+    live->ctx = ctx;
+    strcpy(live->fname,fname);
+    strcpy(live->tfname,fname);
+    strcat(live->tfname,POW_INC_EXT);
+    live->lag = lag;
+
+    /*
+     * Sort the windows - largest first.
+     */
+    for(i=0;i<nwindows;i++){
+        if(!windows[i]){
+            OWPError(ctx,OWPErrFATAL,EINVAL,
+                    "PowLiveCreate: Invalid window length (0)");
+            free(live);
+            return NULL;
+        }
+        live->windows[i].length = windows[i];
+    }
+    for(i=0;i<nwindows;i++){
+        for(j=i+1;j<nwindows;j++){
+            if(live->windows[j].length > live->windows[i].length){
+                t = live->windows[i].length;
+                live->windows[i].length = live->windows[j].length;
+                live->windows[j].length = t;
+            }
+        }
+    }
+    live->nwindows = nwindows;
+
+    /*
+     * The ring holds the largest window, and the slices that have not
+     * yet entered the windows.
+     */
+    live->nslices = live->windows[0].length + lag + POW_LIVE_SLACK;
+    if( !(live->slices = calloc(live->nslices,sizeof(pow_live_slice_rec)))){
+        OWPError(ctx,OWPErrFATAL,errno,"calloc(): %M");
+        free(live);
+        return NULL;
+    }
+
+    return live;
+}
+
+void
+PowLiveFree(
+        pow_live    live
+        )
+{
+    uint32_t    i;
+
+    if(!live)
+        return;
+
+    for(i=0;i<live->nslices;i++){
+        if(live->slices[i].buckets){
+            free(live->slices[i].buckets);
+        }
+    }
+    free(live->slices);
+    if(live->seen){
+        free(live->seen);
+    }
+    free(live);
+
+    return;
+}
+
+/*
+ * Function:        PowLiveNewFile
+ *
+ * Description:
+ *              Restart consuming records at the beginning of the session
+ *              file. If newsession is set, the file belongs to a
+ *              new session and duplicate detection is reset as well.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+void
+PowLiveNewFile(
+        pow_live    live,
+        OWPBoolean  newsession
+        )
+{
+    if(!live)
+        return;
+
+    live->nrecs = 0;
+    if(newsession && live->seen){
+        memset(live->seen,0,(live->seenlen + 7) / 8);
+    }
+
+    return;
+}
+
+/*
+ * Function:        PowLiveFeed
+ *
+ * Description:
+ *              Consume the records that have been added to the session
+ *              file fp since the last call.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:     fp is left positioned at the end of the records.
+ */
+OWPBoolean
+PowLiveFeed(
+        pow_live    live,
+        FILE        *fp
+        )
+{
+    OWPSessionHeaderRec hdr;
+    uint32_t            nrecs;
+    uint8_t             *seen;
+
+    if(!live || !fp)
+        return True;
+
+    /*
+     * No header yet - the session has not started writing.
+     */
+    if(!(nrecs = OWPReadDataHeader(live->ctx,fp,&hdr)) || !hdr.header){
+        goto done;
+    }
+
+    if(hdr.test_spec.npackets != live->seenlen){
+        if( !(seen = calloc((hdr.test_spec.npackets + 7) / 8,1))){
+            OWPError(live->ctx,OWPErrFATAL,errno,"calloc(): %M");
+            return False;
+        }
+        if(live->seen){
+            free(live->seen);
+        }
+        live->seen = seen;
+        live->seenlen = hdr.test_spec.npackets;
+    }
+
+    if(nrecs <= live->nrecs){
+        goto done;
+    }
+
+    if(fseeko(fp,hdr.oset_datarecs + (off_t)live->nrecs * hdr.rec_size,
+                SEEK_SET) != 0){
+        OWPError(live->ctx,OWPErrFATAL,errno,"fseeko(): %M");
+        return False;
+    }
+
+    if(OWPParseRecords(live->ctx,fp,nrecs - live->nrecs,hdr.version,
+                LiveParse,live) != OWPErrOK){
+        OWPError(live->ctx,OWPErrWARNING,OWPErrUNKNOWN,
+                "PowLiveFeed: Unable to parse session records");
+        return False;
+    }
+    live->nrecs = nrecs;
+
+done:
+    /*
+     * Clear eof so more records can be read as the file grows.
+     */
+    if(feof(fp)){
+        clearerr(fp);
+    }
+
+    return True;
+}
+
+/*
+ * Percentile of the window histogram. nrecv must be non-zero.
+ */
+static double
+LivePercentile(
+        pow_live_window w,
+        uint32_t        nrecv,
+        double          alpha
+        )
+{
+    uint32_t    i;
+    uint32_t    sum = 0;
+    uint32_t    target;
+
+    target = (uint32_t)(alpha * nrecv);
+    if(target < 1)
+        target = 1;
+
+    for(i=0;i<POW_LIVE_NBUCKETS;i++){
+        sum += w->hist[i];
+        if(sum >= target)
+            break;
+    }
+
+    return LiveBucketDelay(MIN(i,POW_LIVE_NBUCKETS-1));
+}
+
+/*
+ * Function:        PowLiveReport
+ *
+ * Description:
+ *              Move the windows to now (less the lag) and write the
+ *              report file. The file is written under a temporary name
+ *              and renamed into place so readers always see a complete
+ *              report.
+ *
+ *              Delays are in seconds. MEDIAN/P95 are from a histogram
+ *              with ~3% resolution. JITTER is P95-P50.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+OWPBoolean
+PowLiveReport(
+        pow_live    live,
+        OWPNum64    now
+        )
+{
+    FILE            *fp;
+    pow_live_window w;
+    pow_live_slice  s;
+    uint32_t        i,sec,nrecv;
+    double          min,max,p50,p95;
+    OWPBoolean      first;
+
+    if(!live)
+        return True;
+
+    LiveAdvance(live,(uint32_t)(now >> 32) - live->lag);
+
+    while(!(fp = fopen(live->tfname,"w")) && (errno == EINTR));
+    if(!fp){
+        OWPError(live->ctx,OWPErrWARNING,errno,"fopen(%s): %M",live->tfname);
+        return False;
+    }
+
+    fprintf(fp,"LIVE\t%.2f\n",1.0);
+    fprintf(fp,"TIME\t" OWP_TSTAMPFMT "\n",now);
+    fprintf(fp,"END_TIME\t" OWP_TSTAMPFMT "\n",
+            OWPULongToNum64(live->end));
+
+    for(i=0;i<live->nwindows;i++){
+        w = &live->windows[i];
+
+        fprintf(fp,"<WINDOW>\n");
+        fprintf(fp,"\tLENGTH\t%u\n",w->length);
+        fprintf(fp,"\tSTART_TIME\t" OWP_TSTAMPFMT "\n",
+                OWPULongToNum64(live->end - w->length));
+        fprintf(fp,"\tSENT\t%u\n",w->sent);
+        fprintf(fp,"\tLOST\t%u\n",w->lost);
+        fprintf(fp,"\tDUPS\t%u\n",w->dups);
+
+        nrecv = w->sent - w->lost;
+        if(nrecv){
+            /*
+             * Exact min/max from the slices in the window.
+             */
+            min = max = 0.0;
+            first = True;
+            for(sec=live->end - w->length;sec<live->end;sec++){
+                s = &live->slices[sec % live->nslices];
+                if(!s->used || (s->sec != sec) || (s->sent == s->lost)){
+                    continue;
+                }
+                if(first || (s->min < min)) min = s->min;
+                if(first || (s->max > max)) max = s->max;
+                first = False;
+            }
+            p50 = LivePercentile(w,nrecv,0.5);
+            p95 = LivePercentile(w,nrecv,0.95);
+
+            fprintf(fp,"\tMIN\t%g\n",min);
+            fprintf(fp,"\tMEDIAN\t%g\n",p50);
+            fprintf(fp,"\tP95\t%g\n",p95);
+            fprintf(fp,"\tMAX\t%g\n",max);
+            fprintf(fp,"\tJITTER\t%g\n",p95 - p50);
+        }
+        fprintf(fp,"</WINDOW>\n");
+    }
+
+    if(fclose(fp) != 0){
+        OWPError(live->ctx,OWPErrWARNING,errno,"fclose(%s): %M",live->tfname);
+        (void)unlink(live->tfname);
+        return False;
+    }
+
+    if(rename(live->tfname,live->fname) != 0){
+        OWPError(live->ctx,OWPErrWARNING,errno,"rename(%s,%s): %M",
+                live->tfname,live->fname);
+        (void)unlink(live->tfname);
+        return False;
+    }
+
+    return True;
+}
@@ -32,6 +32,7 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/time.h>
 #include <string.h>
 #include <ctype.h>
 #include <netdb.h>
@@ -39,6 +40,12 @@
 #include <assert.h>
 #include <syslog.h>
 #include <math.h>
+#include <poll.h>
+#include <dirent.h>
+#if defined(HAVE_LINUX_FS_H)
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
 
 
 #if defined HAVE_DECL_OPTRESET && !HAVE_DECL_OPTRESET
@@ -61,13 +68,16 @@ int optreset;
  */
 static powapp_trec      appctx;
 static I2ErrHandle      eh;
-static pow_cntrl_rec    pcntrl[2];
+static pow_target       targets;
+static uint32_t         ntargets;
 static OWPTestSpec      tspec;
 static OWPSlot          slot;
 static uint32_t         sessionTime;
 static double           inf_delay;
 static uint8_t          *pfbuff;
 static size_t           pfbuff_len;
+static uint32_t         numSummaries;
+static uint32_t         iotime;
 
 /*
  * signal catching vars
@@ -75,10 +85,12 @@ static size_t           pfbuff_len;
 static int              pow_reset = 0;
 static int              pow_exit = 0;
 static int              pow_intr = 0;
+static int              pow_alrm = 0;
 static int              pow_error = SIGCONT;
 
 /*
- * pathname variables used throughout:
+ * pathname variables used throughout (kept per target, the targets of
+ * a -T file each have a sub-directory of dirpath):
  *
  * /dirpath/STIME_ETIME.ext
  * ^        ^    ^     ^
@@ -91,16 +103,23 @@ static int              pow_error = SIGCONT;
  * |__ dirpath
  */
 static char             dirpath[PATH_MAX];
-static uint32_t        file_offset,tstamp_offset,ext_offset;
 
-static uint32_t FetchSession(
-        pow_cntrl       p,
-        uint32_t        begin,
-        uint32_t        end,
-        OWPErrSeverity  *err_ret
+static OWPBoolean FetchSession(
+        pow_cntrl               p,
+        OWPSessionFinishedType  *finished_ret,
+        OWPErrSeverity          *err_ret
+        );
+
+static int RequestSession(
+        OWPContext  ctx,
+        pow_cntrl   p,
+        pow_cntrl   q,
+        OWPNum64    *stop
         );
 
 static int sig_check();
+static void CntrlTimerStart();
+static void CntrlTimerStop();
 
 static void
 print_conn_args(){
@@ -124,8 +143,10 @@ print_test_args(){
 "   -E endDelay    time to wait before sending stop-session message\n"
 "   -i wait        mean average time between packets (seconds)\n"
 "   -L timeout     maximum time to wait for a packet (seconds)\n"
+"   -n segments    run segments sessions of -c packets as one test session\n"
 "   -P portrange   test port range to use (must contain at least 2 ports)\n"
 "   -s padding     size of the padding added to each packet (bytes)\n"
+"   -T targetfile  measure the targets listed in targetfile ([-t] testaddr [servaddr] per line)\n"
 "   -z delayStart  time to wait before starting first test (seconds)\n"
         );
 }
@@ -136,6 +157,7 @@ print_output_args()
     fprintf(stderr,
 "              [Output Args]\n\n"
 "   -b bucketWidth create summary files with buckets(seconds)\n"
+"   -B             also write summaries in binary (OWPStatsResultWrite)\n"
 "   -d dir         directory to save session file in\n"
 "   -e facility    syslog facility to log to\n"
 "   -g loglevel    severity log messages to report to syslog Valid values: NONE, FATAL, WARN, INFO, DEBUG, ALL\n"
@@ -143,7 +165,8 @@ print_output_args()
 "   -p             print filenames to stdout\n"
 "   -R             Only send messages to syslog (not STDERR)\n"
 "   -v             include more verbose output\n"
-"   -U             Adds UNIX timestamps to summary results"
+"   -U             Adds UNIX timestamps to summary results\n"
+"   -W windows     report live statistics for these windows (seconds, comma separated)"
            );
 }
 
@@ -154,7 +177,7 @@ usage(
 {
     if(msg) fprintf(stderr, "%s: %s\n", progname, msg);
     fprintf(stderr,"usage: %s %s\n%s\n",progname,
-            "[arguments] testaddr [servaddr]",
+            "[arguments] testaddr [servaddr] | -T targetfile",
             "[arguments] are as follows: "
             );
 
@@ -329,13 +352,41 @@ DONE:
     return;
 }
 
+/*
+ * State for the single pass over the records of a session in
+ * write_session: the last valid index, the scheduled send time
+ * following it, and (if stats is set) the session statistics.
+ */
 typedef struct pow_maxsend_rec{
     OWPSessionHeader    hdr;
     uint32_t           index;
     OWPNum64            sendtime;
     OWPSkip             skips;
+    OWPScheduleContext  sctx;
+    uint32_t            nsched;     /* schedule deltas added to endnum */
+    OWPNum64            endnum;
+    OWPStats            stats;
 } pow_maxsend_rec;
 
+/*
+ * Advance sndrec->endnum to the scheduled time following index.
+ * (The schedule is only ever advanced, so the whole pass costs the
+ * same as replaying the schedule once.)
+ */
+static void
+MaxSendAdvance(
+        pow_maxsend_rec *sndrec
+        )
+{
+    while(sndrec->nsched < sndrec->index+1){
+        sndrec->endnum = OWPNum64Add(sndrec->endnum,
+                OWPScheduleContextGenerateNextDelta(sndrec->sctx));
+        sndrec->nsched++;
+    }
+
+    return;
+}
+
 static int
 GetMaxSend(
         OWPDataRec  *rec,
@@ -344,6 +395,11 @@ GetMaxSend(
 {
     pow_maxsend_rec     *sndrec = (pow_maxsend_rec *)data;
     uint32_t           iskip =0;
+    OWPBoolean          skipped = False;
+
+    if(sndrec->stats && !OWPStatsParseRecords(sndrec->stats,rec,1)){
+        return -1;
+    }
 
     if(sndrec->skips){
         /*
@@ -359,76 +415,382 @@ GetMaxSend(
          */
         if((iskip < sndrec->hdr->num_skiprecs) &&
                 (rec->seq_no > sndrec->skips[iskip].begin)){
-            return 0;
+            skipped = True;
         }
     }
 
     assert(rec->seq_no < sndrec->hdr->test_spec.npackets);
     assert(sndrec->index < sndrec->hdr->test_spec.npackets);
-    if(rec->seq_no > sndrec->index){
+    if(!skipped && (rec->seq_no > sndrec->index)){
         sndrec->index = rec->seq_no;
         sndrec->sendtime = rec->send.owptime;
+        MaxSendAdvance(sndrec);
     }
 
     return 0;
 }
 
-static uint32_t
+/*
+ * Append the records of the (sender) session that testfp does not have
+ * yet. testfp accumulates the session as it runs, so each call only
+ * transfers the new records. Returns False if the fetch failed.
+ */
+static OWPBoolean
 FetchSession(
-        pow_cntrl       p,
-        uint32_t        begin,
-        uint32_t        end,
-        OWPErrSeverity  *err_ret
+        pow_cntrl               p,
+        OWPSessionFinishedType  *finished_ret,
+        OWPErrSeverity          *err_ret
         )
 {
     OWPErrSeverity err;
     uint32_t       num_rec;
 
+    CntrlTimerStart();
+
     if (p->fetch == NULL) {
         p->fetch = OWPControlOpen(p->ctx,
                         appctx.opt.srcaddr,
-                        I2AddrByNode(eh, appctx.remote_serv),
+                        I2AddrByNode(eh, p->tgt->remote_serv),
                         appctx.auth_mode,appctx.opt.identity,
                         NULL,&err);
         if (!p->fetch) {
             I2ErrLog(eh,"OWPControlOpen(%s): Couldn't open 'fetch' connection to server: %M",
-                    appctx.remote_serv);
+                    p->tgt->remote_serv);
             goto error_out;
         }
 
         if(sig_check()) {
+            CntrlTimerStop();
             *err_ret = OWPErrINVALID;
-            return 0;
+            return False;
         }
     }
 
-    num_rec = OWPFetchSession(p->fetch,p->testfp,
-                begin, end,p->sid,err_ret);
-    if (!num_rec) {
+    if(!OWPFetchSessionAppend(p->fetch,p->testfp,p->sid,&num_rec,
+                finished_ret,err_ret)){
         goto error_out;
     }
  
-    return num_rec;
+    CntrlTimerStop();
+
+    return True;
 
 error_out:
+    CntrlTimerStop();
+
     if (p->fetch)
         OWPControlClose(p->fetch);
 
     p->fetch = NULL;
 
-    return 0;
+    return False;
+}
+
+/*
+ * Remove the temporary name of the session data file of p, if it still
+ * has one.
+ */
+static void
+unlink_session_file(
+        pow_cntrl   p
+        )
+{
+    if(p->fname[0] && (unlink(p->fname) != 0) && (errno != ENOENT)){
+        /* note, but ignore the error */
+        I2ErrLog(eh,"unlink(%s): %M",p->fname);
+    }
+    p->fname[0] = '\0';
+
+    return;
+}
+
+/*
+ * Copy the session data file fromfd to tofd. A reflink is tried first,
+ * then copy_file_range, so the data does not have to pass through
+ * user space.
+ *
+ * Returns 0 on success.
+ */
+static int
+copy_session_file(
+        int tofd,
+        int fromfd
+        )
+{
+#if defined(HAVE_COPY_FILE_RANGE)
+    struct stat sbuf;
+    loff_t      ioff = 0;
+    loff_t      ooff = 0;
+    ssize_t     n;
+#endif
+
+#if defined(HAVE_LINUX_FS_H) && defined(FICLONE)
+    if(ioctl(tofd,FICLONE,fromfd) == 0){
+        return 0;
+    }
+#endif
+
+#if defined(HAVE_COPY_FILE_RANGE)
+    if(fstat(fromfd,&sbuf) == 0){
+        while(ioff < sbuf.st_size){
+            n = copy_file_range(fromfd,&ioff,tofd,&ooff,
+                    sbuf.st_size - ioff,0);
+            if(n < 0 && errno == EINTR){
+                continue;
+            }
+            if(n <= 0){
+                break;
+            }
+        }
+        if(ioff >= sbuf.st_size){
+            return 0;
+        }
+    }
+#endif
+
+    /*
+     * stat the "from" file, ftruncate the to file,
+     * mmap both of them, then do a memcpy between them.
+     */
+    return I2CopyFile(eh,tofd,fromfd,0);
+}
+
+/*
+ * Create the temporary (POW_INC_EXT) session data file for
+ * [startnum,endnum]. Its name is returned in tfname. Returns the fd, or
+ * -1 if the file can not be created for a temporary reason - the caller
+ * goes on without it. Any other error is a reason to exit.
+ */
+static int
+open_tmp_session(
+        pow_target  t,
+        OWPNum64    startnum,
+        OWPNum64    endnum,
+        char        *tfname
+        )
+{
+    char    startname[PATH_MAX];
+    char    endname[PATH_MAX];
+    int     tofd;
+
+    strcpy(tfname,t->dirpath);
+    sprintf(startname,OWP_TSTAMPFMT,startnum);
+    sprintf(endname,OWP_TSTAMPFMT,endnum);
+    sprintf(&tfname[t->file_offset],"%s%s%s%s%s",
+            startname,OWP_NAME_SEP,endname,
+            OWP_FILE_EXT,POW_INC_EXT);
+
+    while(((tofd = open(tfname,O_RDWR|O_CREAT|O_EXCL,
+                        S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH)) < 0) && errno==EINTR);
+    if(tofd < 0){
+
+        I2ErrLog(eh,"open(%s): %M",tfname);
+
+        /*
+         * Can't open the file.
+         */
+        switch(errno){
+            /*
+             * reasons to go to the next session
+             * (Temporary resource problems.)
+             */
+            case ENOMEM:
+            case EMFILE:
+            case ENFILE:
+            case ENOSPC:
+            case EDQUOT:
+                break;
+                /*
+                 * Everything else is a reason to exit
+                 * (Probably permissions.)
+                 */
+            default:
+                exit(1);
+                break;
+        }
+    }
+
+    return tofd;
+}
+
+/*
+ * Relink the complete temporary session data file tfname as a complete
+ * one. The name is returned in fname (empty if the link failed).
+ */
+static void
+link_tmp_session(
+        pow_target  t,
+        char        *tfname,
+        char        *fname
+        )
+{
+    strcpy(fname,tfname);
+    sprintf(&fname[t->ext_offset],"%s",OWP_FILE_EXT);
+    if(link(tfname,fname) != 0){
+        /* note, but ignore the error */
+        I2ErrLog(eh,"link(%s,%s): %M",tfname,fname);
+        fname[0] = '\0';
+    }
+
+    return;
+}
+
+/*
+ * Write the records of the session data file of p with seq_no in
+ * [first,last) to the session file for [startnum,endnum]. (-n)
+ * begin_oset is where to start reading the data file (see
+ * OWPWriteDataSegment).
+ *
+ * The name of the file is returned in ofname if it is not NULL.
+ */
+static void
+write_segment(
+        pow_cntrl   p,
+        OWPNum64    startnum,
+        OWPNum64    endnum,
+        off_t       begin_oset,
+        uint32_t    first,
+        uint32_t    last,
+        char        *ofname
+        )
+{
+    pow_target  t = p->tgt;
+    char        tfname[PATH_MAX];
+    char        fname[PATH_MAX];
+    int         tofd;
+    FILE        *tofp;
+    OWPBoolean  rc;
+
+    fname[0] = '\0';
+
+    if((tofd = open_tmp_session(t,startnum,endnum,tfname)) < 0){
+        goto done;
+    }
+
+    if( !(tofp = fdopen(tofd,"w+b"))){
+        I2ErrLog(eh,"fdopen(%s): %M",tfname);
+        while((close(tofd) != 0) && errno==EINTR);
+        goto unlink_tmp;
+    }
+    rc = OWPWriteDataSegment(p->ctx,p->fp,tofp,begin_oset,first,last,NULL);
+    while((fclose(tofp) != 0) && errno==EINTR);
+
+    /*
+     * The segment may have read to the end of the stream, clear the
+     * eof flag so the stream will work if the child process adds
+     * more records.
+     */
+    clearerr(p->fp);
+
+    if(!rc){
+        I2ErrLog(eh,"OWPWriteDataSegment(%s) failed",tfname);
+        goto unlink_tmp;
+    }
+
+    link_tmp_session(t,tfname,fname);
+
+unlink_tmp:
+    if(unlink(tfname) != 0){
+        /* note, but ignore the error */
+        I2ErrLog(eh,"unlink(%s): %M",tfname);
+    }
+
+done:
+    if(ofname){
+        strcpy(ofname,fname);
+    }
+    else if(appctx.opt.printfiles && fname[0]){
+        fprintf(stdout,"%s\n",fname);
+        fflush(stdout);
+    }
+
+    return;
+}
+
+/*
+ * Print the summary of stats to fp (the temporary .sum file tfname). The
+ * text is printed from an OWPStatsResult. With -B the same result is also
+ * written with OWPStatsResultWrite to a POW_RES_EXT file next to it, so
+ * collectors can read the summary without parsing the text.
+ *
+ * Only a failure to print the text is returned.
+ */
+static OWPBoolean
+write_summary(
+        pow_target  t,
+        OWPStats    stats,
+        FILE        *fp,
+        const char  *tfname
+        )
+{
+    OWPStatsResult  result;
+    char            rtfname[PATH_MAX];
+    char            rfname[PATH_MAX];
+    FILE            *rfp;
+    OWPBoolean      rc;
+    OWPBoolean      wrc;
+
+    if( !(result = OWPStatsResultCreate(stats))){
+        I2ErrLog(eh,"OWPStatsResultCreate failed");
+        return False;
+    }
+
+    if( !(rc = OWPStatsResultPrintMachine(result,fp)) ||
+            !appctx.opt.binsummary){
+        goto done;
+    }
+
+    strcpy(rtfname,tfname);
+    sprintf(&rtfname[t->ext_offset],"%s%s",POW_RES_EXT,POW_INC_EXT);
+    if( !(rfp = fopen(rtfname,"wb"))){
+        I2ErrLog(eh,"fopen(%s): %M",rtfname);
+        goto done;
+    }
+    wrc = OWPStatsResultWrite(stats->ctx,result,rfp);
+    if((fclose(rfp) != 0) || !wrc){
+        I2ErrLog(eh,"OWPStatsResultWrite(%s) failed",rtfname);
+        goto unlink_tmp;
+    }
+
+    strcpy(rfname,rtfname);
+    sprintf(&rfname[t->ext_offset],"%s",POW_RES_EXT);
+    if(link(rtfname,rfname) != 0){
+        /* note, but ignore the error */
+        I2ErrLog(eh,"link(%s,%s): %M",rtfname,rfname);
+    }
+    else if(appctx.opt.printfiles){
+        fprintf(stdout,"%s\n",rfname);
+        fflush(stdout);
+    }
+
+unlink_tmp:
+    if(unlink(rtfname) != 0){
+        /* note, but ignore the error */
+        I2ErrLog(eh,"unlink(%s): %M",rtfname);
+    }
+
+done:
+    OWPStatsResultFree(result);
+
+    return rc;
 }
 
 /*
  * Function:    write_session
  *
  * Description:    
- *              Takes a completed session and copies it from the
- *              unlinked file - possibly computing a new endtime
+ *              Takes a completed session and links the session data
+ *              file to its final name - possibly computing a new endtime
  *              based on the last "valid" record in the file.
  *              (Technically, it should probably be based on the
  *              scheduled sendtime
  *
+ *              Only a session that did not finish normally is copied,
+ *              since the receiver could still be writing to it.
+ *
+ *              In continuous mode (-n) the segments before p->segfirst
+ *              have already been written, so only the last one is.
+ *
  * In Args:    
  *
  * Out Args:    
@@ -444,6 +806,7 @@ write_session(
         OWPBoolean      newend
         )
 {
+    pow_target          t = p->tgt;
     OWPSessionHeaderRec hdr;
     OWPNum64            endnum;
     char                tfname[PATH_MAX];
@@ -455,7 +818,6 @@ write_session(
     FILE                *fp = NULL;
     OWPBoolean          dotf = False;
     OWPStats            stats = NULL;
-    int                 rc;
     OWPErrSeverity      ec;
 
     /*
@@ -465,11 +827,18 @@ write_session(
     if(!p->fp || !p->session_started || (aval != OWP_CNTRL_ACCEPT))
         return;
 
+    /*
+     * In continuous mode the sum-session loop has already written
+     * every segment that completed.
+     */
+    if(appctx.opt.numSegments && (p->segfirst >= p->numPackets))
+        return;
+
     /*
      * If sender session - data needs to be fetched from the remote server.
      */
-    if(appctx.opt.sender){
-        uint32_t    num_rec;
+    if(t->sender){
+        OWPSessionFinishedType  finished;
 
         /*
          * If there is no file to fetch the data give up.
@@ -478,28 +847,14 @@ write_session(
             return;
 
         /*
-         * Move file pointer to beginning and set file size to zero
-         * before Fetching data.
-         */
-        if(fseeko(p->testfp,0,SEEK_SET) != 0){
-            I2ErrLog(eh,"fseeko(): %M");
-            return;
-        }
-        if((rc = ftruncate(fileno(p->testfp),0)) != 0){
-            I2ErrLog(eh,"write_session(): ftruncate(): %M");
-            return;
-        }
-
-        /*
-         * Fetch the data and put it in testfp
+         * Fetch the rest of the data into testfp
          */
-        num_rec = FetchSession(p,0,(uint32_t)0xFFFFFFFF,&ec);
-        if(!num_rec){
+        if(!FetchSession(p,&finished,&ec)){
             if(ec >= OWPErrWARNING){
                 /*
                  * Server denied request - report error
                  */
-                I2ErrLog(eh,"write_session(): OWPFetchSession(): Server denied request for full session data");
+                I2ErrLog(eh,"write_session(): OWPFetchSessionAppend(): Server denied request for session data");
             }
 
             return;
@@ -517,7 +872,6 @@ write_session(
     if(newend){
         struct flock        flk;
         pow_maxsend_rec     sndrec;
-        uint32_t           i;
 
         /*
          * This section reads the packet records
@@ -592,14 +946,38 @@ write_session(
             }
         }
 
+        /*
+         * The statistics for the summary are computed in the same pass.
+         * (If that fails, they are computed separately below.)
+         */
+        if( (stats = OWPStatsCreate(p->ctx,p->fp,&hdr,NULL,NULL,'m',
+                        appctx.opt.bucketWidth))){
+            if (appctx.opt.display_unix_ts == True)
+                stats->display_unix_ts = True;
+            if(OWPStatsParseBegin(stats,NULL,p->segfirst,~0)){
+                sndrec.stats = stats;
+            }
+            else{
+                OWPStatsFree(stats);
+                stats = NULL;
+            }
+        }
+
         /*
          * Find the last index in the file so it can be used to compute
          * the assumed "send" time for the "end" time of the session.
+         * endnum is based on the send schedule and the index of the
+         * last valid packet in the file.
          *
          * Read all records and find the "last" one in the file.
          */
+        (void)OWPScheduleContextReset(p->sctx,NULL,NULL);
+        sndrec.sctx = p->sctx;
+        sndrec.endnum = p->currentSessionStartNum;
+
         if(fseeko(p->fp,hdr.oset_datarecs,SEEK_SET) != 0){
             if(sndrec.skips) free(sndrec.skips);
+            if(stats) OWPStatsFree(stats);
             I2ErrLog(eh,"fseeko(): %M");
             return;
         }
@@ -607,67 +985,64 @@ write_session(
         if(OWPParseRecords(p->ctx,p->fp,hdr.num_datarecs,hdr.version,GetMaxSend,
                     (void*)&sndrec) != OWPErrOK){
             if(sndrec.skips) free(sndrec.skips);
+            if(stats) OWPStatsFree(stats);
             I2ErrLog(eh,"GetMaxIndex: %M");
             return;
         }
         if(sndrec.skips) free(sndrec.skips);
 
-        /*
-         * Compute endnum based on the send schedule and the index of the
-         * last valid packet in the file.
-         */
-        (void)OWPScheduleContextReset(p->sctx,NULL,NULL);
-        endnum = p->currentSessionStartNum;
         assert(sndrec.index < hdr.test_spec.npackets);
-        for(i=0;i<sndrec.index+1;i++){
-            endnum = OWPNum64Add(endnum,
-                    OWPScheduleContextGenerateNextDelta(p->sctx));
+        MaxSendAdvance(&sndrec);
+        endnum = sndrec.endnum;
+
+        if(stats && !OWPStatsParseEnd(stats)){
+            I2ErrLog(eh,"OWPStatsParse failed");
+            OWPStatsFree(stats);
+            stats = NULL;
         }
     }
     else{
         endnum = p->currentSessionEndNum;
     }
 
+    ofname[0] = sfname[0] = '\0';
+
     /*
-     * Make a temporary session filename to hold data.
+     * The rest of a continuous session is its last segment.
      */
-    strcpy(tfname,dirpath);
-    sprintf(startname,OWP_TSTAMPFMT,p->currentSessionStartNum);
-    sprintf(endname,OWP_TSTAMPFMT,endnum);
-    sprintf(&tfname[file_offset],"%s%s%s%s%s",
-            startname,OWP_NAME_SEP,endname,
-            OWP_FILE_EXT,POW_INC_EXT);
-
-    while(((tofd = open(tfname,O_RDWR|O_CREAT|O_EXCL,
-                        S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH)) < 0) && errno==EINTR);
-    if(tofd < 0){
-
-        I2ErrLog(eh,"open(%s): %M",tfname);
+    if(appctx.opt.numSegments){
+        if(OWPNum64Cmp(endnum,p->segstartnum) <= 0){
+            goto skip_sum;
+        }
+        write_segment(p,p->segstartnum,endnum,p->segoset,
+                p->segfirst,p->numPackets,ofname);
+        goto skip_data;
+    }
 
-        /*
-         * Can't open the file.
-         */
-        switch(errno){
-            /*
-             * reasons to go to the next
-             * session
-             * (Temporary resource problems.)
-             */
-            case ENOMEM:
-            case EMFILE:
-            case ENFILE:
-            case ENOSPC:
-            case EDQUOT:
-                break;
-                /*
-                 * Everything else is a reason to exit
-                 * (Probably permissions.)
-                 */
-            default:
-                exit(1);
-                break;
+    /*
+     * A complete session file is not modified any more, so the data
+     * file (which is already in dirpath) just gets its final name.
+     */
+    strcpy(tfname,t->dirpath);
+    sprintf(startname,OWP_TSTAMPFMT,p->segstartnum);
+    sprintf(endname,OWP_TSTAMPFMT,endnum);
+    if((hdr.finished == OWP_SESSION_FINISHED_NORMAL) && p->fname[0]){
+        strcpy(ofname,t->dirpath);
+        sprintf(&ofname[t->file_offset],"%s%s%s%s",
+                startname,OWP_NAME_SEP,endname,OWP_FILE_EXT);
+        if(link(p->fname,ofname) == 0){
+            unlink_session_file(p);
+            goto skip_data;
         }
+        /* note, and fall back to a copy */
+        I2ErrLog(eh,"link(%s,%s): %M",p->fname,ofname);
+        ofname[0] = '\0';
+    }
 
+    /*
+     * Make a temporary session file to hold data.
+     */
+    if((tofd = open_tmp_session(t,p->segstartnum,endnum,tfname)) < 0){
         /*
          * Skip to next session.
          */
@@ -675,26 +1050,13 @@ write_session(
     }
     dotf=True;
 
-    /*
-     * stat the "from" file, ftruncate the to file,
-     * mmap both of them, then do a memcpy between them.
-     */
-    if(I2CopyFile(eh,tofd,fileno(p->fp),0) == 0){
-        /*
-         * Relink the incomplete file as a complete one.
-         */
-        strcpy(ofname,tfname);
-        sprintf(&ofname[ext_offset],"%s",OWP_FILE_EXT);
-        if(link(tfname,ofname) != 0){
-            /* note, but ignore the error */
-            I2ErrLog(eh,"link(%s,%s): %M",tfname,ofname);
-            ofname[0]='\0';
-        }
+    if(copy_session_file(tofd,fileno(p->fp)) == 0){
+        link_tmp_session(t,tfname,ofname);
     }
 
 skip_data:
 
-    while((close(tofd) != 0) && errno==EINTR);
+    while((tofd >= 0) && (close(tofd) != 0) && errno==EINTR);
     if(dotf && (unlink(tfname) != 0)){
         /* note, but ignore the error */
         I2ErrLog(eh,"unlink(%s): %M",tfname);
@@ -706,34 +1068,40 @@ skip_data:
      */
 
     /*
-     * Create the stats record if empty. (Did not go through
-     * subsession loop.)
+     * Create the stats record if empty. (Not computed with the new end
+     * time.) This is the only pass over the records of a session without
+     * sub-sessions. With sub-sessions (-N) the records have also been
+     * parsed for their sub-session summaries: those stats only cover
+     * one sub-session each, and the skip records are not known until the
+     * session is over, so they are not reused here.
      */
-    if( !(stats = OWPStatsCreate(p->ctx,p->fp,&hdr,NULL,NULL,'m',
-                    appctx.opt.bucketWidth))){
-        I2ErrLog(eh,"OWPStatsCreate failed");
-        goto skip_sum;
-    }
-    
-    /* Set the timestamp flag here */
-    if (appctx.opt.display_unix_ts == True)
-        stats->display_unix_ts = True;
+    if(!stats){
+        if( !(stats = OWPStatsCreate(p->ctx,p->fp,&hdr,NULL,NULL,'m',
+                        appctx.opt.bucketWidth))){
+            I2ErrLog(eh,"OWPStatsCreate failed");
+            goto skip_sum;
+        }
 
-    /*
-     * Parse the data and compute the statistics
-     */
-    if( !OWPStatsParse(stats,NULL,0,0,~0)){
-        I2ErrLog(eh,"OWPStatsParse failed");
-        goto skip_sum;
+        /* Set the timestamp flag here */
+        if (appctx.opt.display_unix_ts == True)
+            stats->display_unix_ts = True;
+
+        /*
+         * Parse the data and compute the statistics
+         */
+        if( !OWPStatsParse(stats,NULL,0,p->segfirst,~0)){
+            I2ErrLog(eh,"OWPStatsParse failed");
+            goto skip_sum;
+        }
     }
 
     /*
      * Make a temporary session filename to hold data.
      */
-    strcpy(tfname,dirpath);
-    sprintf(startname,OWP_TSTAMPFMT,p->currentSessionStartNum);
+    strcpy(tfname,t->dirpath);
+    sprintf(startname,OWP_TSTAMPFMT,p->segstartnum);
     sprintf(endname,OWP_TSTAMPFMT,endnum);
-    sprintf(&tfname[file_offset],"%s%s%s%s%s",
+    sprintf(&tfname[t->file_offset],"%s%s%s%s%s",
             startname,OWP_NAME_SEP,endname,
             POW_SUM_EXT,POW_INC_EXT);
 
@@ -776,7 +1144,7 @@ skip_data:
     /*
      * Actually print out stats
      */
-    if(!OWPStatsPrintMachine(stats,fp)){
+    if(!write_summary(t,stats,fp,tfname)){
         goto skip_sum;
     }
 
@@ -784,7 +1152,7 @@ skip_data:
      * Relink the incomplete file as a complete one.
      */
     strcpy(sfname,tfname);
-    sprintf(&sfname[ext_offset],"%s",POW_SUM_EXT);
+    sprintf(&sfname[t->ext_offset],"%s",POW_SUM_EXT);
     if(link(tfname,sfname) != 0){
         /* note, but ignore the error */
         I2ErrLog(eh,"link(%s,%s): %M",tfname,sfname);
@@ -828,7 +1196,9 @@ ResetSession(
     OWPAcceptType   aval = OWP_CNTRL_ACCEPT;
 
     if(p->numPackets && p->call_stop && p->cntrl){
+            CntrlTimerStart();
             (void)OWPStopSessions(p->cntrl,&pow_intr,&aval);
+            CntrlTimerStop();
     }
 
     /*
@@ -836,6 +1206,7 @@ ResetSession(
      * for 'sender' sessions so OWPFetchSession can be called.
      */
     write_session(p,aval,True);
+    unlink_session_file(p);
 
     if(p->fetch){
         OWPControlClose(p->fetch);
@@ -864,11 +1235,30 @@ ResetSession(
     return;
 }
 
+/*
+ * Reset both sessions of t - its sum-session loop starts over.
+ */
+static void
+CloseTargetSessions(
+        pow_target  t
+        )
+{
+    ResetSession(&t->pcntrl[0],&t->pcntrl[1]);
+    ResetSession(&t->pcntrl[1],&t->pcntrl[0]);
+    t->state = POW_STATE_NEXT;
+    t->wake = OWPULongToNum64(0);
+
+    return;
+}
+
 static void
 CloseSessions()
 {
-    ResetSession(&pcntrl[0],&pcntrl[1]);
-    ResetSession(&pcntrl[1],&pcntrl[0]);
+    uint32_t    i;
+
+    for(i=0;i<ntargets;i++){
+        CloseTargetSessions(&targets[i]);
+    }
 
     return;
 }
@@ -888,6 +1278,10 @@ sig_catch(
             pow_reset++;
             pow_intr++;
             break;
+        case SIGALRM:
+            pow_alrm++;
+            pow_intr++;
+            break;
         default:
             pow_error = signo;
             break;
@@ -926,6 +1320,96 @@ sig_check()
     return 0;
 }
 
+/*
+ * With more than one target (-T), bound the blocking control exchanges
+ * that follow - connecting, requesting and starting a session, fetching
+ * and StopSessions - by POW_CNTRL_TIMEOUT seconds each, so a target whose
+ * server does not answer holds up the other targets only that long. The
+ * timer keeps firing until CntrlTimerStop, and each SIGALRM interrupts
+ * the library call in progress through pow_intr. (The failed step is
+ * retried after retryDelay like any other failure.)
+ */
+static void
+CntrlTimerStart()
+{
+    struct itimerval    itval;
+
+    if(ntargets < 2)
+        return;
+
+    pow_alrm = 0;
+    memset(&itval,0,sizeof(itval));
+    itval.it_value.tv_sec = itval.it_interval.tv_sec = POW_CNTRL_TIMEOUT;
+    if(setitimer(ITIMER_REAL,&itval,NULL) != 0){
+        I2ErrLog(eh,"setitimer(): %M");
+    }
+
+    return;
+}
+
+static void
+CntrlTimerStop()
+{
+    struct itimerval    itval;
+
+    if(ntargets < 2)
+        return;
+
+    memset(&itval,0,sizeof(itval));
+    if(setitimer(ITIMER_REAL,&itval,NULL) != 0){
+        I2ErrLog(eh,"setitimer(): %M");
+    }
+
+    if(pow_alrm){
+        I2ErrLog(eh,"Control exchange timed out after %d seconds",
+                POW_CNTRL_TIMEOUT);
+        pow_alrm = 0;
+        if(!pow_exit && !pow_reset){
+            pow_intr = 0;
+        }
+    }
+
+    return;
+}
+
+/*
+ * Earliest time SetupSession may contact the server for p again.
+ * (retryDelay after the previous attempt.)
+ */
+static OWPNum64
+RetryTime(
+        pow_cntrl   p
+        )
+{
+    if(appctx.opt.retryDelay > 0 &&
+            OWPNum64Cmp(p->prev_runtime.owptime, OWPULongToNum64(0)) > 0){
+        return OWPNum64Add(p->prev_runtime.owptime,
+                OWPULongToNum64(appctx.opt.retryDelay));
+    }
+
+    return OWPULongToNum64(0);
+}
+
+/*
+ * Function:        SetupSession
+ *
+ * Description:
+ *              Request and start the next session for p. The start time
+ *              of the session following it is passed to q.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ *              0 on success (or if stop has already passed), 1 if a
+ *              reset signal was caught, -1 on failure and
+ *              POW_SETUP_RETRY if the retry delay since the previous
+ *              attempt has not passed yet. (See RetryTime.)
+ * Side Effect:
+ */
+#define POW_SETUP_RETRY 2
 static int
 SetupSession(
         OWPContext  ctx,
@@ -934,12 +1418,32 @@ SetupSession(
         OWPNum64    *stop   /* return by this time              */
         )
 {
+    int rc;
+
+    CntrlTimerStart();
+    rc = RequestSession(ctx,p,q,stop);
+    CntrlTimerStop();
+
+    return rc;
+}
+
+/*
+ * SetupSession, without the control timer.
+ */
+static int
+RequestSession(
+        OWPContext  ctx,
+        pow_cntrl   p,
+        pow_cntrl   q,
+        OWPNum64    *stop
+        )
+{
+    pow_target      t = p->tgt;
     OWPErrSeverity  err;
     OWPTimeStamp    currtime;
     int             fd;
     uint64_t        i;
     char            fname[PATH_MAX];
-    static int      first_time=1;
 
     if(p->numPackets)
         return 0;
@@ -968,36 +1472,25 @@ SetupSession(
     p->session_started = False;
 
 
-    if(appctx.opt.retryDelay > 0 && OWPNum64Cmp(p->prev_runtime.owptime, OWPULongToNum64(0)) > 0) {
-        struct timespec ts, nts;
-        OWPNum64 next_runtime;
-
-        if(!OWPGetTimeOfDay(ctx,&currtime)){
-            I2ErrLog(eh,"OWPGetTimeOfDay: %M");
-            exit(1);
-        }
-
-        next_runtime = OWPNum64Add(p->prev_runtime.owptime, OWPULongToNum64(appctx.opt.retryDelay));
-        if (OWPNum64Cmp(next_runtime, currtime.owptime) > 0) {
-            OWPNum64ToTimespec(&ts, OWPNum64Sub(next_runtime, currtime.owptime));
-
-            I2ErrLog(eh,"OWPControlOpen(%s): Waiting %d.%d seconds before retrying",
-                    appctx.remote_serv,ts.tv_sec,ts.tv_nsec);
-            while (nanosleep(&ts, &nts) == -1 && errno == EINTR) {
-                if (sig_check()) return 1;
-
-                ts.tv_sec  = nts.tv_sec;
-                ts.tv_nsec = nts.tv_nsec;
-            }
-        }
-
-    }
-
     if(!OWPGetTimeOfDay(ctx,&currtime)){
         I2ErrLog(eh,"OWPGetTimeOfDay: %M");
         exit(1);
     }
 
+    /*
+     * The other targets keep running while this one waits, so the
+     * caller sleeps until RetryTime instead of this function.
+     */
+    if(OWPNum64Cmp(RetryTime(p),currtime.owptime) > 0){
+        struct timespec ts;
+
+        OWPNum64ToTimespec(&ts,
+                OWPNum64Sub(RetryTime(p),currtime.owptime));
+        I2ErrLog(eh,"OWPControlOpen(%s): Waiting %d.%d seconds before retrying",
+                t->remote_serv,ts.tv_sec,ts.tv_nsec);
+        return POW_SETUP_RETRY;
+    }
+
     if(stop != NULL && OWPNum64Cmp(currtime.owptime,*stop) > 0){
         if(p->nextSessionStart){
             q->nextSessionStart = &q->nextSessionStartNum;
@@ -1045,13 +1538,13 @@ SetupSession(
 
     if(!(p->cntrl = OWPControlOpen(ctx,
                     appctx.opt.srcaddr,
-                    I2AddrByNode(eh, appctx.remote_serv),
+                    I2AddrByNode(eh, t->remote_serv),
                     appctx.auth_mode,appctx.opt.identity,
                     NULL,&err))){
         if(sig_check()) return 1;
 
         I2ErrLog(eh,"OWPControlOpen(%s): Couldn't open 'control' connection to server: %M",
-                appctx.remote_serv);
+                t->remote_serv);
         goto sctx_clean;
     }
 
@@ -1064,10 +1557,10 @@ SetupSession(
     }
     currtime.owptime = OWPNum64Add(currtime.owptime,
             OWPULongToNum64(SETUP_ESTIMATE));
-    if(first_time){
+    if(t->delayStart){
         currtime.owptime = OWPNum64Add(currtime.owptime,
-                OWPULongToNum64(appctx.opt.delayStart));
-        first_time=0;
+                OWPULongToNum64(t->delayStart));
+        t->delayStart = 0;
     }
 
     if(p->nextSessionStart){
@@ -1082,11 +1575,13 @@ SetupSession(
     }
 
     /*
-     * Create a tmpfile to hold session data - this file will be
-     * in an unlinked state to make "cleanup" easier.
+     * Create a tmpfile to hold session data. It is created in dirpath
+     * so write_session can link it to its final name instead of
+     * copying the data.
      */
-    strcpy(fname,dirpath);
-    strcpy(&fname[file_offset],POWTMPFILEFMT);
+    unlink_session_file(p);
+    strcpy(fname,t->dirpath);
+    strcpy(&fname[t->file_offset],POWTMPFILEFMT);
 
     /*
      * use mkstemp to avoid race condition (downside, fd - not fp)
@@ -1095,6 +1590,14 @@ SetupSession(
         I2ErrLog(eh,"mkstemp(%s): %M",fname);
         goto cntrl_clean;
     }
+    strcpy(p->fname,fname);
+
+    /*
+     * Same mode as the other files in dirpath (mkstemp uses 0600).
+     */
+    if(fchmod(fd,S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH) != 0){
+        I2ErrLog(eh,"fchmod(%s): %M",fname);
+    }
 
     /*
      * Wrap the fd in a file pointer.
@@ -1102,7 +1605,7 @@ SetupSession(
     if(!(p->fp = fdopen(fd,"wb+"))){
         I2ErrLog(eh,"fdopen(%s:(%d)): %M",fname,fd);
         while((close(fd) != 0) && errno==EINTR);
-        (void)unlink(fname);
+        unlink_session_file(p);
         goto cntrl_clean;
     }
 
@@ -1115,21 +1618,10 @@ SetupSession(
         I2ErrLog(eh,"fopen(%s): %M",fname);
         while((fclose(p->fp) != 0) && errno==EINTR);
         p->fp = NULL;
-        (void)unlink(fname);
+        unlink_session_file(p);
         goto cntrl_clean;
     }
 
-    /*
-     * Unlink the filename so interrupt resets don't have
-     * as much work to do. (This does mean the data needs
-     * to be copied into a new file upon completion of the
-     * test.)
-     */
-    if(unlink(fname) != 0){
-        I2ErrLog(eh,"unlink(): %M");
-        goto file_clean;
-    }
-
     // XXX: this could be bad?
     if(sig_check())
         return 1;
@@ -1140,9 +1632,9 @@ SetupSession(
      * data that is fetched using OWPFetchSession for sender sessions)
      */
     tspec.start_time = *p->nextSessionStart;
-    if(appctx.opt.sender){
+    if(t->sender){
         if(!OWPSessionRequest(p->cntrl,NULL,(OWPBoolean)False,
-                    I2AddrByNode(eh,appctx.remote_test),(OWPBoolean)True,
+                    I2AddrByNode(eh,t->remote_test),(OWPBoolean)True,
                     (OWPTestSpec*)&tspec,NULL,p->sid,&err)){
             I2ErrLog(eh,"OWPSessionRequest: Failed");
             /*
@@ -1155,7 +1647,7 @@ SetupSession(
         }
     }
     else{
-        if(!OWPSessionRequest(p->cntrl,I2AddrByNode(eh,appctx.remote_test),
+        if(!OWPSessionRequest(p->cntrl,I2AddrByNode(eh,t->remote_test),
                     True, NULL, False,(OWPTestSpec*)&tspec,p->testfp,
                     p->sid,&err)){
             I2ErrLog(eh,"OWPSessionRequest: Failed");
@@ -1220,29 +1712,962 @@ SetupSession(
     q->nextSessionStartNum = p->nextSessionEndNum;
     q->nextSessionStart = &q->nextSessionStartNum;
 
-    return 0;
+    return 0;
+
+file_clean:
+    while((fclose(p->fp) != 0) && errno==EINTR);
+    p->fp = NULL;
+    while((fclose(p->testfp) != 0) && errno==EINTR);
+    p->testfp = NULL;
+    unlink_session_file(p);
+
+cntrl_clean:
+    OWPControlClose(p->cntrl);
+    p->cntrl = NULL;
+
+sctx_clean:
+    OWPScheduleContextFree(p->sctx);
+    p->sctx = NULL;
+
+fetch_clean:
+    if (p->fetch){
+        OWPControlClose(p->fetch);
+	p->fetch = NULL;
+    }
+
+    return -1;
+}
+
+/*
+ * Function:        TargetWait
+ *
+ * Description:
+ *              Set the time t has to run again while it waits for the
+ *              end of its session (or sum-session) at stop: the
+ *              earliest of stop, the next live statistics report and
+ *              the time the next session may be requested again. (main
+ *              also runs t when its control connection is readable.)
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+static void
+TargetWait(
+        pow_target  t,
+        OWPNum64    stop,
+        OWPNum64    now
+        )
+{
+    OWPNum64    retry;
+
+    t->wake = stop;
+    if(t->live && (OWPNum64Cmp(t->livenext,t->wake) < 0)){
+        t->wake = t->livenext;
+    }
+    if(!t->q->numPackets){
+        retry = RetryTime(t->q);
+        if((OWPNum64Cmp(retry,now) > 0) && (OWPNum64Cmp(retry,t->wake) < 0)){
+            t->wake = retry;
+        }
+    }
+
+    return;
+}
+
+/*
+ * Request the next session of t again if that failed, and retryDelay
+ * has passed. (SetupSession does not wait for it.)
+ *
+ * Returns non-zero if a reset signal was caught.
+ */
+static int
+RetrySetup(
+        pow_target  t,
+        OWPNum64    *stop,
+        OWPNum64    now
+        )
+{
+    OWPNum64    retry;
+
+    if(t->q->numPackets)
+        return 0;
+
+    retry = RetryTime(t->q);
+    if(!OWPNum64Cmp(retry,OWPULongToNum64(0)) ||
+            (OWPNum64Cmp(retry,now) > 0))
+        return 0;
+
+    return (SetupSession(appctx.lib_ctx,t->q,t->p,stop) == 1);
+}
+
+/*
+ * Function:        LiveUpdate
+ *
+ * Description:
+ *              Consume any new records of the current session and
+ *              write the live statistics report. On the sender side,
+ *              records are only available after they are fetched.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+static void
+LiveUpdate(
+        pow_cntrl   p
+        )
+{
+    pow_target      t = p->tgt;
+    OWPTimeStamp    currtime;
+
+    if(!t->live)
+        return;
+
+    if(!t->sender && p->fp){
+        (void)PowLiveFeed(t->live,p->fp);
+    }
+
+    if(!OWPGetTimeOfDay(appctx.lib_ctx,&currtime)){
+        I2ErrLog(eh,"OWPGetTimeOfDay: %M");
+        return;
+    }
+    (void)PowLiveReport(t->live,currtime.owptime);
+    t->livenext = OWPNum64Add(currtime.owptime,
+            OWPULongToNum64(POW_LIVE_INTERVAL));
+
+    return;
+}
+
+/*
+ * Function:        TargetStep
+ *
+ * Description:
+ *              Run the sum-session loop of t until it has to wait for
+ *              a session (or sum-session) to end. t->state records
+ *              where it waits, and t->wake when it has to run again.
+ *
+ *              The loop alternates between the two connections of t.
+ *              While the session of p is collected, the session of q
+ *              (starting when the one of p ends) is requested. A
+ *              summary is written at the end of each sum-session,
+ *              and the session file at the end of the session.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+static void
+TargetStep(
+        pow_target  t
+        )
+{
+    OWPContext          ctx = appctx.lib_ctx;
+    pow_cntrl           p = t->p;
+    pow_cntrl           q = t->q;
+    OWPTimeStamp        currtime;
+    OWPNum64            stop;
+    OWPErrSeverity      err_ret = OWPErrOK;
+    int                 rc;
+    uint32_t            nrecs;
+    OWPSessionHeaderRec hdr;
+    FILE                *fp=NULL;
+    OWPBoolean          dotf = False;
+    char                tfname[PATH_MAX];
+    char                fname[PATH_MAX];
+    char                startname[PATH_MAX];
+    char                endname[PATH_MAX];
+
+    switch(t->state){
+        case POW_STATE_WAIT:
+            goto wait_again;
+        case POW_STATE_SUMWAIT:
+            goto AGAIN;
+        default:
+            break;
+    }
+
+NextConnection:
+    sig_check();
+    t->state = POW_STATE_NEXT;
+
+    /*
+     * p is the "connection" we are dealing with this loop
+     * iteration. We need a pointer to q to tell it what series
+     * start time to use based upon the end of the p series.
+     */
+    p = t->p = &t->pcntrl[t->which];
+    q = t->q = &t->pcntrl[(t->which + 1) % 2];
+
+    /* If the sessions haven't been initialized, do the init phase */
+    if(!p->numPackets){
+        if(SetupSession(ctx,q,p,NULL) == POW_SETUP_RETRY){
+            t->wake = RetryTime(q);
+            return;
+        }
+        t->which = (t->which + 1) % 2;
+        goto NextConnection;
+    }
+    t->which = (t->which + 1) % 2;
+
+    /* init vars for loop */
+    t->lastnum=OWPULongToNum64(0);
+    t->aval = OWP_CNTRL_ACCEPT;
+
+    /*
+     * Make local copies of start/end - SetupSession modifies
+     * them.
+     */
+    p->currentSessionStartNum = p->nextSessionStartNum;
+    p->currentSessionEndNum = p->nextSessionEndNum;
+    p->segfirst = 0;
+    p->segstartnum = p->currentSessionStartNum;
+    p->segoset = 0;
+    PowLiveNewFile(t->live,True);
+
+    if(appctx.opt.verbose > 1){
+        sprintf(startname,OWP_TSTAMPFMT,p->currentSessionStartNum);
+        sprintf(endname,OWP_TSTAMPFMT,p->currentSessionEndNum);
+        fprintf(stderr,"Starting session %s [%s - %s] v=%d\n",
+                t->remote_test,startname,endname,appctx.opt.verbose);
+    }
+
+    if(numSummaries)
+        goto SumStart;
+
+    /*
+     * No summaries - just wait for the end of the session.
+     *
+     * Now try and setup the next full session (q).
+     * SetupSession checks for reset signals, and returns
+     * non-zero if one happend.
+     */
+    rc = SetupSession(ctx,q,p,NULL);
+    if(rc && (rc != POW_SETUP_RETRY))
+        goto NextConnection;
+    p->session_started = True;
+wait_again:
+    t->state = POW_STATE_WAIT;
+    if(!OWPGetTimeOfDay(ctx,&currtime)){
+        I2ErrLog(eh,"OWPGetTimeOfDay: %M");
+        exit(1);
+    }
+    if(RetrySetup(t,NULL,currtime.owptime))
+        goto NextConnection;
+
+    /*
+     * Check for the end of the session without blocking - the other
+     * targets are waited for in main.
+     */
+    rc = OWPStopSessionsWait(p->cntrl,&currtime.owptime,&pow_intr,
+            &t->aval,&err_ret);
+    if(rc<0){
+        /* error - reset sessions and start over. */
+        p->call_stop = False;
+        CloseTargetSessions(t);
+        goto NextConnection;
+    }
+    else if(rc==2){
+        /*
+         * system event
+         */
+        if(sig_check()){
+            /* cleanup resources */
+            goto NextConnection;
+        }
+        goto wait_again;
+    }
+    else if(rc==1){
+        /*
+         * Still running - live statistics report if due, then
+         * check again when the session should be over.
+         */
+        if(t->live && (OWPNum64Cmp(t->livenext,currtime.owptime) <= 0)){
+            LiveUpdate(p);
+            if(sig_check())
+                goto NextConnection;
+        }
+        stop = OWPNum64Add(p->currentSessionEndNum,
+                OWPNum64Add(tspec.loss_timeout,
+                    OWPULongToNum64(POW_END_POLL)));
+        if(OWPNum64Cmp(stop,currtime.owptime) <= 0){
+            stop = OWPNum64Add(currtime.owptime,
+                    OWPULongToNum64(POW_END_POLL));
+        }
+        TargetWait(t,stop,currtime.owptime);
+        return;
+    }
+    p->call_stop = False;
+
+SumStart:
+    /*
+     * This loops on each "sum" session - it completes when
+     * there are no more sum-sessions to fetch - i.e. the real
+     * test session is complete.
+     *
+     * stats structures are specific to the file - so any previous
+     * one is no longer valid when we get back here.
+     */
+    if(t->stats){
+        OWPStatsFree(t->stats);
+        t->stats = NULL;
+    }
+
+    t->sum = 0;
+NextSum:
+    if(t->sum >= numSummaries)
+        goto SessionEnd;
+
+    if(sig_check())
+        goto NextConnection;
+
+    /*
+     * lastnum contains offset for previous sum.
+     * So - currentSessionStart + lastnum is new
+     * startnum.
+     */
+    t->startnum = OWPNum64Add(p->currentSessionStartNum,t->lastnum);
+
+    /*
+     * This loop sets lastnum to the relative lastnum
+     * of this sum-session. (It starts at the relative
+     * offset of the lastnum from the previous session.)
+     */
+    for(nrecs=0;nrecs<appctx.opt.numBucketPackets;nrecs++){
+        t->lastnum = OWPNum64Add(t->lastnum,
+                OWPScheduleContextGenerateNextDelta(p->sctx));
+
+    }
+    /*
+     * set localstop to absolute time of final packet.
+     */
+    t->localstop = OWPNum64Add(p->currentSessionStartNum,t->lastnum);
+
+    /*
+     * set stopnum to the time we should collect this
+     * session.
+     * sumsession can't be over until after
+     * lossThresh, then add iotime.
+     */
+    t->stopnum = OWPNum64Add(t->localstop,OWPNum64Add(tspec.loss_timeout,
+                OWPULongToNum64(iotime)));
+
+    /*
+     * Now try and setup the next full session (q).
+     * SetupSession checks for reset signals, and returns
+     * non-zero if one happend.
+     */
+    rc = SetupSession(ctx,q,p,&t->stopnum);
+    if(rc && (rc != POW_SETUP_RETRY))
+        goto NextConnection;
+AGAIN:
+    /*
+     * Wait until this "sumsession" is complete.
+     */
+    t->state = POW_STATE_SUMWAIT;
+    if(!OWPGetTimeOfDay(ctx,&currtime)){
+        I2ErrLog(eh,"OWPGetTimeOfDay: %M");
+        exit(1);
+    }
+    if(RetrySetup(t,&t->stopnum,currtime.owptime))
+        goto NextConnection;
+
+    if(p->call_stop){
+        rc = OWPStopSessionsWait(p->cntrl,&currtime.owptime,&pow_intr,
+                &t->aval,&err_ret);
+    }
+    else{
+        rc=1; /* no more data coming */
+    }
+
+    if((rc==1) && p->call_stop &&
+            (OWPNum64Cmp(currtime.owptime,t->stopnum) < 0)){
+        /*
+         * sum-session not over yet - live statistics report if due.
+         */
+        if(t->live && (OWPNum64Cmp(t->livenext,currtime.owptime) <= 0)){
+            LiveUpdate(p);
+            if(sig_check())
+                goto NextConnection;
+        }
+        TargetWait(t,t->stopnum,currtime.owptime);
+        return;
+    }
+
+    if(rc<0){
+        /* error */
+        OWPControlClose(p->cntrl);
+        p->cntrl = NULL;
+        goto SessionEnd;
+    }
+    if(rc==0){
+        /* session over */
+        p->call_stop = False;
+        /*
+         * If aval non-zero, session data is invalid.
+         */
+        if(t->aval)
+            goto SessionEnd;
+    }
+    if(rc==2){
+        /*
+         * system event
+         */
+        if(sig_check())
+            goto NextConnection;
+
+        if(OWPSessionsActive(p->cntrl,NULL)){
+            goto AGAIN;
+        }
+    }
+
+    /* Time's up! Get to work.        */
+    p->session_started = True;
+
+    /*
+     * If "sender" then Fetch the records the file does not have yet
+     * (up to this sub-session) from remote side into the file.
+     * -- initialize special 'send' control pointer if needed
+     * (if can't - don't fail on the error. This allows long-lived
+     * sessions to survive temporary network problems and show
+     * the loss! - just goto 'cleanup')
+     */
+    if(t->sender){
+        OWPSessionFinishedType  finished;
+
+        /*
+         * Fetch the new data into testfp
+         */
+        if(!FetchSession(p,&finished,&err_ret)){
+            if(err_ret >= OWPErrWARNING){
+                /*
+                 * Server denied request - report error
+                 */
+                I2ErrLog(eh,"OWPFetchSessionAppend(): Server denied request for session data seq_no[%llu-%llu]",
+                        appctx.opt.numBucketPackets*t->sum,
+                        appctx.opt.numBucketPackets*(t->sum+1));
+            }
+            /*
+             * If this fails - continue to next summary
+             * so we see packet loss during temporary network
+             * failures.
+             */
+            goto SumNext;
+        }
+
+        /*
+         * New records for the live statistics.
+         */
+        (void)PowLiveFeed(t->live,p->fp);
+    }
+
+    /*
+     * This section reads the packet records
+     * in the time period of this sum-session.
+     */
+    (void)OWPReadDataHeader(ctx,p->fp,&hdr);
+
+    /*
+     * If no data, then skip.
+     */
+    if(!hdr.header){
+        I2ErrLog(eh,"OWPReadDataHeader failed");
+        goto SessionEnd;
+    }
+
+    /*
+     * Create the stats record if empty. (first time in loop)
+     */
+    if(!t->stats){
+        if( !(t->stats = OWPStatsCreate(ctx,p->fp,&hdr,NULL,NULL,'m',
+                        appctx.opt.bucketWidth))){
+            I2ErrLog(eh,"OWPStatsCreate failed");
+            goto SessionEnd;
+        }
+    }
+    
+    /* Set the timestamp flag here */
+    if (appctx.opt.display_unix_ts == True)
+        t->stats->display_unix_ts = True;
+
+    /*
+     * Parse the data and compute the statistics
+     */
+    if( !OWPStatsParse(t->stats,NULL,t->stats->next_oset,
+                appctx.opt.numBucketPackets*t->sum,
+                (appctx.opt.numBucketPackets*(t->sum+1)))){
+        I2ErrLog(eh,"OWPStatsParse failed");
+        goto SessionEnd;
+    }
+
+    /*
+     * No more data to parse.
+     */
+    if(!p->call_stop && !t->stats->sent)
+        goto SessionEnd;
+
+    /*
+     * If we have read to the end of the stream, we need
+     * to clear the eof flag so the stream will work
+     * if the child process adds more records.
+     */
+    if(feof(p->fp)){
+        clearerr(p->fp);
+    }
+
+    /*
+     * Make a temporary sum-session file.
+     */
+    strcpy(tfname,t->dirpath);
+    sprintf(startname,OWP_TSTAMPFMT,t->startnum);
+    sprintf(endname,OWP_TSTAMPFMT,t->localstop);
+    sprintf(&tfname[t->file_offset],"%s%s%s%s%s",
+            startname,OWP_NAME_SEP,endname,POW_SUM_EXT,POW_INC_EXT);
+
+    while(!(fp = fopen(tfname,"w")) && errno==EINTR){
+        if(sig_check())
+            goto NextConnection;
+    }
+    if(!fp){
+
+        I2ErrLog(eh,"fopen(%s): %M",tfname);
+
+        /*
+         * Can't open the file.
+         */
+        switch(errno){
+            /*
+             * reasons to go to the next sum-session.
+             * (Temporary resource problems.)
+             */
+            case ENOMEM:
+            case EMFILE:
+            case ENFILE:
+            case ENOSPC:
+            case EDQUOT:
+                break;
+                /*
+                 * Everything else is a reason to exit
+                 * (Probably permissions.)
+                 */
+            default:
+                exit(1);
+                break;
+        }
+
+        /*
+         * Skip to next sum-session.
+         */
+        goto cleanup;
+    }
+    dotf=True;
+
+    /*
+     * File is good, write to it.
+     */
+    if(!write_summary(t,t->stats,fp,tfname)){
+        goto cleanup;
+    }
+
+    /*
+     * Relink the incomplete file as a complete one.
+     */
+    strcpy(fname,tfname);
+    sprintf(&fname[t->ext_offset],"%s",POW_SUM_EXT);
+    if(link(tfname,fname) != 0){
+        /* note, but ignore the error */
+        I2ErrLog(eh,"link(%s,%s): %M",tfname,fname);
+    }
+
+    if(appctx.opt.printfiles){
+        /* Make sure file is complete */
+        fflush(fp);
+        /* Now print the filename to stdout */
+        fprintf(stdout,"%s\n",fname);
+        fflush(stdout);
+    }
+
+cleanup:
+    if(fp){
+        fclose(fp);
+    }
+    fp = NULL;
+
+    /* unlink old name */
+    if(dotf && (unlink(tfname) != 0)){
+        /* note, but ignore the error */
+        I2ErrLog(eh,"unlink(%s): %M",tfname);
+    }
+    dotf=False;
+
+    /*
+     * In continuous mode each sum-session is also written
+     * out as a session file of its own.
+     */
+    if(appctx.opt.numSegments){
+        write_segment(p,t->startnum,t->localstop,t->stats->begin_oset,
+                appctx.opt.numBucketPackets*t->sum,
+                appctx.opt.numBucketPackets*(t->sum+1),NULL);
+        p->segfirst = appctx.opt.numBucketPackets*(t->sum+1);
+        p->segstartnum = t->localstop;
+        p->segoset = t->stats->next_oset;
+    }
+
+    if(!p->cntrl)
+        goto SessionEnd;
+
+SumNext:
+    t->sum++;
+    goto NextSum;
+
+SessionEnd:
+    if(p->cntrl && p->call_stop){
+        CntrlTimerStart();
+        rc = OWPStopSessions(p->cntrl,&pow_intr,&t->aval);
+        CntrlTimerStop();
+        if(rc < OWPErrWARNING){
+            OWPControlClose(p->cntrl);
+            p->cntrl = NULL;
+        }
+    }
+
+    /*
+     * Catch the live statistics up with the end of the session.
+     */
+    LiveUpdate(p);
+
+    /*
+     * Write out the complete owp session file.
+     */
+    write_session(p,t->aval,False);
+
+    /*
+     * The sender side has the rest of the records once the complete
+     * session has been fetched.
+     */
+    if(t->live && t->sender){
+        (void)PowLiveFeed(t->live,p->fp);
+    }
+
+    /*
+     * This session is complete - reset p.
+     */
+    p->numPackets = 0;
+    while(p->fp && (fclose(p->fp) != 0) && errno==EINTR);
+    while(p->testfp && (fclose(p->testfp) != 0) && errno==EINTR);
+    p->fp = p->testfp = NULL;
+    unlink_session_file(p);
+
+    if(t->sum < numSummaries){
+        /*
+         * This session ended prematurely - q needs to
+         * be reset for an immediate start time!.
+         */
+        ResetSession(q,p);
+    }
+
+    goto NextConnection;
+}
+
+/*
+ * Function:        AddTarget
+ *
+ * Description:
+ *              Add a path to measure to targets.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+static void
+AddTarget(
+        const char  *remote_test,
+        const char  *remote_serv,
+        OWPBoolean  sender
+        )
+{
+    pow_target  t;
+
+    if( !(t = realloc(targets,(ntargets+1)*sizeof(pow_target_rec)))){
+        I2ErrLog(eh,"realloc(): %M");
+        exit(1);
+    }
+    targets = t;
+    t = &targets[ntargets++];
+    memset(t,0,sizeof(*t));
+
+    if( !(t->remote_test = strdup(remote_test)) ||
+            !(t->remote_serv = strdup(remote_serv))){
+        I2ErrLog(eh,"malloc: %M");
+        exit(1);
+    }
+    t->sender = sender;
+
+    return;
+}
+
+/*
+ * Function:        ReadTargets
+ *
+ * Description:
+ *              Read the targets to measure from fname (-T). Each line
+ *              holds the arguments for one target:
+ *
+ *                  [-t] testaddr [servaddr]
+ *
+ *              -t sets the test direction from client to server for
+ *              that target. (The -t option does for all of them.)
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+static void
+ReadTargets(
+        const char  *fname
+        )
+{
+    FILE        *fp;
+    char        *lbuf = NULL;
+    size_t      lbuf_max = 0;
+    int         rc = 0;
+    char        *tok[4];
+    int         ntok;
+    int         i;
+    char        *s;
+    OWPBoolean  sender;
+
+    if(!(fp = fopen(fname,"r"))){
+        I2ErrLog(eh,"Unable to open %s: %M",fname);
+        exit(1);
+    }
+
+    while((rc = I2GetConfLine(eh,fp,rc,&lbuf,&lbuf_max)) > 0){
+        ntok = 0;
+        for(s = strtok(lbuf," \t\n");s && (ntok < 4);
+                s = strtok(NULL," \t\n")){
+            tok[ntok++] = s;
+        }
+
+        i = 0;
+        sender = appctx.opt.sender;
+        if(ntok && !strcmp(tok[0],"-t")){
+            sender = True;
+            i++;
+        }
+        if(((ntok - i) < 1) || ((ntok - i) > 2)){
+            I2ErrLog(eh,"%s:%d Invalid target (\"[-t] testaddr [servaddr]\" expected)",
+                    fname,rc);
+            exit(1);
+        }
+        AddTarget(tok[i],tok[ntok-1],sender);
+    }
+    if(rc < 0){
+        I2ErrLog(eh,"%s:%d Invalid file syntax",fname,-rc);
+        exit(1);
+    }
+
+    if(lbuf){
+        free(lbuf);
+    }
+    fclose(fp);
+
+    if(!ntargets){
+        I2ErrLog(eh,"%s: No targets",fname);
+        exit(1);
+    }
+
+    return;
+}
+
+/*
+ * Function:        RemoveStaleFiles
+ *
+ * Description:
+ *              Remove the temporary files (POWTMPFILEFMT session data
+ *              files and POW_INC_EXT files) left in the directory of t
+ *              by a powstream that did not exit cleanly. Only one
+ *              powstream can hold the lock of the output directory, so
+ *              none of them are in use.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+static void
+RemoveStaleFiles(
+        pow_target  t
+        )
+{
+    DIR             *dir;
+    struct dirent   *dp;
+    char            fname[PATH_MAX];
+    size_t          tmplen = strlen(POWTMPFILEFMT);
+    size_t          prelen = strcspn(POWTMPFILEFMT,"X");
+    size_t          inclen = strlen(POW_INC_EXT);
+    size_t          len;
+
+    if( !(dir = opendir((t->file_offset)? t->dirpath: "."))){
+        I2ErrLog(eh,"opendir(%s): %M",t->dirpath);
+        return;
+    }
+
+    while((dp = readdir(dir))){
+        len = strlen(dp->d_name);
+        if( !((len == tmplen) &&
+                    !strncmp(dp->d_name,POWTMPFILEFMT,prelen)) &&
+                !((len > inclen) &&
+                    !strcmp(&dp->d_name[len - inclen],POW_INC_EXT))){
+            continue;
+        }
+        if((t->file_offset + len + 1) > PATH_MAX){
+            continue;
+        }
+        strcpy(fname,t->dirpath);
+        strcpy(&fname[t->file_offset],dp->d_name);
+        if((unlink(fname) != 0) && (errno != ENOENT)){
+            /* note, but ignore the error */
+            I2ErrLog(eh,"unlink(%s): %M",fname);
+            continue;
+        }
+        if(appctx.opt.verbose){
+            I2ErrLog(eh,"Removed stale file %s",fname);
+        }
+    }
+
+    while((closedir(dir) != 0) && errno==EINTR);
 
-file_clean:
-    while((fclose(p->fp) != 0) && errno==EINTR);
-    p->fp = NULL;
-    while((fclose(p->testfp) != 0) && errno==EINTR);
-    p->testfp = NULL;
+    return;
+}
 
-cntrl_clean:
-    OWPControlClose(p->cntrl);
-    p->cntrl = NULL;
+/*
+ * Function:        InitTargets
+ *
+ * Description:
+ *              Setup the output directory, connections and live
+ *              statistics of each target. Targets from a target file
+ *              write to a sub-directory of dirpath named for the test
+ *              direction and testaddr. Their first sessions are spread
+ *              over the session duration, so the session rotations of
+ *              the targets do not all happen at the same time.
+ *
+ * In Args:
+ *
+ * Out Args:
+ *
+ * Scope:
+ * Returns:
+ * Side Effect:
+ */
+static void
+InitTargets(
+        OWPContext  ctx,
+        size_t      fname_len
+        )
+{
+    pow_target      t;
+    OWPTimeStamp    currtime;
+    char            livepath[PATH_MAX];
+    uint32_t        i,j;
 
-sctx_clean:
-    OWPScheduleContextFree(p->sctx);
-    p->sctx = NULL;
+    if(!OWPGetTimeOfDay(ctx,&currtime)){
+        I2ErrLog(eh,"OWPGetTimeOfDay: %M");
+        exit(1);
+    }
 
-fetch_clean:
-    if (p->fetch){
-        OWPControlClose(p->fetch);
-	p->fetch = NULL;
+    for(i=0;i<ntargets;i++){
+        t = &targets[i];
+
+        strcpy(t->dirpath,dirpath);
+        if(appctx.opt.targetfile){
+            if(strstr(t->remote_test,OWP_PATH_SEPARATOR) ||
+                    !strcmp(t->remote_test,".") ||
+                    !strcmp(t->remote_test,"..")){
+                I2ErrLog(eh,"Invalid testaddr \"%s\"",t->remote_test);
+                exit(1);
+            }
+            if((strlen(dirpath) + strlen(POW_RECV_PREFIX) +
+                        strlen(t->remote_test) +
+                        strlen(OWP_PATH_SEPARATOR) + fname_len + 1) >
+                    PATH_MAX){
+                I2ErrLog(eh,"%s: pathname too long",t->remote_test);
+                exit(1);
+            }
+            strcat(t->dirpath,
+                    (t->sender)? POW_SEND_PREFIX: POW_RECV_PREFIX);
+            strcat(t->dirpath,t->remote_test);
+            strcat(t->dirpath,OWP_PATH_SEPARATOR);
+
+            for(j=0;j<i;j++){
+                if(!strcmp(t->dirpath,targets[j].dirpath)){
+                    I2ErrLog(eh,"Duplicate target \"%s\"",t->remote_test);
+                    exit(1);
+                }
+            }
+
+            if((mkdir(t->dirpath,S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH)
+                        != 0) && (errno != EEXIST)){
+                I2ErrLog(eh,"mkdir(%s): %M",t->dirpath);
+                exit(1);
+            }
+        }
+        t->file_offset = strlen(t->dirpath);
+        t->ext_offset = t->file_offset + (2 * OWP_TSTAMPCHARS) +
+            strlen(OWP_NAME_SEP);
+        RemoveStaleFiles(t);
+
+        t->pcntrl[0].ctx = t->pcntrl[1].ctx = ctx;
+        t->pcntrl[0].tgt = t->pcntrl[1].tgt = t;
+        t->delayStart = appctx.opt.delayStart;
+        t->state = POW_STATE_NEXT;
+        t->wake = OWPNum64Add(currtime.owptime,
+                OWPULongToNum64((uint32_t)((uint64_t)sessionTime * i /
+                        ntargets)));
+
+        /*
+         * Setup the live statistics. The windows trail the current time
+         * by the loss timeout (and a second for the lost records to be
+         * written) so they only contain packets that have been received
+         * or lost.
+         */
+        if(appctx.opt.numLiveWindows){
+            strcpy(livepath,t->dirpath);
+            strcat(livepath,POW_LIVE_FILE);
+            if( !(t->live = PowLiveCreate(ctx,appctx.opt.liveWindows,
+                            appctx.opt.numLiveWindows,
+                            (uint32_t)ceil(appctx.opt.lossThreshold) + 1,
+                            livepath))){
+                I2ErrLog(eh,"Unable to initialize live statistics");
+                exit(1);
+            }
+        }
     }
 
-    return -1;
+    return;
 }
 
 int
@@ -1255,7 +2680,6 @@ main(
     int                 lockfd;
     char                lockpath[PATH_MAX];
     int                 rc;
-    OWPErrSeverity      err_ret = OWPErrOK;
     I2ErrLogSyslogAttr  syslogattr;
     OWPContext          ctx;
 
@@ -1264,17 +2688,17 @@ main(
     char                *endptr = NULL;
     char                optstring[128];
     static char         *conn_opts = "46A:k:S:u:I:";
-    static char         *test_opts = "c:E:i:L:s:tz:P:";
-    static char         *out_opts = "b:d:e:g:N:pRvU";
+    static char         *test_opts = "c:E:i:L:n:s:tT:z:P:";
+    static char         *out_opts = "b:Bd:e:g:N:pRvUW:";
     static char         *gen_opts = "hw";
     static char         *posixly_correct="POSIXLY_CORRECT=True";
 
-    int                 which=0;        /* which cntrl connect used */
-    uint32_t            numSummaries;
-    uint32_t            iotime;
     struct flock        flk;
     struct sigaction    act;
-    OWPStats            stats = NULL;
+    struct pollfd       *pfds;
+    pow_target          *ptgt;
+    nfds_t              nfds;
+    uint32_t            i;
 
     progname = (progname = strrchr(argv[0], '/')) ? progname+1 : *argv;
 
@@ -1409,6 +2833,14 @@ main(
                     exit(1);
                 }
                 break;
+            case 'n':
+                appctx.opt.numSegments = strtoul(optarg, &endptr, 10);
+                if((*endptr != '\0') || !appctx.opt.numSegments){
+                    usage(progname,
+                            "Invalid (-n) value. Positive integer expected");
+                    exit(1);
+                }
+                break;
             case 's':
                 appctx.opt.padding = strtoul(optarg, &endptr, 10);
                 if (*endptr != '\0') {
@@ -1420,6 +2852,12 @@ main(
             case 't':
                 appctx.opt.sender = True;
                 break;
+            case 'T':
+                if (!(appctx.opt.targetfile = strdup(optarg))) {
+                    I2ErrLog(eh,"malloc: %M");
+                    exit(1);
+                }
+                break;
             case 'z':
                 appctx.opt.delayStart = strtoul(optarg,&endptr,10);
                 if(*endptr != '\0'){
@@ -1499,9 +2937,37 @@ main(
             case 'p':
                 appctx.opt.printfiles = True;
                 break;
+            case 'B':
+                appctx.opt.binsummary = True;
+                break;
             case 'U':
                 appctx.opt.display_unix_ts = True;
                 break;
+            case 'W':
+                {
+                    char    *tok = optarg;
+
+                    appctx.opt.numLiveWindows = 0;
+                    while(tok){
+                        if(appctx.opt.numLiveWindows >= POW_LIVE_MAXWINDOWS){
+                            usage(progname,"Too many (-W) windows.");
+                            exit(1);
+                        }
+                        appctx.opt.liveWindows[appctx.opt.numLiveWindows] =
+                            strtoul(tok, &endptr, 10);
+                        if((endptr == tok) ||
+                                ((*endptr != '\0') && (*endptr != ',')) ||
+                                !appctx.opt.liveWindows[
+                                    appctx.opt.numLiveWindows]){
+                            usage(progname,
+                                    "Invalid (-W) value. Comma separated list of positive integers expected");
+                            exit(1);
+                        }
+                        appctx.opt.numLiveWindows++;
+                        tok = (*endptr == ',')? endptr+1: NULL;
+                    }
+                }
+                break;
             /* undocumented debug options */
 #ifndef        NDEBUG
             case 'w':
@@ -1526,16 +2992,20 @@ main(
     argc -= optind;
     argv += optind;
 
-    if((argc < 1) || (argc > 2)){
-        usage(progname, NULL);
-        exit(1);
+    if(appctx.opt.targetfile){
+        if(argc > 0){
+            usage(progname, "-T: No testaddr expected");
+            exit(1);
+        }
+        ReadTargets(appctx.opt.targetfile);
+    }
+    else{
+        if((argc < 1) || (argc > 2)){
+            usage(progname, NULL);
+            exit(1);
+        }
+        AddTarget(argv[0],argv[(argc > 1)? 1: 0],appctx.opt.sender);
     }
-
-    appctx.remote_test = argv[0];
-    if(argc > 1)
-        appctx.remote_serv = argv[1];
-    else
-        appctx.remote_serv = appctx.remote_test;
 
     /*
      * This is in reality dependent upon the actual protocol used
@@ -1548,7 +3018,7 @@ main(
     /*
      * Check savedir option. Make sure it will not make fnames
      * exceed PATH_MAX even with the nul byte.
-     * Also set file_offset and tstamp_offset to the lengths needed.
+     * (The offsets into the names of each target are set in InitTargets.)
      */
     fname_len = (2 * OWP_TSTAMPCHARS) + strlen(OWP_NAME_SEP) +
         MAX(strlen(OWP_FILE_EXT),strlen(POW_SUM_EXT)) + strlen(POW_INC_EXT);
@@ -1565,9 +3035,6 @@ main(
     else{
         dirpath[0] = '\0';
     }
-    file_offset = strlen(dirpath);
-    tstamp_offset = file_offset + OWP_TSTAMPCHARS;
-    ext_offset = tstamp_offset + OWP_TSTAMPCHARS + strlen(OWP_NAME_SEP);
 
     /*
      * Lock the directory for powstream.
@@ -1607,7 +3074,29 @@ main(
      * Verify that summary sessions are an even divisor of full
      * sessions.
      */
-    if(!appctx.opt.numBucketPackets){
+    if(appctx.opt.numSegments){
+        /*
+         * Continuous mode: a single test session of numSegments
+         * -c sized segments. Each segment is summarized and written
+         * out as its own session file.
+         */
+        if(appctx.opt.numBucketPackets &&
+                (appctx.opt.numBucketPackets != appctx.opt.numPackets)){
+            I2ErrLog(eh,"Number of summary packets (-N %d) must equal the number of segment packets (-c %d) with -n.",
+                    appctx.opt.numBucketPackets,appctx.opt.numPackets);
+            exit(1);
+        }
+        if(!appctx.opt.numPackets ||
+                (appctx.opt.numSegments > (0xFFFFFFFF/appctx.opt.numPackets))){
+            I2ErrLog(eh,"Too many packets (-c %d) per session (-n %d).",
+                    appctx.opt.numPackets,appctx.opt.numSegments);
+            exit(1);
+        }
+        appctx.opt.numBucketPackets = appctx.opt.numPackets;
+        numSummaries = appctx.opt.numSegments;
+        appctx.opt.numPackets *= appctx.opt.numSegments;
+    }
+    else if(!appctx.opt.numBucketPackets){
         appctx.opt.numBucketPackets = appctx.opt.numPackets;
         numSummaries = 0;
     }
@@ -1673,10 +3162,7 @@ main(
 
     owp_set_auth(ctx,progname,&appctx); 
 
-    memset(&pcntrl,0,2*sizeof(pow_cntrl_rec));
-    strcpy(pcntrl[0].fname,dirpath);
-    strcpy(pcntrl[1].fname,dirpath);
-    pcntrl[0].ctx = pcntrl[1].ctx = ctx;
+    InitTargets(ctx,fname_len);
 
     /*
      * Restrict INET address families
@@ -1732,7 +3218,8 @@ main(
 
     if((sigaction(SIGTERM,&act,NULL) != 0) ||
             (sigaction(SIGINT,&act,NULL) != 0) ||
-            (sigaction(SIGHUP,&act,NULL) != 0)){
+            (sigaction(SIGHUP,&act,NULL) != 0) ||
+            (sigaction(SIGALRM,&act,NULL) != 0)){
         I2ErrLog(eh,"sigaction(): %M");
         exit(1);
     }
@@ -1786,430 +3273,91 @@ main(
 #endif
 
     /*
-     * Main loop - loop over two connections collecting the data
-     * and placing a summary in the directory when the sum-session
-     * is complete.
-     *
+     * Main loop - run the sum-session loop of every target that is due
+     * (TargetStep), then wait in a single poll for the earliest wake
+     * time of the targets, or for the control connection of one of the
+     * sessions being waited for to become readable.
      */
-    while(1){
-        pow_cntrl       p,q;
-        OWPAcceptType   aval;
-        uint32_t        sum;
-        OWPNum64        stopnum;
-        OWPNum64        startnum,lastnum;
-        char            tfname[PATH_MAX];
-        char            fname[PATH_MAX];
-        char            startname[PATH_MAX];
-        char            endname[PATH_MAX];
-
-NextConnection:
-        sig_check();
-
-        /*
-         * p is the "connection" we are dealing with this loop
-         * iteration. We need a pointer to q to tell it what series
-         * start time to use based upon the end of the p series.
-         */
-        p = &pcntrl[which++];
-        which %= 2;
-        q = &pcntrl[which];
-
-	/* If the sessions haven't been initialized, do the init phase */
-        if(!p->numPackets){
-            (void)SetupSession(ctx,q,p,NULL);
-            goto NextConnection;
-        }
-
-        /* init vars for loop */
-        lastnum=OWPULongToNum64(0);
-        aval = OWP_CNTRL_ACCEPT;
+    if( !(pfds = calloc(ntargets,sizeof(struct pollfd))) ||
+            !(ptgt = calloc(ntargets,sizeof(pow_target)))){
+        I2ErrLog(eh,"calloc(): %M");
+        exit(1);
+    }
 
-        /*
-         * Make local copies of start/end - SetupSession modifies
-         * them.
-         */
-        p->currentSessionStartNum = p->nextSessionStartNum;
-        p->currentSessionEndNum = p->nextSessionEndNum;
+    while(1){
+        OWPTimeStamp    currtime;
+        OWPNum64        wakenum;
+        struct timespec reltime;
+        int             timeout;
+        pow_target      t;
 
-        if(appctx.opt.verbose > 1){
-            sprintf(startname,OWP_TSTAMPFMT,p->currentSessionStartNum);
-            sprintf(endname,OWP_TSTAMPFMT,p->currentSessionEndNum);
-            fprintf(stderr,"Starting session [%s - %s] v=%d\n",startname,endname,appctx.opt.verbose);
-        }
+        (void)sig_check();
 
-        /*
-         * Call StopSessionsWait (blocking) if no summaries
-         * are wanted.
-         */
-        if(!numSummaries){
-            /*
-             * Now try and setup the next full session (q).
-             * SetupSession checks for reset signals, and returns
-             * non-zero if one happend.
-             */
-            if(SetupSession(ctx,q,p,NULL))
-                goto NextConnection;
-            p->session_started = True;
-wait_again:
-	    rc = OWPStopSessionsWait(p->cntrl,NULL,&pow_intr,&aval,&err_ret);
-            if(rc<0){
-                /* error - reset sessions and start over. */
-                p->call_stop = False;
-                CloseSessions();
-                goto NextConnection;
+        for(i=0;i<ntargets;i++){
+            t = &targets[i];
+            if(!OWPGetTimeOfDay(ctx,&currtime)){
+                I2ErrLog(eh,"OWPGetTimeOfDay: %M");
+                exit(1);
             }
-            else if(rc==2){
-                /*
-                 * system event
-                 */
-                if(sig_check()){
-                    /* cleanup resources */
-                    goto NextConnection;
-                }
-                goto wait_again;
+            if(OWPNum64Cmp(t->wake,currtime.owptime) <= 0){
+                TargetStep(t);
             }
-            p->call_stop = False;
-
         }
 
-        /*
-         * This loops on each "sum" session - it completes when
-         * there are no more sum-sessions to fetch - i.e. the real
-         * test session is complete.
-         *
-         * stats structures are specific to the file - so any previous
-         * one is no longer valid when we get back here.
-         */
-        if(stats){
-            OWPStatsFree(stats);
-            stats = NULL;
+        if(!OWPGetTimeOfDay(ctx,&currtime)){
+            I2ErrLog(eh,"OWPGetTimeOfDay: %M");
+            exit(1);
         }
 
-        for(sum=0;sum<numSummaries;sum++){
-            uint32_t            nrecs;
-            OWPSessionHeaderRec hdr;
-            OWPNum64            localstop;
-            FILE                *fp=NULL;
-            OWPBoolean          dotf = False;
-
-            if(sig_check())
-                goto NextConnection;
-
-            /*
-             * lastnum contains offset for previous sum.
-             * So - currentSessionStart + lastnum is new
-             * startnum.
-             */
-            startnum = OWPNum64Add(p->currentSessionStartNum,lastnum);
-
-            /*
-             * This loop sets lastnum to the relative lastnum
-             * of this sum-session. (It starts at the relative
-             * offset of the lastnum from the previous session.)
-             */
-            for(nrecs=0;nrecs<appctx.opt.numBucketPackets;nrecs++){
-                lastnum = OWPNum64Add(lastnum,
-                        OWPScheduleContextGenerateNextDelta(p->sctx));
-
-            }
-            /*
-             * set localstop to absolute time of final packet.
-             */
-            localstop = OWPNum64Add(p->currentSessionStartNum,lastnum);
-
-            /*
-             * set stopnum to the time we should collect this
-             * session.
-             * sumsession can't be over until after
-             * lossThresh, then add iotime.
-             */
-            stopnum = OWPNum64Add(localstop,OWPNum64Add(tspec.loss_timeout,
-                        OWPULongToNum64(iotime)));
-
-            /*
-             * Now try and setup the next full session (q).
-             * SetupSession checks for reset signals, and returns
-             * non-zero if one happend.
-             */
-            if(SetupSession(ctx,q,p,&stopnum))
-                goto NextConnection;
-AGAIN:
-            /*
-             * Wait until this "sumsession" is complete.
-             */
-            if(p->call_stop){
-                rc = OWPStopSessionsWait(p->cntrl,&stopnum,&pow_intr,
-                        &aval,&err_ret);
-            }
-            else{
-                rc=1; /* no more data coming */
-            }
-
-            if(rc<0){
-                /* error */
-                OWPControlClose(p->cntrl);
-                p->cntrl = NULL;
-                break;
-            }
-            if(rc==0){
-                /* session over */
-                p->call_stop = False;
-                /*
-                 * If aval non-zero, session data is invalid.
-                 */
-                if(aval)
-                    break;
-            }
-            if(rc==2){
-                /*
-                 * system event
-                 */
-                if(sig_check())
-                    goto NextConnection;
-
-                if(OWPSessionsActive(p->cntrl,NULL)){
-                    goto AGAIN;
-                }
-            }
-
-            /* Time's up! Get to work.        */
-            p->session_started = True;
-
-            /*
-             * If "sender" then Fetch records for
-             * just this sub-session from remote side into the file.
-             * -- initialize special 'send' control pointer if needed
-             * (if can't - don't fail on the error. This allows long-lived
-             * sessions to survive temporary network problems and show
-             * the loss! - just goto 'cleanup')
-             */
-            if(appctx.opt.sender){
-                /*
-                 * Delete the stats record if it exists - this will
-                 * effectively create a new file, so the stats record
-                 * is no longer valid.
-                 */
-                if(stats){
-                    OWPStatsFree(stats);
-                    stats = NULL;
-                }
-
-                /*
-                 * Move file pointer to beginning and set file size to zero
-                 * before Fetching data.
-                 */
-                if(fseeko(p->testfp,0,SEEK_SET) != 0){
-                    I2ErrLog(eh,"fseeko(): %M");
-                    break;
-                }
-                if((rc = ftruncate(fileno(p->testfp),0)) != 0){
-                    I2ErrLog(eh,"write_session(): ftruncate(): %M");
-                    break;
-                }
-                /*
-                 * Refresh read-only file pointer due to above trunc
-                 */
-                if(fflush(p->fp) != 0){
-                    I2ErrLog(eh,"fflush(): %M");
-                    break;
-                }
-
-                /*
-                 * Fetch the data and put it in testfp
-                 */
-                nrecs = FetchSession(p,
-                        appctx.opt.numBucketPackets*sum,
-                        (appctx.opt.numBucketPackets*(sum+1))-1,
-                        &err_ret);
-                if(!nrecs){
-                    if(err_ret >= OWPErrWARNING){
-                        /*
-                         * Server denied request - report error
-                         */
-                        I2ErrLog(eh,"write_session(): OWPFetchSession(): Server denied request for session data seq_no[%llu-%llu]",
-                                appctx.opt.numBucketPackets*sum,
-                                appctx.opt.numBucketPackets*(sum+1));
-                    }
-                    /*
-                     * If this fails - continue to next summary
-                     * so we see packet loss during temporary network
-                     * failures.
-                     */
-                    continue;
-                }
-
-            }
-
-            /*
-             * This section reads the packet records
-             * in the time period of this sum-session.
-             */
-            (void)OWPReadDataHeader(ctx,p->fp,&hdr);
-
-            /*
-             * If no data, then skip.
-             */
-            if(!hdr.header){
-                I2ErrLog(eh,"OWPReadDataHeader failed");
-                break;
-            }
-
-            /*
-             * Create the stats record if empty. (first time in loop)
-             */
-            if(!stats){
-                if( !(stats = OWPStatsCreate(ctx,p->fp,&hdr,NULL,NULL,'m',
-                                appctx.opt.bucketWidth))){
-                    I2ErrLog(eh,"OWPStatsCreate failed");
-                    break;
-                }
-            }
-            
-            /* Set the timestamp flag here */
-            if (appctx.opt.display_unix_ts == True)
-                stats->display_unix_ts = True;
-
-            /*
-             * Parse the data and compute the statistics
-             */
-            if( !OWPStatsParse(stats,NULL,stats->next_oset,
-                        appctx.opt.numBucketPackets*sum,
-                        (appctx.opt.numBucketPackets*(sum+1)))){
-                I2ErrLog(eh,"OWPStatsParse failed");
-                break;
+        nfds = 0;
+        wakenum = targets[0].wake;
+        for(i=0;i<ntargets;i++){
+            t = &targets[i];
+            if(OWPNum64Cmp(t->wake,wakenum) < 0){
+                wakenum = t->wake;
             }
-
-            /*
-             * No more data to parse.
-             */
-            if(!p->call_stop && !stats->sent)
-                break;
-
-            /*
-             * If we have read to the end of the stream, we need
-             * to clear the eof flag so the stream will work
-             * if the child process adds more records.
-             */
-            if(feof(p->fp)){
-                clearerr(p->fp);
-            }
-
-            /*
-             * Make a temporary sum-session file.
-             */
-            strcpy(tfname,dirpath);
-            sprintf(startname,OWP_TSTAMPFMT,startnum);
-            sprintf(endname,OWP_TSTAMPFMT,localstop);
-            sprintf(&tfname[file_offset],"%s%s%s%s%s",
-                    startname,OWP_NAME_SEP,endname,POW_SUM_EXT,POW_INC_EXT);
-
-            while(!(fp = fopen(tfname,"w")) && errno==EINTR){
-                if(sig_check())
-                    goto NextConnection;
+            if((t->state != POW_STATE_NEXT) && t->p->cntrl &&
+                    t->p->call_stop){
+                pfds[nfds].fd = OWPControlFD(t->p->cntrl);
+                pfds[nfds].events = POLLIN;
+                pfds[nfds].revents = 0;
+                ptgt[nfds++] = t;
             }
-            if(!fp){
-
-                I2ErrLog(eh,"fopen(%s): %M",tfname);
-
-                /*
-                 * Can't open the file.
-                 */
-                switch(errno){
-                    /*
-                     * reasons to go to the next sum-session.
-                     * (Temporary resource problems.)
-                     */
-                    case ENOMEM:
-                    case EMFILE:
-                    case ENFILE:
-                    case ENOSPC:
-                    case EDQUOT:
-                        break;
-                        /*
-                         * Everything else is a reason to exit
-                         * (Probably permissions.)
-                         */
-                    default:
-                        exit(1);
-                        break;
-                }
+        }
 
-                /*
-                 * Skip to next sum-session.
-                 */
-                goto cleanup;
-            }
-            dotf=True;
+        if(OWPNum64Cmp(wakenum,currtime.owptime) > 0){
+            OWPNum64ToTimespec(&reltime,
+                    OWPNum64Sub(wakenum,currtime.owptime));
+            reltime.tv_sec = MIN(reltime.tv_sec,SETUP_ESTIMATE);
+            timeout = (reltime.tv_sec * 1000) +
+                ((reltime.tv_nsec + 999999) / 1000000);
+        }
+        else{
+            timeout = 0;
+        }
 
-            /*
-             * File is good, write to it.
-             */
-            if(!OWPStatsPrintMachine(stats,fp)){
-                goto cleanup;
+        rc = poll(pfds,nfds,timeout);
+        if(rc < 0){
+            if(errno != EINTR){
+                I2ErrLog(eh,"poll(): %M");
+                exit(1);
             }
 
             /*
-             * Relink the incomplete file as a complete one.
+             * Most likely SIGCHLD - the endpoint of one of the sessions
+             * may be done. (Reset/exit signals are handled by sig_check.)
              */
-            strcpy(fname,tfname);
-            sprintf(&fname[ext_offset],"%s",POW_SUM_EXT);
-            if(link(tfname,fname) != 0){
-                /* note, but ignore the error */
-                I2ErrLog(eh,"link(%s,%s): %M",tfname,fname);
-            }
-
-            if(appctx.opt.printfiles){
-                /* Make sure file is complete */
-                fflush(fp);
-                /* Now print the filename to stdout */
-                fprintf(stdout,"%s\n",fname);
-                fflush(stdout);
-            }
-
-cleanup:
-            if(fp){
-                fclose(fp);
+            for(i=0;i<nfds;i++){
+                ptgt[i]->wake = OWPULongToNum64(0);
             }
-            fp = NULL;
-
-            /* unlink old name */
-            if(dotf && (unlink(tfname) != 0)){
-                /* note, but ignore the error */
-                I2ErrLog(eh,"unlink(%s): %M",tfname);
-            }
-            dotf=False;
-
-            if(!p->cntrl)
-                break;
+            continue;
         }
 
-        if(p->cntrl && p->call_stop){
-            if(OWPStopSessions(p->cntrl,&pow_intr,&aval)<OWPErrWARNING){
-                OWPControlClose(p->cntrl);
-                p->cntrl = NULL;
+        for(i=0;i<nfds;i++){
+            if(pfds[i].revents){
+                ptgt[i]->wake = OWPULongToNum64(0);
             }
         }
-
-        /*
-         * Write out the complete owp session file.
-         */
-        write_session(p,aval,False);
-
-        /*
-         * This session is complete - reset p.
-         */
-        p->numPackets = 0;
-        while(p->fp && (fclose(p->fp) != 0) && errno==EINTR);
-        while(p->testfp && (fclose(p->testfp) != 0) && errno==EINTR);
-        p->fp = p->testfp = NULL;
-
-        if(sum < numSummaries){
-            /*
-             * This session ended prematurely - q needs to
-             * be reset for an immediate start time!.
-             */
-            ResetSession(q,p);
-        }
     }
 
     exit(0);
@@ -37,6 +37,13 @@
  */
 #define SETUP_ESTIMATE  10
 
+/*
+ * With more than one target, the longest (seconds) a single control
+ * exchange of one target may hold up the others. (A session set up
+ * later than SETUP_ESTIMATE misses its start time anyway.)
+ */
+#define POW_CNTRL_TIMEOUT   SETUP_ESTIMATE
+
 /*
  * Lock file name. This file is created in the output directory to ensure
  * there is not more than one powstream process writing there.
@@ -45,6 +52,25 @@
 #define POWTMPFILEFMT   "pow.XXXXXX"
 #define POW_INC_EXT     ".i"
 #define POW_SUM_EXT     ".sum"
+#define POW_RES_EXT     ".sumb"
+#define POW_LIVE_FILE   "powstream.live"
+
+/*
+ * Output sub-directories of the targets in a -T target file.
+ */
+#define POW_RECV_PREFIX "from_"
+#define POW_SEND_PREFIX "to_"
+
+/*
+ * Interval to poll a session for completion once it is due to end.
+ */
+#define POW_END_POLL    1       /* seconds */
+
+/*
+ * Live (sliding-window) statistics. (-W)
+ */
+#define POW_LIVE_MAXWINDOWS 8
+#define POW_LIVE_INTERVAL   1       /* seconds between reports */
 
 /*
  * Reasonable limits on these so dynamic memory is not needed.
@@ -82,31 +108,38 @@ typedef        struct {
 
         char        *savedir;           /* -d */
         I2Boolean   printfiles;         /* -p */
+        I2Boolean   binsummary;         /* -B */
         I2Boolean   display_unix_ts;    /* -U */
         int         facility;           /* -e */
                                         /* -r stderr too */
         int         verbose;            /* -v verbose */
         double      bucketWidth;        /* -b (seconds) */
         uint32_t    numBucketPackets;   /* -N */
+        uint32_t    numSegments;        /* -n */
         uint32_t    delayStart;         /* -z */
 
         uint32_t    retryDelay;         /* -I */
 
+        char        *targetfile;        /* -T */
+
+        uint32_t    liveWindows[POW_LIVE_MAXWINDOWS];   /* -W */
+        uint32_t    numLiveWindows;
+
         I2Boolean   setEndDelay;
         double      endDelay;           /* -E */
 
     } opt;
 
-    char            *remote_test;
-    char            *remote_serv;
-
     uint32_t        auth_mode;
 
     OWPContext      lib_ctx;
 } powapp_trec, *powapp_t;
 
+typedef struct pow_target_rec *pow_target;
+
 typedef struct pow_cntrl_rec{
     OWPContext          ctx;
+    pow_target          tgt;
     OWPControl          cntrl;
     OWPControl          fetch;
     OWPScheduleContext  sctx;
@@ -120,10 +153,102 @@ typedef struct pow_cntrl_rec{
 
     FILE                *fp;
     FILE                *testfp;
-    char                fname[PATH_MAX];
+    char                fname[PATH_MAX];    /* session data file, while
+                                               it is linked in dirpath */
     uint32_t           numPackets;
+    uint32_t           segfirst;           /* first packet, and start */
+    OWPNum64            segstartnum;        /* time, of the segment not
+                                               yet written (-n) */
+    off_t               segoset;            /* data file offset to start
+                                               reading it from */
     OWPBoolean          call_stop;
     OWPBoolean          session_started;
 } pow_cntrl_rec, *pow_cntrl;
 
+
+/*
+ * livestats.c
+ */
+typedef struct pow_live_rec *pow_live;
+
+extern pow_live
+PowLiveCreate(
+        OWPContext  ctx,
+        uint32_t    *windows,
+        uint32_t    nwindows,
+        uint32_t    lag,
+        const char  *fname
+        );
+
+extern void
+PowLiveFree(
+        pow_live    live
+        );
+
+extern void
+PowLiveNewFile(
+        pow_live    live,
+        OWPBoolean  newsession
+        );
+
+extern OWPBoolean
+PowLiveFeed(
+        pow_live    live,
+        FILE        *fp
+        );
+
+extern OWPBoolean
+PowLiveReport(
+        pow_live    live,
+        OWPNum64    now
+        );
+
+/*
+ * Where the sum-session loop of a target is waiting. (see TargetStep)
+ */
+typedef enum{
+    POW_STATE_NEXT=0,   /* set up/start collecting the next session  */
+    POW_STATE_WAIT,     /* for the end of the session (no -N)        */
+    POW_STATE_SUMWAIT   /* for the end of sum-session "sum"          */
+} pow_state;
+
+/*
+ * A measured path. All targets share the OWPContext (and pass-phrase)
+ * of the process, and are driven by the single loop in main.
+ */
+typedef struct pow_target_rec{
+    char                *remote_test;
+    char                *remote_serv;
+    OWPBoolean          sender;             /* -t */
+
+    /*
+     * Output directory of the target (see powstream.c)
+     */
+    char                dirpath[PATH_MAX];
+    uint32_t            file_offset;
+    uint32_t            ext_offset;
+
+    pow_cntrl_rec       pcntrl[2];
+    int                 which;
+    pow_cntrl           p;                  /* session being collected */
+    pow_cntrl           q;                  /* next session */
+    uint32_t            delayStart;         /* before the first session */
+
+    pow_live            live;               /* -W */
+    OWPNum64            livenext;
+    OWPStats            stats;
+
+    /*
+     * State of the sum-session loop
+     */
+    pow_state           state;
+    OWPNum64            wake;               /* run TargetStep again by */
+    OWPAcceptType       aval;
+    uint32_t            sum;
+    OWPNum64            lastnum;
+    OWPNum64            startnum;
+    OWPNum64            localstop;
+    OWPNum64            stopnum;
+} pow_target_rec;
+
 #endif
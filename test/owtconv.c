@@ -0,0 +1,207 @@
+/*
+ *      $Id$
+ */
+/************************************************************************
+ *                                                                      *
+ *                             Copyright (C)  2026                      *
+ *                                Internet2                             *
+ *                             All Rights Reserved                      *
+ *                                                                      *
+ ************************************************************************/
+/*
+ *        File:         owtconv.c
+ *
+ *        Description:
+ *              Verifies that a version 3 session file survives a
+ *              version 3 -> 4 -> 3 round trip with OWPConvertDataFile.
+ *              The session has lost packets (on and off the schedule),
+ *              reordered and duplicate packets and skip ranges. The
+ *              header, skip records and data records of every file are
+ *              compared to the originals.
+ */
+#include "owttest.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NPACKETS    20000
+
+static OWPSkipRec   skips[] = {{1000,1099},{5000,5000},{19990,19999}};
+
+typedef struct RecArrayRec{
+    OWPDataRec  *recs;
+    uint32_t    n;
+    uint32_t    size;
+} RecArrayRec, *RecArray;
+
+static int
+AddRec(
+        OWPDataRec  *rec,
+        void        *udata
+      )
+{
+    RecArray    ra = (RecArray)udata;
+
+    if(ra->n >= ra->size){
+        return -1;
+    }
+    ra->recs[ra->n++] = *rec;
+
+    return 0;
+}
+
+static OWPBoolean
+SameTStamp(
+        OWPTimeStamp    *a,
+        OWPTimeStamp    *b
+        )
+{
+    return ((a->owptime == b->owptime) && (a->sync == b->sync) &&
+            (a->multiplier == b->multiplier) && (a->scale == b->scale));
+}
+
+static FILE *
+Convert(
+        OWPContext  ctx,
+        FILE        *infp,
+        uint32_t    version
+        )
+{
+    FILE    *outfp;
+
+    outfp = OWTTmpFile();
+    rewind(infp);
+    if(!OWPConvertDataFile(ctx,infp,outfp,version)){
+        return NULL;
+    }
+
+    return outfp;
+}
+
+static int
+Compare(
+        I2ErrHandle         eh,
+        OWPContext          ctx,
+        const char          *name,
+        FILE                *fp,
+        uint32_t            version,
+        OWPSessionHeader    ohdr,
+        OWPDataRec          *orecs,
+        uint32_t            n
+        )
+{
+    OWPSessionHeaderRec hdr;
+    OWPSkipRec          fskips[I2Number(skips)];
+    RecArrayRec         ra;
+    uint32_t            i;
+    int                 rc = -1;
+
+    memset(&hdr,0,sizeof(hdr));
+    rewind(fp);
+    (void)OWPReadDataHeader(ctx,fp,&hdr);
+    if(!hdr.header || (hdr.version != version) ||
+            (hdr.finished != ohdr->finished) ||
+            (hdr.next_seqno != ohdr->next_seqno) ||
+            (hdr.num_skiprecs != ohdr->num_skiprecs) ||
+            (hdr.num_datarecs != n) ||
+            memcmp(hdr.sid,ohdr->sid,sizeof(OWPSID)) ||
+            (hdr.test_spec.start_time != ohdr->test_spec.start_time) ||
+            (hdr.test_spec.loss_timeout != ohdr->test_spec.loss_timeout) ||
+            (hdr.test_spec.npackets != ohdr->test_spec.npackets) ||
+            (hdr.test_spec.nslots != ohdr->test_spec.nslots)){
+        I2ErrLog(eh,"%s: session header differs",name);
+        return -1;
+    }
+
+    if(!OWPReadDataSkips(ctx,fp,hdr.num_skiprecs,fskips)){
+        I2ErrLog(eh,"%s: unable to read skip records",name);
+        return -1;
+    }
+    for(i=0;i<hdr.num_skiprecs;i++){
+        if((fskips[i].begin != skips[i].begin) ||
+                (fskips[i].end != skips[i].end)){
+            I2ErrLog(eh,"%s: skip record %u differs",name,i);
+            return -1;
+        }
+    }
+
+    ra.n = 0;
+    ra.size = n;
+    if( !(ra.recs = calloc(n,sizeof(OWPDataRec)))){
+        I2ErrLog(eh,"calloc(%u,OWPDataRec): %M",n);
+        exit(1);
+    }
+    if((fseeko(fp,hdr.oset_datarecs,SEEK_SET) != 0) ||
+            (OWPParseRecords(ctx,fp,hdr.num_datarecs,hdr.version,AddRec,
+                             &ra) != OWPErrOK) || (ra.n != n)){
+        I2ErrLog(eh,"%s: unable to read data records",name);
+        goto done;
+    }
+    for(i=0;i<n;i++){
+        if((ra.recs[i].seq_no != orecs[i].seq_no) ||
+                !SameTStamp(&ra.recs[i].send,&orecs[i].send) ||
+                !SameTStamp(&ra.recs[i].recv,&orecs[i].recv) ||
+                (ra.recs[i].ttl != orecs[i].ttl)){
+            I2ErrLog(eh,"%s: data record %u (seq_no=%u) differs",
+                    name,i,orecs[i].seq_no);
+            goto done;
+        }
+    }
+
+    fprintf(stdout,"%s: %u records identical, %lu bytes\n",name,n,
+            (unsigned long)hdr.sbuf.st_size);
+    rc = 0;
+
+done:
+    free(ra.recs);
+
+    return rc;
+}
+
+int
+main(
+        int     argc    __attribute__((unused)),
+        char    **argv
+    ) {
+    I2ErrHandle         eh;
+    OWPContext          ctx;
+    OWPSessionHeaderRec hdr;
+    OWPSlot             slot;
+    OWPDataRec          *recs;
+    uint32_t            n;
+    FILE                *fp3,*fp4,*fp33;
+    int                 rc = 0;
+
+    eh = OWTInit(argv,&ctx);
+    OWTSeed(0x0102030405060708ULL);
+
+    /*
+     * Session: 10 packets a second, exponentially distributed.
+     */
+    memset(&slot,0,sizeof(slot));
+    slot.rand_exp.slot_type = OWPSlotRandExpType;
+    slot.rand_exp.mean = OWPDoubleToNum64(0.1);
+    OWTSessionHeader(&hdr,&slot,NPACKETS);
+
+    if( !(recs = calloc(2*NPACKETS,sizeof(OWPDataRec)))){
+        I2ErrLog(eh,"calloc(%d,OWPDataRec): %M",2*NPACKETS);
+        exit(1);
+    }
+    n = OWTMakeRecs(ctx,&hdr,skips,I2Number(skips),recs,2*NPACKETS);
+
+    fp3 = OWTWriteV3(ctx,&hdr,skips,I2Number(skips),recs,n);
+    if((Compare(eh,ctx,"v3",fp3,3,&hdr,recs,n) != 0) ||
+            !(fp4 = Convert(ctx,fp3,4)) ||
+            (Compare(eh,ctx,"v3->v4",fp4,4,&hdr,recs,n) != 0) ||
+            !(fp33 = Convert(ctx,fp4,3)) ||
+            (Compare(eh,ctx,"v3->v4->v3",fp33,3,&hdr,recs,n) != 0)){
+        rc = 1;
+    }
+
+    free(recs);
+    OWPContextFree(ctx);
+
+    exit(rc);
+}
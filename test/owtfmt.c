@@ -0,0 +1,224 @@
+/*
+ *      $Id$
+ */
+/************************************************************************
+ *                                                                      *
+ *                             Copyright (C)  2026                      *
+ *                                Internet2                             *
+ *                             All Rights Reserved                      *
+ *                                                                      *
+ ************************************************************************/
+/*
+ *        File:         owtfmt.c
+ *
+ *        Description:
+ *              Verifies that OWPRecFormatter output is byte-identical to
+ *              the fprintf formats it replaced (OWPStatsParse per-record
+ *              output and owping -R) for a pseudo-random set of records
+ *              in every scale. CSV has no previous format to compare to.
+ */
+#include "owttest.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NRECS   200000
+
+#define RAWFMT "%lu " OWP_TSTAMPFMT " %u %g " OWP_TSTAMPFMT " %u %g %u\n"
+
+/*
+ * The per-record formats previously printed by OWPStatsParse.
+ */
+static void
+PrintText(
+        FILE        *out,
+        OWPRecFmt   fmt,
+        float       scale_factor,
+        const char  *scale_abrv,
+        OWPDataRec  *rec
+        )
+{
+    double  d,derr;
+
+    if(OWPIsLostRecord(rec)){
+        fprintf(out,"seq_no=%-10u *LOST*\n", rec->seq_no);
+        return;
+    }
+
+    d = OWPDelay(&rec->send, &rec->recv);
+    derr = OWPGetTimeStampError(&rec->send) +
+        OWPGetTimeStampError(&rec->recv);
+
+    if(rec->send.sync && rec->recv.sync){
+        if(fmt == OWPRecFmtUnixTS){
+            double epochdiff = (OWPULongToNum64(OWPJAN_1970))>>32;
+            fprintf(out,
+                    "seq_no=%d delay=%e %s (sync, err=%.3g %s) sent=%f recv=%f\n",
+                    rec->seq_no, d*scale_factor, scale_abrv,
+                    derr*scale_factor, scale_abrv,
+                    OWPNum64ToDouble(rec->send.owptime) - epochdiff,
+                    OWPNum64ToDouble(rec->recv.owptime) - epochdiff
+                   );
+        }
+        else{
+            fprintf(out,
+                    "seq_no=%-10u delay=%.3g %s\t(sync, err=%.3g %s)\n",
+                    rec->seq_no, d*scale_factor, scale_abrv,
+                    derr*scale_factor,scale_abrv);
+        }
+    }
+    else{
+        fprintf(out,
+                "seq_no=%-10u delay=%.3g %s\t(unsync)\n",
+                rec->seq_no, d*scale_factor,scale_abrv);
+    }
+
+    return;
+}
+
+/*
+ * The format previously printed by owping -R.
+ */
+static void
+PrintRaw(
+        FILE        *out,
+        OWPDataRec  *rec
+        )
+{
+    fprintf(out,RAWFMT,(unsigned long)rec->seq_no,
+            rec->send.owptime,rec->send.sync,
+            OWPGetTimeStampError(&rec->send),
+            rec->recv.owptime,rec->recv.sync,
+            OWPGetTimeStampError(&rec->recv),
+            rec->ttl);
+    return;
+}
+
+/*
+ * Compare the contents of a and b line by line, reporting the first
+ * difference.
+ */
+static int
+CompareOutput(
+        I2ErrHandle eh,
+        const char  *name,
+        FILE        *a,
+        FILE        *b
+        )
+{
+    char        abuf[1024];
+    char        bbuf[1024];
+    char        *ap,*bp;
+    uint32_t    line = 0;
+
+    rewind(a);
+    rewind(b);
+
+    while(1){
+        ap = fgets(abuf,sizeof(abuf),a);
+        bp = fgets(bbuf,sizeof(bbuf),b);
+        line++;
+        if(!ap && !bp){
+            return 0;
+        }
+        if(!ap || !bp || strcmp(abuf,bbuf)){
+            I2ErrLog(eh,"%s: line %u differs:\n  printf: %s  format: %s",
+                    name,line,(bp)? bbuf: "(EOF)\n",(ap)? abuf: "(EOF)\n");
+            return -1;
+        }
+    }
+}
+
+int
+main(
+        int     argc    __attribute__((unused)),
+        char    **argv
+    ) {
+    I2ErrHandle         eh;
+    OWPContext          ctx;
+    OWPDataRec          *recs;
+    char                scales[] = {'s','m','u','n'};
+    OWPRecFmt           fmts[] = {OWPRecFmtDefault,OWPRecFmtUnixTS,
+                                    OWPRecFmtRaw};
+    char                *fmtnames[] = {"default","unixts","raw"};
+    char                name[64];
+    char                scale_abrv[3];
+    size_t              abrv_len;
+    float               scale_factor;
+    OWPRecFormatter     formatter;
+    FILE                *ffp,*pfp;
+    unsigned int        i,j,k;
+    int                 rc = 0;
+
+    eh = OWTInit(argv,&ctx);
+    OWTSeed(0x2872979303ab47eeULL);
+
+    if( !(recs = calloc(NRECS,sizeof(OWPDataRec)))){
+        I2ErrLog(eh,"calloc(%d,OWPDataRec): %M",NRECS);
+        exit(1);
+    }
+    for(k=0;k<NRECS;k++){
+        OWTRandRec(&recs[k]);
+    }
+
+    for(i=0;i<I2Number(fmts);i++){
+        for(j=0;j<I2Number(scales);j++){
+            /* raw output is not scaled */
+            if((fmts[i] == OWPRecFmtRaw) && j){
+                break;
+            }
+
+            memset(scale_abrv,0,sizeof(scale_abrv));
+            abrv_len = sizeof(scale_abrv);
+            scale_factor = OWPStatsScaleFactor(scales[j],scale_abrv,
+                    &abrv_len);
+            if(scale_factor == 0.0){
+                I2ErrLog(eh,"OWPStatsScaleFactor(%c) failed",scales[j]);
+                exit(1);
+            }
+
+            ffp = OWTTmpFile();
+            pfp = OWTTmpFile();
+            formatter = OWPRecFormatterCreate(ctx,ffp,fmts[i],scales[j]);
+            if( !formatter){
+                I2ErrLog(eh,"OWPRecFormatterCreate failed");
+                exit(1);
+            }
+
+            for(k=0;k<NRECS;k++){
+                if( !OWPRecFormatterWrite(formatter,&recs[k])){
+                    I2ErrLog(eh,"OWPRecFormatterWrite failed");
+                    exit(1);
+                }
+                if(fmts[i] == OWPRecFmtRaw){
+                    PrintRaw(pfp,&recs[k]);
+                }
+                else{
+                    PrintText(pfp,fmts[i],scale_factor,scale_abrv,&recs[k]);
+                }
+            }
+            if( !OWPRecFormatterFree(formatter)){
+                I2ErrLog(eh,"OWPRecFormatterFree failed");
+                exit(1);
+            }
+
+            snprintf(name,sizeof(name),"%s(%c)",fmtnames[i],scales[j]);
+            if(CompareOutput(eh,name,ffp,pfp) != 0){
+                rc = 1;
+            }
+            else{
+                fprintf(stdout,"%s: %d records identical\n",name,NRECS);
+            }
+
+            fclose(ffp);
+            fclose(pfp);
+        }
+    }
+
+    free(recs);
+    OWPContextFree(ctx);
+
+    exit(rc);
+}
@@ -0,0 +1,310 @@
+/*
+ *      $Id$
+ */
+/************************************************************************
+ *                                                                      *
+ *                             Copyright (C)  2026                      *
+ *                                Internet2                             *
+ *                             All Rights Reserved                      *
+ *                                                                      *
+ ************************************************************************/
+/*
+ *        File:         owtreord.c
+ *
+ *        Description:
+ *              Verifies the reordering, IPDV and PDV statistics of
+ *              OWPStatsParse for a short session with a known arrival
+ *              order and known delays. The expected values were worked
+ *              out by hand from the definitions (n-reordering and the
+ *              RFC 4737 reordered ratio, extent and gap; RFC 3393 ipdv
+ *              of consecutive packets; PDV relative to the minimum).
+ */
+#include "owttest.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#define BUCKETWIDTH 0.001
+
+/*
+ * Delays are differences of absolute timestamps converted to double,
+ * which are only good to a fraction of a microsecond.
+ */
+#define EPSILON     1e-6
+
+/*
+ * Packets in the order they arrive. Delays (ms) are not multiples of the
+ * bucket width, and neither are the differences of consecutive packets,
+ * so each one falls in one bucket without doubt.
+ *
+ *  - 3 arrives after 5: 1-reordered, extent 1
+ *  - 4 arrives after 3: not n-reordered, extent 2
+ *  - 8 arrives after 9: 1-reordered, extent 1
+ *  - 12 arrives after 14,15,16: 3-reordered, extent 3
+ *  - 13 arrives after 12: not n-reordered, extent 4
+ *
+ * The discontinuities (5, 9 and 14) are each followed by reordering,
+ * so there are gaps of 9-5 and 14-9.
+ */
+static struct{
+    uint32_t    seq;
+    double      delay;
+} arrivals[] = {
+    {0,10.5},   {1,12.25},  {2,11.5},   {5,10.25},  {3,15.25},
+    {4,10.5},   {6,20.5},   {7,13.25},  {9,11.25},  {8,11.5},
+    {10,12.5},  {11,30.25}, {14,11.5},  {15,10.25}, {16,12.5},
+    {12,10.5},  {13,14.25}, {17,10.25}
+};
+#define NARRIVALS   ((uint32_t)I2Number(arrivals))
+
+/* j-reordering counts (j = 1..3) */
+static uint32_t reordering[] = {3,1,1};
+#define NREORDERING ((uint32_t)I2Number(reordering))
+
+static int
+CheckEqual(
+        I2ErrHandle eh,
+        const char  *name,
+        double      val,
+        double      expected
+        )
+{
+    if(fabs(val - expected) > EPSILON){
+        I2ErrLog(eh,"%s: %.9g (expected %.9g)",name,val,expected);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+CheckPercentile(
+        I2ErrHandle     eh,
+        OWPStatsResult  result,
+        OWPBoolean      ipdv,
+        double          alpha,
+        double          expected
+        )
+{
+    char        name[64];
+    double      val;
+    OWPBoolean  rc;
+
+    snprintf(name,sizeof(name),"%s P%g",(ipdv)? "ipdv": "delay",alpha*100);
+    rc = (ipdv)? OWPStatsResultIPDVPercentile(result,alpha,&val):
+        OWPStatsResultPercentile(result,alpha,&val);
+    if(!rc){
+        I2ErrLog(eh,"%s: not available",name);
+        return -1;
+    }
+
+    return CheckEqual(eh,name,val,expected);
+}
+
+/*
+ * The value of key in the machine readable summary of result. (PDV is
+ * only printed there.)
+ */
+static int
+CheckMachine(
+        I2ErrHandle     eh,
+        OWPStatsResult  result,
+        const char      *key,
+        double          expected
+        )
+{
+    FILE    *fp = OWTTmpFile();
+    char    line[1024];
+    size_t  len = strlen(key);
+    int     rc = -1;
+
+    if( !OWPStatsResultPrintMachine(result,fp)){
+        I2ErrLog(eh,"OWPStatsResultPrintMachine failed");
+        exit(1);
+    }
+
+    rewind(fp);
+    while(fgets(line,sizeof(line),fp)){
+        if(!strncmp(line,key,len) && (line[len] == '\t')){
+            rc = CheckEqual(eh,key,strtod(&line[len+1],NULL),expected);
+            goto done;
+        }
+    }
+    I2ErrLog(eh,"%s: not printed",key);
+
+done:
+    fclose(fp);
+
+    return rc;
+}
+
+static int
+Check(
+        I2ErrHandle     eh,
+        OWPStatsResult  r
+        )
+{
+    uint32_t    i;
+    int         rc = 0;
+
+    /*
+     * Counts
+     */
+    if((r->sent != NARRIVALS) || r->lost || r->dups ||
+            (r->narrived != NARRIVALS) ||
+            (r->nrecv != NARRIVALS)){
+        I2ErrLog(eh,"sent %u lost %u dups %u arrived %u recv %u "
+                "(expected %u, no loss or duplicates)",r->sent,r->lost,
+                r->dups,r->narrived,r->nrecv,NARRIVALS);
+        return -1;
+    }
+
+    /*
+     * n-reordering
+     */
+    if(r->nreordering != NREORDERING){
+        I2ErrLog(eh,"%u j-reordering counts (expected %u)",r->nreordering,
+                NREORDERING);
+        return -1;
+    }
+    for(i=0;i<NREORDERING;i++){
+        if(r->reordering[i] != reordering[i]){
+            I2ErrLog(eh,"%u-reordering: %u (expected %u)",i+1,
+                    r->reordering[i],reordering[i]);
+            rc = -1;
+        }
+    }
+
+    /*
+     * RFC 4737
+     */
+    if((r->reordered != 5) || (r->extent_max != 4) ||
+            (r->extent_sum != 11) || r->extent_unknown ||
+            (r->gap_num != 2) || (r->gap_max != 5) || (r->gap_sum != 9)){
+        I2ErrLog(eh,"reordered %u extent max/sum/unknown %u/%lu/%u "
+                "gap num/max/sum %u/%u/%lu (expected 5 4/11/0 2/5/9)",
+                r->reordered,r->extent_max,(unsigned long)r->extent_sum,
+                r->extent_unknown,r->gap_num,r->gap_max,
+                (unsigned long)r->gap_sum);
+        rc = -1;
+    }
+
+    /*
+     * Delay and PDV (relative to the minimum delay). The percentiles
+     * are the upper bounds of the buckets.
+     */
+    if(!r->have_delay ||
+            (CheckEqual(eh,"min delay",r->min_delay,0.01025) != 0) ||
+            (CheckEqual(eh,"max delay",r->max_delay,0.03025) != 0) ||
+            (CheckPercentile(eh,r,False,0.5,0.012) != 0) ||
+            (CheckPercentile(eh,r,False,0.95,0.031) != 0) ||
+            (CheckMachine(eh,r,"PDV_P50",0.00175) != 0) ||
+            (CheckMachine(eh,r,"PDV_P95",0.02075) != 0)){
+        rc = -1;
+    }
+
+    /*
+     * IPDV of the 17 consecutive pairs. (Negative ipdv are rounded
+     * down to their bucket.)
+     */
+    if(r->ipdv_n != NARRIVALS - 1){
+        I2ErrLog(eh,"%u ipdv samples (expected %u)",r->ipdv_n,
+                NARRIVALS - 1);
+        return -1;
+    }
+    if((CheckEqual(eh,"ipdv min",r->ipdv_min,-0.01975) != 0) ||
+            (CheckEqual(eh,"ipdv max",r->ipdv_max,0.01775) != 0) ||
+            (CheckEqual(eh,"ipdv sum",r->ipdv_sum,-0.00025) != 0) ||
+            (CheckEqual(eh,"ipdv abssum",r->ipdv_abssum,0.08175) != 0) ||
+            (CheckPercentile(eh,r,True,0.0,-0.020) != 0) ||
+            (CheckPercentile(eh,r,True,0.5,-0.001) != 0) ||
+            (CheckPercentile(eh,r,True,0.95,0.018) != 0)){
+        rc = -1;
+    }
+
+    return rc;
+}
+
+int
+main(
+        int     argc    __attribute__((unused)),
+        char    **argv
+    ) {
+    I2ErrHandle         eh;
+    OWPContext          ctx;
+    OWPSessionHeaderRec hdr;
+    OWPSlot             slot;
+    OWPScheduleContext  sctx;
+    OWPNum64            sched[NARRIVALS];
+    OWPDataRec          recs[NARRIVALS];
+    FILE                *fp;
+    OWPStats            stats;
+    OWPStatsResult      result;
+    uint32_t            i;
+    int                 rc = 0;
+
+    eh = OWTInit(argv,&ctx);
+
+    /*
+     * Session: a packet every millisecond.
+     */
+    memset(&slot,0,sizeof(slot));
+    slot.any.slot_type = OWPSlotLiteralType;
+    slot.literal.offset = OWPDoubleToNum64(0.001);
+    OWTSessionHeader(&hdr,&slot,NARRIVALS);
+
+    if( !(sctx = OWPScheduleContextCreate(ctx,hdr.sid,&hdr.test_spec))){
+        I2ErrLog(eh,"OWPScheduleContextCreate failed");
+        exit(1);
+    }
+    sched[0] = OWPNum64Add(hdr.test_spec.start_time,
+            OWPScheduleContextGenerateNextDelta(sctx));
+    for(i=1;i<NARRIVALS;i++){
+        sched[i] = OWPNum64Add(sched[i-1],
+                OWPScheduleContextGenerateNextDelta(sctx));
+    }
+    OWPScheduleContextFree(sctx);
+
+    memset(recs,0,sizeof(recs));
+    for(i=0;i<NARRIVALS;i++){
+        recs[i].seq_no = arrivals[i].seq;
+        recs[i].send.sync = recs[i].recv.sync = 1;
+        recs[i].send.scale = recs[i].recv.scale = 1;
+        recs[i].send.multiplier = recs[i].recv.multiplier = 1;
+        recs[i].send.owptime = sched[arrivals[i].seq];
+        recs[i].recv.owptime = OWPNum64Add(recs[i].send.owptime,
+                OWPDoubleToNum64(arrivals[i].delay / 1000.0));
+        recs[i].ttl = 255;
+    }
+    fp = OWTWriteV3(ctx,&hdr,NULL,0,recs,NARRIVALS);
+
+    memset(&hdr,0,sizeof(hdr));
+    rewind(fp);
+    (void)OWPReadDataHeader(ctx,fp,&hdr);
+    if( !hdr.header ||
+            !(stats = OWPStatsCreate(ctx,fp,&hdr,NULL,NULL,'m',
+                    BUCKETWIDTH)) ||
+            !OWPStatsParse(stats,NULL,0,0,~0) ||
+            !(result = OWPStatsResultCreate(stats))){
+        I2ErrLog(eh,"unable to compute the stats of the session");
+        exit(1);
+    }
+
+    if(Check(eh,result) != 0){
+        rc = 1;
+    }
+    else{
+        fprintf(stdout,"%u packets: reordering, ipdv and pdv as expected\n",
+                NARRIVALS);
+    }
+
+    OWPStatsResultFree(result);
+    OWPStatsFree(stats);
+    fclose(fp);
+    OWPContextFree(ctx);
+
+    exit(rc);
+}
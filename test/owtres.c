@@ -0,0 +1,357 @@
+/*
+ *      $Id$
+ */
+/************************************************************************
+ *                                                                      *
+ *                             Copyright (C)  2026                      *
+ *                                Internet2                             *
+ *                             All Rights Reserved                      *
+ *                                                                      *
+ ************************************************************************/
+/*
+ *        File:         owtres.c
+ *
+ *        Description:
+ *              Verifies that an OWPStatsResult survives a round trip
+ *              through OWPStatsResultWrite and OWPStatsResultRead: the
+ *              record read back must have the same counts, delay and
+ *              IPDV buckets, TTL counts and reordering results, print
+ *              the same machine readable summary, and encode to the
+ *              same bytes. Truncated encodings must be rejected.
+ */
+#include "owttest.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NPACKETS    20000
+#define NTRUNCATED  16
+
+/*
+ * The encoding of result (in a new tmpfile, rewound). Its size is
+ * returned in size_ret.
+ */
+static FILE *
+Encode(
+        I2ErrHandle     eh,
+        OWPContext      ctx,
+        OWPStatsResult  result,
+        long            *size_ret
+        )
+{
+    FILE    *fp = OWTTmpFile();
+
+    if( !OWPStatsResultWrite(ctx,result,fp) || (fflush(fp) != 0) ||
+            ((*size_ret = ftell(fp)) < 0)){
+        I2ErrLog(eh,"OWPStatsResultWrite failed");
+        exit(1);
+    }
+    rewind(fp);
+
+    return fp;
+}
+
+/*
+ * Compare the contents of a and b from the start (printed or encoded).
+ */
+static OWPBoolean
+SameContents(
+        FILE    *a,
+        FILE    *b
+        )
+{
+    int ca,cb;
+
+    rewind(a);
+    rewind(b);
+    do{
+        ca = getc(a);
+        cb = getc(b);
+        if(ca != cb){
+            return False;
+        }
+    }while(ca != EOF);
+
+    return True;
+}
+
+static OWPBoolean
+SameBuckets(
+        OWPStatsBucketRec   *a,
+        uint32_t            na,
+        OWPStatsBucketRec   *b,
+        uint32_t            nb
+        )
+{
+    uint32_t    i;
+
+    if(na != nb){
+        return False;
+    }
+    for(i=0;i<na;i++){
+        if((a[i].b != b[i].b) || (a[i].n != b[i].n)){
+            return False;
+        }
+    }
+
+    return True;
+}
+
+static int
+Compare(
+        I2ErrHandle     eh,
+        OWPStatsResult  a,
+        OWPStatsResult  b
+        )
+{
+    double      alphas[] = {0.0,0.5,0.95,1.0};
+    double      da,db;
+    OWPBoolean  ra,rb;
+    uint32_t    i;
+
+    if(memcmp(a->sid,b->sid,sizeof(OWPSID)) ||
+            strcmp(a->fromhost,b->fromhost) ||
+            strcmp(a->fromaddr,b->fromaddr) ||
+            strcmp(a->fromserv,b->fromserv) ||
+            strcmp(a->tohost,b->tohost) ||
+            strcmp(a->toaddr,b->toaddr) ||
+            strcmp(a->toserv,b->toserv) ||
+            (a->start_time != b->start_time) ||
+            (a->end_time != b->end_time) ||
+            (a->display_unix_ts != b->display_unix_ts) ||
+            (a->typeP != b->typeP) ||
+            (a->loss_timeout != b->loss_timeout) ||
+            (a->packet_padding != b->packet_padding) ||
+            (a->session_npackets != b->session_npackets) ||
+            (a->sample_npackets != b->sample_npackets) ||
+            (a->bucketwidth != b->bucketwidth) ||
+            (a->finished != b->finished)){
+        I2ErrLog(eh,"session information differs");
+        return -1;
+    }
+
+    if((a->sent != b->sent) || (a->lost != b->lost) ||
+            (a->dups != b->dups) || (a->sync != b->sync) ||
+            (a->maxerr != b->maxerr) ||
+            (a->have_delay != b->have_delay) ||
+            (a->min_delay != b->min_delay) ||
+            (a->max_delay != b->max_delay) ||
+            !SameBuckets(a->buckets,a->nbuckets,b->buckets,b->nbuckets)){
+        I2ErrLog(eh,"counts or delays differ");
+        return -1;
+    }
+
+    if((a->ipdv_n != b->ipdv_n) || (a->ipdv_min != b->ipdv_min) ||
+            (a->ipdv_max != b->ipdv_max) ||
+            (a->ipdv_sum != b->ipdv_sum) ||
+            (a->ipdv_abssum != b->ipdv_abssum) ||
+            !SameBuckets(a->ipdvbuckets,a->nipdvbuckets,
+                b->ipdvbuckets,b->nipdvbuckets)){
+        I2ErrLog(eh,"IPDV differs");
+        return -1;
+    }
+
+    if(memcmp(a->ttl_count,b->ttl_count,sizeof(a->ttl_count))){
+        I2ErrLog(eh,"TTL counts differ");
+        return -1;
+    }
+
+    if((a->reorder_window != b->reorder_window) ||
+            (a->narrived != b->narrived) ||
+            (a->nreordering != b->nreordering) ||
+            (a->nrecv != b->nrecv) ||
+            (a->reordered != b->reordered) ||
+            (a->extent_max != b->extent_max) ||
+            (a->extent_unknown != b->extent_unknown) ||
+            (a->extent_sum != b->extent_sum) ||
+            (a->gap_num != b->gap_num) ||
+            (a->gap_max != b->gap_max) ||
+            (a->gap_sum != b->gap_sum)){
+        I2ErrLog(eh,"reordering differs");
+        return -1;
+    }
+    for(i=0;i<a->nreordering;i++){
+        if(a->reordering[i] != b->reordering[i]){
+            I2ErrLog(eh,"%u-reordering differs",i+1);
+            return -1;
+        }
+    }
+
+    for(i=0;i<I2Number(alphas);i++){
+        ra = OWPStatsResultPercentile(a,alphas[i],&da);
+        rb = OWPStatsResultPercentile(b,alphas[i],&db);
+        if((ra != rb) || (ra && (da != db))){
+            I2ErrLog(eh,"delay percentile %g differs",alphas[i]);
+            return -1;
+        }
+        ra = OWPStatsResultIPDVPercentile(a,alphas[i],&da);
+        rb = OWPStatsResultIPDVPercentile(b,alphas[i],&db);
+        if((ra != rb) || (ra && (da != db))){
+            I2ErrLog(eh,"IPDV percentile %g differs",alphas[i]);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Every prefix of the encoding in fp (of size bytes) that is tried must
+ * be rejected by OWPStatsResultRead.
+ */
+static int
+CheckTruncated(
+        I2ErrHandle eh,
+        OWPContext  ctx,
+        FILE        *fp,
+        long        size
+        )
+{
+    char            *buf;
+    FILE            *tfp;
+    OWPStatsResult  result;
+    long            len;
+    unsigned int    i;
+    int             rc = 0;
+
+    if( !(buf = malloc(size))){
+        I2ErrLog(eh,"malloc(%ld): %M",size);
+        exit(1);
+    }
+    rewind(fp);
+    if(fread(buf,size,1,fp) != 1){
+        I2ErrLog(eh,"fread(): %M");
+        exit(1);
+    }
+
+    for(i=0;i<=NTRUNCATED;i++){
+        /* the last one is missing only the last byte */
+        len = (i < NTRUNCATED)? (size * i) / NTRUNCATED: size - 1;
+        tfp = OWTTmpFile();
+        if(len && (fwrite(buf,len,1,tfp) != 1)){
+            I2ErrLog(eh,"fwrite(): %M");
+            exit(1);
+        }
+        rewind(tfp);
+        if((result = OWPStatsResultRead(ctx,tfp))){
+            I2ErrLog(eh,"%ld of %ld bytes read as a result",len,size);
+            OWPStatsResultFree(result);
+            rc = -1;
+        }
+        fclose(tfp);
+    }
+
+    free(buf);
+
+    return rc;
+}
+
+int
+main(
+        int     argc    __attribute__((unused)),
+        char    **argv
+    ) {
+    I2ErrHandle         eh;
+    OWPContext          ctx;
+    OWPSessionHeaderRec hdr;
+    OWPSlot             slot;
+    OWPDataRec          *recs;
+    uint32_t            n;
+    FILE                *fp;
+    OWPStats            stats;
+    OWPStatsResult      result,rresult;
+    FILE                *efp,*refp;
+    FILE                *pfp,*rpfp;
+    long                esize,resize;
+    int                 rc = 0;
+
+    eh = OWTInit(argv,&ctx);
+    OWTSeed(0x9e3779b97f4a7c15ULL);
+
+    /*
+     * Session: 10 packets a second, exponentially distributed.
+     */
+    memset(&slot,0,sizeof(slot));
+    slot.rand_exp.slot_type = OWPSlotRandExpType;
+    slot.rand_exp.mean = OWPDoubleToNum64(0.1);
+    OWTSessionHeader(&hdr,&slot,NPACKETS);
+
+    if( !(recs = calloc(2*NPACKETS,sizeof(OWPDataRec)))){
+        I2ErrLog(eh,"calloc(%d,OWPDataRec): %M",2*NPACKETS);
+        exit(1);
+    }
+    n = OWTMakeRecs(ctx,&hdr,NULL,0,recs,2*NPACKETS);
+    fp = OWTWriteV3(ctx,&hdr,NULL,0,recs,n);
+
+    /*
+     * The result of a full parse of the session.
+     */
+    memset(&hdr,0,sizeof(hdr));
+    rewind(fp);
+    (void)OWPReadDataHeader(ctx,fp,&hdr);
+    if( !hdr.header ||
+            !(stats = OWPStatsCreate(ctx,fp,&hdr,NULL,NULL,'m',0.0001)) ||
+            !OWPStatsParse(stats,NULL,0,0,~0) ||
+            !(result = OWPStatsResultCreate(stats))){
+        I2ErrLog(eh,"unable to compute the stats of the session");
+        exit(1);
+    }
+    if(!result->sent || !result->lost || !result->dups ||
+            !result->nbuckets || !result->nipdvbuckets ||
+            !result->reordered){
+        I2ErrLog(eh,"session lacks losses, duplicates or reordering");
+        exit(1);
+    }
+
+    /*
+     * Write it, read it back, and write that.
+     */
+    efp = Encode(eh,ctx,result,&esize);
+    if( !(rresult = OWPStatsResultRead(ctx,efp))){
+        I2ErrLog(eh,"OWPStatsResultRead failed");
+        exit(1);
+    }
+    refp = Encode(eh,ctx,rresult,&resize);
+
+    pfp = OWTTmpFile();
+    rpfp = OWTTmpFile();
+    if( !OWPStatsResultPrintMachine(result,pfp) ||
+            !OWPStatsResultPrintMachine(rresult,rpfp)){
+        I2ErrLog(eh,"OWPStatsResultPrintMachine failed");
+        exit(1);
+    }
+
+    if(Compare(eh,result,rresult) != 0){
+        rc = 1;
+    }
+    else if(!SameContents(pfp,rpfp)){
+        I2ErrLog(eh,"machine readable summaries differ");
+        rc = 1;
+    }
+    else if((esize != resize) || !SameContents(efp,refp)){
+        I2ErrLog(eh,"encodings differ");
+        rc = 1;
+    }
+    else if(CheckTruncated(eh,ctx,efp,esize) != 0){
+        rc = 1;
+    }
+    else{
+        fprintf(stdout,"%u records: result of %ld bytes identical\n",n,
+                esize);
+    }
+
+    fclose(pfp);
+    fclose(rpfp);
+    fclose(efp);
+    fclose(refp);
+    OWPStatsResultFree(rresult);
+    OWPStatsResultFree(result);
+    OWPStatsFree(stats);
+    fclose(fp);
+    free(recs);
+    OWPContextFree(ctx);
+
+    exit(rc);
+}
@@ -0,0 +1,266 @@
+/*
+ *      $Id$
+ */
+/************************************************************************
+ *                                                                      *
+ *                             Copyright (C)  2026                      *
+ *                                Internet2                             *
+ *                             All Rights Reserved                      *
+ *                                                                      *
+ ************************************************************************/
+/*
+ *        File:         owtsum.c
+ *
+ *        Description:
+ *              Verifies OWPReadDataSummary and OWPDataSummaryQuantile.
+ *              For a set of send time ranges of a version 3 session
+ *              (and its version 4 copy), the summary merged from the
+ *              index must match the summary of a full parse of the
+ *              file, the record and loss counts must match the records
+ *              written, and the estimated delay quantiles must be within
+ *              one histogram bucket of the exact ones.
+ */
+#include "owttest.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#define NPACKETS    30000
+#define NRANGES     300
+
+/*
+ * Largest upper/lower bound ratio of a histogram bucket (an octave is
+ * split into 16 equal buckets).
+ */
+#define BUCKETRATIO (1.0 + 1.0/16)
+
+static int
+CmpDouble(
+        const void  *a,
+        const void  *b
+        )
+{
+    double  x = *(const double *)a;
+    double  y = *(const double *)b;
+
+    return (x < y)? -1: (x > y)? 1: 0;
+}
+
+/*
+ * Check the summaries of [begin,end) of the session in fp against
+ * each other and against recs.
+ */
+static int
+CheckRange(
+        I2ErrHandle eh,
+        OWPContext  ctx,
+        const char  *name,
+        FILE        *fp,
+        OWPNum64    begin,
+        OWPNum64    end,
+        OWPDataRec  *recs,
+        uint32_t    n,
+        double      *delays
+        )
+{
+    OWPSessionHeaderRec hdr;
+    OWPDataSummaryRec   isum,psum;
+    double              alphas[] = {0.0,0.01,0.25,0.5,0.9,0.99,1.0};
+    double              q,est;
+    int64_t             delay;
+    uint32_t            nrecs = 0;
+    uint32_t            lost = 0;
+    uint32_t            ndelays = 0;
+    uint32_t            i,k;
+
+    memset(&hdr,0,sizeof(hdr));
+    if(fseeko(fp,0,SEEK_SET) != 0){
+        I2ErrLog(eh,"%s: fseeko(): %M",name);
+        exit(1);
+    }
+    (void)OWPReadDataHeader(ctx,fp,&hdr);
+    if( !hdr.header){
+        I2ErrLog(eh,"%s: unable to read session header",name);
+        exit(1);
+    }
+
+    /*
+     * From the index, and from a full parse (the summaries are only
+     * used for finished sessions).
+     */
+    if( !OWPReadDataSummary(ctx,fp,&hdr,begin,end,&isum)){
+        I2ErrLog(eh,"%s: OWPReadDataSummary failed",name);
+        return -1;
+    }
+    hdr.finished = OWP_SESSION_FINISHED_INCOMPLETE;
+    if( !OWPReadDataSummary(ctx,fp,&hdr,begin,end,&psum)){
+        I2ErrLog(eh,"%s: OWPReadDataSummary (parse) failed",name);
+        return -1;
+    }
+
+    /*
+     * Version 4 groups are blocks, not fixed numbers of records, so
+     * duplicates are only comparable for version 3.
+     */
+    if((isum.nrecs != psum.nrecs) || (isum.lost != psum.lost) ||
+            ((hdr.version == 3) && (isum.dups != psum.dups)) ||
+            memcmp(isum.hist,psum.hist,sizeof(isum.hist)) ||
+            ((isum.nrecs > isum.lost) &&
+             ((isum.min_delay != psum.min_delay) ||
+              (isum.max_delay != psum.max_delay)))){
+        I2ErrLog(eh,"%s: index summary differs from parse: "
+                "nrecs %u/%u lost %u/%u dups %u/%u min %g/%g max %g/%g",
+                name,isum.nrecs,psum.nrecs,isum.lost,psum.lost,
+                isum.dups,psum.dups,isum.min_delay,psum.min_delay,
+                isum.max_delay,psum.max_delay);
+        return -1;
+    }
+
+    for(i=0;i<n;i++){
+        if((recs[i].send.owptime < begin) || (recs[i].send.owptime >= end)){
+            continue;
+        }
+        nrecs++;
+        if(OWPIsLostRecord(&recs[i])){
+            lost++;
+            continue;
+        }
+        delay = (int64_t)(recs[i].recv.owptime - recs[i].send.owptime);
+        delays[ndelays++] = OWPNum64ToDouble((OWPNum64)delay);
+    }
+
+    if((isum.nrecs != nrecs) || (isum.lost != lost)){
+        I2ErrLog(eh,"%s: nrecs %u (expected %u) lost %u (expected %u)",
+                name,isum.nrecs,nrecs,isum.lost,lost);
+        return -1;
+    }
+
+    if(!ndelays){
+        if(!isnan(OWPDataSummaryQuantile(&isum,0.5))){
+            I2ErrLog(eh,"%s: quantile of no delays is not NaN",name);
+            return -1;
+        }
+        return 0;
+    }
+
+    /*
+     * The estimate is the upper bound of the bucket holding the exact
+     * quantile.
+     */
+    qsort(delays,ndelays,sizeof(double),CmpDouble);
+    for(k=0;k<I2Number(alphas);k++){
+        i = (uint32_t)ceil(alphas[k] * ndelays);
+        q = delays[(i)? i-1: 0];
+        est = OWPDataSummaryQuantile(&isum,alphas[k]);
+        if((est < q * (1.0 - 1e-9)) || (est > q * BUCKETRATIO * (1.0 + 1e-9))){
+            I2ErrLog(eh,"%s: quantile %g estimated %g, exact %g",
+                    name,alphas[k],est,q);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int
+CheckRanges(
+        I2ErrHandle         eh,
+        OWPContext          ctx,
+        const char          *name,
+        FILE                *fp,
+        OWPSessionHeader    hdr,
+        OWPDataRec          *recs,
+        uint32_t            n,
+        double              *delays
+        )
+{
+    OWPNum64        start = hdr->test_spec.start_time;
+    OWPNum64        dur = OWPDoubleToNum64(0.1 * (NPACKETS + 2));
+    OWPNum64        begin,end;
+    unsigned int    i;
+
+    /*
+     * The whole session, nothing, and a range before the session.
+     */
+    if((CheckRange(eh,ctx,name,fp,0,~(OWPNum64)0,recs,n,delays) != 0) ||
+            (CheckRange(eh,ctx,name,fp,start,start,recs,n,delays) != 0) ||
+            (CheckRange(eh,ctx,name,fp,0,start,recs,n,delays) != 0)){
+        return -1;
+    }
+
+    for(i=0;i<NRANGES;i++){
+        begin = start + (OWTRand64() % dur);
+        if(i % 3){
+            /* short ranges, inside one or two groups */
+            end = begin + (OWTRand64() % OWPULongToNum64(200));
+        }
+        else{
+            end = begin + (OWTRand64() % dur);
+        }
+        if(CheckRange(eh,ctx,name,fp,begin,end,recs,n,delays) != 0){
+            return -1;
+        }
+    }
+
+    fprintf(stdout,"%s: %d ranges identical\n",name,NRANGES+3);
+
+    return 0;
+}
+
+int
+main(
+        int     argc    __attribute__((unused)),
+        char    **argv
+    ) {
+    I2ErrHandle         eh;
+    OWPContext          ctx;
+    OWPSessionHeaderRec hdr;
+    OWPSlot             slot;
+    OWPDataRec          *recs;
+    double              *delays;
+    uint32_t            n;
+    FILE                *fp3,*fp4;
+    int                 rc = 0;
+
+    eh = OWTInit(argv,&ctx);
+    OWTSeed(0x5deece66d2545f49ULL);
+
+    /*
+     * Session: 10 packets a second.
+     */
+    memset(&slot,0,sizeof(slot));
+    slot.any.slot_type = OWPSlotLiteralType;
+    slot.literal.offset = OWPDoubleToNum64(0.1);
+    OWTSessionHeader(&hdr,&slot,NPACKETS);
+
+    if( !(recs = calloc(2*NPACKETS,sizeof(OWPDataRec))) ||
+            !(delays = calloc(2*NPACKETS,sizeof(double)))){
+        I2ErrLog(eh,"calloc(%d): %M",2*NPACKETS);
+        exit(1);
+    }
+    n = OWTMakeRecs(ctx,&hdr,NULL,0,recs,2*NPACKETS);
+
+    fp3 = OWTWriteV3(ctx,&hdr,NULL,0,recs,n);
+    fp4 = OWTTmpFile();
+    rewind(fp3);
+    if( !OWPConvertDataFile(ctx,fp3,fp4,4)){
+        I2ErrLog(eh,"OWPConvertDataFile: failed");
+        exit(1);
+    }
+
+    if((CheckRanges(eh,ctx,"v3",fp3,&hdr,recs,n,delays) != 0) ||
+            (CheckRanges(eh,ctx,"v4",fp4,&hdr,recs,n,delays) != 0)){
+        rc = 1;
+    }
+
+    fclose(fp3);
+    fclose(fp4);
+    free(delays);
+    free(recs);
+    OWPContextFree(ctx);
+
+    exit(rc);
+}
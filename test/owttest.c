@@ -0,0 +1,383 @@
+/*
+ *      $Id$
+ */
+/************************************************************************
+ *                                                                      *
+ *                             Copyright (C)  2026                      *
+ *                                Internet2                             *
+ *                             All Rights Reserved                      *
+ *                                                                      *
+ ************************************************************************/
+/*
+ *        File:         owttest.c
+ *
+ *        Description:
+ *              Fixtures shared by the library tests. (See owttest.h)
+ */
+#include "owttest.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static I2ErrHandle  owt_eh = NULL;
+static uint64_t     rstate = 0x2872979303ab47eeULL;
+
+I2ErrHandle
+OWTInit(
+        char        **argv,
+        OWPContext  *ctx_ret
+        )
+{
+    char                *progname;
+    I2LogImmediateAttr  ia;
+
+    ia.line_info = (I2NAME | I2MSG);
+#ifndef        NDEBUG
+    ia.line_info |= (I2LINE | I2FILE);
+#endif
+    ia.fp = stderr;
+
+    progname = (progname = strrchr(argv[0], '/')) ? progname+1 : *argv;
+
+    /*
+     * Start an error logging session for reporing errors to the
+     * standard error
+     */
+    owt_eh = I2ErrOpen(progname, I2ErrLogImmediate, &ia, NULL, NULL);
+    if(! owt_eh) {
+        fprintf(stderr, "%s : Couldn't init error module\n", progname);
+        exit(1);
+    }
+
+    /*
+     * Initialize library with configuration functions.
+     */
+    if( !(*ctx_ret = OWPContextCreate(owt_eh))){
+        I2ErrLog(owt_eh, "Unable to initialize OWP library.");
+        exit(1);
+    }
+
+    return owt_eh;
+}
+
+void
+OWTSeed(
+        uint64_t    seed
+        )
+{
+    rstate = seed;
+
+    return;
+}
+
+uint64_t
+OWTRand64(
+        void
+        )
+{
+    rstate ^= rstate << 13;
+    rstate ^= rstate >> 7;
+    rstate ^= rstate << 17;
+
+    return rstate;
+}
+
+/*
+ * Timestamps near the current time, with a few that are far outside
+ * the ranges the formatter can handle exactly.
+ */
+static OWPNum64
+RandTStamp(
+        void
+        )
+{
+    OWPNum64    t;
+
+    switch(OWTRand64() % 16){
+        case 0:
+            return OWTRand64();
+        case 1:
+            return OWTRand64() & 0xffffffffULL;
+        default:
+            t = (uint64_t)(OWPJAN_1970 + 1700000000UL +
+                    (OWTRand64() % 400000000UL)) << 32;
+            return t | (OWTRand64() & 0xffffffffULL);
+    }
+}
+
+void
+OWTRandRec(
+        OWPDataRec  *rec
+        )
+{
+    OWPNum64    delay;
+
+    memset(rec,0,sizeof(*rec));
+
+    rec->seq_no = (uint32_t)OWTRand64();
+    if(OWTRand64() % 2){
+        rec->seq_no &= 0xfffff;
+    }
+
+    rec->send.owptime = RandTStamp();
+    rec->send.sync = OWTRand64() % 2;
+    rec->send.multiplier = OWTRand64() & 0xff;
+    rec->send.scale = OWTRand64() & 0x3f;
+
+    switch(OWTRand64() % 8){
+        /* lost */
+        case 0:
+            rec->recv.owptime = 0;
+            break;
+        /* recv before send */
+        case 1:
+            delay = OWTRand64() % (OWPULongToNum64(2));
+            rec->recv.owptime = rec->send.owptime - delay;
+            break;
+        /* anything */
+        case 2:
+            rec->recv.owptime = RandTStamp();
+            break;
+        default:
+            delay = OWTRand64() % (OWPULongToNum64(1) >> (OWTRand64() % 24));
+            rec->recv.owptime = rec->send.owptime + delay;
+            break;
+    }
+    /* the smallest receive time that is not lost */
+    if(!rec->recv.owptime && (OWTRand64() % 2)){
+        rec->recv.owptime = 1;
+    }
+    rec->recv.sync = OWTRand64() % 2;
+    rec->recv.multiplier = OWTRand64() & 0xff;
+    rec->recv.scale = OWTRand64() & 0x3f;
+    rec->ttl = OWTRand64() & 0xff;
+
+    return;
+}
+
+void
+OWTSessionHeader(
+        OWPSessionHeader    hdr,
+        OWPSlot             *slot,
+        uint32_t            npackets
+        )
+{
+    struct sockaddr_in  *saddr;
+
+    memset(hdr,0,sizeof(*hdr));
+    saddr = (struct sockaddr_in *)&hdr->addr_sender;
+    saddr->sin_family = AF_INET;
+    saddr->sin_addr.s_addr = htonl(0x7f000001);
+    saddr->sin_port = htons(8760);
+    saddr = (struct sockaddr_in *)&hdr->addr_receiver;
+    saddr->sin_family = AF_INET;
+    saddr->sin_addr.s_addr = htonl(0x7f000001);
+    saddr->sin_port = htons(8761);
+    hdr->addr_len = sizeof(struct sockaddr_in);
+    hdr->conf_receiver = True;
+    if( !I2HexDecode("deadbeefdeadbeefdeadbeefdeadbeef",hdr->sid,16)){
+        I2ErrLog(owt_eh,"I2HexDecode: invalid SID");
+        exit(1);
+    }
+
+    hdr->test_spec.start_time = OWPULongToNum64(OWPJAN_1970 + 1700000000UL);
+    hdr->test_spec.loss_timeout = OWPULongToNum64(10);
+    hdr->test_spec.npackets = npackets;
+    hdr->test_spec.nslots = 1;
+    hdr->test_spec.slots = slot;
+
+    return;
+}
+
+static OWPBoolean
+InSkip(
+        OWPSkipRec  *skips,
+        uint32_t    nskips,
+        uint32_t    seq
+        )
+{
+    uint32_t    i;
+
+    for(i=0;i<nskips;i++){
+        if((seq >= skips[i].begin) && (seq <= skips[i].end)){
+            return True;
+        }
+    }
+
+    return False;
+}
+
+uint32_t
+OWTMakeRecs(
+        OWPContext          ctx,
+        OWPSessionHeader    hdr,
+        OWPSkipRec          *skips,
+        uint32_t            nskips,
+        OWPDataRec          *recs,
+        uint32_t            size
+        )
+{
+    OWPTestSpec         *tspec = &hdr->test_spec;
+    OWPScheduleContext  sctx;
+    OWPNum64            sched;
+    OWPDataRec          tmp;
+    uint32_t            seq,n,i,k;
+    uint32_t            lostrun = 0;
+    uint8_t             multiplier = 3;
+
+    if( !(sctx = OWPScheduleContextCreate(ctx,hdr->sid,tspec))){
+        I2ErrLog(owt_eh,"OWPScheduleContextCreate failed");
+        exit(1);
+    }
+
+    n = 0;
+    sched = tspec->start_time;
+    for(seq=0;seq<tspec->npackets;seq++){
+        sched = OWPNum64Add(sched,OWPScheduleContextGenerateNextDelta(sctx));
+        if(InSkip(skips,nskips,seq)){
+            continue;
+        }
+
+        if(n >= size){
+            I2ErrLog(owt_eh,"OWTMakeRecs: more than %u records",size);
+            exit(1);
+        }
+        memset(&recs[n],0,sizeof(recs[n]));
+        recs[n].seq_no = seq;
+        recs[n].send.sync = recs[n].recv.sync = 1;
+        recs[n].send.scale = recs[n].recv.scale = 1;
+        /* (an error estimate with multiplier 0 can not be encoded) */
+        if(!(OWTRand64() % 1000)){
+            multiplier = 1 + (OWTRand64() % 0xff);
+        }
+        recs[n].send.multiplier = recs[n].recv.multiplier = multiplier;
+
+        if(!lostrun && !(OWTRand64() % 100)){
+            lostrun = 1 + (OWTRand64() % 40);
+        }
+
+        if(lostrun){
+            /*
+             * lost packets have the scheduled send time, except for a
+             * few that do not.
+             */
+            lostrun--;
+            recs[n].send.owptime = sched;
+            if(!(OWTRand64() % 20)){
+                recs[n].send.owptime += OWTRand64() & 0xffff;
+            }
+            recs[n].ttl = 255;
+        }
+        else{
+            /* 20ms and up, with a long tail */
+            recs[n].send.owptime = sched + (OWTRand64() & 0xfffff);
+            recs[n].recv.owptime = recs[n].send.owptime +
+                OWPULongToNum64(1)/50 +
+                ((OWTRand64() & 0xffffff) << (OWTRand64() % 8));
+            if(!(OWTRand64() % 500)){
+                recs[n].recv.sync = 0;
+            }
+            recs[n].ttl = (OWTRand64() % 100)? 250: OWTRand64() & 0xff;
+
+            /* duplicate */
+            if(!(OWTRand64() % 200) && (n+1 < size)){
+                recs[n+1] = recs[n];
+                recs[n+1].recv.owptime += OWTRand64() & 0xffffff;
+                n++;
+            }
+        }
+        n++;
+
+        /* reorder (lost records are only written once it is too late) */
+        if((n > 1) && !OWPIsLostRecord(&recs[n-1]) && !(OWTRand64() % 150)){
+            tmp = recs[n-1];
+            recs[n-1] = recs[n-2];
+            recs[n-2] = tmp;
+        }
+    }
+
+    /*
+     * The receiver writes lost records once the loss timeout has
+     * passed, so they are not ordered by sequence number in the file.
+     * (They still follow every record of a lower sequence number.)
+     */
+    for(i=0;(n > 10) && (i<n/200);i++){
+        seq = OWTRand64() % (n - 10);
+        if(!OWPIsLostRecord(&recs[seq])){
+            continue;
+        }
+        for(k=1;(k < 10) && !OWPIsLostRecord(&recs[seq+k]);k++);
+        tmp = recs[seq];
+        memmove(&recs[seq],&recs[seq+1],(k-1)*sizeof(OWPDataRec));
+        recs[seq+k-1] = tmp;
+    }
+
+    OWPScheduleContextFree(sctx);
+
+    return n;
+}
+
+FILE *
+OWTWriteV3(
+        OWPContext          ctx,
+        OWPSessionHeader    hdr,
+        OWPSkipRec          *skips,
+        uint32_t            nskips,
+        OWPDataRec          *recs,
+        uint32_t            n
+        )
+{
+    FILE        *fp;
+    uint8_t     buf[8];
+    uint32_t    i;
+
+    fp = OWTTmpFile();
+
+    hdr->finished = OWP_SESSION_FINISHED_NORMAL;
+    hdr->next_seqno = hdr->test_spec.npackets;
+    hdr->num_skiprecs = nskips;
+    hdr->num_datarecs = n;
+    hdr->rec_size = 25;
+    if( !OWPWriteDataHeader(ctx,fp,hdr)){
+        goto failed;
+    }
+
+    for(i=0;i<nskips;i++){
+        *(uint32_t*)&buf[0] = htonl(skips[i].begin);
+        *(uint32_t*)&buf[4] = htonl(skips[i].end);
+        if(fwrite(buf,1,sizeof(buf),fp) != sizeof(buf)){
+            goto failed;
+        }
+    }
+    for(i=0;i<n;i++){
+        if( !OWPWriteDataRecord(ctx,fp,&recs[i])){
+            goto failed;
+        }
+    }
+    if((fflush(fp) != 0) || !OWPWriteDataIndex(ctx,fp)){
+        goto failed;
+    }
+
+    return fp;
+
+failed:
+    I2ErrLog(owt_eh,"OWTWriteV3: unable to write session file");
+    exit(1);
+}
+
+FILE *
+OWTTmpFile(
+        void
+        )
+{
+    FILE    *fp;
+
+    if( !(fp = tmpfile())){
+        I2ErrLog(owt_eh,"tmpfile(): %M");
+        exit(1);
+    }
+
+    return fp;
+}
@@ -0,0 +1,107 @@
+/*
+ *      $Id$
+ */
+/************************************************************************
+ *                                                                      *
+ *                             Copyright (C)  2026                      *
+ *                                Internet2                             *
+ *                             All Rights Reserved                      *
+ *                                                                      *
+ ************************************************************************/
+/*
+ *        File:         owttest.h
+ *
+ *        Description:
+ *              Fixtures shared by the library tests run by "make check":
+ *              a seeded pseudo-random generator, records and session
+ *              files. The functions log with the error handle of
+ *              OWTInit and exit(1) if anything they need fails, so the
+ *              tests only check the results they are testing.
+ */
+#ifndef _OWTTEST_H
+#define _OWTTEST_H
+
+#include <owamp/owamp.h>
+#include <I2util/util.h>
+
+#include <stdio.h>
+
+/*
+ * Start error logging to stderr and initialize the library. The error
+ * handle is returned (and kept for the other functions).
+ */
+extern I2ErrHandle
+OWTInit(
+        char        **argv,
+        OWPContext  *ctx_ret
+        );
+
+/*
+ * xorshift generator - each test seeds it so its data is reproducible.
+ */
+extern void
+OWTSeed(
+        uint64_t    seed
+        );
+
+extern uint64_t
+OWTRand64(
+        void
+        );
+
+/*
+ * A record with anything in it: lost, received before it was sent,
+ * timestamps far outside the session, etc.
+ */
+extern void
+OWTRandRec(
+        OWPDataRec  *rec
+        );
+
+/*
+ * A session between two local ports, starting at a fixed time, with the
+ * schedule in slot (filled in by the caller).
+ */
+extern void
+OWTSessionHeader(
+        OWPSessionHeader    hdr,
+        OWPSlot             *slot,
+        uint32_t            npackets
+        );
+
+/*
+ * Create the records of the session of hdr, in the order the receiver
+ * would write them: with runs of lost packets, duplicates, reordering
+ * and (delayed) lost records. Packets in skips are not sent. The number
+ * of records is returned.
+ */
+extern uint32_t
+OWTMakeRecs(
+        OWPContext          ctx,
+        OWPSessionHeader    hdr,
+        OWPSkipRec          *skips,
+        uint32_t            nskips,
+        OWPDataRec          *recs,
+        uint32_t            size
+        );
+
+/*
+ * Write a finished version 3 session file (with its index) holding
+ * skips and recs. hdr is updated to match the file.
+ */
+extern FILE *
+OWTWriteV3(
+        OWPContext          ctx,
+        OWPSessionHeader    hdr,
+        OWPSkipRec          *skips,
+        uint32_t            nskips,
+        OWPDataRec          *recs,
+        uint32_t            n
+        );
+
+extern FILE *
+OWTTmpFile(
+        void
+        );
+
+#endif  /* _OWTTEST_H */